@@ -0,0 +1,662 @@
+/* YCSB-style benchmark of the tree. every combination of the given thread
+ * counts, cache sizes, page sizes, fan-outs, latencies and workloads loads
+ * a fresh tree and runs the workload on it, the results are written as
+ * JSON or CSV with throughput, latency percentiles per operation and the
+ * counters of the tree during the run. run with --help for the options */
+
+#include "bptree/heap_page_cache.h"
+#include "bptree/latency_simulator.h"
+#include "bptree/mem_page_cache.h"
+#include "bptree/metrics.h"
+#include "bptree/tree.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+
+enum class Distribution { DEFAULT, UNIFORM, ZIPFIAN, LATEST };
+
+enum OpType { OP_READ, OP_UPDATE, OP_INSERT, OP_SCAN, OP_RMW, NUM_OP_TYPES };
+
+static const char* op_names[NUM_OP_TYPES] = {"read", "update", "insert", "scan",
+                                             "rmw"};
+
+/* the operation mixes of the YCSB core workloads. updates replace the
+ * value of a key (erase + insert), read-modify-writes read it first */
+struct Workload {
+    char name;
+    double mix[NUM_OP_TYPES];
+    Distribution distribution;
+};
+
+static const Workload workloads[] = {
+    {'A', {0.5, 0.5, 0, 0, 0}, Distribution::ZIPFIAN},
+    {'B', {0.95, 0.05, 0, 0, 0}, Distribution::ZIPFIAN},
+    {'C', {1, 0, 0, 0, 0}, Distribution::ZIPFIAN},
+    {'D', {0.95, 0, 0.05, 0, 0}, Distribution::LATEST},
+    {'E', {0, 0, 0.05, 0.95, 0}, Distribution::ZIPFIAN},
+    {'F', {0.5, 0, 0, 0, 0.5}, Distribution::ZIPFIAN},
+};
+
+struct Options {
+    std::vector<char> workloads{'A', 'B', 'C', 'D', 'E', 'F'};
+    Distribution distribution = Distribution::DEFAULT;
+    std::vector<size_t> threads{1, 4};
+    std::vector<size_t> cache_pages{4096};
+    std::vector<size_t> page_sizes{4096};
+    std::vector<size_t> fanouts{64};
+    std::vector<int> latencies_us{0};
+    size_t records = 100000;
+    size_t operations = 100000;
+    size_t max_scan_length = 100;
+    bool mem_cache = false;
+    bptree::WritePolicy write_policy = bptree::WritePolicy::WRITE_BACK;
+    std::string dir = "/tmp";
+    std::string format = "json";
+    std::string output;
+    uint64_t seed = 42;
+};
+
+/* spreads the record indexes over the key space so that neither loads nor
+ * inserts go in key order. odd multipliers are bijective mod 2^64 */
+static KeyType key_of(uint64_t index) { return index * 0x9E3779B97F4A7C15ULL; }
+
+/* the zipfian generator of YCSB (Gray et al., "Quickly generating
+ * billion-record synthetic databases") over [0, n), 0 is the most popular
+ * item */
+class ZipfianGenerator {
+public:
+    static constexpr double THETA = 0.99;
+
+    explicit ZipfianGenerator(uint64_t n) : n(std::max<uint64_t>(n, 2))
+    {
+        double zeta2 = zeta(2);
+        zetan = zeta(this->n);
+        alpha = 1.0 / (1.0 - THETA);
+        eta = (1 - std::pow(2.0 / this->n, 1 - THETA)) / (1 - zeta2 / zetan);
+        half_pow_theta = 1 + std::pow(0.5, THETA);
+    }
+
+    template <typename Rng> uint64_t next(Rng& rng)
+    {
+        double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        double uz = u * zetan;
+        if (uz < 1.0) return 0;
+        if (uz < half_pow_theta) return 1;
+        return std::min<uint64_t>(n - 1,
+                                  (uint64_t)(n * std::pow(eta * u - eta + 1, alpha)));
+    }
+
+private:
+    uint64_t n;
+    double zetan;
+    double alpha;
+    double eta;
+    double half_pow_theta;
+
+    static double zeta(uint64_t n)
+    {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++) {
+            sum += 1 / std::pow((double)i, THETA);
+        }
+        return sum;
+    }
+};
+
+/* hashes an index so that the popular items of a zipfian are spread over
+ * the records (YCSB's scrambled zipfian) */
+static uint64_t scramble(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+struct RunResult {
+    char workload;
+    Distribution distribution;
+    size_t threads;
+    size_t cache_pages;
+    size_t page_size;
+    size_t fanout;
+    int latency_us;
+    double load_seconds;
+    double run_seconds;
+    size_t operations;
+    bptree::HistogramSnapshot latency[NUM_OP_TYPES];
+    bptree::TreeMetrics metrics;
+};
+
+/* the counters of after that went up since before, so that a run does
+ * not count the load */
+static bptree::TreeMetrics metrics_since(const bptree::TreeMetrics& before,
+                                         bptree::TreeMetrics after)
+{
+    after.restarts.reads -= before.restarts.reads;
+    after.restarts.inserts -= before.restarts.inserts;
+    after.restarts.erases -= before.restarts.erases;
+    after.splits -= before.splits;
+    after.merges -= before.merges;
+    after.prefetch.issued -= before.prefetch.issued;
+    after.prefetch.useful -= before.prefetch.useful;
+    after.prefetch.demand_reads -= before.prefetch.demand_reads;
+    after.page_cache.hits -= before.page_cache.hits;
+    after.page_cache.misses -= before.page_cache.misses;
+    after.page_cache.evictions -= before.page_cache.evictions;
+    after.page_cache.bytes_read -= before.page_cache.bytes_read;
+    after.page_cache.bytes_written -= before.page_cache.bytes_written;
+    return after;
+}
+
+static const char* distribution_name(Distribution d)
+{
+    switch (d) {
+    case Distribution::UNIFORM:
+        return "uniform";
+    case Distribution::ZIPFIAN:
+        return "zipfian";
+    case Distribution::LATEST:
+        return "latest";
+    default:
+        return "default";
+    }
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+template <unsigned int N> class Benchmark {
+public:
+    using Tree = bptree::BTree<N, KeyType, ValueType>;
+
+    Benchmark(const Options& options, const Workload& workload, size_t threads,
+              size_t cache_pages, size_t page_size, int latency_us)
+        : options(options), workload(workload), num_threads(threads),
+          cache_pages(cache_pages), page_size(page_size), latency_us(latency_us)
+    {}
+
+    RunResult run()
+    {
+        std::string filename;
+        std::unique_ptr<bptree::AbstractPageCache> page_cache;
+        if (options.mem_cache) {
+            page_cache = std::make_unique<bptree::MemPageCache>(page_size);
+        } else {
+            filename = options.dir + "/bptree_bench_XXXXXX";
+            int fd = mkstemp(&filename[0]);
+            close(fd);
+            unlink(filename.c_str());
+            page_cache = std::make_unique<bptree::HeapPageCache>(
+                filename, true, cache_pages, page_size, options.write_policy);
+        }
+
+        RunResult result{};
+        try {
+            Tree tree(page_cache.get());
+            result = run_on(tree);
+        } catch (...) {
+            page_cache.reset();
+            if (!filename.empty()) unlink(filename.c_str());
+            throw;
+        }
+
+        page_cache.reset();
+        if (!filename.empty()) unlink(filename.c_str());
+        return result;
+    }
+
+private:
+    const Options& options;
+    const Workload& workload;
+    size_t num_threads;
+    size_t cache_pages;
+    size_t page_size;
+    int latency_us;
+
+    bptree::LatencyHistogram histograms[NUM_OP_TYPES];
+    /* records [0, num_records) are in the tree. inserts take the next
+     * index from next_index and acknowledge it when it is in, num_records
+     * only moves past an index once all before it are acknowledged */
+    std::atomic<uint64_t> num_records{0};
+    std::atomic<uint64_t> next_index{0};
+    std::mutex acked_mutex;
+    std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>>
+        acked;
+
+    void acknowledge(uint64_t index)
+    {
+        std::lock_guard<std::mutex> guard(acked_mutex);
+        acked.push(index);
+        uint64_t n = num_records.load(std::memory_order_relaxed);
+        while (!acked.empty() && acked.top() == n) {
+            acked.pop();
+            n++;
+        }
+        num_records.store(n, std::memory_order_release);
+    }
+
+    template <typename Func> void parallel(Func&& func)
+    {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < num_threads; t++) {
+            threads.emplace_back([t, &func]() { func(t); });
+        }
+        for (auto&& p : threads) {
+            p.join();
+        }
+    }
+
+    RunResult run_on(Tree& tree)
+    {
+        RunResult result{};
+        result.workload = workload.name;
+        result.distribution = options.distribution == Distribution::DEFAULT
+                                  ? workload.distribution
+                                  : options.distribution;
+        result.threads = num_threads;
+        result.cache_pages = cache_pages;
+        result.page_size = page_size;
+        result.fanout = N;
+        result.latency_us = latency_us;
+        result.operations = options.operations;
+
+        /* the load is not slowed down by the latency */
+        auto start = std::chrono::steady_clock::now();
+        parallel([this, &tree](size_t t) {
+            for (uint64_t i = t; i < options.records; i += num_threads) {
+                tree.insert(key_of(i), i);
+            }
+        });
+        num_records = options.records;
+        next_index = options.records;
+        result.load_seconds = seconds_since(start);
+
+        auto loaded = tree.get_metrics();
+        ZipfianGenerator zipfian(options.records);
+        bptree::LatencySimulator::configure(latency_us);
+        start = std::chrono::steady_clock::now();
+        parallel([this, &tree, &zipfian, &result](size_t t) {
+            run_thread(tree, zipfian, result.distribution, t);
+        });
+        result.run_seconds = seconds_since(start);
+        bptree::LatencySimulator::configure(0);
+
+        for (int op = 0; op < NUM_OP_TYPES; op++) {
+            result.latency[op] = histograms[op].snapshot();
+        }
+        result.metrics = metrics_since(loaded, tree.get_metrics());
+        return result;
+    }
+
+    void run_thread(Tree& tree, ZipfianGenerator zipfian,
+                    Distribution distribution, size_t t)
+    {
+        std::mt19937_64 rng(options.seed + t);
+        std::uniform_real_distribution<double> coin(0, 1);
+        std::uniform_int_distribution<size_t> scan_length(1, options.max_scan_length);
+        std::vector<ValueType> values;
+
+        auto choose = [&]() -> uint64_t {
+            uint64_t n = num_records.load(std::memory_order_acquire);
+            switch (distribution) {
+            case Distribution::UNIFORM:
+                return std::uniform_int_distribution<uint64_t>(0, n - 1)(rng);
+            case Distribution::LATEST:
+                return n - 1 - std::min(n - 1, zipfian.next(rng));
+            default:
+                return scramble(zipfian.next(rng)) % n;
+            }
+        };
+
+        size_t num_ops = options.operations / num_threads +
+                         (t < options.operations % num_threads ? 1 : 0);
+        for (size_t i = 0; i < num_ops; i++) {
+            double c = coin(rng);
+            int op = 0;
+            while (op < NUM_OP_TYPES - 1 && c >= workload.mix[op]) {
+                c -= workload.mix[op];
+                op++;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            switch (op) {
+            case OP_READ:
+                values.clear();
+                tree.get_value(key_of(choose()), values);
+                break;
+            case OP_UPDATE: {
+                auto index = choose();
+                tree.erase(key_of(index));
+                tree.insert(key_of(index), index + i);
+                break;
+            }
+            case OP_INSERT: {
+                /* chosen by the other threads once it and all before it
+                 * are in */
+                auto index = next_index.fetch_add(1);
+                tree.insert(key_of(index), index);
+                acknowledge(index);
+                break;
+            }
+            case OP_SCAN: {
+                size_t length = scan_length(rng);
+                size_t count = 0;
+                for (auto it = tree.begin(key_of(choose()));
+                     it != tree.end() && count < length; ++it) {
+                    count++;
+                }
+                break;
+            }
+            case OP_RMW: {
+                auto index = choose();
+                values.clear();
+                tree.get_value(key_of(index), values);
+                tree.erase(key_of(index));
+                tree.insert(key_of(index), values.empty() ? index : values[0] + 1);
+                break;
+            }
+            }
+            histograms[op].record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                      std::chrono::steady_clock::now() - start)
+                                      .count());
+        }
+    }
+};
+
+static RunResult run_benchmark(const Options& options, const Workload& workload,
+                               size_t fanout, size_t threads, size_t cache_pages,
+                               size_t page_size, int latency_us)
+{
+#define BENCH_FANOUT(n)                                                        \
+    case n:                                                                    \
+        return Benchmark<n>(options, workload, threads, cache_pages, page_size, \
+                            latency_us)                                        \
+            .run();
+
+    switch (fanout) {
+        BENCH_FANOUT(8)
+        BENCH_FANOUT(16)
+        BENCH_FANOUT(32)
+        BENCH_FANOUT(64)
+        BENCH_FANOUT(128)
+        BENCH_FANOUT(256)
+    default:
+        throw std::invalid_argument("fan-outs are 8, 16, 32, 64, 128 or 256");
+    }
+#undef BENCH_FANOUT
+}
+
+static const double PERCENTILES[] = {0.5, 0.95, 0.99, 0.999};
+static const char* PERCENTILE_NAMES[] = {"p50", "p95", "p99", "p999"};
+
+static void write_json(std::ostream& os, const std::vector<RunResult>& results,
+                       const Options& options)
+{
+    os << "[\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        const auto& m = r.metrics;
+        os << "  {\"workload\": \"" << r.workload << "\", \"distribution\": \""
+           << distribution_name(r.distribution) << "\", \"threads\": " << r.threads
+           << ", \"cache_pages\": " << r.cache_pages
+           << ", \"page_size\": " << r.page_size << ", \"fanout\": " << r.fanout
+           << ", \"sim_latency_us\": " << r.latency_us
+           << ", \"records\": " << options.records
+           << ", \"operations\": " << r.operations
+           << ", \"load_seconds\": " << r.load_seconds
+           << ", \"run_seconds\": " << r.run_seconds
+           << ", \"ops_per_second\": " << r.operations / r.run_seconds << ",\n";
+
+        os << "   \"op_latency_us\": {";
+        bool first = true;
+        for (int op = 0; op < NUM_OP_TYPES; op++) {
+            const auto& h = r.latency[op];
+            if (h.count == 0) continue;
+            os << (first ? "" : ", ") << "\"" << op_names[op]
+               << "\": {\"count\": " << h.count << ", \"mean\": " << h.mean() / 1000;
+            for (size_t p = 0; p < 4; p++) {
+                os << ", \"" << PERCENTILE_NAMES[p]
+                   << "\": " << h.percentile(PERCENTILES[p]) / 1000.0;
+            }
+            os << ", \"max\": " << h.max / 1000.0 << "}";
+            first = false;
+        }
+        os << "},\n";
+
+        os << "   \"tree\": {\"read_restarts\": " << m.restarts.reads
+           << ", \"insert_restarts\": " << m.restarts.inserts
+           << ", \"erase_restarts\": " << m.restarts.erases
+           << ", \"splits\": " << m.splits << ", \"merges\": " << m.merges
+           << ", \"cache_hits\": " << m.page_cache.hits
+           << ", \"cache_misses\": " << m.page_cache.misses
+           << ", \"cache_evictions\": " << m.page_cache.evictions
+           << ", \"bytes_read\": " << m.page_cache.bytes_read
+           << ", \"bytes_written\": " << m.page_cache.bytes_written
+           << ", \"prefetch_accuracy\": " << m.prefetch.accuracy()
+           << ", \"prefetch_coverage\": " << m.prefetch.coverage() << "}}"
+           << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "]\n";
+}
+
+static void write_csv(std::ostream& os, const std::vector<RunResult>& results,
+                      const Options& options)
+{
+    os << "workload,distribution,threads,cache_pages,page_size,fanout,"
+          "sim_latency_us,records,operations,load_seconds,run_seconds,ops_per_second";
+    for (int op = 0; op < NUM_OP_TYPES; op++) {
+        os << "," << op_names[op] << "_count," << op_names[op] << "_mean_us";
+        for (size_t p = 0; p < 4; p++) {
+            os << "," << op_names[op] << "_" << PERCENTILE_NAMES[p] << "_us";
+        }
+        os << "," << op_names[op] << "_max_us";
+    }
+    os << ",read_restarts,insert_restarts,erase_restarts,splits,merges,"
+          "cache_hits,cache_misses,cache_evictions,bytes_read,bytes_written,"
+          "prefetch_accuracy,prefetch_coverage\n";
+
+    for (const auto& r : results) {
+        const auto& m = r.metrics;
+        os << r.workload << "," << distribution_name(r.distribution) << ","
+           << r.threads << "," << r.cache_pages << "," << r.page_size << ","
+           << r.fanout << "," << r.latency_us << "," << options.records << ","
+           << r.operations << "," << r.load_seconds << "," << r.run_seconds << ","
+           << r.operations / r.run_seconds;
+        for (int op = 0; op < NUM_OP_TYPES; op++) {
+            const auto& h = r.latency[op];
+            os << "," << h.count << "," << h.mean() / 1000;
+            for (size_t p = 0; p < 4; p++) {
+                os << "," << h.percentile(PERCENTILES[p]) / 1000.0;
+            }
+            os << "," << h.max / 1000.0;
+        }
+        os << "," << m.restarts.reads << "," << m.restarts.inserts << ","
+           << m.restarts.erases << "," << m.splits << "," << m.merges << ","
+           << m.page_cache.hits << "," << m.page_cache.misses << ","
+           << m.page_cache.evictions << "," << m.page_cache.bytes_read << ","
+           << m.page_cache.bytes_written << "," << m.prefetch.accuracy() << ","
+           << m.prefetch.coverage() << "\n";
+    }
+}
+
+static void usage(const char* prog)
+{
+    std::cerr
+        << "usage: " << prog << " [options]\n"
+        << "lists are comma-separated, every combination is run\n"
+        << "  --workloads=A,B,C,D,E,F   YCSB core workloads\n"
+        << "  --distribution=NAME       uniform, zipfian or latest instead of\n"
+        << "                            the workload's own\n"
+        << "  --threads=1,4             client threads\n"
+        << "  --cache-pages=4096        max_pages of the page cache\n"
+        << "  --page-sizes=4096         bytes per page\n"
+        << "  --fanouts=64              8, 16, 32, 64, 128 or 256\n"
+        << "  --latency-us=0            far memory latency per page read\n"
+        << "  --records=100000          records loaded before each run\n"
+        << "  --operations=100000       operations per run\n"
+        << "  --max-scan-length=100     scans read 1 to this many pairs\n"
+        << "  --cache=heap|mem          HeapPageCache on a file or MemPageCache\n"
+        << "  --write-policy=back|through\n"
+        << "  --dir=/tmp                where the heap files go\n"
+        << "  --format=json|csv\n"
+        << "  --output=FILE             instead of stdout\n"
+        << "  --seed=42\n";
+}
+
+template <typename T> static std::vector<T> parse_list(const std::string& s)
+{
+    std::vector<T> list;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) list.push_back((T)std::stoll(item));
+    }
+    if (list.empty()) throw std::invalid_argument("empty list");
+    return list;
+}
+
+static Options parse_options(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "--help" || name == "-h") {
+            usage(argv[0]);
+            exit(0);
+        } else if (name == "--workloads") {
+            options.workloads.clear();
+            for (char c : value) {
+                if (c == ',') continue;
+                c = toupper(c);
+                if (c < 'A' || c > 'F') throw std::invalid_argument("workloads are A to F");
+                options.workloads.push_back(c);
+            }
+        } else if (name == "--distribution") {
+            if (value == "uniform") {
+                options.distribution = Distribution::UNIFORM;
+            } else if (value == "zipfian") {
+                options.distribution = Distribution::ZIPFIAN;
+            } else if (value == "latest") {
+                options.distribution = Distribution::LATEST;
+            } else {
+                throw std::invalid_argument("unknown distribution " + value);
+            }
+        } else if (name == "--threads") {
+            options.threads = parse_list<size_t>(value);
+        } else if (name == "--cache-pages") {
+            options.cache_pages = parse_list<size_t>(value);
+        } else if (name == "--page-sizes") {
+            options.page_sizes = parse_list<size_t>(value);
+        } else if (name == "--fanouts") {
+            options.fanouts = parse_list<size_t>(value);
+        } else if (name == "--latency-us") {
+            options.latencies_us = parse_list<int>(value);
+        } else if (name == "--records") {
+            options.records = std::stoull(value);
+        } else if (name == "--operations") {
+            options.operations = std::stoull(value);
+        } else if (name == "--max-scan-length") {
+            options.max_scan_length = std::max<size_t>(1, std::stoull(value));
+        } else if (name == "--cache") {
+            options.mem_cache = value == "mem";
+        } else if (name == "--write-policy") {
+            options.write_policy = value == "through"
+                                       ? bptree::WritePolicy::WRITE_THROUGH
+                                       : bptree::WritePolicy::WRITE_BACK;
+        } else if (name == "--dir") {
+            options.dir = value;
+        } else if (name == "--format") {
+            if (value != "json" && value != "csv") {
+                throw std::invalid_argument("formats are json and csv");
+            }
+            options.format = value;
+        } else if (name == "--output") {
+            options.output = value;
+        } else if (name == "--seed") {
+            options.seed = std::stoull(value);
+        } else {
+            throw std::invalid_argument("unknown option " + arg);
+        }
+    }
+    if (options.records == 0) throw std::invalid_argument("no records");
+    return options;
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    try {
+        options = parse_options(argc, argv);
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+    if (!bptree::METRICS_ENABLED) {
+        std::cerr << "built without metrics, latencies and counters are 0"
+                  << std::endl;
+    }
+
+    std::vector<RunResult> results;
+    for (size_t fanout : options.fanouts)
+        for (size_t page_size : options.page_sizes)
+            for (size_t cache_pages : options.cache_pages)
+                for (int latency_us : options.latencies_us)
+                    for (size_t threads : options.threads)
+                        for (char name : options.workloads) {
+                            const auto& workload = workloads[name - 'A'];
+                            std::cerr << "workload " << name << ", " << threads
+                                      << " threads, " << cache_pages
+                                      << " cache pages, page size " << page_size
+                                      << ", fan-out " << fanout << ", latency "
+                                      << latency_us << "us" << std::endl;
+                            try {
+                                results.push_back(run_benchmark(
+                                    options, workload, fanout, std::max<size_t>(1, threads),
+                                    cache_pages, page_size, latency_us));
+                            } catch (std::exception& e) {
+                                std::cerr << "  skipped: " << e.what() << std::endl;
+                            }
+                        }
+
+    std::ofstream file;
+    if (!options.output.empty()) {
+        file.open(options.output);
+        if (!file) {
+            std::cerr << "cannot open " << options.output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& os = options.output.empty() ? std::cout : file;
+    if (options.format == "csv") {
+        write_csv(os, results, options);
+    } else {
+        write_json(os, results, options);
+    }
+    return 0;
+}
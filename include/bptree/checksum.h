@@ -0,0 +1,15 @@
+#ifndef _BPTREE_CHECKSUM_H_
+#define _BPTREE_CHECKSUM_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bptree {
+
+/* CRC-32C (Castagnoli). pass the result of a previous call as crc to
+ * checksum data that is split into several buffers */
+uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0);
+
+} // namespace bptree
+
+#endif
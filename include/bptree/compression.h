@@ -0,0 +1,21 @@
+#ifndef _BPTREE_COMPRESSION_H_
+#define _BPTREE_COMPRESSION_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bptree {
+
+/* compress length bytes into the LZ4 block format. returns the compressed
+ * size, or 0 if it would not fit in capacity bytes */
+size_t lz4_compress(const uint8_t* src, size_t length, uint8_t* dst,
+                    size_t capacity);
+
+/* decompress an LZ4 block that must expand to exactly dst_length bytes.
+ * returns false if the block is malformed or has a different size */
+bool lz4_decompress(const uint8_t* src, size_t length, uint8_t* dst,
+                    size_t dst_length);
+
+} // namespace bptree
+
+#endif
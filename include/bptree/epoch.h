@@ -0,0 +1,152 @@
+#ifndef _BPTREE_EPOCH_H_
+#define _BPTREE_EPOCH_H_
+
+#include "bptree/sharded_counter.h"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+namespace bptree {
+
+/* epoch-based reclamation for objects that optimistic readers may still be
+ * looking at after they are unlinked. threads enter the current epoch for
+ * the duration of an operation and retired objects are destroyed once every
+ * thread that might have seen them has left. the global epoch only advances
+ * when nobody is left in the epoch before the current one, so an object
+ * retired in epoch e is unreachable once the global epoch is e + 2 */
+class EpochManager {
+public:
+    class Guard {
+    public:
+        Guard() : manager(nullptr), slot(0) {}
+        explicit Guard(EpochManager* manager)
+            : manager(manager), slot(manager->enter())
+        {}
+        Guard(Guard&& other) : manager(other.manager), slot(other.slot)
+        {
+            other.manager = nullptr;
+        }
+        Guard& operator=(Guard&& other)
+        {
+            std::swap(manager, other.manager);
+            std::swap(slot, other.slot);
+            return *this;
+        }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard()
+        {
+            if (manager) manager->exit(slot);
+        }
+
+    private:
+        EpochManager* manager;
+        unsigned int slot;
+    };
+
+    EpochManager() : global_epoch(2) {}
+
+    /* no thread may be in an epoch any more */
+    ~EpochManager() { drain(); }
+
+    /* run deleter once no reader can reach what it destroys */
+    void retire(std::function<void()> deleter)
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        retired.push_back({global_epoch.load(), std::move(deleter)});
+    }
+
+    size_t num_retired() const
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        return retired.size();
+    }
+
+    /* advance the epoch if possible and destroy what has become
+     * unreachable. calling it while inside an epoch is safe but the
+     * caller's own epoch holds back everything it retired */
+    void reclaim()
+    {
+        std::deque<Retired> ready;
+
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (retired.empty()) return;
+
+            for (int i = 0; i < 2; i++) {
+                if (!try_advance()) break;
+            }
+
+            uint64_t safe_epoch = global_epoch.load() - 2;
+            while (!retired.empty() && retired.front().epoch <= safe_epoch) {
+                ready.push_back(std::move(retired.front()));
+                retired.pop_front();
+            }
+        }
+
+        for (auto&& r : ready) {
+            r.deleter();
+        }
+    }
+
+    /* destroy everything, only when no thread is in an epoch */
+    void drain()
+    {
+        std::deque<Retired> ready;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            ready.swap(retired);
+        }
+        for (auto&& r : ready) {
+            r.deleter();
+        }
+    }
+
+private:
+    struct Retired {
+        uint64_t epoch;
+        std::function<void()> deleter;
+    };
+
+    std::atomic<uint64_t> global_epoch;
+    /* # of threads in the even/odd epochs */
+    ShardedCounter active[2];
+    mutable std::mutex mutex; /* protects retired and epoch advances */
+    std::deque<Retired> retired; /* in epoch order */
+
+    unsigned int enter()
+    {
+        unsigned int slot = global_epoch.load() & 1;
+        active[slot].add(1);
+        /* publish the entry before the first read of the data structure */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return slot;
+    }
+
+    void exit(unsigned int slot)
+    {
+        std::atomic_thread_fence(std::memory_order_release);
+        active[slot].add(-1);
+    }
+
+    /* from e to e + 1 once nobody is left in e - 1, which shares its
+     * counter with e + 1 */
+    bool try_advance()
+    {
+        uint64_t epoch = global_epoch.load();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (active[(epoch + 1) & 1].load() != 0) return false;
+
+        global_epoch.store(epoch + 1);
+        return true;
+    }
+};
+
+} // namespace bptree
+
+#endif
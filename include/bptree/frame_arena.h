@@ -0,0 +1,41 @@
+#ifndef _BPTREE_FRAME_ARENA_H_
+#define _BPTREE_FRAME_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace bptree {
+
+/* the buffers of all frames of a page cache as one mapping that is created
+ * once. the mapping is aligned to the system page size so frames can be used
+ * for O_DIRECT I/O as long as the frame size is a multiple of the device
+ * block size. with use_huge_pages, explicit huge pages are tried first and
+ * transparent huge pages are asked for if there are not enough of them.
+ * memory is only backed when a frame is first touched */
+class FrameArena {
+public:
+    FrameArena(size_t num_frames, size_t frame_size, bool use_huge_pages = false);
+    ~FrameArena();
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    uint8_t* get_frame(size_t i) const { return base + i * frame_size; }
+
+    size_t get_num_frames() const { return num_frames; }
+    size_t get_frame_size() const { return frame_size; }
+
+    /* whether the arena is mapped with explicit huge pages */
+    bool has_huge_pages() const { return huge_pages; }
+
+private:
+    uint8_t* base;
+    size_t num_frames;
+    size_t frame_size;
+    size_t mapped_size;
+    bool huge_pages;
+};
+
+} // namespace bptree
+
+#endif
@@ -1,39 +1,154 @@
 #ifndef _BPTREE_HEAP_FILE_H_
 #define _BPTREE_HEAP_FILE_H_
 
+#include "bptree/metrics.h"
 #include "bptree/page.h"
+#include "bptree/page_store.h"
+#include "bptree/rate_limiter.h"
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace bptree {
 
-class IOException : public std::runtime_error {
-public:
-    IOException(const char* message) : runtime_error(message) {}
-};
+class IOUring;
+
+/* SYNC issues one pread/pwrite per page. IO_URING submits the pages of a
+ * batch (read_pages()/write_pages()) together so that they are all in flight
+ * at the same time. the heap file falls back to SYNC if the kernel does not
+ * support io_uring */
+enum class IOBackend { SYNC, IO_URING };
 
-class HeapFile {
+/* how pages are stored in the heap file. RAW pages are written as they are.
+ * CHECKSUM pages start with a PAGE_HEADER_SIZE-byte header that holds a
+ * CRC-32C of the page, the LSN it was written with and the # of bytes
+ * stored after the header, a page that does not match its checksum fails
+ * to read. LZ4 pages are also LZ4-compressed when that makes them smaller
+ * and only the compressed bytes are written. pages of the formats with a
+ * header have PAGE_HEADER_SIZE fewer bytes for data (see
+ * HeapFile::get_data_size()) */
+enum class PageFormat : uint32_t { RAW = 0, CHECKSUM = 1, LZ4 = 2 };
+
+class HeapFile : public PageStore {
 public:
-    explicit HeapFile(std::string_view filename, bool create, size_t page_size);
+    /* with direct_io, pages are read and written with O_DIRECT, bypassing the
+     * kernel page cache. page buffers must then be aligned to
+     * DIRECT_IO_ALIGNMENT (like the frames of a FrameArena). the file is
+     * opened normally if page_size is not a multiple of DIRECT_IO_ALIGNMENT
+     * or the file system does not support O_DIRECT, see is_direct_io().
+     * format only applies to a file that is created, an existing file keeps
+     * the format it was created with */
+    explicit HeapFile(std::string_view filename, bool create, size_t page_size,
+                      IOBackend backend = IOBackend::SYNC,
+                      bool direct_io = false,
+                      PageFormat format = PageFormat::RAW);
     ~HeapFile();
 
+    static constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+    static constexpr size_t PAGE_HEADER_SIZE = 24;
+
     bool is_open() const { return fd != -1; }
+    bool is_direct_io() const { return direct_fd != -1; }
     size_t get_page_size() const { return page_size; }
+    /* the buffers of read_page(), write_page() and the batched I/O only
+     * need get_data_size() bytes */
+    virtual size_t get_data_size() const override { return data_size; }
+    PageFormat get_page_format() const { return format; }
+    IOBackend get_io_backend() const { return backend; }
+    /* # of bytes written for pages, after compression */
+    size_t get_num_bytes_written() const { return num_bytes_written.load(); }
+    /* # of bytes read for pages, 0 without metrics (see metrics.h) */
+    size_t get_num_bytes_read() const { return num_bytes_read.load(); }
+
+    /* freed pages go on a free list */
+    virtual PageID new_page() override;
+    virtual void free_page(PageID pid) override;
+    size_t get_num_free_pages() const { return num_free_pages.load(); }
+    /* page 0 is the header page */
+    virtual size_t get_num_pages() const override { return file_size_pages.load(); }
+    virtual void read_page(Page* page,
+                           boost::upgrade_to_unique_lock<Page>& lock) override;
+    virtual void write_page(Page* page, boost::upgrade_lock<Page>& lock) override;
 
-    PageID new_page();
-    void read_page(Page* page, boost::upgrade_to_unique_lock<Page>& lock);
-    void write_page(Page* page, boost::upgrade_lock<Page>& lock);
+    virtual void read_pages(std::vector<PageIORequest>& requests) override;
+    virtual void write_pages(std::vector<PageIORequest>& requests) override;
+
+    /* fdatasync() the pages and the header */
+    virtual void sync() override;
+
+    /* a copy-on-write snapshot of the file: the pages, the header and the
+     * free list as they are when begin_snapshot() returns. a page that is
+     * written while the snapshot is open has its old content read and kept
+     * first, unless the snapshot has copied it already. pages allocated
+     * after the snapshot began are not part of it. one snapshot at a time.
+     * started is called once the snapshot is open, before any page can be
+     * allocated or freed */
+    void begin_snapshot(const std::function<void()>& started = {});
+    /* write the snapshot to a new file, paced by limiter. returns the # of
+     * bytes written */
+    size_t write_snapshot(std::string_view filename, RateLimiter& limiter);
+    void end_snapshot();
+    /* # of pages whose old content is kept for the open snapshot */
+    size_t get_num_snapshot_copies();
 
 private:
-    static const uint32_t MAGIC = 0xDEADBEEF;
+    static constexpr uint32_t MAGIC = 0xDEADBEEF;
 
     int fd;
+    /* page I/O with O_DIRECT, -1 if not used. the header and the free list
+     * links are small and go through fd */
+    int direct_fd;
     size_t page_size;
-    uint32_t file_size_pages;
+    PageFormat format;
+    size_t data_size;
+    std::atomic<size_t> num_bytes_written;
+    MetricCounter num_bytes_read;
+    std::atomic<uint32_t> file_size_pages;
+    /* freed pages are chained through their first 4 bytes */
+    PageID free_list_head;
+    std::atomic<uint32_t> num_free_pages;
     std::string filename;
-    std::mutex mutex;
+    std::mutex mutex; /* serializes file growth, the free list and header
+                         updates */
+    IOBackend backend;
+    std::unique_ptr<IOUring> ring;
+
+    /* pages of the open snapshot that were written since it began. a page
+     * is copied either here or by write_snapshot(), whichever comes first */
+    struct Snapshot {
+        size_t num_pages;
+        std::vector<bool> copied;
+        std::unordered_map<PageID, std::unique_ptr<uint8_t[]>> old_pages;
+    };
+    std::atomic<bool> snapshot_open;
+    std::mutex snapshot_mutex; /* taken after mutex */
+    std::unique_ptr<Snapshot> snapshot;
+
+    /* keep the content of the page for the snapshot before it is written */
+    void preserve_page(PageID pid);
+    /* read a page through the buffered descriptor into any buffer */
+    void read_raw_page(PageID pid, uint8_t* buf);
+
+    void check_page_id(PageID pid) const;
+    void pread_page(PageID pid, uint8_t* buf);
+    void pwrite_page(PageID pid, const uint8_t* buf, size_t length);
+
+    /* a page buffer for the on-disk form of a page, aligned for O_DIRECT */
+    using PageBuffer = std::unique_ptr<uint8_t[], void (*)(void*)>;
+    PageBuffer alloc_page_buffer() const;
+    /* write the header and the (compressed) data of a page to the page
+     * buffer out, returns the # of bytes to write */
+    size_t encode_page(const uint8_t* data, uint64_t lsn, uint8_t* out) const;
+    /* check the page read into in and write its data to data */
+    void decode_page(PageID pid, const uint8_t* in, uint8_t* data) const;
+    void submit_batch(std::vector<PageIORequest>& requests, bool write);
+    int page_fd() const { return direct_fd != -1 ? direct_fd : fd; }
 
     void create();
     void open(bool create);
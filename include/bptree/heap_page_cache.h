@@ -1,26 +1,82 @@
 #ifndef _BPTREE_HEAP_PAGE_CACHE_H_
 #define _BPTREE_HEAP_PAGE_CACHE_H_
 
+#include "bptree/frame_arena.h"
 #include "bptree/heap_file.h"
 #include "bptree/page_cache.h"
+#include "bptree/replacement_policy.h"
 
 #include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <deque>
-#include <list>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace bptree {
 
+/* WRITE_THROUGH writes a dirty page back to the heap file as soon as it is
+ * unpinned. WRITE_BACK keeps dirty pages in the cache and leaves them to the
+ * background flusher, eviction or an explicit flush_all_pages() */
+enum class WritePolicy { WRITE_THROUGH, WRITE_BACK };
+
 class HeapPageCache : public AbstractPageCache {
 public:
+    /* dirty_high_watermark is the number of dirty pages that wakes up the
+     * background flusher in write-back mode (0 means max_pages / 2).
+     * prefetches are served by num_prefetch_threads I/O threads (0 makes
+     * prefetch_page() a no-op) and at most max_prefetch_pages prefetched
+     * pages can be queued, in flight or cached but not yet fetched (0 means
+     * max_pages / 8). the frames are split between num_shards shards, each
+     * with its own lock, page table and replacement state (0 picks one shard
+     * per DEFAULT_FRAMES_PER_SHARD frames). with prioritize_inner_nodes,
+     * pages marked PagePriority::HIGH (inner nodes) are only evicted when
+     * there are no other candidates or they fill more than half of their
+     * shard. the frames are one FrameArena of max_pages * page_size bytes,
+     * backed by huge pages with use_huge_pages. with direct_io, the heap
+     * file is accessed with O_DIRECT (see HeapFile). page_format is the
+     * PageFormat of a heap file that is created, get_page_size() is the
+     * data size of its pages */
     HeapPageCache(std::string_view filename, bool create,
-                  size_t max_pages = 4096, size_t page_size = 4096);
+                  size_t max_pages = 4096, size_t page_size = 4096,
+                  WritePolicy write_policy = WritePolicy::WRITE_THROUGH,
+                  size_t dirty_high_watermark = 0,
+                  IOBackend io_backend = IOBackend::SYNC,
+                  size_t num_prefetch_threads = 1,
+                  size_t max_prefetch_pages = 0,
+                  size_t num_shards = 0,
+                  ReplacementPolicyType replacement_policy =
+                      ReplacementPolicyType::LRU,
+                  bool prioritize_inner_nodes = false,
+                  bool direct_io = false, bool use_huge_pages = false,
+                  PageFormat page_format = PageFormat::RAW);
+    /* a cache over another page store, e.g. a RemotePageStore. the frames
+     * are get_data_size() bytes of the store */
+    HeapPageCache(std::unique_ptr<PageStore> store, size_t max_pages = 4096,
+                  WritePolicy write_policy = WritePolicy::WRITE_THROUGH,
+                  size_t dirty_high_watermark = 0,
+                  size_t num_prefetch_threads = 1,
+                  size_t max_prefetch_pages = 0,
+                  size_t num_shards = 0,
+                  ReplacementPolicyType replacement_policy =
+                      ReplacementPolicyType::LRU,
+                  bool prioritize_inner_nodes = false,
+                  bool use_huge_pages = false);
+    ~HeapPageCache();
 
     virtual Page *new_page(boost::upgrade_lock<Page> &lock) override;
     virtual Page *fetch_page(PageID id, boost::upgrade_lock<Page> &lock) override;
+    virtual Page *fetch_page_for_redo(PageID id, boost::upgrade_lock<Page> &lock,
+                                      bool &corrupt) override;
+    /* drops the cached copy without writing it back and puts the page on
+     * the heap file's free list */
+    virtual void free_page(PageID id) override;
 
     virtual void pin_page(Page *page, boost::upgrade_lock<Page> &lock) override;
     virtual void unpin_page(Page *page, bool dirty, boost::upgrade_lock<Page> &lock) override;
@@ -28,29 +84,188 @@ public:
     virtual void flush_page(Page *page, boost::upgrade_lock<Page> &lock) override;
     virtual void flush_all_pages() override;
 
-    virtual size_t size() const override { return pages.size(); }
+    virtual size_t size() const override { return num_cached.load(); }
     virtual size_t get_page_size() const override { return page_size; }
 
     virtual void prefetch_page(PageID id) override;
     virtual void prefetch_pages(const std::vector<PageID>& ids) override;
 
+    /* must be set while no page is written back */
+    virtual void set_write_ahead_log(WriteAheadLog* log) override
+    {
+        this->log = log;
+    }
+
+    virtual HeapFile* get_heap_file() override { return heap_file; }
+    PageStore* get_page_store() { return store.get(); }
+
+    WritePolicy get_write_policy() const { return write_policy; }
+    size_t get_num_dirty_pages() const { return num_dirty.load(); }
+
+    /* # of pages read by the prefetch threads / # of those that were
+     * fetched before being evicted */
+    size_t get_num_prefetched_pages() const { return num_prefetched.load(); }
+    size_t get_num_prefetch_hits() const { return num_prefetch_hits.load(); }
+
+    size_t get_num_shards() const { return num_shards; }
+
+    bool is_direct_io() const { return heap_file && heap_file->is_direct_io(); }
+    bool has_huge_pages() const { return frame_arena.has_huge_pages(); }
+
+    ReplacementPolicyType get_replacement_policy() const
+    {
+        return replacement_policy;
+    }
+    virtual PageCacheStats get_stats() const override;
+
+    /* warm restarts: the IDs of the cached pages are written to the
+     * manifest at filename on every flush_all_pages() (e.g. a checkpoint of
+     * the tree) and when the cache is destroyed, the pages of inner nodes
+     * first. the pages listed in an existing manifest are read back by a
+     * background thread while the cache is in use, inner nodes first, in
+     * batches of sorted page IDs. it only fills free frames and never
+     * evicts a page. must be called before the cache is shared. returns
+     * the # of pages in the existing manifest, 0 if there is none or it
+     * cannot be read */
+    size_t use_manifest(std::string_view filename);
+    /* write the manifest now, returns the # of pages in it */
+    size_t write_manifest();
+    /* block until the pages of the manifest are read back */
+    void wait_for_warm_up();
+    /* # of pages read back from the manifest */
+    size_t get_num_warmed_pages() const { return num_warmed.load(); }
+
+    static constexpr size_t DEFAULT_FRAMES_PER_SHARD = 256;
+    static constexpr size_t MAX_SHARDS = 64;
+
 private:
-    std::unique_ptr<HeapFile> heap_file;
+    /* max # of pages written back with one HeapFile::write_pages() call */
+    static constexpr size_t FLUSH_BATCH_SIZE = 64;
+    /* max # of pages read with one HeapFile::read_pages() call */
+    static constexpr size_t PREFETCH_BATCH_SIZE = 32;
+    /* max # of pages read with one read_pages() call of the warm up */
+    static constexpr size_t WARM_UP_BATCH_SIZE = 256;
+    static constexpr uint32_t MANIFEST_MAGIC = 0x4d414e46;
+
+    /* a read that is queued or in progress, or the write-back of an evicted
+     * page. fetch_page() waits for a started read instead of issuing another
+     * one and takes over queued ones */
+    struct PendingRead {
+        bool started;
+        bool prefetch;
+    };
+
+    /* frame_policy value of frames that are in no replacement policy */
+    static constexpr uint8_t NO_POLICY = 0xff;
+
+    /* a partition of the buffer pool. a page always lives in the shard its
+     * ID hashes to and only uses the frames of that shard */
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<PageID, Page*> page_map;
+        std::unordered_map<PageID, std::shared_ptr<PendingRead>> pending_reads;
+        std::condition_variable read_cv;
+        std::unordered_set<PageID> prefetched_unused;
+        std::vector<Page*> free_frames;
+        size_t first_frame;
+        size_t num_frames;
+        /* indexed by PagePriority */
+        std::unique_ptr<ReplacementPolicy> policies[2];
+
+        std::atomic<size_t> hits;
+        std::atomic<size_t> misses;
+        std::atomic<size_t> evictions;
+    };
+
+    std::unique_ptr<PageStore> store;
+    /* store if it is a HeapFile */
+    HeapFile* heap_file;
     size_t page_size;
     size_t max_pages;
-    std::mutex mutex;
-    std::mutex lru_mutex;
 
-    std::list<std::unique_ptr<Page>> pages;
-    std::unordered_map<PageID, Page*> page_map;
-    std::list<PageID> lru_list;
-    std::unordered_map<PageID, std::list<PageID>::iterator> lru_map;
+    /* all frames and their buffers are allocated up front as two
+     * contiguous arrays */
+    FrameArena frame_arena;
+    Page* frames;
+    /* priority of the policy that has the frame, under the shard's mutex */
+    std::unique_ptr<uint8_t[]> frame_policy;
+    std::atomic<size_t> num_cached;
+
+    size_t num_shards;
+    std::unique_ptr<Shard[]> shards;
+    ReplacementPolicyType replacement_policy;
+    bool prioritize_inner_nodes;
+
+    WritePolicy write_policy;
+    size_t dirty_high_watermark;
+    std::atomic<size_t> num_dirty;
+    std::thread flusher;
+    std::mutex flusher_mutex;
+    std::condition_variable flusher_cv;
+    bool flusher_stop;
+    WriteAheadLog* log;
+
+    size_t max_prefetch_pages;
+    std::vector<std::thread> prefetch_threads;
+    std::mutex prefetch_mutex;
+    std::deque<std::pair<PageID, std::shared_ptr<PendingRead>>>
+        prefetch_queue;
+    std::atomic<size_t> num_prefetch_pending;
+    std::condition_variable prefetch_cv;
+    bool prefetch_stop;
+    std::atomic<size_t> num_prefetched;
+    std::atomic<size_t> num_prefetch_hits;
+
+    std::string manifest_filename;
+    std::mutex manifest_mutex;
+    std::thread warm_up_thread;
+    std::atomic<bool> warm_up_stop;
+    std::atomic<size_t> num_warmed;
+
+    Shard& shard_for(PageID id) const;
+    size_t frame_index(const Page* page) const { return page - frames; }
+
+    /* get a frame of the shard that is not in its page_map, evicting a
+     * page if needed. requires the shard's mutex */
+    /* fetch_page(), a page of the store that cannot be read is zeroed and
+     * sets *corrupt if corrupt is not nullptr */
+    Page* fetch(PageID id, boost::upgrade_lock<Page>& lock, bool* corrupt);
+    /* a free frame or an evicted one, locked. guard holds the shard lock
+     * and is dropped while a dirty victim is written back, callers register
+     * the page they allocate for in pending_reads first */
+    Page* alloc_frame(Shard& shard, boost::upgrade_lock<Page>& lock,
+                      std::unique_lock<std::mutex>& guard);
+    void release_frame(Shard& shard, Page* page);
+    /* forget the cached copy of a freed page, waiting for a read of it that
+     * is in flight. guard holds the shard's mutex */
+    void drop_page_locked(Shard& shard, PageID id,
+                          std::unique_lock<std::mutex>& guard);
+
+    /* pin count transitions of the shard's pages and its replacement
+     * state are updated together under the shard's mutex so that a pinned
+     * page is never evictable */
+    void pin_locked(Shard& shard, Page* page);
+    void unpin_locked(Shard& shard, Page* page);
+
+    /* requires the shard's mutex */
+    Page* evict_frame(Shard& shard);
 
-    Page* alloc_page(PageID new_id, boost::upgrade_lock<Page>& lock);
+    void prefetch_main();
+    /* read the pages of requests into their frames, which are locked by
+     * locks, and publish them unpinned. prefetched pages count as
+     * prefetches until they are fetched. the vectors are cleared, returns
+     * the # of pages published */
+    size_t read_batch(std::vector<Page*>& pages,
+                      std::vector<boost::upgrade_lock<Page>>& locks,
+                      std::vector<PageIORequest>& requests, bool prefetch);
+    /* read pids back into free frames, the first num_inner are inner nodes */
+    void warm_up_main(std::vector<PageID> pids, size_t num_inner);
 
-    void lru_insert(PageID id);
-    void lru_erase(PageID id);
-    bool lru_victim(PageID& id);
+    void mark_dirty(Page* page);
+    /* with wait_pending, pages that wait for their log batch are written
+     * once it is appended, otherwise they are left dirty */
+    void flush_dirty_pages(bool wait_pending);
+    void flusher_main();
 };
 
 } // namespace bptree
@@ -0,0 +1,202 @@
+#ifndef _BPTREE_INLINE_STRING_H_
+#define _BPTREE_INLINE_STRING_H_
+
+#include "bptree/page_store.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+namespace bptree {
+
+/* a string of up to Capacity bytes that is stored inline. it is trivially
+ * copyable so that nodes can move it around with memcpy and optimistic
+ * readers never follow a pointer that a writer is changing. on pages it is
+ * written by InlineStringSerializer with its actual length */
+template <size_t Capacity> class InlineString {
+    static_assert(Capacity > 0 && Capacity <= 255,
+                  "the length of an InlineString is stored in one byte");
+
+public:
+    static constexpr size_t CAPACITY = Capacity;
+
+    InlineString() : length(0), bytes{} {}
+    InlineString(const char* s, size_t n) : length(0), bytes{} { assign(s, n); }
+    InlineString(const char* s) : InlineString(s, ::strlen(s)) {}
+    InlineString(const std::string& s) : InlineString(s.data(), s.size()) {}
+
+    void assign(const char* s, size_t n)
+    {
+        if (n > Capacity) throw std::length_error("string too long");
+        ::memcpy(bytes, s, n);
+        length = (uint8_t)n;
+    }
+
+    /* clamped so that a torn read by an optimistic reader stays in bounds */
+    size_t size() const { return std::min<size_t>(length, Capacity); }
+    const char* data() const { return bytes; }
+    std::string str() const { return std::string(bytes, size()); }
+
+    /* bytewise, a prefix orders before the longer string */
+    int compare(const InlineString& other) const
+    {
+        size_t n = std::min(size(), other.size());
+        int c = ::memcmp(bytes, other.bytes, n);
+        if (c != 0) return c;
+        return size() < other.size() ? -1 : size() > other.size();
+    }
+
+    bool operator<(const InlineString& other) const { return compare(other) < 0; }
+    bool operator>(const InlineString& other) const { return compare(other) > 0; }
+    bool operator<=(const InlineString& other) const { return compare(other) <= 0; }
+    bool operator>=(const InlineString& other) const { return compare(other) >= 0; }
+    bool operator==(const InlineString& other) const
+    {
+        return size() == other.size() && ::memcmp(bytes, other.bytes, size()) == 0;
+    }
+    bool operator!=(const InlineString& other) const { return !(*this == other); }
+
+    friend std::ostream& operator<<(std::ostream& os, const InlineString& s)
+    {
+        return os.write(s.data(), s.size());
+    }
+
+private:
+    uint8_t length;
+    char bytes[Capacity];
+};
+
+/* writes | prefix length | prefix | (suffix length | suffix)* |, the prefix
+ * being the longest one that all strings of the range share. nodes hold
+ * sorted keys, which often share long prefixes */
+template <size_t Capacity> class InlineStringSerializer {
+public:
+    using StringType = InlineString<Capacity>;
+
+    size_t serialize(uint8_t* buf, size_t buf_size, const StringType* begin,
+                     const StringType* end) const
+    {
+        size_t prefix = common_prefix(begin, end);
+        size_t nbytes = size_with_prefix(begin, end, prefix);
+        if (nbytes > buf_size) {
+            throw std::length_error("strings do not fit in the buffer");
+        }
+
+        *buf++ = (uint8_t)prefix;
+        if (begin != end) {
+            ::memcpy(buf, begin->data(), prefix);
+            buf += prefix;
+        }
+
+        for (auto it = begin; it != end; it++) {
+            size_t suffix = it->size() - prefix;
+            *buf++ = (uint8_t)suffix;
+            ::memcpy(buf, it->data() + prefix, suffix);
+            buf += suffix;
+        }
+
+        return nbytes;
+    }
+
+    size_t deserialize(StringType* begin, StringType* end, const uint8_t* buf,
+                       size_t buf_size) const
+    {
+        const uint8_t* start = buf;
+        const uint8_t* limit = buf + buf_size;
+        char scratch[Capacity];
+
+        /* the lengths come from the page, a torn or corrupt one must not
+         * make us read past it */
+        auto take = [&buf, limit](size_t max_len) {
+            if (buf == limit) {
+                throw IOException("string lengths run past the end of the buffer");
+            }
+            size_t len = std::min<size_t>(*buf++, max_len);
+            if (len > (size_t)(limit - buf)) {
+                throw IOException("string bytes run past the end of the buffer");
+            }
+            return len;
+        };
+
+        size_t prefix = take(Capacity);
+        ::memcpy(scratch, buf, prefix);
+        buf += prefix;
+
+        for (auto it = begin; it != end; it++) {
+            size_t suffix = take(Capacity - prefix);
+            ::memcpy(scratch + prefix, buf, suffix);
+            buf += suffix;
+            it->assign(scratch, prefix + suffix);
+        }
+
+        return buf - start;
+    }
+
+    size_t encoded_size(const StringType* begin, const StringType* end) const
+    {
+        return size_with_prefix(begin, end, common_prefix(begin, end));
+    }
+
+    size_t encoded_size(const StringType* begin, const StringType* end,
+                        const StringType& extra) const
+    {
+        /* a prefix of all strings is one of the first string */
+        size_t prefix = 0;
+        if (begin != end) {
+            prefix = common_length(extra, *begin, common_prefix(begin, end));
+        }
+
+        return size_with_prefix(begin, end, prefix) + 1 + extra.size() - prefix;
+    }
+
+    size_t max_encoded_size() const { return 2 + Capacity; }
+
+    /* the shortest prefix of right that is still greater than left */
+    StringType shorten(const StringType& left, const StringType& right) const
+    {
+        size_t n = common_length(left, right, right.size());
+        if (n >= right.size()) return right;
+        return StringType(right.data(), n + 1);
+    }
+
+private:
+    static size_t common_length(const StringType& a, const StringType& b,
+                                size_t limit)
+    {
+        size_t n = std::min({a.size(), b.size(), limit});
+        size_t i = 0;
+        while (i < n && a.data()[i] == b.data()[i]) {
+            i++;
+        }
+        return i;
+    }
+
+    static size_t common_prefix(const StringType* begin, const StringType* end)
+    {
+        if (begin == end) return 0;
+
+        size_t prefix = begin->size();
+        for (auto it = begin + 1; it != end && prefix > 0; it++) {
+            prefix = common_length(*begin, *it, prefix);
+        }
+        return prefix;
+    }
+
+    static size_t size_with_prefix(const StringType* begin, const StringType* end,
+                               size_t prefix)
+    {
+        size_t nbytes = 1 + (begin != end ? prefix : 0);
+        for (auto it = begin; it != end; it++) {
+            nbytes += 1 + it->size() - prefix;
+        }
+        return nbytes;
+    }
+};
+
+} // namespace bptree
+
+#endif
@@ -0,0 +1,285 @@
+#ifndef _BPTREE_INSERT_BUFFER_H_
+#define _BPTREE_INSERT_BUFFER_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace bptree {
+
+/* pairs that were inserted but not applied to the tree yet. threads are
+ * assigned slots round-robin like in ShardedCounter, each slot keeps its
+ * pairs sorted and hands them to the tree as one run when it holds
+ * batch_size pairs or its oldest pair is older than max_delay. the age is
+ * checked on every insert into the slot and by a drainer thread that wakes
+ * up every max_delay / 2, so a pair of a slot that gets no more inserts is
+ * applied within about 1.5 * max_delay. a slot is locked while its run is
+ * applied, so a pair is always either in the buffer or in the tree for
+ * anyone who locks the slot. new pairs go to a short unsorted tail that is
+ * merged into the run when it is full */
+template <typename K, typename V, typename KeyComparator = std::less<K>>
+class InsertBuffer {
+public:
+    static constexpr size_t NUM_SLOTS = 32;
+    static constexpr size_t TAIL_SIZE = 32;
+
+    /* apply(keys, values, n) inserts a sorted run into the tree, it is
+     * called by inserting threads and by the drainer */
+    using ApplyFunc = std::function<void(const K*, const V*, size_t)>;
+
+    InsertBuffer(size_t batch_size, std::chrono::microseconds max_delay,
+                 ApplyFunc apply)
+        : batch_size(std::max<size_t>(1, batch_size)), max_delay(max_delay),
+          apply(std::move(apply)), drainer_stop(false)
+    {
+        drainer = std::thread([this]() { drainer_main(); });
+    }
+
+    ~InsertBuffer()
+    {
+        {
+            std::lock_guard<std::mutex> guard(drainer_mutex);
+            drainer_stop = true;
+        }
+        drainer_cv.notify_one();
+        drainer.join();
+    }
+
+    InsertBuffer(const InsertBuffer&) = delete;
+    InsertBuffer& operator=(const InsertBuffer&) = delete;
+
+    void insert(const K& key, const V& value)
+    {
+        auto& slot = slots[slot_index()];
+        std::lock_guard<std::mutex> guard(slot.mutex);
+
+        auto now = std::chrono::steady_clock::now();
+        if (slot.pairs.empty()) slot.oldest = now;
+
+        slot.pairs.emplace_back(key, value);
+        if (slot.pairs.size() - slot.sorted >= TAIL_SIZE) sort(slot);
+        slot.count.store(slot.pairs.size(), std::memory_order_release);
+
+        if (slot.pairs.size() >= batch_size || now - slot.oldest >= max_delay) {
+            drain(slot);
+        }
+    }
+
+    void flush()
+    {
+        for (auto&& slot : slots) {
+            if (slot.count.load(std::memory_order_acquire) == 0) continue;
+            std::lock_guard<std::mutex> guard(slot.mutex);
+            drain(slot);
+        }
+    }
+
+    /* lookup(values) searches the tree. the values of key in the buffer are
+     * appended after the ones in the tree. a slot that was drained while
+     * the tree was searched may have moved its pairs into the tree before
+     * the search, the lookup is then done again */
+    template <typename Lookup>
+    void get_values(const K& key, std::vector<V>& value_list, Lookup&& lookup)
+    {
+        std::vector<V> buffered;
+        std::vector<std::pair<size_t, uint64_t>> seen;
+
+        while (true) {
+            buffered.clear();
+            seen.clear();
+            for (size_t i = 0; i < NUM_SLOTS; i++) {
+                auto& slot = slots[i];
+                if (slot.count.load(std::memory_order_acquire) == 0) continue;
+
+                std::lock_guard<std::mutex> guard(slot.mutex);
+                size_t num_buffered = buffered.size();
+                auto end = slot.pairs.begin() + slot.sorted;
+                for (auto it = std::lower_bound(slot.pairs.begin(), end, key, cmp);
+                     it != end && !kcmp(key, it->first); it++) {
+                    buffered.push_back(it->second);
+                }
+                for (auto it = end; it != slot.pairs.end(); it++) {
+                    if (!kcmp(key, it->first) && !kcmp(it->first, key)) {
+                        buffered.push_back(it->second);
+                    }
+                }
+                if (buffered.size() > num_buffered) {
+                    seen.emplace_back(i, slot.generation);
+                }
+            }
+
+            lookup(value_list);
+
+            bool drained = false;
+            for (auto&& p : seen) {
+                auto& slot = slots[p.first];
+                std::lock_guard<std::mutex> guard(slot.mutex);
+                if (slot.generation != p.second) {
+                    drained = true;
+                    break;
+                }
+            }
+            if (drained) continue;
+
+            value_list.insert(value_list.end(), buffered.begin(), buffered.end());
+            return;
+        }
+    }
+
+    /* remove the pairs of key (only those equal to *value unless value is
+     * nullptr) from the buffer, returns the # of pairs removed. callers
+     * erase from the buffer before the tree so that a pair drained in
+     * between is found in the tree */
+    size_t erase(const K& key, const V* value)
+    {
+        size_t count = 0;
+        for (auto&& slot : slots) {
+            if (slot.count.load(std::memory_order_acquire) == 0) continue;
+
+            std::lock_guard<std::mutex> guard(slot.mutex);
+            sort(slot);
+            auto range =
+                std::equal_range(slot.pairs.begin(), slot.pairs.end(), key, cmp);
+            auto out = std::remove_if(range.first, range.second, [value](auto& p) {
+                return !value || p.second == *value;
+            });
+            count += range.second - out;
+
+            slot.pairs.erase(out, range.second);
+            slot.sorted = slot.pairs.size();
+            slot.count.store(slot.pairs.size(), std::memory_order_release);
+        }
+        return count;
+    }
+
+    /* # of pairs that are not in the tree yet */
+    size_t size() const
+    {
+        size_t total = 0;
+        for (auto&& slot : slots) {
+            total += slot.count.load(std::memory_order_acquire);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::mutex mutex;
+        /* pairs[0, sorted) are sorted by key */
+        std::vector<std::pair<K, V>> pairs;
+        size_t sorted = 0;
+        std::chrono::steady_clock::time_point oldest;
+        /* # of pairs, read without the lock to skip empty slots */
+        std::atomic<size_t> count{0};
+        /* # of times the slot was drained */
+        uint64_t generation = 0;
+    };
+
+    size_t batch_size;
+    std::chrono::microseconds max_delay;
+    ApplyFunc apply;
+    KeyComparator kcmp;
+    std::array<Slot, NUM_SLOTS> slots;
+
+    std::thread drainer;
+    std::mutex drainer_mutex;
+    std::condition_variable drainer_cv;
+    bool drainer_stop;
+
+    /* pairs of a key stay in insertion order */
+    struct PairComparator {
+        KeyComparator kcmp;
+        bool operator()(const std::pair<K, V>& a, const K& b) const
+        {
+            return kcmp(a.first, b);
+        }
+        bool operator()(const K& a, const std::pair<K, V>& b) const
+        {
+            return kcmp(a, b.first);
+        }
+        bool operator()(const std::pair<K, V>& a, const std::pair<K, V>& b) const
+        {
+            return kcmp(a.first, b.first);
+        }
+    } cmp;
+
+    void sort(Slot& slot)
+    {
+        auto middle = slot.pairs.begin() + slot.sorted;
+        std::stable_sort(middle, slot.pairs.end(), cmp);
+        std::inplace_merge(slot.pairs.begin(), middle, slot.pairs.end(), cmp);
+        slot.sorted = slot.pairs.size();
+    }
+
+    void drain(Slot& slot)
+    {
+        slot.generation++;
+        if (!slot.pairs.empty()) {
+            sort(slot);
+            /* the tree takes keys and values apart */
+            std::vector<K> run_keys;
+            std::vector<V> run_values;
+            run_keys.reserve(slot.pairs.size());
+            run_values.reserve(slot.pairs.size());
+            for (auto&& p : slot.pairs) {
+                run_keys.push_back(p.first);
+                run_values.push_back(p.second);
+            }
+            apply(run_keys.data(), run_values.data(), run_keys.size());
+        }
+        slot.pairs.clear();
+        slot.sorted = 0;
+        slot.count.store(0, std::memory_order_release);
+    }
+
+    /* apply the slots whose oldest pair is older than max_delay. a slot
+     * that is locked is being filled or drained and is checked next time */
+    void drain_expired()
+    {
+        auto now = std::chrono::steady_clock::now();
+        for (auto&& slot : slots) {
+            if (slot.count.load(std::memory_order_acquire) == 0) continue;
+
+            std::unique_lock<std::mutex> guard(slot.mutex, std::try_to_lock);
+            if (!guard.owns_lock()) continue;
+            if (!slot.pairs.empty() && now - slot.oldest >= max_delay) {
+                drain(slot);
+            }
+        }
+    }
+
+    void drainer_main()
+    {
+        auto interval = std::max(max_delay / 2, std::chrono::microseconds(1));
+        std::unique_lock<std::mutex> guard(drainer_mutex);
+
+        while (true) {
+            drainer_cv.wait_for(guard, interval, [this]() { return drainer_stop; });
+            if (drainer_stop) break;
+
+            guard.unlock();
+            drain_expired();
+            guard.lock();
+        }
+    }
+
+    static size_t slot_index()
+    {
+        static std::atomic<size_t> next_index{0};
+        static thread_local size_t index = next_index++ % NUM_SLOTS;
+        return index;
+    }
+};
+
+} // namespace bptree
+
+#endif
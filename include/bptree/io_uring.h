@@ -0,0 +1,84 @@
+#ifndef _BPTREE_IO_URING_H_
+#define _BPTREE_IO_URING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <sys/types.h>
+
+namespace bptree {
+
+/* minimal io_uring wrapper on top of the raw system calls. submissions and
+ * completions are protected by separate mutexes so that several threads can
+ * share one ring: any thread waiting for completions reaps all of them and
+ * hands them to their owners through IOUring::Request */
+class IOUring {
+public:
+    struct Request {
+        std::atomic<bool> done;
+        int result; /* bytes transferred or -errno, valid when done is set */
+
+        Request() : done(false), result(0) {}
+    };
+
+    explicit IOUring(unsigned int queue_depth = 64);
+    ~IOUring();
+
+    IOUring(const IOUring&) = delete;
+    IOUring& operator=(const IOUring&) = delete;
+
+    /* whether the running kernel lets us set up a ring */
+    static bool is_supported();
+
+    unsigned int get_queue_depth() const { return sq_entries; }
+
+    /* queue a read/write. blocks while the ring is full. the request is
+     * not handed to the kernel until submit() is called */
+    void prepare_read(int fd, void* buf, size_t len, off_t offset,
+                      Request* req);
+    void prepare_write(int fd, const void* buf, size_t len, off_t offset,
+                       Request* req);
+
+    /* submit all prepared requests with a single system call */
+    void submit();
+
+    /* wait until req is done, reaping completions of other requests on the
+     * way */
+    void wait(Request* req);
+
+private:
+    int ring_fd;
+    unsigned int sq_entries;
+    unsigned int cq_entries;
+
+    void* sq_ptr;
+    void* cq_ptr;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    void* sqes;
+    size_t sqes_size;
+
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    void* cqes;
+
+    std::mutex sq_mutex;
+    std::mutex cq_mutex;
+    unsigned int pending; /* prepared but not submitted, under sq_mutex */
+    std::atomic<unsigned int> in_flight;
+
+    void prepare(int opcode, int fd, uint64_t addr, size_t len, off_t offset,
+                 Request* req);
+    void submit_locked();
+    size_t reap(); /* requires cq_mutex */
+};
+
+} // namespace bptree
+
+#endif
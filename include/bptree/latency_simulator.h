@@ -1,38 +1,113 @@
 #ifndef _BPTREE_LATENCY_SIMULATOR_H_
 #define _BPTREE_LATENCY_SIMULATOR_H_
 
+#include <algorithm>
 #include <chrono>
+#include <functional>
+#include <mutex>
+#include <queue>
 #include <random>
 #include <thread>
+#include <vector>
 
 namespace bptree {
 
+/* models the link to far memory. a transfer waits for a free slot if
+ * queue_depth transfers are in flight, then for the link to push its bytes
+ * at bandwidth_bytes_per_second after the transfers before it, and
+ * completes base_latency_us (+- jitter_us) later. transfers in flight
+ * overlap their latencies but share the bandwidth. 0 bandwidth or queue
+ * depth means no limit */
 class LatencySimulator {
 public:
-    static void configure(int base_latency_us, int jitter_us = 0) {
+    using Clock = std::chrono::steady_clock;
+
+    /* transfers of the current thread are not simulated while a LocalIO
+     * exists, e.g. a PageServer's I/O of its own store */
+    class LocalIO {
+    public:
+        LocalIO() { local_io = true; }
+        ~LocalIO() { local_io = false; }
+    };
+
+    static void configure(int base_latency_us, int jitter_us = 0,
+                          size_t bandwidth_bytes_per_second = 0,
+                          size_t queue_depth = 0) {
+        std::lock_guard<std::mutex> guard(mutex);
         base_latency = base_latency_us;
         jitter = jitter_us;
+        bandwidth = bandwidth_bytes_per_second;
+        max_in_flight = queue_depth;
+        link_free = Clock::now();
+        in_flight = decltype(in_flight)();
+    }
+
+    /* a transfer of no bytes */
+    static void simulate_network_latency() { simulate_transfer(0); }
+
+    static void simulate_transfer(size_t bytes) {
+        if (!is_enabled() || local_io) return;
+        std::this_thread::sleep_until(reserve_transfer(bytes));
     }
-    
-    static void simulate_network_latency() {
-        if (base_latency <= 0) return;
-        
+
+    /* book a transfer of bytes that starts now and return when it
+     * completes, without waiting for it. e.g. a server that answers many
+     * requests at once sends each answer at its completion time */
+    static Clock::time_point reserve_transfer(size_t bytes) {
+        auto now = Clock::now();
+        if (!is_enabled()) return now;
+
+        std::lock_guard<std::mutex> guard(mutex);
+        auto start = now;
+
+        if (max_in_flight > 0) {
+            while (!in_flight.empty() && in_flight.top() <= now) {
+                in_flight.pop();
+            }
+            if (in_flight.size() >= max_in_flight) {
+                start = in_flight.top();
+                in_flight.pop();
+            }
+        }
+
+        auto end = start;
+        if (bandwidth > 0) {
+            link_free = std::max(link_free, start) +
+                        std::chrono::nanoseconds((uint64_t)(bytes * 1e9 / bandwidth));
+            end = link_free;
+        }
+
         int delay = base_latency;
         if (jitter > 0) {
             static thread_local std::mt19937 gen(std::random_device{}());
             std::uniform_int_distribution<> dist(-jitter, jitter);
             delay += dist(gen);
-            if (delay < 0) delay = 0;
         }
-        
-        std::this_thread::sleep_for(std::chrono::microseconds(delay));
+        if (delay > 0) end += std::chrono::microseconds(delay);
+
+        if (max_in_flight > 0) in_flight.push(end);
+        return end;
     }
-    
+
 private:
     static inline int base_latency = 0;
     static inline int jitter = 0;
+    static inline size_t bandwidth = 0;
+    static inline size_t max_in_flight = 0;
+    static inline thread_local bool local_io = false;
+
+    static inline std::mutex mutex;
+    /* when the link has pushed the bytes of all booked transfers */
+    static inline Clock::time_point link_free;
+    /* completion times of the transfers in flight, with a queue depth */
+    static inline std::priority_queue<Clock::time_point,
+                                      std::vector<Clock::time_point>,
+                                      std::greater<Clock::time_point>>
+        in_flight;
+
+    static bool is_enabled() { return base_latency > 0 || bandwidth > 0; }
 };
 
 } // namespace bptree
 
-#endif
\ No newline at end of file
+#endif
@@ -1,10 +1,12 @@
 #ifndef _BPTREE_MEM_PAGE_CACHE_H_
 #define _BPTREE_MEM_PAGE_CACHE_H_
 
+#include "bptree/metrics.h"
 #include "bptree/page_cache.h"
 
 #include <shared_mutex>
 #include <unordered_map>
+#include <vector>
 
 namespace bptree {
 
@@ -14,8 +16,14 @@ public:
 
     virtual Page* new_page(boost::upgrade_lock<Page>& lock) override
     {
-        auto id = get_next_id();
         std::unique_lock<std::shared_mutex> guard(mutex);
+        PageID id;
+        if (!free_ids.empty()) {
+            id = free_ids.back();
+            free_ids.pop_back();
+        } else {
+            id = get_next_id();
+        }
         page_map[id] = std::make_unique<Page>(id, page_size);
         Page* page = page_map[id].get();
         lock = boost::upgrade_lock<Page>(*page);
@@ -27,10 +35,17 @@ public:
         std::shared_lock<std::shared_mutex> guard(mutex);
         auto it = page_map.find(id);
         if (it == page_map.end()) return nullptr;
+        num_fetches.add(1);
         lock = boost::upgrade_lock<Page>(*it->second);
         return it->second.get();
     }
 
+    virtual void free_page(PageID id) override
+    {
+        std::unique_lock<std::shared_mutex> guard(mutex);
+        if (page_map.erase(id)) free_ids.push_back(id);
+    }
+
     virtual void pin_page(Page* page, boost::upgrade_lock<Page>&) override {}
     virtual void unpin_page(Page* page, bool dirty, boost::upgrade_lock<Page>&) override {}
 
@@ -40,23 +55,16 @@ public:
     virtual size_t size() const override { return page_map.size(); }
     virtual size_t get_page_size() const override { return page_size; }
 
-    virtual void prefetch_page(PageID id) override {
-        std::shared_lock<std::shared_mutex> guard(mutex);
-        if (page_map.find(id) == page_map.end())
-        {
-            std::unique_lock<std::shared_mutex> write_guard(mutex);
-            if (page_map.find(id) == page_map.end())
-            {
-                page_map[id] = std::make_unique<Page>(id, page_size);
-            }
-        }
-    }
+    /* all pages are resident, there is nothing to prefetch */
+    virtual void prefetch_page(PageID id) override {}
+    virtual void prefetch_pages(const std::vector<PageID>& ids) override {}
 
-    virtual void prefetch_pages(const std::vector<PageID> &ids) override {
-        for (PageID id : ids)
-        {
-            prefetch_page(id);
-        }
+    /* every fetch is a hit */
+    virtual PageCacheStats get_stats() const override
+    {
+        PageCacheStats stats;
+        stats.hits = num_fetches.load();
+        return stats;
     }
 
 private:
@@ -64,6 +72,8 @@ private:
     std::atomic<PageID> next_id;
     std::shared_mutex mutex;
     std::unordered_map<PageID, std::unique_ptr<Page>> page_map;
+    std::vector<PageID> free_ids;
+    MetricCounter num_fetches;
 
     PageID get_next_id() { return next_id++; }
 };
@@ -0,0 +1,192 @@
+#ifndef _BPTREE_METRICS_H_
+#define _BPTREE_METRICS_H_
+
+#include "bptree/sharded_counter.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace bptree {
+
+/* counters and latency histograms of the tree and the page caches. built
+ * with BPTREE_DISABLE_METRICS (cmake -DBPTREE_METRICS=OFF) they compile to
+ * nothing and always read as 0 */
+#ifdef BPTREE_DISABLE_METRICS
+static constexpr bool METRICS_ENABLED = false;
+#else
+static constexpr bool METRICS_ENABLED = true;
+#endif
+
+/* a ShardedCounter that goes away without metrics */
+class MetricCounter {
+public:
+#ifdef BPTREE_DISABLE_METRICS
+    void add(int64_t delta) {}
+    size_t load() const { return 0; }
+#else
+    void add(int64_t delta) { counter.add(delta); }
+    size_t load() const { return (size_t)counter.load(); }
+
+private:
+    ShardedCounter counter;
+#endif
+};
+
+/* the recorded values of a LatencyHistogram, in nanoseconds */
+struct HistogramSnapshot {
+    size_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    /* # of values per bucket, see LatencyHistogram::bucket_of() */
+    std::vector<uint64_t> buckets;
+
+    double mean() const { return count ? (double)sum / count : 0.0; }
+    /* the value that fraction p (in [0, 1]) of the values are at most,
+     * rounded up to the end of its bucket */
+    uint64_t percentile(double p) const;
+};
+
+/* a histogram of durations in the style of HdrHistogram: every power of
+ * two is split into SUB_BUCKETS linear buckets, so a value is known within
+ * 1 / SUB_BUCKETS of itself from 1 ns up to 2^MAX_EXPONENT ns (about 18
+ * minutes, larger values go into the last bucket). each thread records
+ * into one of NUM_SLOTS slots of counts, snapshot() adds them up */
+class LatencyHistogram {
+public:
+    static constexpr size_t SUB_BUCKET_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr size_t MAX_EXPONENT = 40;
+    static constexpr size_t NUM_BUCKETS =
+        (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+    static constexpr size_t NUM_SLOTS = 16;
+
+    LatencyHistogram()
+    {
+        if constexpr (METRICS_ENABLED) slots = std::make_unique<Slot[]>(NUM_SLOTS);
+    }
+
+    void record(uint64_t ns)
+    {
+        if constexpr (METRICS_ENABLED) {
+            auto& slot = slots[slot_index()];
+            slot.counts[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+            slot.sum.fetch_add(ns, std::memory_order_relaxed);
+            auto max = slot.max.load(std::memory_order_relaxed);
+            while (ns > max && !slot.max.compare_exchange_weak(
+                                   max, ns, std::memory_order_relaxed)) {
+            }
+        }
+    }
+
+    HistogramSnapshot snapshot() const
+    {
+        HistogramSnapshot snap;
+        if constexpr (METRICS_ENABLED) {
+            snap.buckets.assign(NUM_BUCKETS, 0);
+            for (size_t s = 0; s < NUM_SLOTS; s++) {
+                for (size_t i = 0; i < NUM_BUCKETS; i++) {
+                    auto n = slots[s].counts[i].load(std::memory_order_relaxed);
+                    snap.buckets[i] += n;
+                    snap.count += n;
+                }
+                snap.sum += slots[s].sum.load(std::memory_order_relaxed);
+                snap.max = std::max(snap.max,
+                                    slots[s].max.load(std::memory_order_relaxed));
+            }
+        }
+        return snap;
+    }
+
+    /* values below SUB_BUCKETS have a bucket each, the others are bucketed
+     * by their top SUB_BUCKET_BITS + 1 bits */
+    static size_t bucket_of(uint64_t ns)
+    {
+        if (ns < SUB_BUCKETS) return ns;
+        size_t exponent = 63 - __builtin_clzll(ns);
+        if (exponent >= MAX_EXPONENT) return NUM_BUCKETS - 1;
+        size_t shift = exponent - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((ns >> shift) - SUB_BUCKETS);
+    }
+
+    /* the largest value that goes into bucket i */
+    static uint64_t bucket_end(size_t i)
+    {
+        if (i < SUB_BUCKETS) return i;
+        size_t shift = i / SUB_BUCKETS - 1;
+        uint64_t first = (SUB_BUCKETS + i % SUB_BUCKETS) << shift;
+        return first + ((uint64_t)1 << shift) - 1;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::array<std::atomic<uint64_t>, NUM_BUCKETS> counts{};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+    };
+
+    std::unique_ptr<Slot[]> slots;
+
+    static size_t slot_index()
+    {
+        static std::atomic<size_t> next_index{0};
+        static thread_local size_t index = next_index++ % NUM_SLOTS;
+        return index;
+    }
+};
+
+inline uint64_t HistogramSnapshot::percentile(double p) const
+{
+    if (count == 0) return 0;
+    auto rank = (uint64_t)std::max(1.0, p * count + 0.5);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank) return std::min(LatencyHistogram::bucket_end(i), max);
+    }
+    return max;
+}
+
+/* records the time from its construction to its destruction */
+class LatencyTimer {
+public:
+    explicit LatencyTimer(LatencyHistogram& histogram) : histogram(histogram)
+    {
+        if constexpr (METRICS_ENABLED) start = std::chrono::steady_clock::now();
+    }
+
+    ~LatencyTimer()
+    {
+        if constexpr (METRICS_ENABLED) {
+            histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count());
+        }
+    }
+
+    LatencyTimer(const LatencyTimer&) = delete;
+    LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+private:
+    LatencyHistogram& histogram;
+    std::chrono::steady_clock::time_point start;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const HistogramSnapshot& h)
+{
+    return os << "count " << h.count << " mean " << h.mean() / 1000 << "us p50 "
+              << h.percentile(0.5) / 1000.0 << "us p99 "
+              << h.percentile(0.99) / 1000.0 << "us p99.9 "
+              << h.percentile(0.999) / 1000.0 << "us max " << h.max / 1000.0
+              << "us";
+}
+
+} // namespace bptree
+
+#endif
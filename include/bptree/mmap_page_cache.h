@@ -0,0 +1,96 @@
+#ifndef _BPTREE_MMAP_PAGE_CACHE_H_
+#define _BPTREE_MMAP_PAGE_CACHE_H_
+
+#include "bptree/heap_file.h"
+#include "bptree/page_cache.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace bptree {
+
+/* a page cache that maps the heap file and leaves residency to the kernel.
+ * pages are views over the mapping: fetch_page() neither copies nor takes a
+ * cache-wide lock, and a dirty page is written back by the kernel like any
+ * other shared file mapping. max_file_size bytes of address space are mapped
+ * up front so that the file grows without moving the mapping under the pages
+ * that are in use, the heap file can not grow beyond it. with
+ * sync_on_flush, flush_all_pages() (and so BTree::checkpoint()) waits for
+ * msync() to write the dirty pages to the file, otherwise it returns at
+ * once */
+class MmapPageCache : public AbstractPageCache {
+public:
+    static constexpr size_t DEFAULT_MAX_FILE_SIZE = (size_t)1 << 36;
+
+    MmapPageCache(std::string_view filename, bool create,
+                  size_t page_size = 4096,
+                  size_t max_file_size = DEFAULT_MAX_FILE_SIZE,
+                  bool sync_on_flush = true);
+    ~MmapPageCache();
+
+    MmapPageCache(const MmapPageCache&) = delete;
+    MmapPageCache& operator=(const MmapPageCache&) = delete;
+
+    virtual Page* new_page(boost::upgrade_lock<Page>& lock) override;
+    /* nullptr if the page is not in the file */
+    virtual Page* fetch_page(PageID id, boost::upgrade_lock<Page>& lock) override;
+    virtual void free_page(PageID id) override;
+
+    /* pages are never evicted, there is nothing to pin */
+    virtual void pin_page(Page* page, boost::upgrade_lock<Page>&) override {}
+    virtual void unpin_page(Page* page, bool dirty,
+                            boost::upgrade_lock<Page>&) override {}
+
+    /* msync() the page */
+    virtual void flush_page(Page* page, boost::upgrade_lock<Page>&) override;
+    virtual void flush_all_pages() override;
+
+    /* # of pages in the heap file */
+    virtual size_t size() const override { return heap_file->get_num_pages(); }
+    virtual size_t get_page_size() const override { return page_size; }
+
+    /* madvise(MADV_WILLNEED) for the pages, runs of adjacent pages are
+     * advised together. pages that were fetched or advised before are
+     * assumed to be resident and skipped */
+    virtual void prefetch_page(PageID id) override;
+    virtual void prefetch_pages(const std::vector<PageID>& ids) override;
+
+    /* the kernel writes dirty pages of the mapping back whenever it likes,
+     * the log can not be flushed before them. throws std::invalid_argument */
+    virtual void set_write_ahead_log(WriteAheadLog* log) override;
+
+private:
+    /* pages are created in chunks the first time one of them is used */
+    static constexpr size_t CHUNK_PAGES = 1024;
+
+    std::unique_ptr<HeapFile> heap_file;
+    size_t page_size;
+    size_t max_pages;
+    bool sync_on_flush;
+    int fd;
+    uint8_t* base;
+    size_t mapped_size;
+    size_t system_page_size;
+
+    struct Chunk {
+        Page* pages;
+        /* one bit per page that was fetched or advised */
+        std::atomic<uint64_t> touched[CHUNK_PAGES / 64];
+    };
+
+    size_t num_chunks;
+    std::unique_ptr<std::atomic<Chunk*>[]> chunks;
+
+    Chunk* chunk_for(PageID id);
+    /* returns whether the page was touched before */
+    bool touch(Chunk* chunk, PageID id);
+    /* msync() or madvise() the bytes of pages [first, last) */
+    void sync_range(PageID first, PageID last);
+    void advise_range(PageID first, PageID last);
+};
+
+} // namespace bptree
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef _BPTREE_NODE_SEARCH_H_
+#define _BPTREE_NODE_SEARCH_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+namespace bptree {
+
+enum class SearchKernel {
+    SCALAR,
+    AVX2,
+    AVX512,
+    NEON,
+};
+
+/* the best kernel this CPU supports unless another one is set. setting
+ * one that the CPU cannot run fails */
+SearchKernel node_search_kernel();
+bool set_node_search_kernel(SearchKernel kernel);
+const char* search_kernel_name(SearchKernel kernel);
+
+/* # of keys in keys[0, n) that are less than key, or with upper that are
+ * not greater than key. the keys are compared as signed or unsigned
+ * integers of their width */
+size_t count_keys_before(const uint32_t* keys, size_t n, uint32_t key,
+                         bool upper);
+size_t count_keys_before(const int32_t* keys, size_t n, int32_t key,
+                         bool upper);
+size_t count_keys_before(const uint64_t* keys, size_t n, uint64_t key,
+                         bool upper);
+size_t count_keys_before(const int64_t* keys, size_t n, int64_t key,
+                         bool upper);
+
+/* integer keys ordered by std::less are searched with SIMD compares */
+template <typename K, typename Compare>
+struct is_simd_searchable
+    : std::integral_constant<bool, std::is_integral<K>::value &&
+                                       !std::is_same<K, bool>::value &&
+                                       (sizeof(K) == 4 || sizeof(K) == 8) &&
+                                       std::is_same<Compare, std::less<K>>::value> {
+};
+
+/* branch-free binary search down to a few cache lines, then count the keys
+ * in them with SIMD compares */
+template <typename K>
+size_t simd_bound_index(const K* keys, size_t n, const K& key, bool upper)
+{
+    using Fixed = std::conditional_t<
+        sizeof(K) == 4,
+        std::conditional_t<std::is_signed<K>::value, int32_t, uint32_t>,
+        std::conditional_t<std::is_signed<K>::value, int64_t, uint64_t>>;
+    static constexpr size_t WINDOW = 128 / sizeof(K);
+
+    /* the result is in [base, base + len] */
+    size_t base = 0, len = n;
+    while (len > WINDOW) {
+        size_t half = len / 2;
+        const K& probe = keys[base + half];
+        bool before = upper ? !(key < probe) : probe < key;
+        base = before ? base + half : base;
+        len -= half;
+    }
+
+    return base + count_keys_before(reinterpret_cast<const Fixed*>(keys + base),
+                                    len, (Fixed)key, upper);
+}
+
+/* std::lower_bound/std::upper_bound over keys[0, n) as an index */
+template <typename K, typename Compare>
+size_t lower_bound_index(const K* keys, size_t n, const K& key,
+                         const Compare& cmp)
+{
+    if constexpr (is_simd_searchable<K, Compare>::value) {
+        return simd_bound_index(keys, n, key, false);
+    } else {
+        return std::lower_bound(keys, keys + n, key, cmp) - keys;
+    }
+}
+
+template <typename K, typename Compare>
+size_t upper_bound_index(const K* keys, size_t n, const K& key,
+                         const Compare& cmp)
+{
+    if constexpr (is_simd_searchable<K, Compare>::value) {
+        return simd_bound_index(keys, n, key, true);
+    } else {
+        return std::upper_bound(keys, keys + n, key, cmp) - keys;
+    }
+}
+
+} // namespace bptree
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef _BPTREE_OBJECT_POOL_H_
+#define _BPTREE_OBJECT_POOL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace bptree {
+
+/* memory for objects of type T, carved out of large slabs so that node churn
+ * does not go through the global allocator. every thread caches up to
+ * 2 * BATCH_SIZE free chunks and trades them with a shared free list in
+ * batches of BATCH_SIZE, so the shared lock is taken once per batch. chunks
+ * are cache-line aligned. slabs are only returned when the process exits, the
+ * pool keeps as much memory as there were objects of T at the peak */
+template <typename T> class ObjectPool {
+public:
+    static constexpr size_t BATCH_SIZE = 32;
+    static constexpr size_t SLAB_SIZE = 1 << 20;
+    static constexpr size_t ALIGNMENT = 64;
+
+    static void* allocate()
+    {
+        auto& cache = local_cache();
+
+        if (!cache.head) refill(cache);
+
+        auto* chunk = cache.head;
+        cache.head = chunk->next;
+        cache.count--;
+        return chunk;
+    }
+
+    static void deallocate(void* p)
+    {
+        auto& cache = local_cache();
+        auto* chunk = static_cast<Chunk*>(p);
+
+        chunk->next = cache.head;
+        cache.head = chunk;
+        if (++cache.count >= 2 * BATCH_SIZE) spill(cache, BATCH_SIZE);
+    }
+
+    /* # of slabs allocated so far */
+    static size_t get_num_slabs()
+    {
+        auto& shared = shared_pool();
+        std::lock_guard<std::mutex> guard(shared.mutex);
+        return shared.slabs.size();
+    }
+
+private:
+    struct Chunk {
+        Chunk* next;
+    };
+
+    static constexpr size_t CHUNK_SIZE =
+        (std::max(sizeof(T), sizeof(Chunk)) + ALIGNMENT - 1) / ALIGNMENT *
+        ALIGNMENT;
+    static constexpr size_t CHUNKS_PER_SLAB =
+        CHUNK_SIZE >= SLAB_SIZE ? 1 : SLAB_SIZE / CHUNK_SIZE;
+
+    static_assert(alignof(T) <= ALIGNMENT, "T is over-aligned");
+
+    struct Shared {
+        std::mutex mutex;
+        /* lists of free chunks and their lengths */
+        std::vector<std::pair<Chunk*, size_t>> batches;
+        std::vector<void*> slabs;
+
+        ~Shared()
+        {
+            for (auto* slab : slabs) {
+                ::operator delete(slab, std::align_val_t(ALIGNMENT));
+            }
+        }
+    };
+
+    struct LocalCache {
+        Chunk* head = nullptr;
+        size_t count = 0;
+
+        /* the chunks of an exiting thread go back to the shared list */
+        ~LocalCache()
+        {
+            if (count) spill(*this, count);
+        }
+    };
+
+    /* constructed before any LocalCache so it is destroyed after them */
+    static Shared& shared_pool()
+    {
+        static Shared shared;
+        return shared;
+    }
+
+    static LocalCache& local_cache()
+    {
+        shared_pool();
+        static thread_local LocalCache cache;
+        return cache;
+    }
+
+    static void refill(LocalCache& cache)
+    {
+        auto& shared = shared_pool();
+        std::lock_guard<std::mutex> guard(shared.mutex);
+
+        if (!shared.batches.empty()) {
+            std::tie(cache.head, cache.count) = shared.batches.back();
+            shared.batches.pop_back();
+            return;
+        }
+
+        auto* slab = static_cast<char*>(::operator new(
+            CHUNKS_PER_SLAB * CHUNK_SIZE, std::align_val_t(ALIGNMENT)));
+        shared.slabs.push_back(slab);
+
+        /* the first batch goes to the caller, the rest to the shared list */
+        for (size_t first = 0; first < CHUNKS_PER_SLAB; first += BATCH_SIZE) {
+            size_t last = std::min(first + BATCH_SIZE, CHUNKS_PER_SLAB);
+            Chunk* head = nullptr;
+            for (size_t i = last; i > first; i--) {
+                auto* chunk = reinterpret_cast<Chunk*>(slab + (i - 1) * CHUNK_SIZE);
+                chunk->next = head;
+                head = chunk;
+            }
+
+            if (first == 0) {
+                cache.head = head;
+                cache.count = last;
+            } else {
+                shared.batches.emplace_back(head, last - first);
+            }
+        }
+    }
+
+    /* move n chunks from the cache to the shared list */
+    static void spill(LocalCache& cache, size_t n)
+    {
+        auto* head = cache.head;
+        auto* tail = head;
+        for (size_t i = 1; i < n; i++) {
+            tail = tail->next;
+        }
+        cache.head = tail->next;
+        cache.count -= n;
+        tail->next = nullptr;
+
+        auto& shared = shared_pool();
+        std::lock_guard<std::mutex> guard(shared.mutex);
+        shared.batches.emplace_back(head, n);
+    }
+};
+
+} // namespace bptree
+
+#endif
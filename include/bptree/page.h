@@ -13,21 +13,34 @@ namespace bptree {
 
 typedef uint32_t PageID;
 
+/* hint for the replacement policy of the page cache */
+enum class PagePriority : uint8_t { NORMAL = 0, HIGH = 1 };
+
 class Page : public boost::upgrade_lockable_adapter<boost::shared_mutex> {
 public:
-    static const PageID INVALID_PAGE_ID = 0;
+    static constexpr PageID INVALID_PAGE_ID = 0;
 
-    explicit Page(PageID id, size_t size) : id(id), size(size), dirty(false), pin_count(0)
+    explicit Page(PageID id, size_t size)
+        : id(id), size(size), dirty(false), pin_count(0),
+          priority(PagePriority::NORMAL), lsn(0)
     {
-        buffer = std::make_unique<uint8_t[]>(size);
+        owned_buffer = std::make_unique<uint8_t[]>(size);
+        buffer = owned_buffer.get();
     }
 
+    /* a page whose buffer is owned by someone else, e.g. a frame of a
+     * preallocated buffer pool */
+    Page(PageID id, size_t size, uint8_t* buffer)
+        : id(id), buffer(buffer), size(size), dirty(false), pin_count(0),
+          priority(PagePriority::NORMAL), lsn(0)
+    {}
+
     uint8_t* get_buffer(boost::upgrade_to_unique_lock<Page>&) {
-        return buffer.get();
+        return buffer;
     }
 
     const uint8_t* get_buffer(boost::upgrade_lock<Page>&) {
-        return buffer.get();
+        return buffer;
     }
 
     int32_t pin() { return pin_count.fetch_add(1); }
@@ -37,15 +50,32 @@ public:
     PageID get_id() const { return id; }
     size_t get_size() const { return size; }
 
-    bool is_dirty() const { return dirty; }
-    void set_dirty(bool d) { dirty = d; }
+    bool is_dirty() const { return dirty.load(); }
+    void set_dirty(bool d) { dirty.store(d); }
+
+    PagePriority get_priority() const
+    {
+        return priority.load(std::memory_order_relaxed);
+    }
+    void set_priority(PagePriority p)
+    {
+        priority.store(p, std::memory_order_relaxed);
+    }
+
+    /* LSN of the last log record of the page (see WriteAheadLog), 0 if
+     * it has none */
+    uint64_t get_lsn() const { return lsn.load(std::memory_order_acquire); }
+    void set_lsn(uint64_t l) { lsn.store(l, std::memory_order_release); }
 
 private:
     PageID id;
-    std::unique_ptr<uint8_t[]> buffer;
+    std::unique_ptr<uint8_t[]> owned_buffer;
+    uint8_t* buffer;
     size_t size;
-    bool dirty;
+    std::atomic<bool> dirty;
     std::atomic<int32_t> pin_count;
+    std::atomic<PagePriority> priority;
+    std::atomic<uint64_t> lsn;
     std::mutex mutex;
 };
 
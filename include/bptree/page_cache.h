@@ -5,10 +5,43 @@
 
 namespace bptree {
 
+class HeapFile;
+class WriteAheadLog;
+
+/* fetch_page() hits, misses and evictions, the # of dirty pages, the #
+ * of pages read by prefetches and of those that were fetched afterwards,
+ * and the bytes read from and written to the heap file. a cache reports 0
+ * for what it does not track */
+struct PageCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t dirty_pages = 0;
+    size_t prefetched = 0;
+    size_t prefetch_hits = 0;
+    size_t bytes_read = 0;
+    size_t bytes_written = 0;
+};
+
 class AbstractPageCache {
 public:
+    virtual ~AbstractPageCache() = default;
+
     virtual Page* new_page(boost::upgrade_lock<Page>& lock) = 0;
     virtual Page* fetch_page(PageID id, boost::upgrade_lock<Page>& lock) = 0;
+    /* fetch_page() for log replay. a page that exists but cannot be read
+     * (e.g. its checksum does not match) is returned zeroed with corrupt
+     * set instead of nullptr, so that the replay can rebuild it from an
+     * image or give up. nullptr means the page is not in the file */
+    virtual Page* fetch_page_for_redo(PageID id, boost::upgrade_lock<Page>& lock,
+                                      bool& corrupt)
+    {
+        corrupt = false;
+        return fetch_page(id, lock);
+    }
+    /* give a page back for reuse by new_page(). the page must not be pinned
+     * and must not be fetched again */
+    virtual void free_page(PageID id) = 0;
 
     virtual void pin_page(Page* page, boost::upgrade_lock<Page>&) = 0;
     virtual void unpin_page(Page* page, bool dirty, boost::upgrade_lock<Page>&) = 0;
@@ -21,6 +54,19 @@ public:
 
     virtual void prefetch_page(PageID id) = 0;
     virtual void prefetch_pages(const std::vector<PageID> &ids) = 0;
+
+    /* a cache that writes pages back to a file must flush the log up to a
+     * page's LSN before it writes the page, and must not write pages whose
+     * LSN is WriteAheadLog::PENDING_LSN. nullptr detaches the log. pages
+     * that only live in memory have nothing to do */
+    virtual void set_write_ahead_log(WriteAheadLog*) {}
+
+    /* the heap file that pages are written back to through this cache, for
+     * snapshots of it. nullptr if there is none or pages reach it another
+     * way */
+    virtual HeapFile* get_heap_file() { return nullptr; }
+
+    virtual PageCacheStats get_stats() const { return PageCacheStats{}; }
 };
 
 } // namespace bptree
@@ -0,0 +1,128 @@
+#ifndef _BPTREE_PAGE_RESERVE_H_
+#define _BPTREE_PAGE_RESERVE_H_
+
+#include "bptree/page_cache.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace bptree {
+
+/* pages allocated ahead of time so that splits do not call into the page
+ * cache (and possibly evict a dirty page or grow the heap file) while they
+ * hold node locks. threads are assigned slots round-robin like in
+ * ShardedCounter and each slot keeps a few page IDs of its own */
+class PageReserve {
+public:
+    static constexpr size_t NUM_SLOTS = 32;
+    static constexpr size_t BATCH_SIZE = 8;
+
+    explicit PageReserve(AbstractPageCache* page_cache) : page_cache(page_cache)
+    {}
+
+    ~PageReserve() { release(); }
+
+    PageReserve(const PageReserve&) = delete;
+    PageReserve& operator=(const PageReserve&) = delete;
+
+    /* make sure that the calling thread can take n pages without calling
+     * into the page cache, call it before taking any lock */
+    void reserve(size_t n)
+    {
+        auto& slot = slots[slot_index()];
+
+        while (true) {
+            {
+                std::lock_guard<std::mutex> guard(slot.mutex);
+                if (slot.pages.size() >= n) return;
+            }
+            refill(slot, std::max(n, BATCH_SIZE));
+        }
+    }
+
+    /* a page that nobody else uses. it may have been evicted since it was
+     * reserved so its content is undefined until it is written */
+    PageID take()
+    {
+        auto& slot = slots[slot_index()];
+
+        while (true) {
+            {
+                std::lock_guard<std::mutex> guard(slot.mutex);
+                if (!slot.pages.empty()) {
+                    PageID pid = slot.pages.back();
+                    slot.pages.pop_back();
+                    return pid;
+                }
+            }
+            /* another thread of the slot took the pages reserved for this
+             * one, allocate under whatever locks the caller holds */
+            refill(slot, BATCH_SIZE);
+        }
+    }
+
+    size_t size() const
+    {
+        size_t total = 0;
+        for (auto&& slot : slots) {
+            std::lock_guard<std::mutex> guard(slot.mutex);
+            total += slot.pages.size();
+        }
+        return total;
+    }
+
+    /* give the pages that were not used back to the page cache */
+    void release()
+    {
+        for (auto&& slot : slots) {
+            std::lock_guard<std::mutex> guard(slot.mutex);
+            for (auto pid : slot.pages) {
+                page_cache->free_page(pid);
+            }
+            slot.pages.clear();
+        }
+    }
+
+private:
+    struct alignas(64) Slot {
+        mutable std::mutex mutex;
+        std::vector<PageID> pages;
+    };
+
+    AbstractPageCache* page_cache;
+    std::array<Slot, NUM_SLOTS> slots;
+
+    /* the page cache is called without the slot lock so that the other
+     * threads of the slot are not held up */
+    void refill(Slot& slot, size_t n)
+    {
+        std::vector<PageID> pages;
+        pages.reserve(n);
+
+        for (size_t i = 0; i < n; i++) {
+            boost::upgrade_lock<Page> lock;
+            auto page = page_cache->new_page(lock);
+            pages.push_back(page->get_id());
+            page_cache->unpin_page(page, false, lock);
+        }
+
+        /* taken from the back, lowest page first */
+        std::lock_guard<std::mutex> guard(slot.mutex);
+        slot.pages.insert(slot.pages.end(), pages.rbegin(), pages.rend());
+    }
+
+    static size_t slot_index()
+    {
+        static std::atomic<size_t> next_index{0};
+        static thread_local size_t index = next_index++ % NUM_SLOTS;
+        return index;
+    }
+};
+
+} // namespace bptree
+
+#endif
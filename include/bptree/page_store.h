@@ -0,0 +1,57 @@
+#ifndef _BPTREE_PAGE_STORE_H_
+#define _BPTREE_PAGE_STORE_H_
+
+#include "bptree/page.h"
+
+#include <stdexcept>
+#include <vector>
+
+namespace bptree {
+
+class IOException : public std::runtime_error {
+public:
+    IOException(const char* message) : runtime_error(message) {}
+};
+
+/* a page read or write in a batch. buf must hold get_data_size() bytes and
+ * stay valid (i.e. the page stays locked) until the batch is done */
+struct PageIORequest {
+    PageID pid;
+    uint8_t* buf;
+    bool ok; /* set when the batch is done */
+    uint64_t lsn = 0; /* stored in the page header of a written page */
+};
+
+/* where a HeapPageCache reads its pages from and writes them back to, e.g.
+ * a local HeapFile or a RemotePageStore. page 0 belongs to the store and is
+ * never handed out. errors are reported with IOException */
+class PageStore {
+public:
+    virtual ~PageStore() = default;
+
+    /* # of bytes of a page that hold data */
+    virtual size_t get_data_size() const = 0;
+    /* # of pages in the store, including page 0 */
+    virtual size_t get_num_pages() const = 0;
+
+    /* reuses a freed page if there is one, otherwise grows the store */
+    virtual PageID new_page() = 0;
+    /* its content is lost and the caller must make sure that nobody reads
+     * it any more */
+    virtual void free_page(PageID pid) = 0;
+
+    virtual void read_page(Page* page, boost::upgrade_to_unique_lock<Page>& lock) = 0;
+    virtual void write_page(Page* page, boost::upgrade_lock<Page>& lock) = 0;
+
+    /* batched I/O. requests that fail are marked with ok = false instead of
+     * throwing so that one bad page does not fail the whole batch */
+    virtual void read_pages(std::vector<PageIORequest>& requests) = 0;
+    virtual void write_pages(std::vector<PageIORequest>& requests) = 0;
+
+    /* make the written pages durable */
+    virtual void sync() = 0;
+};
+
+} // namespace bptree
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef _BPTREE_PREFETCHER_H_
+#define _BPTREE_PREFETCHER_H_
+
+#include "bptree/page.h"
+#include "bptree/sharded_counter.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace bptree {
+
+/* issued: pages handed to the page cache to prefetch. useful: those the
+ * tree read before they were forgotten. demand_reads: all pages the tree
+ * read for its nodes. depth and width are the current limits of the
+ * prefetcher */
+struct PrefetchStats {
+    size_t issued;
+    size_t useful;
+    size_t demand_reads;
+    size_t depth;
+    size_t width;
+
+    /* the share of prefetches that were used */
+    double accuracy() const { return issued ? (double)useful / issued : 0.0; }
+    /* the share of reads that a prefetch saw coming */
+    double coverage() const
+    {
+        return demand_reads ? (double)useful / demand_reads : 0.0;
+    }
+};
+
+/* decides what a tree prefetches from its history of accesses. every
+ * thread is a stream whose lookups are tracked as (inner node, child index)
+ * pairs: lookups that keep moving by the same delta (a sequential or
+ * strided pattern) prefetch up to depth children further along that
+ * delta, doubling with every confirming lookup; lookups that stay within
+ * one inner node (a hot subtree) prefetch the width children on each side
+ * of the one they go to; other lookups prefetch nothing. iterators read
+ * ahead on the leaf chain with a window that starts small and doubles up
+ * to depth.
+ *
+ * the prefetched pages are remembered for a while so that the reads of
+ * the tree tell which of them were useful. every WINDOW prefetched pages
+ * the accuracy decides on the limits: below LOW_ACCURACY depth is halved
+ * and width shrinks, above HIGH_ACCURACY they grow again. a prefetcher
+ * that has been throttled so far that it hardly prefetches anything
+ * slowly grows them again to notice when the workload changes */
+class AdaptivePrefetcher {
+public:
+    static constexpr size_t DEFAULT_MAX_DEPTH = 64;
+    static constexpr size_t INITIAL_DEPTH = 8;
+    static constexpr size_t MAX_WIDTH = 2;
+    static constexpr size_t INITIAL_SCAN_WINDOW = 2;
+
+    static constexpr size_t WINDOW = 256;
+    static constexpr double LOW_ACCURACY = 0.25;
+    static constexpr double HIGH_ACCURACY = 0.75;
+
+    explicit AdaptivePrefetcher(size_t max_depth = DEFAULT_MAX_DEPTH);
+
+    AdaptivePrefetcher(const AdaptivePrefetcher&) = delete;
+    AdaptivePrefetcher& operator=(const AdaptivePrefetcher&) = delete;
+
+    /* a disabled prefetcher suggests nothing but still counts reads */
+    void set_enabled(bool enabled) { this->enabled = enabled; }
+    bool is_enabled() const { return enabled; }
+
+    /* a lookup of the calling thread goes to child idx of the inner node
+     * on page parent, which has num_children children. appends the indexes
+     * of the children worth prefetching to child_indexes */
+    void on_lookup(PageID parent, int idx, int num_children,
+                   std::vector<int>& child_indexes);
+
+    /* # of leaves an iterator should prefetch ahead, given the window it
+     * used last time (0 on its first prefetch) */
+    size_t next_scan_window(size_t window) const;
+
+    /* pids are about to be prefetched. drops the ones that are already
+     * waiting to be read and remembers the rest */
+    void on_prefetch(std::vector<PageID>& pids);
+
+    /* the tree reads pid from the page cache */
+    void on_read(PageID pid);
+
+    PrefetchStats get_stats() const;
+
+private:
+    static constexpr size_t NUM_STREAMS = 64;
+    static constexpr size_t NUM_SHARDS = 16;
+    /* # of prefetched pages remembered per shard */
+    static constexpr size_t SHARD_CAPACITY = 256;
+    /* lookups of a stream in between checks of the limits */
+    static constexpr size_t ADJUST_INTERVAL = 256;
+    /* checks without a full window before the limits grow */
+    static constexpr size_t IDLE_CHECKS = 16;
+    /* lookups that stay in an inner node before it counts as hot */
+    static constexpr size_t HOT_LOOKUPS = 2;
+
+    struct alignas(64) Stream {
+        std::mutex mutex;
+        PageID parent = Page::INVALID_PAGE_ID;
+        int idx = 0;
+        int delta = 0;
+        /* # of lookups in a row that moved by delta */
+        size_t run = 0;
+        /* # of lookups in a row that stayed in parent */
+        size_t lookups_in_parent = 0;
+        size_t lookups = 0;
+    };
+
+    /* prefetched pages that have not been read yet, with the sequence
+     * number they were prefetched with so that a page prefetched again
+     * is not forgotten by its old entry */
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<PageID, uint64_t> pending;
+        std::deque<std::pair<PageID, uint64_t>> order;
+    };
+
+    std::atomic<bool> enabled;
+    size_t max_depth;
+    std::atomic<size_t> depth;
+    std::atomic<size_t> width;
+
+    std::array<Stream, NUM_STREAMS> streams;
+    std::array<Shard, NUM_SHARDS> shards;
+    std::atomic<size_t> num_pending;
+    std::atomic<uint64_t> next_seq;
+
+    std::atomic<size_t> num_issued;
+    std::atomic<size_t> num_useful;
+    ShardedCounter num_demand_reads;
+
+    std::mutex adjust_mutex;
+    std::atomic<size_t> window_issued;
+    std::atomic<size_t> window_useful;
+    size_t idle_checks;
+
+    Shard& shard_of(PageID pid) { return shards[pid % NUM_SHARDS]; }
+    /* check the limits against the accuracy of the last window, skipped
+     * if another thread is at it */
+    void adjust();
+    void grow();
+    void shrink();
+};
+
+} // namespace bptree
+
+#endif
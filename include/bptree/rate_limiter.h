@@ -0,0 +1,43 @@
+#ifndef _BPTREE_RATE_LIMITER_H_
+#define _BPTREE_RATE_LIMITER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <thread>
+
+namespace bptree {
+
+/* paces a stream of I/O to bytes_per_second on average. acquire() sleeps
+ * until the bytes transferred so far are within the budget of the time
+ * since the limiter was created. 0 bytes_per_second means no limit */
+class RateLimiter {
+public:
+    explicit RateLimiter(size_t bytes_per_second)
+        : bytes_per_second(bytes_per_second), total_bytes(0),
+          start(std::chrono::steady_clock::now())
+    {}
+
+    void acquire(size_t bytes)
+    {
+        total_bytes += bytes;
+        if (bytes_per_second == 0) return;
+
+        auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                               std::chrono::duration<double>((double)total_bytes /
+                                                             bytes_per_second));
+        if (due > std::chrono::steady_clock::now()) {
+            std::this_thread::sleep_until(due);
+        }
+    }
+
+    size_t get_total_bytes() const { return total_bytes; }
+
+private:
+    size_t bytes_per_second;
+    size_t total_bytes;
+    std::chrono::steady_clock::time_point start;
+};
+
+} // namespace bptree
+
+#endif
@@ -0,0 +1,195 @@
+#ifndef _BPTREE_REMOTE_PAGE_STORE_H_
+#define _BPTREE_REMOTE_PAGE_STORE_H_
+
+#include "bptree/latency_simulator.h"
+#include "bptree/page_store.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace bptree {
+
+/* a connection that carries whole messages in both directions, e.g. over
+ * TCP or an RDMA queue pair. send() is only called by one thread at a time
+ * and so is receive() */
+class PageTransport {
+public:
+    virtual ~PageTransport() = default;
+
+    virtual void send(const std::vector<uint8_t>& message) = 0;
+    /* false once the connection is closed */
+    virtual bool receive(std::vector<uint8_t>& message) = 0;
+    /* make a blocked receive() return false */
+    virtual void close() = 0;
+};
+
+/* messages over a TCP connection, each sent as | length(4 bytes) | bytes | */
+class TcpTransport : public PageTransport {
+public:
+    TcpTransport(std::string_view host, uint16_t port);
+    /* a connection that was accepted */
+    explicit TcpTransport(int fd);
+    ~TcpTransport();
+
+    TcpTransport(const TcpTransport&) = delete;
+    TcpTransport& operator=(const TcpTransport&) = delete;
+
+    virtual void send(const std::vector<uint8_t>& message) override;
+    virtual bool receive(std::vector<uint8_t>& message) override;
+    virtual void close() override;
+
+private:
+    int fd;
+};
+
+/* a PageStore whose pages live in another process, reached through
+ * PageTransports (see PageServer). reads and writes of all threads are
+ * queued per connection and a sender thread packs the queued pages into
+ * one message of up to max_batch_pages pages, so concurrent misses and
+ * prefetches share a round trip. up to max_in_flight messages are sent
+ * ahead of their answers on every connection, which a receiver thread
+ * matches to their callers. a call's pages all go through one
+ * connection, so pages written by a call are read back by later calls
+ * of any thread */
+class RemotePageStore : public PageStore {
+public:
+    RemotePageStore(std::string_view host, uint16_t port,
+                    size_t num_connections = 1, size_t max_batch_pages = 64,
+                    size_t max_in_flight = 8);
+    explicit RemotePageStore(
+        std::vector<std::unique_ptr<PageTransport>> transports,
+        size_t max_batch_pages = 64, size_t max_in_flight = 8);
+    ~RemotePageStore();
+
+    RemotePageStore(const RemotePageStore&) = delete;
+    RemotePageStore& operator=(const RemotePageStore&) = delete;
+
+    virtual size_t get_data_size() const override { return data_size; }
+    /* as of the last answer of the server */
+    virtual size_t get_num_pages() const override { return num_pages.load(); }
+
+    virtual PageID new_page() override;
+    virtual void free_page(PageID pid) override;
+
+    virtual void read_page(Page* page,
+                           boost::upgrade_to_unique_lock<Page>& lock) override;
+    virtual void write_page(Page* page, boost::upgrade_lock<Page>& lock) override;
+    virtual void read_pages(std::vector<PageIORequest>& requests) override;
+    virtual void write_pages(std::vector<PageIORequest>& requests) override;
+
+    virtual void sync() override;
+
+    /* # of messages sent / # of pages read or written with them */
+    size_t get_num_messages() const { return num_messages.load(); }
+    size_t get_num_pages_transferred() const { return num_pages_transferred.load(); }
+
+private:
+    /* the ops of one call, done when remaining reaches 0. value is the
+     * answer of OP_NEW_PAGE and OP_INFO */
+    struct Call {
+        size_t remaining;
+        bool failed;
+        uint64_t value;
+    };
+
+    struct Op {
+        uint32_t opcode;
+        PageIORequest* req;
+        PageID pid;
+        Call* call;
+    };
+
+    struct Connection {
+        std::unique_ptr<PageTransport> transport;
+        std::thread sender;
+        std::thread receiver;
+
+        std::mutex mutex;
+        std::condition_variable send_cv; /* ops queued or a slot freed */
+        std::condition_variable done_cv; /* calls finished */
+        std::deque<Op> queue;
+        std::unordered_map<uint64_t, std::vector<Op>> in_flight;
+        uint64_t next_id;
+        bool broken;
+        bool stop;
+    };
+
+    size_t max_batch_pages;
+    size_t max_in_flight;
+    size_t data_size;
+    std::atomic<size_t> num_pages;
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::atomic<size_t> next_connection;
+
+    std::atomic<size_t> num_messages;
+    std::atomic<size_t> num_pages_transferred;
+
+    void shutdown();
+    /* queue the ops of call on one connection and wait for their answers */
+    void run(std::vector<Op>& ops, Call& call);
+    void sender_main(Connection& conn);
+    void receiver_main(Connection& conn);
+    /* fail the queued and in-flight ops of a connection that is lost, under
+     * its lock */
+    void mark_broken(Connection& conn);
+    /* under the lock of the op's connection */
+    void complete_op(const Op& op, bool ok);
+};
+
+/* serves a PageStore to RemotePageStores over TCP, one reader and one
+ * writer thread per connection. the answer to a request is sent when the
+ * LatencySimulator's link would have delivered it, so a modeled far memory
+ * link (latency, bandwidth and queue depth) applies to the network path
+ * while the server's own I/O of the store is not slowed down */
+class PageServer {
+public:
+    /* port 0 picks a free port, see get_port() */
+    explicit PageServer(PageStore* store, uint16_t port = 0);
+    ~PageServer();
+
+    PageServer(const PageServer&) = delete;
+    PageServer& operator=(const PageServer&) = delete;
+
+    uint16_t get_port() const { return port; }
+
+private:
+    struct Connection {
+        std::unique_ptr<TcpTransport> transport;
+        std::thread reader;
+        std::thread writer;
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        /* answers by the time they are due */
+        std::multimap<LatencySimulator::Clock::time_point, std::vector<uint8_t>>
+            answers;
+        bool closed;
+    };
+
+    PageStore* store;
+    uint16_t port;
+    int listen_fd;
+    std::thread acceptor;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Connection>> connections;
+    bool stop;
+
+    void acceptor_main();
+    void reader_main(Connection& conn);
+    void writer_main(Connection& conn);
+    std::vector<uint8_t> handle(const std::vector<uint8_t>& request);
+};
+
+} // namespace bptree
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _BPTREE_REPLACEMENT_POLICY_H_
+#define _BPTREE_REPLACEMENT_POLICY_H_
+
+#include "bptree/page.h"
+
+#include <cstddef>
+#include <memory>
+
+namespace bptree {
+
+/* LRU moves a page to the head of a list whenever it is unpinned. CLOCK only
+ * sets a reference bit on access. TWO_Q and ARC keep pages that were used
+ * once apart from pages that were used again so that a scan does not push
+ * out the hot set */
+enum class ReplacementPolicyType { LRU, CLOCK, TWO_Q, ARC };
+
+const char* replacement_policy_name(ReplacementPolicyType type);
+
+/* replacement state of a set of num_frames frames, identified by their index
+ * in [0, num_frames). a frame enters the policy with on_load() once it holds
+ * a page and leaves it with evict() or remove(). only evictable frames (i.e.
+ * unpinned ones) are ever chosen as victims. not thread-safe, the owner
+ * serializes all calls */
+class ReplacementPolicy {
+public:
+    virtual ~ReplacementPolicy() {}
+
+    static std::unique_ptr<ReplacementPolicy> create(ReplacementPolicyType type,
+                                                     size_t num_frames);
+
+    /* the frame now holds page id, it is not evictable yet */
+    virtual void on_load(size_t frame, PageID id) = 0;
+    /* the page in the frame was hit in the cache */
+    virtual void on_access(size_t frame) = 0;
+    virtual void set_evictable(size_t frame, bool evictable) = 0;
+
+    /* choose a victim and drop it from the policy, false if every frame is
+     * pinned */
+    virtual bool evict(size_t& frame) = 0;
+    /* drop a frame without treating it as evicted */
+    virtual void remove(size_t frame) = 0;
+
+    /* # of frames in the policy / # of those that are evictable */
+    virtual size_t size() const = 0;
+    virtual size_t num_evictable() const = 0;
+};
+
+} // namespace bptree
+
+#endif
@@ -4,6 +4,8 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <type_traits>
+#include <utility>
 
 namespace bptree {
 
@@ -17,6 +19,18 @@ public:
      * returns number of bytes consumed */
     virtual size_t deserialize(T* begin, T* end, const uint8_t* buf,
                                size_t buf_size) const = 0;
+
+    /* serializers for variable-length elements also provide
+     *
+     *   size_t encoded_size(const T* begin, const T* end) const;
+     *   size_t encoded_size(const T* begin, const T* end, const T& extra) const;
+     *   size_t max_encoded_size() const;
+     *
+     * the exact size that serialize() needs for [begin, end), the same with
+     * extra added to the elements and an upper bound for a single element.
+     * nodes of such serializers are split and merged by bytes. they may also
+     * provide T shorten(const T& left, const T& right) const that returns the
+     * shortest separator s with left < s <= right for left < right */
 };
 
 template <typename T> class CopySerializer {
@@ -38,6 +52,65 @@ public:
     }
 };
 
+/* elements written by CopySerializer take sizeof(T) bytes each at fixed
+ * offsets, so a node can read and write single slots of its page in place
+ * instead of going through the whole array */
+template <typename T, typename Serializer>
+struct is_fixed_stride : std::false_type {};
+
+template <typename T>
+struct is_fixed_stride<T, CopySerializer<T>> : std::is_trivially_copyable<T> {};
+
+template <typename S, typename T, typename = void>
+struct has_encoded_size : std::false_type {};
+
+template <typename S, typename T>
+struct has_encoded_size<
+    S, T,
+    std::void_t<decltype(std::declval<const S&>().encoded_size(
+        std::declval<const T*>(), std::declval<const T*>()))>>
+    : std::true_type {};
+
+template <typename S, typename T, typename = void>
+struct has_shorten : std::false_type {};
+
+template <typename S, typename T>
+struct has_shorten<S, T,
+                   std::void_t<decltype(std::declval<const S&>().shorten(
+                       std::declval<const T&>(), std::declval<const T&>()))>>
+    : std::true_type {};
+
+/* the sizes of the interface above, sizeof(T) per element for serializers
+ * that do not report them */
+template <typename T, typename S>
+size_t encoded_size(const S& ser, const T* begin, const T* end)
+{
+    if constexpr (has_encoded_size<S, T>::value) {
+        return ser.encoded_size(begin, end);
+    } else {
+        return (end - begin) * sizeof(T);
+    }
+}
+
+template <typename T, typename S>
+size_t encoded_size(const S& ser, const T* begin, const T* end, const T& extra)
+{
+    if constexpr (has_encoded_size<S, T>::value) {
+        return ser.encoded_size(begin, end, extra);
+    } else {
+        return (end - begin + 1) * sizeof(T);
+    }
+}
+
+template <typename T, typename S> size_t max_encoded_size(const S& ser)
+{
+    if constexpr (has_encoded_size<S, T>::value) {
+        return ser.max_encoded_size();
+    } else {
+        return sizeof(T);
+    }
+}
+
 } // namespace bptree
 
 #endif
@@ -0,0 +1,65 @@
+#ifndef _BPTREE_SHARDED_COUNTER_H_
+#define _BPTREE_SHARDED_COUNTER_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace bptree {
+
+/* a counter that is split into cache-line sized slots so that concurrent
+ * writers do not bounce the same cache line. each thread updates its own
+ * slot and readers sum all slots */
+class ShardedCounter {
+public:
+    static constexpr size_t NUM_SLOTS = 32;
+
+    ShardedCounter() { store(0); }
+
+    /* returns the value of the calling thread's slot after the update */
+    int64_t add(int64_t delta)
+    {
+        return slots[slot_index()].value.fetch_add(delta,
+                                                   std::memory_order_relaxed) +
+               delta;
+    }
+
+    int64_t load() const
+    {
+        int64_t sum = 0;
+        for (auto&& slot : slots) {
+            sum += slot.value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    /* not linearizable with concurrent add(), only use it when there is no
+     * writer, e.g. on initialization */
+    void store(int64_t value)
+    {
+        for (auto&& slot : slots) {
+            slot.value.store(0, std::memory_order_relaxed);
+        }
+        slots[0].value.store(value, std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<int64_t> value;
+    };
+
+    std::array<Slot, NUM_SLOTS> slots;
+
+    /* threads are assigned slots round-robin on first use */
+    static size_t slot_index()
+    {
+        static std::atomic<size_t> next_index{0};
+        static thread_local size_t index = next_index++ % NUM_SLOTS;
+        return index;
+    }
+};
+
+} // namespace bptree
+
+#endif
@@ -1,25 +1,198 @@
 #ifndef _BPTREE_TREE_H_
 #define _BPTREE_TREE_H_
 
+#include "bptree/epoch.h"
+#include "bptree/insert_buffer.h"
+#include "bptree/metrics.h"
 #include "bptree/page_cache.h"
+#include "bptree/page_reserve.h"
+#include "bptree/page_store.h"
+#include "bptree/prefetcher.h"
+#include "bptree/sharded_counter.h"
 #include "bptree/tree_node.h"
+#include "bptree/wal.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include <utility>
 
 namespace bptree {
 
+/* the largest fan-outs whose nodes fit in a page of PageSize bytes with the
+ * fixed-stride layout of CopySerializer. a leaf page is
+ * | tag | size | next leaf | keys | values | and an inner page is
+ * | tag | size | keys | child pages |, both with one key less than the
+ * fan-out */
+template <size_t PageSize, typename K, typename V> struct PageFit {
+    static constexpr size_t LEAF_HEADER_SIZE = 2 * sizeof(uint32_t) + sizeof(PageID);
+    static constexpr size_t INNER_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+    /* splits need at least a few slots per node */
+    static constexpr size_t MIN_FANOUT = 4;
+
+    static_assert(PageSize >= LEAF_HEADER_SIZE +
+                                  (MIN_FANOUT - 1) * (sizeof(K) + sizeof(V)),
+                  "a page cannot hold a leaf with a useful fan-out");
+    static_assert(PageSize >= INNER_HEADER_SIZE + (MIN_FANOUT - 1) * sizeof(K) +
+                                  MIN_FANOUT * sizeof(PageID),
+                  "a page cannot hold an inner node with a useful fan-out");
+
+    static constexpr unsigned int LEAF_FANOUT =
+        (PageSize - LEAF_HEADER_SIZE) / (sizeof(K) + sizeof(V)) + 1;
+    static constexpr unsigned int INNER_FANOUT =
+        (PageSize - INNER_HEADER_SIZE + sizeof(K)) / (sizeof(K) + sizeof(PageID));
+};
+
+/* # of times operations started over from the root because a concurrent
+ * writer changed or locked a node on their path */
+struct RestartStats {
+    size_t reads; /* get_value(), multi_get() and iterators */
+    size_t inserts;
+    size_t erases;
+};
+
+/* what a tree has been up to, see BTree::get_metrics(). splits and merges
+ * are counted per node. get_value and insert time whole calls, scan times
+ * an iterator finding its first leaf or moving on to the next one. the
+ * counters and histograms that are only kept with metrics read as 0
+ * without them (see metrics.h) */
+struct TreeMetrics {
+    RestartStats restarts;
+    size_t splits;
+    size_t merges;
+    size_t appends;
+    size_t cached_nodes;
+    size_t node_evictions;
+    PrefetchStats prefetch;
+    PageCacheStats page_cache;
+    HistogramSnapshot get_value_latency;
+    HistogramSnapshot insert_latency;
+    HistogramSnapshot scan_latency;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const TreeMetrics& m)
+{
+    os << "restarts: reads " << m.restarts.reads << " inserts "
+       << m.restarts.inserts << " erases " << m.restarts.erases << "\n"
+       << "nodes: splits " << m.splits << " merges " << m.merges << " appends "
+       << m.appends << " cached " << m.cached_nodes << " evicted "
+       << m.node_evictions << "\n"
+       << "prefetch: issued " << m.prefetch.issued << " useful "
+       << m.prefetch.useful << " accuracy " << m.prefetch.accuracy()
+       << " coverage " << m.prefetch.coverage() << "\n"
+       << "page cache: hits " << m.page_cache.hits << " misses "
+       << m.page_cache.misses << " evictions " << m.page_cache.evictions
+       << " dirty " << m.page_cache.dirty_pages << " prefetched "
+       << m.page_cache.prefetched << " prefetch hits "
+       << m.page_cache.prefetch_hits << " bytes read "
+       << m.page_cache.bytes_read << " bytes written "
+       << m.page_cache.bytes_written << "\n"
+       << "get_value: " << m.get_value_latency << "\n"
+       << "insert: " << m.insert_latency << "\n"
+       << "scan: " << m.scan_latency << "\n";
+    return os;
+}
+
+/* N is the fan-out of inner nodes and LeafN the one of leaves */
 template <unsigned int N, typename K, typename V,
           typename KeySerializer = CopySerializer<K>,
           typename KeyComparator = std::less<K>,
           typename KeyEq = std::equal_to<K>,
-          typename ValueSerializer = CopySerializer<V>>
+          typename ValueSerializer = CopySerializer<V>,
+          unsigned int LeafN = N>
 class BTree {
+    static_assert(N >= 4 && LeafN >= 4, "fan-outs must be at least 4");
+
 public:
-    BTree(AbstractPageCache* page_cache) : page_cache(page_cache)
+    /* the metadata (root page ID and number of pairs) is kept in memory and
+     * written to the meta page when the root changes, on checkpoint() and
+     * after every metadata_commit_interval inserts of a thread */
+    static constexpr size_t DEFAULT_METADATA_COMMIT_INTERVAL = 1024;
+
+    /* bulk_load() sorts unsorted input in runs of this many pairs, runs are
+     * spilled to temporary files and merged when there is more than one */
+    static constexpr size_t BULK_LOAD_RUN_SIZE = 1 << 20;
+
+    /* how long a buffered insert waits for its batch to fill up */
+    static constexpr std::chrono::microseconds DEFAULT_INSERT_BUFFER_DELAY{1000};
+
+    /* with max_cached_nodes > 0, at most about that many deserialized nodes
+     * are kept in memory. the least recently used ones are dropped and read
+     * back from the page cache on the next access.
+     *
+     * with a write-ahead log, every page write is logged and the page cache
+     * only writes a page back after its log records are durable. the page
+     * writes of a split or a merge go into the log as one batch, so a crash
+     * never leaves half of one in the tree. the log is replayed here before
+     * the tree is read and truncated by checkpoint(). with a sync_commit
+     * log, insert(), erase() and bulk_load() return once their changes are
+     * durable, concurrent ones share an fdatasync(). the log must outlive
+     * the tree */
+    BTree(AbstractPageCache* page_cache,
+          size_t metadata_commit_interval = DEFAULT_METADATA_COMMIT_INTERVAL,
+          size_t max_cached_nodes = 0, WriteAheadLog* log = nullptr)
+        : page_cache(page_cache), log(log), pages(page_cache), num_nodes(0),
+          num_node_evictions(0),
+          metadata_commit_interval(std::max<size_t>(1, metadata_commit_interval)),
+          max_cached_nodes(max_cached_nodes)
     {
+        /* nodes of variable-length serializers are split by bytes and must
+         * hold a few elements of the largest size. other serializers are
+         * handed the page size and have to check it themselves */
+        size_t capacity = get_node_capacity();
+        if constexpr (LeafNodeType::VARIABLE_SIZE) {
+            if (2 * sizeof(uint32_t) + 4 * (max_encoded_size<K>(KeySerializer{}) +
+                                            max_encoded_size<V>(ValueSerializer{})) >
+                capacity) {
+                throw std::invalid_argument("leaf nodes do not fit in a page");
+            }
+        } else if constexpr (LeafNodeType::FIXED_STRIDE) {
+            if (sizeof(uint32_t) + LeafNodeType::MAX_SERIALIZED_SIZE >
+                page_cache->get_page_size()) {
+                throw std::invalid_argument("leaf nodes do not fit in a page");
+            }
+        }
+        if constexpr (InnerNodeType::VARIABLE_SIZE) {
+            if (sizeof(uint32_t) + 4 * max_encoded_size<K>(KeySerializer{}) +
+                    5 * sizeof(PageID) >
+                capacity) {
+                throw std::invalid_argument("inner nodes do not fit in a page");
+            }
+        } else if constexpr (InnerNodeType::FIXED_STRIDE) {
+            if (sizeof(uint32_t) + InnerNodeType::MAX_SERIALIZED_SIZE >
+                page_cache->get_page_size()) {
+                throw std::invalid_argument("inner nodes do not fit in a page");
+            }
+        }
+
+        size_t num_replayed = 0;
+        if (log) {
+            page_cache->set_write_ahead_log(log);
+            num_replayed = replay_log();
+        }
+
         bool create = !read_metadata();
 
+        if (num_replayed > 0 && !create) {
+            /* the pair count is only written every metadata_commit_interval
+             * inserts, count the pairs of the recovered leaves instead */
+            num_pairs.store(count_leaf_pairs());
+            checkpoint();
+        }
+
         if (create) {
             {
                 boost::upgrade_lock<Page> lock;
@@ -27,16 +200,198 @@ public:
                 assert(page->get_id() == META_PAGE_ID);
             }
 
-            root = create_node<LeafNode<N, K, V, KeySerializer, KeyComparator,
-                                        KeyEq, ValueSerializer>>(nullptr);
+            /* iterators start from the leftmost leaf at the first node
+             * page, so it is not taken from the reserve */
+            PageID root_page;
+            {
+                boost::upgrade_lock<Page> lock;
+                auto page = page_cache->new_page(lock);
+                root_page = page->get_id();
+                page_cache->unpin_page(page, false, lock);
+            }
+            assert(root_page == FIRST_NODE_PAGE_ID);
+
+            root = std::make_unique<LeafNodeType>(this, nullptr, root_page);
+            root_pid.store(root->get_pid());
             num_pairs.store(0);
+            write_node(root.get());
             write_metadata();
+            commit_log();
+        }
+    }
+
+    ~BTree()
+    {
+        flush();
+        /* stop the drainer before the tree goes away */
+        insert_buffer.reset();
+        /* nobody can be in an epoch any more */
+        epochs.drain();
+        pages.release();
+        write_metadata();
+
+        if (log) {
+            /* leave nothing to replay for the next open */
+            checkpoint();
+            page_cache->set_write_ahead_log(nullptr);
+        }
+    }
+
+    /* pairs in the insert buffer are not counted until they are drained */
+    size_t size() const { return (size_t)num_pairs.load(); }
+
+    /* # of deserialized nodes in memory and # of nodes dropped to stay
+     * within max_cached_nodes */
+    size_t get_num_cached_nodes() const { return (size_t)num_nodes.load(); }
+    size_t get_num_node_evictions() const { return num_node_evictions.load(); }
+
+    /* # of inserts that were appended to the rightmost leaf directly */
+    size_t get_num_appends() const { return (size_t)num_appends.load(); }
+
+    RestartStats get_restart_stats() const
+    {
+        return RestartStats{(size_t)read_restarts.load(),
+                            (size_t)insert_restarts.load(),
+                            (size_t)erase_restarts.load()};
+    }
+
+    /* what the prefetches of lookups and iterators were good for, see
+     * AdaptivePrefetcher. multi_get() prefetches the pages it is going to
+     * read for sure and is not counted */
+    PrefetchStats get_prefetch_stats() const { return prefetcher.get_stats(); }
+
+    /* lookups and iterators prefetch nothing while it is off */
+    void set_prefetching(bool enabled) { prefetcher.set_enabled(enabled); }
+
+    /* the counters of the tree and its page cache and the latency
+     * histograms, added up over all threads when called */
+    TreeMetrics get_metrics() const
+    {
+        TreeMetrics m;
+        m.restarts = get_restart_stats();
+        m.splits = num_splits.load();
+        m.merges = num_merges.load();
+        m.appends = get_num_appends();
+        m.cached_nodes = get_num_cached_nodes();
+        m.node_evictions = get_num_node_evictions();
+        m.prefetch = get_prefetch_stats();
+        m.page_cache = page_cache->get_stats();
+        m.get_value_latency = get_value_latency.snapshot();
+        m.insert_latency = insert_latency.snapshot();
+        m.scan_latency = scan_latency.snapshot();
+        return m;
+    }
+
+    /* with batch_size > 1, insert() adds pairs to a buffer instead of the
+     * tree. each thread's pairs are applied as a sorted run once batch_size
+     * of them are buffered or the oldest is older than max_delay, so that
+     * a leaf gets all pairs of the run that belong to it with one lock and
+     * one write. the age is also checked by a background drainer every
+     * max_delay / 2, a thread that stops inserting has its pairs applied
+     * within about 1.5 * max_delay. get_value() and erase() see the
+     * buffered pairs, multi_get() and iterators only see them once they
+     * are applied or after flush(). a batch_size of 1 or less turns the
+     * buffer off. must not be called concurrently with other operations */
+    void set_insert_buffer(size_t batch_size, std::chrono::microseconds max_delay =
+                                                  DEFAULT_INSERT_BUFFER_DELAY)
+    {
+        flush();
+        if (batch_size > 1) {
+            insert_buffer = std::make_unique<InsertBuffer<K, V, KeyComparator>>(
+                batch_size, max_delay,
+                [this](const K* keys, const V* values, size_t n) {
+                    insert_run(keys, values, n);
+                });
+        } else {
+            insert_buffer.reset();
+        }
+    }
+
+    /* apply all buffered pairs to the tree */
+    void flush()
+    {
+        if (!insert_buffer) return;
+        insert_buffer->flush();
+    }
+
+    /* # of pairs in the insert buffer */
+    size_t get_num_buffered() const
+    {
+        return insert_buffer ? insert_buffer->size() : 0;
+    }
+
+    /* persist the metadata and write back all dirty pages, buffered pairs
+     * are applied first. the log records of the pages that were written
+     * back are dropped */
+    void checkpoint()
+    {
+        flush();
+        write_metadata();
+
+        if (!log) {
+            page_cache->flush_all_pages();
+            return;
         }
+
+        /* records appended after this are kept, their pages may have been
+         * written back before them */
+        auto lsn = log->get_end_lsn();
+        page_cache->flush_all_pages();
+        log->truncate(lsn);
     }
 
-    ~BTree() { write_metadata(); }
+    WriteAheadLog* get_write_ahead_log() const { return log; }
+
+    /* write a copy of the tree to heap_filename and log_filename while
+     * inserts and erases go on. the dirty pages are written back first,
+     * then the heap file is copied from a copy-on-write snapshot and the
+     * log from the checkpoint up to the snapshot. opening the copy with its
+     * log replays the log to the state of the snapshot. reads of the copy
+     * are paced to max_bytes_per_second (0 means no limit). needs a
+     * write-ahead log and a page cache with a heap file. returns the # of
+     * bytes written */
+    size_t backup(std::string_view heap_filename, std::string_view log_filename,
+                  size_t max_bytes_per_second = 0)
+    {
+        auto* heap_file = page_cache->get_heap_file();
+        if (!log || !heap_file) {
+            throw std::invalid_argument(
+                "backups need a write-ahead log and a heap file");
+        }
+
+        struct Retained {
+            WriteAheadLog* log;
+            ~Retained() { log->release(); }
+        };
+        log->retain();
+        Retained retained{log};
+
+        /* every page in the file is at least as new as first_lsn after the
+         * write-back. the metadata is logged after it so that the copy
+         * always replays something and recounts its pairs */
+        auto first_lsn = log->get_end_lsn();
+        write_metadata();
+        page_cache->flush_all_pages();
+
+        /* the pages in the file are never ahead of the durable log, what
+         * is written after the snapshot began is copied on write. the LSN is
+         * taken before any page of the log after it can be allocated */
+        uint64_t last_lsn;
+        heap_file->begin_snapshot([&]() { last_lsn = log->get_durable_lsn(); });
+
+        RateLimiter limiter(max_bytes_per_second);
+        size_t nbytes;
+        try {
+            nbytes = heap_file->write_snapshot(heap_filename, limiter);
+        } catch (...) {
+            heap_file->end_snapshot();
+            throw;
+        }
+        heap_file->end_snapshot();
 
-    size_t size() const { return num_pairs.load(); }
+        return nbytes + log->write_frames(log_filename, first_lsn, last_lsn,
+                                          limiter);
+    }
 
     template <
         typename T,
@@ -44,152 +399,294 @@ public:
             BaseNode<K, V, KeyComparator, KeyEq>, T>::value>::type* = nullptr>
     std::unique_ptr<T> create_node(BaseNode<K, V, KeyComparator, KeyEq>* parent)
     {
-        boost::upgrade_lock<Page> lock;
-        auto page = page_cache->new_page(lock);
-        auto node = std::make_unique<T>(this, parent, page->get_id());
-        page_cache->unpin_page(page, false, lock);
-
-        return node;
+        return std::make_unique<T>(this, parent, pages.take());
     }
 
-    // Helper method to prefetch nodes along a search path
+    /* called by splits before they take their lock, and by the new root
+     * above a root that split. each needs one page */
+    void reserve_split_pages() { pages.reserve(1); }
+
+    /* let the prefetcher see the lookup of key and prefetch the children
+     * it suggests of the last inner node in memory on the path. the slots
+     * are read once, they may be reset concurrently */
     void prefetch_search_path(const K& key) {
+        if (!prefetcher.is_enabled()) return;
+
+        InnerNodeType* parent = nullptr;
+        int child_idx = 0;
         auto* node = root.get();
-        std::vector<PageID> pages_to_prefetch;
-        
         while (node && !node->is_leaf()) {
-            auto* inner_node = static_cast<InnerNode<N, K, V, KeySerializer, KeyComparator, KeyEq, ValueSerializer>*>(node);
-            
-            // Find the child index for this key
-            int child_idx = std::distance(
-                inner_node->keys.begin(),
-                std::upper_bound(inner_node->keys.begin(), 
-                                inner_node->keys.begin() + inner_node->get_size(),
-                                key, 
-                                inner_node->kcmp)
-            );
-            
-            // Prefetch this child
-            if (inner_node->child_pages[child_idx] != Page::INVALID_PAGE_ID) {
-                pages_to_prefetch.push_back(inner_node->child_pages[child_idx]);
-            }
-            
-            // Also prefetch siblings if available - this helps with range scans
-            if (child_idx > 0 && inner_node->child_pages[child_idx-1] != Page::INVALID_PAGE_ID) {
-                pages_to_prefetch.push_back(inner_node->child_pages[child_idx-1]);
-            }
-            
-            if (child_idx < inner_node->get_size() && 
-                inner_node->child_pages[child_idx+1] != Page::INVALID_PAGE_ID) {
-                pages_to_prefetch.push_back(inner_node->child_pages[child_idx+1]);
-            }
-            
-            // Move to the next node in the path
-            if (inner_node->child_cache[child_idx]) {
-                node = inner_node->child_cache[child_idx].get();
-            } else {
-                break; // We can't continue the path prediction
-            }
+            parent = static_cast<InnerNodeType*>(node);
+            child_idx = child_index(parent, key);
+            node = parent->child_cache[child_idx].get();
         }
-        
-        // Request prefetch for all identified pages
-        if (!pages_to_prefetch.empty()) {
-            page_cache->prefetch_pages(pages_to_prefetch);
+        if (!parent) return;
+
+        std::vector<int> child_indexes;
+        prefetcher.on_lookup(parent->get_pid(), child_idx,
+                             parent->get_size() + 1, child_indexes);
+
+        std::vector<PageID> pages_to_prefetch;
+        for (int i : child_indexes) {
+            if (!parent->child_cache[i].get() &&
+                parent->child_pages[i] != Page::INVALID_PAGE_ID) {
+                pages_to_prefetch.push_back(parent->child_pages[i]);
+            }
         }
+
+        prefetch(pages_to_prefetch);
     }
 
     void get_value(const K& key, std::vector<V>& value_list)
     {
-        prefetch_search_path(key);
+        LatencyTimer timer(get_value_latency);
+        if (insert_buffer) {
+            insert_buffer->get_values(
+                key, value_list,
+                [this, &key](std::vector<V>& values) { lookup(key, values); });
+            return;
+        }
+        lookup(key, value_list);
+    }
 
+    void collect_values(const K& key, PageID* next_leaf,
+                        std::vector<K>& key_list, std::vector<V>& value_list)
+    {
+        check_node_budget();
+        EpochManager::Guard guard(&epochs);
+        RestartBackoff backoff;
         while (true) {
-            try {
-                value_list.clear();
-                auto* root_node = root.get();
-                root_node->get_values(key, false, nullptr, nullptr, value_list,
-                                      0);
-                if (root_node != root.get()) continue;
-                break;
-            } catch (OLCRestart&) {
-                continue;
+            bool need_restart = false;
+            key_list.clear();
+            value_list.clear();
+            auto* root_node = root.get();
+            root_node->get_values(key, true, next_leaf, &key_list, value_list, 0,
+                                  need_restart);
+            if (!need_restart && root_node == root.get()) break;
+            restarted(read_restarts, backoff);
+        }
+    }
+
+    /* look up a batch of keys with a single descent that is shared by all
+     * keys. the values of keys[i] are stored in values[offsets[i]] ..
+     * values[offsets[i + 1] - 1], both outputs are owned by the caller so
+     * that they can be reused across batches */
+    void multi_get(const K* keys, size_t num_keys, std::vector<V>& values,
+                   std::vector<size_t>& offsets)
+    {
+        check_node_budget();
+        EpochManager::Guard guard(&epochs);
+        MultiGetBatch batch;
+        batch.keys = keys;
+        batch.order.resize(num_keys);
+        for (size_t i = 0; i < num_keys; i++) {
+            batch.order[i] = i;
+        }
+        KeyComparator kcmp;
+        std::stable_sort(batch.order.begin(), batch.order.end(),
+                         [keys, &kcmp](size_t a, size_t b) {
+                             return kcmp(keys[a], keys[b]);
+                         });
+        batch.offsets.assign(num_keys + 1, 0);
+        batch.done = 0;
+
+        /* start reading every leaf of the batch before touching any */
+        prefetch_batch(batch);
+
+        RestartBackoff backoff;
+        while (batch.done < num_keys) {
+            /* drop the results of a leaf that was not validated */
+            batch.values.resize(batch.offsets[batch.done]);
+            if (!multi_get_node(root.get(), batch, batch.done, num_keys, 0)) {
+                restarted(read_restarts, backoff);
             }
         }
+
+        /* the batch was processed in key order, restore the caller's */
+        values.clear();
+        offsets.resize(num_keys + 1);
+        std::vector<size_t> rank(num_keys);
+        for (size_t p = 0; p < num_keys; p++) {
+            rank[batch.order[p]] = p;
+        }
+        for (size_t i = 0; i < num_keys; i++) {
+            auto p = rank[i];
+            offsets[i] = values.size();
+            values.insert(values.end(), batch.values.begin() + batch.offsets[p],
+                          batch.values.begin() + batch.offsets[p + 1]);
+        }
+        offsets[num_keys] = values.size();
     }
 
-    void collect_values(const K& key, std::optional<K>* next_key,
-                        std::vector<K>& key_list, std::vector<V>& value_list)
+    void multi_get(const std::vector<K>& keys, std::vector<V>& values,
+                   std::vector<size_t>& offsets)
     {
-        while (true) {
-            try {
-                key_list.clear();
-                value_list.clear();
-                auto* root_node = root.get();
-                root_node->get_values(key, true, next_key, &key_list,
-                                      value_list, 0);
-                if (root_node != root.get()) continue;
-                break;
-            } catch (OLCRestart&) {
-                continue;
+        multi_get(keys.data(), keys.size(), values, offsets);
+    }
+
+    /* scan the pairs with keys in [lo, hi) with num_threads threads, the
+     * calling thread being one of them. the range is split into partitions
+     * at separator keys of the inner nodes and the threads take partitions
+     * until none are left, reading ahead on the leaf chain like iterators.
+     * callback(const K* keys, const V* values, size_t n) is called with the
+     * pairs of a leaf that are in the range, concurrently from all threads.
+     * the spans of a partition come in key order, the partitions in no
+     * particular order. like iterators, scans do not see pairs that are
+     * still in the insert buffer. an exception thrown by callback stops the
+     * scan and is rethrown once all threads are done */
+    template <typename Callback>
+    void parallel_scan(const K& lo, const K& hi, size_t num_threads,
+                       Callback&& callback)
+    {
+        auto bounds = partition_range(lo, hi, num_threads);
+        run_partitions(bounds.size() - 1, num_threads, [&](size_t p) {
+            scan_partition(bounds[p], bounds[p + 1], callback);
+        });
+    }
+
+    /* fold the pairs with keys in [lo, hi) like parallel_scan(). every
+     * partition starts from init, which must be an identity of combine,
+     * and fold(T& acc, const K* keys, const V* values, size_t n) adds the
+     * spans of its leaves to it. the results of the partitions are then
+     * combined in key order */
+    template <typename T, typename Fold, typename Combine>
+    T reduce_range(const K& lo, const K& hi, size_t num_threads, T init,
+                   Fold&& fold, Combine&& combine)
+    {
+        auto bounds = partition_range(lo, hi, num_threads);
+        std::vector<T> results(bounds.size() - 1, init);
+        run_partitions(results.size(), num_threads, [&](size_t p) {
+            auto& acc = results[p];
+            auto fold_leaf = [&acc, &fold](const K* keys, const V* values,
+                                           size_t n) { fold(acc, keys, values, n); };
+            scan_partition(bounds[p], bounds[p + 1], fold_leaf);
+        });
+
+        T result = init;
+        for (auto&& r : results) {
+            result = combine(std::move(result), std::move(r));
+        }
+        return result;
+    }
+
+    /* # of pairs with keys in [lo, hi) */
+    size_t count_range(const K& lo, const K& hi, size_t num_threads = 1)
+    {
+        return reduce_range(
+            lo, hi, num_threads, (size_t)0,
+            [](size_t& acc, const K*, const V*, size_t n) { acc += n; },
+            std::plus<size_t>());
+    }
+
+    /* build the tree bottom-up from a sequence of key-value pairs (anything
+     * with first and second, e.g. std::pair<K, V>). leaves and inner nodes
+     * are packed to fill_factor of their capacity and written once, in page
+     * ID order. sorted input is loaded in a single pass, unsorted input is
+     * sorted first with an external merge sort. the tree must be empty and
+     * must not be accessed concurrently, returns false if it is not empty.
+     * buffered pairs count as pairs of the tree */
+    template <typename Iterator>
+    bool bulk_load(Iterator first, Iterator last, double fill_factor = 1.0)
+    {
+        flush();
+        if (size() != 0) return false;
+
+        /* the loader builds the tree without locks. the buffer is set aside
+         * for the load so that its drainer cannot apply a run to the tree
+         * being built */
+        struct BufferAside {
+            std::unique_ptr<InsertBuffer<K, V, KeyComparator>>& slot;
+            std::unique_ptr<InsertBuffer<K, V, KeyComparator>> buffer;
+            ~BufferAside() { slot = std::move(buffer); }
+        };
+        BufferAside aside{insert_buffer, std::move(insert_buffer)};
+
+        BulkLoader loader(this, fill_factor);
+        KeyComparator kcmp;
+        auto key_less = [&kcmp](const auto& a, const auto& b) {
+            return kcmp(a.first, b.first);
+        };
+
+        if (std::is_sorted(first, last, key_less)) {
+            for (; first != last; ++first) {
+                loader.add(first->first, first->second);
             }
+        } else {
+            external_sort(first, last, loader);
         }
+
+        loader.finish();
+        commit_log();
+        return true;
     }
 
+    /* keys that are not less than any key in the tree (e.g. time-ordered
+     * IDs) are appended to the rightmost leaf without a descent when it is
+     * in memory and has room */
     void insert(const K& key, const V& value)
     {
-        while (true) {
-            try {
-                K split_key;
-                auto old_root = root.get();
-                if (!old_root)
-                    continue; /* old_root may be nullptr when another thread is
-                                 updating the root node pointer */
-
-                auto root_sibling = old_root->insert(key, value, split_key, 0);
-
-                if (root_sibling) {
-                    auto new_root =
-                        create_node<InnerNode<N, K, V, KeySerializer,
-                                              KeyComparator, KeyEq>>(nullptr);
-
-                    root->set_parent(new_root.get());
-                    root_sibling->set_parent(new_root.get());
-
-                    new_root->set_size(1);
-                    new_root->keys[0] = split_key;
-                    new_root->child_pages[0] = root->get_pid();
-                    new_root->child_pages[1] = root_sibling->get_pid();
-                    new_root->child_cache[0] = std::move(root);
-                    new_root->child_cache[1] = std::move(root_sibling);
-
-                    root = std::move(new_root);
-                    write_node(root.get());
-                    write_metadata();
-
-                    /* release the lock on the old root */
-                    old_root->write_unlock();
-                    continue;
-                }
+        LatencyTimer timer(insert_latency);
+        if (insert_buffer) {
+            insert_buffer->insert(key, value);
+            return;
+        }
 
-                num_pairs++;
-                write_metadata();
-                break;
-            } catch (OLCRestart&) {
-                continue;
-            }
+        check_node_budget();
+        EpochManager::Guard guard(&epochs);
+
+        auto* last_leaf = rightmost_leaf.load(std::memory_order_acquire);
+        if (last_leaf && last_leaf->append(key, value)) {
+            num_appends.add(1);
+            inserted(1);
+            commit_log();
+            return;
         }
+
+        insert_pairs(&key, &value, 1);
+        commit_log();
     }
 
-    void print(std::ostream& os) const
+    /* insert n pairs sorted by key, the ones that go into the same leaf
+     * are inserted together */
+    void insert_run(const K* keys, const V* values, size_t n)
     {
+        {
+            check_node_budget();
+            EpochManager::Guard guard(&epochs);
+            insert_pairs(keys, values, n);
+        }
+        commit_log();
+    }
+
+    /* remove all pairs of key, returns the # of pairs removed. nodes that
+     * underflow are merged with or refilled from a sibling on the way down
+     * and the pages of merged nodes are freed once no reader can reach
+     * them any more */
+    size_t erase(const K& key) { return erase_pairs(key, nullptr); }
+    /* remove the pairs of key whose value equals value */
+    size_t erase(const K& key, const V& value)
+    {
+        return erase_pairs(key, &value);
+    }
+
+    /* for debug purpose. nodes that are not in memory are read, each read
+     * restarts the walk */
+    void print(std::ostream& os)
+    {
+        EpochManager::Guard guard(&epochs);
+        RestartBackoff backoff;
         while (true) {
-            try {
-                root->print(os, "");
+            bool need_restart = false;
+            std::stringstream ss;
+            auto* root_node = root.get();
+            root_node->print(ss, "", need_restart);
+            if (!need_restart && root_node == root.get()) {
+                os << ss.str();
                 break;
-            } catch (OLCRestart&) {
-                continue;
             }
+            restarted(read_restarts, backoff);
         }
-    } /* for debug purpose */
+    }
     friend std::ostream& operator<<(std::ostream& os, BTree& tree)
     {
         tree.print(os);
@@ -200,6 +697,7 @@ public:
     read_node(BaseNode<K, V, KeyComparator, KeyEq>* parent, PageID pid)
     {
         boost::upgrade_lock<Page> lock;
+        prefetcher.on_read(pid);
         auto page = page_cache->fetch_page(pid, lock);
 
         if (!page) {
@@ -210,15 +708,25 @@ public:
         uint32_t tag = *reinterpret_cast<const uint32_t*>(buf);
         std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>> node;
 
+        /* inner nodes are on every search path, ask the page cache to keep
+         * them longer than leaves */
+        page->set_priority(tag == INNER_TAG ? PagePriority::HIGH
+                                            : PagePriority::NORMAL);
+
         if (tag == INNER_TAG) {
             node = std::make_unique<InnerNode<
-                N, K, V, KeySerializer, KeyComparator, KeyEq, ValueSerializer>>(
+                N, K, V, KeySerializer, KeyComparator, KeyEq, ValueSerializer,
+                LeafN>>(
                 this, parent, pid);
         } else if (tag == LEAF_TAG) {
             node =
                 std::make_unique<LeafNode<N, K, V, KeySerializer, KeyComparator,
-                                          KeyEq, ValueSerializer>>(this, parent,
+                                          KeyEq, ValueSerializer, LeafN>>(this, parent,
                                                                    pid);
+        } else {
+            /* the page was never written */
+            page_cache->unpin_page(page, false, lock);
+            return nullptr;
         }
 
         node->deserialize(&buf[sizeof(uint32_t)],
@@ -228,30 +736,406 @@ public:
         return node;
     }
 
-    void write_node(const BaseNode<K, V, KeyComparator, KeyEq>* node)
+    /* slots of the node before first_slot have not changed since it was
+     * last written */
+    void write_node(const BaseNode<K, V, KeyComparator, KeyEq>* node,
+                    size_t first_slot = 0)
     {
         boost::upgrade_lock<Page> lock;
         auto page = page_cache->fetch_page(node->get_pid(), lock);
+        if (log && page) wait_for_log_group(page, lock);
 
         {
             boost::upgrade_to_unique_lock<Page> ulock(lock);
             if (!page) return;
             auto* buf = page->get_buffer(ulock);
             uint32_t tag = node->is_leaf() ? LEAF_TAG : INNER_TAG;
+            if (log) save_page(page, buf);
 
             *reinterpret_cast<uint32_t*>(buf) = tag;
+            page->set_priority(node->is_leaf() ? PagePriority::NORMAL
+                                               : PagePriority::HIGH);
             node->serialize(&buf[sizeof(uint32_t)],
-                            page->get_size() - sizeof(uint32_t));
+                            page->get_size() - sizeof(uint32_t), first_slot);
+
+            if (log) log_page(page, lock, buf);
         }
 
         page_cache->unpin_page(page, true, lock);
     }
 
+    /* the page writes of the calling thread up to the matching
+     * end_log_group() are appended to the log as one batch. the pages stay
+     * pinned and are not written back until then, and other writers of
+     * them wait for it. groups nest, the outermost one is appended */
+    void begin_log_group()
+    {
+        if (log) log_group().depth++;
+    }
+
+    void end_log_group()
+    {
+        if (!log) return;
+        auto& group = log_group();
+        if (--group.depth > 0 || group.batch.empty()) return;
+
+        auto lsn = log->append(group.batch);
+        group.batch.clear();
+        group.last_lsn = lsn;
+
+        for (auto* page : group.pages) {
+            boost::upgrade_lock<Page> lock(*page);
+            page->set_lsn(lsn);
+            page_cache->unpin_page(page, true, lock);
+        }
+        group.pages.clear();
+    }
+
+    /* bytes of a page that a node can use after its tag */
+    size_t get_node_capacity() const
+    {
+        return page_cache->get_page_size() - sizeof(uint32_t);
+    }
+
+    /* every node object counts, including the temporary ones */
+    void node_created() { num_nodes.fetch_add(1, std::memory_order_relaxed); }
+    void node_destroyed() { num_nodes.fetch_sub(1, std::memory_order_relaxed); }
+    void node_split() { num_splits.add(1); }
+    /* two nodes became one */
+    void nodes_merged() { num_merges.add(1); }
+
+    /* the node is unlinked and marked obsolete, free it and its page after
+     * the current readers are gone */
+    void retire_node(std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>> node)
+    {
+        auto* raw = node.release();
+        forget_rightmost_leaf(raw);
+        epochs.retire([this, raw]() {
+            auto pid = raw->get_pid();
+            delete raw;
+
+            if (log) {
+                /* the free list link is written to the page right away,
+                 * replaying the page's records must not overwrite it */
+                LogBatch batch;
+                batch.add_free(pid);
+                log->flush(log->append(batch));
+            }
+            page_cache->free_page(pid);
+        });
+    }
+
+    /* set by a leaf without a right sibling while it is write-locked. it is
+     * cleared before the leaf is retired, so an insert that finds it in
+     * its epoch never reaches a leaf that was freed */
+    void set_rightmost_leaf(LeafNode<N, K, V, KeySerializer, KeyComparator, KeyEq,
+                                     ValueSerializer, LeafN>* leaf)
+    {
+        rightmost_leaf.store(leaf, std::memory_order_release);
+    }
+
+    void forget_rightmost_leaf(BaseNode<K, V, KeyComparator, KeyEq>* node)
+    {
+        auto* leaf = rightmost_leaf.load(std::memory_order_relaxed);
+        if (leaf == node) {
+            rightmost_leaf.compare_exchange_strong(leaf, nullptr);
+        }
+    }
+
+    /* copy the pairs and the right sibling of the leaf at pid from its page.
+     * leaves write themselves to their page under the page lock on every
+     * update and a split writes the new sibling before the leaf that links
+     * to it, so the chain of pages is consistent without descending through
+     * the in-memory nodes. returns false if pid is not a leaf */
+    bool read_leaf(PageID pid, std::vector<K>& key_list,
+                   std::vector<V>& value_list, PageID& next_leaf)
+    {
+        if constexpr (LeafNodeType::FIXED_STRIDE) {
+            /* copy the pairs straight out of the frame */
+            boost::upgrade_lock<Page> lock;
+            prefetcher.on_read(pid);
+            auto page = page_cache->fetch_page(pid, lock);
+            if (!page) return false;
+
+            const auto* buf = page->get_buffer(lock);
+            bool is_leaf = *reinterpret_cast<const uint32_t*>(buf) == LEAF_TAG;
+            if (is_leaf) {
+                key_list.clear();
+                value_list.clear();
+                LeafNodeType::read_pairs(&buf[sizeof(uint32_t)], key_list,
+                                         value_list, next_leaf);
+            }
+
+            page_cache->unpin_page(page, false, lock);
+            return is_leaf;
+        }
+
+        auto node = read_node(nullptr, pid);
+        if (!node || !node->is_leaf()) return false;
+
+        auto* leaf = static_cast<LeafNodeType*>(node.get());
+        key_list.assign(leaf->keys.begin(), leaf->keys.begin() + leaf->get_size());
+        value_list.assign(leaf->values.begin(),
+                          leaf->values.begin() + leaf->get_size());
+        next_leaf = leaf->get_next_leaf();
+        return true;
+    }
+
+    /* best effort: prefetch the pages of up to count leaves to the right of
+     * the leaf of key. they are found among the children of its parent so
+     * no leaf has to be read to learn its sibling. inner nodes that were
+     * dropped from memory are read from their pages for the walk and
+     * dropped again. returns the # of leaves found, fewer than count at
+     * the end of the parent */
+    size_t prefetch_next_leaves(const K& key, size_t count)
+    {
+        if (!prefetcher.is_enabled()) return 0;
+        std::vector<PageID> pages_to_prefetch;
+
+        std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>> loaded;
+        auto* node = root.get();
+        while (node && !node->is_leaf()) {
+            auto* inner = static_cast<InnerNodeType*>(node);
+
+            bool need_restart;
+            auto version = inner->read_lock_or_restart(need_restart);
+            if (need_restart) return 0;
+
+            int child_idx = child_index(inner, key);
+            auto* child = inner->child_cache[child_idx].get();
+            PageID child_pid = inner->child_pages[child_idx];
+
+            if (child ? child->is_leaf() : is_leaf_page(child_pid)) {
+                int last = std::min<int>(child_idx + count, inner->get_size());
+                for (int i = child_idx + 1; i <= last; i++) {
+                    pages_to_prefetch.push_back(inner->child_pages[i]);
+                }
+                if (inner->read_unlock_or_restart(version)) return 0;
+                break;
+            }
+
+            if (inner->read_unlock_or_restart(version)) return 0;
+            if (!child) {
+                /* the node it replaces is not looked at any more */
+                loaded = read_node(nullptr, child_pid);
+                child = loaded.get();
+            }
+            node = child;
+        }
+
+        size_t num_leaves = pages_to_prefetch.size();
+        prefetch(pages_to_prefetch);
+        return num_leaves;
+    }
+
+    /* read ahead on the leaf chain of a scan whose leaf ends with last_key.
+     * the window is refilled halfway through so that it stays ahead of the
+     * scan. it grows as long as the scan goes on, short scans do not read
+     * much ahead */
+    void prefetch_scan(const K& last_key, PageID next_leaf, size_t& window,
+                       size_t& leaves_until_prefetch)
+    {
+        if (leaves_until_prefetch == 0 && next_leaf != Page::INVALID_PAGE_ID) {
+            window = prefetcher.next_scan_window(window);
+            leaves_until_prefetch = prefetch_next_leaves(last_key, window) / 2;
+        } else if (leaves_until_prefetch > 0) {
+            leaves_until_prefetch--;
+        }
+    }
+
+    /* partitions a parallel scan takes in turns */
+    static constexpr size_t PARTITIONS_PER_THREAD = 4;
+
+    /* the bounds of the partitions of a parallel scan of [lo, hi): lo, the
+     * separators from range_partitions() and hi. a single partition with
+     * lo == hi if the range is empty */
+    std::vector<K> partition_range(const K& lo, const K& hi, size_t num_threads)
+    {
+        KeyComparator kcmp;
+        if (!kcmp(lo, hi)) return std::vector<K>{lo, lo};
+
+        auto bounds = range_partitions(
+            lo, hi, std::max<size_t>(num_threads, 1) * PARTITIONS_PER_THREAD);
+        bounds.insert(bounds.begin(), lo);
+        bounds.push_back(hi);
+        return bounds;
+    }
+
+    /* call task(p) for every partition p in [0, num_partitions) on up to
+     * num_threads threads, the calling thread being one of them. the first
+     * exception thrown by a task stops the others from taking partitions
+     * and is rethrown once all threads are done */
+    template <typename Task>
+    static void run_partitions(size_t num_partitions, size_t num_threads,
+                               Task&& task)
+    {
+        std::atomic<size_t> next_partition{0};
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto worker = [&]() {
+            try {
+                size_t p;
+                while ((p = next_partition++) < num_partitions) {
+                    task(p);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(error_mutex);
+                if (!error) error = std::current_exception();
+                next_partition = num_partitions;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < std::min(num_threads, num_partitions); t++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto&& t : threads) {
+            t.join();
+        }
+
+        if (error) std::rethrow_exception(error);
+    }
+
+    /* best effort: up to num_partitions - 1 separator keys in (lo, hi), in
+     * order, that split the range into partitions of about the same # of
+     * subtrees. the inner nodes that cover the range are looked at level
+     * by level until a level has enough separators or its children are
+     * leaves, inner nodes that were dropped from memory are read from
+     * their pages for this. on a concurrent update the separators found
+     * so far are used */
+    std::vector<K> range_partitions(const K& lo, const K& hi,
+                                    size_t num_partitions)
+    {
+        std::vector<K> bounds;
+        if (num_partitions < 2) return bounds;
+
+        KeyComparator kcmp;
+        std::vector<BaseNode<K, V, KeyComparator, KeyEq>*> level{root.get()};
+        std::vector<std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>>> loaded;
+
+        EpochManager::Guard guard(&epochs);
+        while (!level.empty() && !level.front()->is_leaf()) {
+            std::vector<K> level_bounds;
+            std::vector<BaseNode<K, V, KeyComparator, KeyEq>*> children;
+            std::vector<PageID> child_pages;
+
+            for (auto* node : level) {
+                auto* inner = static_cast<InnerNodeType*>(node);
+                bool need_restart;
+                auto version = inner->read_lock_or_restart(need_restart);
+                if (need_restart) return bounds;
+
+                int first = child_index(inner, lo);
+                int last = child_index(inner, hi);
+                std::vector<K> keys;
+                for (int i = first; i < last; i++) {
+                    if (kcmp(lo, inner->keys[i]) && kcmp(inner->keys[i], hi)) {
+                        keys.push_back(inner->keys[i]);
+                    }
+                }
+                for (int i = first; i <= last; i++) {
+                    children.push_back(inner->child_cache[i].get());
+                    child_pages.push_back(inner->child_pages[i]);
+                }
+                if (inner->read_unlock_or_restart(version)) return bounds;
+
+                level_bounds.insert(level_bounds.end(), keys.begin(), keys.end());
+            }
+            bounds = std::move(level_bounds);
+
+            if (children.empty()) break;
+            bool leaf_children = children.front() ? children.front()->is_leaf()
+                                             : is_leaf_page(child_pages.front());
+            if (bounds.size() + 1 >= num_partitions || leaf_children) break;
+
+            std::vector<std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>>>
+                next_loaded;
+            for (size_t i = 0; i < children.size(); i++) {
+                if (!children[i]) {
+                    next_loaded.push_back(read_node(nullptr, child_pages[i]));
+                    children[i] = next_loaded.back().get();
+                    if (!children[i]) return bounds;
+                }
+            }
+            /* the nodes of the level above are not looked at any more */
+            loaded = std::move(next_loaded);
+            level = std::move(children);
+        }
+
+        if (bounds.size() + 1 > num_partitions) {
+            std::vector<K> picked;
+            for (size_t p = 1; p < num_partitions; p++) {
+                picked.push_back(bounds[p * bounds.size() / num_partitions]);
+            }
+            bounds = std::move(picked);
+        }
+        return bounds;
+    }
+
+    /* hand the pairs with keys in [lo, hi) to callback a leaf at a time */
+    template <typename Callback>
+    void scan_partition(const K& lo, const K& hi, Callback& callback)
+    {
+        KeyComparator kcmp;
+        /* the leaf pages of the chain are not freed while it is read */
+        EpochManager::Guard guard(&epochs);
+        std::vector<K> keys;
+        std::vector<V> values;
+        PageID next_leaf = Page::INVALID_PAGE_ID;
+        size_t window = 0;
+        size_t leaves_until_prefetch = 0;
+
+        {
+            LatencyTimer timer(scan_latency);
+            collect_values(lo, &next_leaf, keys, values);
+        }
+        size_t from = std::lower_bound(keys.begin(), keys.end(), lo, kcmp) -
+                      keys.begin();
+
+        while (true) {
+            size_t to = std::lower_bound(keys.begin() + from, keys.end(), hi,
+                                         kcmp) -
+                        keys.begin();
+            if (to > from) callback(&keys[from], &values[from], to - from);
+            if (to < keys.size() || next_leaf == Page::INVALID_PAGE_ID) return;
+
+            {
+                LatencyTimer timer(scan_latency);
+                if (!read_leaf(next_leaf, keys, values, next_leaf)) return;
+            }
+            from = 0;
+            if (!keys.empty()) {
+                prefetch_scan(keys.back(), next_leaf, window,
+                              leaves_until_prefetch);
+            }
+        }
+    }
+
+    bool is_leaf_page(PageID pid)
+    {
+        boost::upgrade_lock<Page> lock;
+        auto page = page_cache->fetch_page(pid, lock);
+        if (!page) return false;
+
+        bool is_leaf = *reinterpret_cast<const uint32_t*>(page->get_buffer(lock)) ==
+                       LEAF_TAG;
+        page_cache->unpin_page(page, false, lock);
+        return is_leaf;
+    }
+
+    /* hand the pages that are not on their way yet to the page cache */
+    void prefetch(std::vector<PageID>& pids)
+    {
+        if (pids.empty()) return;
+        prefetcher.on_prefetch(pids);
+        if (!pids.empty()) page_cache->prefetch_pages(pids);
+    }
 
     /* iterator interface */
     class iterator {
         friend class BTree<N, K, V, KeySerializer, KeyComparator, KeyEq,
-                           ValueSerializer>;
+                           ValueSerializer, LeafN>;
 
     public:
         using self_type = iterator;
@@ -283,60 +1167,44 @@ public:
         std::vector<V> value_buf;
         size_t idx;
         value_type kvp;
-        std::optional<K> next_key;
+        PageID next_leaf;
+        size_t leaves_until_prefetch;
+        size_t prefetch_window;
         bool ended;
         KeyComparator kcmp;
 
         using container_type = BTree<N, K, V, KeySerializer, KeyComparator,
-                                     KeyEq, ValueSerializer>;
+                                     KeyEq, ValueSerializer, LeafN>;
         container_type* tree;
+        /* the leaf pages the iterator is about to visit are not freed while
+         * it (or a copy of it) is alive */
+        std::shared_ptr<EpochManager::Guard> epoch_guard;
 
+        /* the leftmost leaf never moves, scan the chain from there */
         iterator(container_type* tree, KeyComparator kcmp = KeyComparator{})
-            : tree(tree), kcmp(kcmp), next_key(std::nullopt)
+            : idx(0), next_leaf(container_type::FIRST_NODE_PAGE_ID),
+              leaves_until_prefetch(0), prefetch_window(0), ended(false),
+              kcmp(kcmp), tree(tree),
+              epoch_guard(std::make_shared<EpochManager::Guard>(&tree->epochs))
         {
-            ended = false;
-            auto first_node = tree->read_node(
-                nullptr, BTree<N, K, V, KeySerializer, KeyComparator, KeyEq,
-                               ValueSerializer>::FIRST_NODE_PAGE_ID);
-
-            if (!first_node) {
-                ended = true;
-                return;
-            }
-
-            auto leaf =
-                static_cast<LeafNode<N, K, V, KeySerializer, KeyComparator,
-                                     KeyEq, ValueSerializer>*>(
-                    first_node.get());
-            key_buf.clear();
-            value_buf.clear();
-            std::copy(leaf->keys.begin(), leaf->keys.begin() + leaf->get_size(),
-                      std::back_inserter(key_buf));
-            std::copy(leaf->values.begin(),
-                      leaf->values.begin() + leaf->get_size(),
-                      std::back_inserter(value_buf));
-
-            idx = 0;
-            if (key_buf.empty()) {
-                ended = true;
-            } else {
-                kvp = std::make_pair(key_buf[idx], value_buf[idx]);
-            }
+            get_next_batch();
+            if (!ended) kvp = std::make_pair(key_buf[idx], value_buf[idx]);
         }
 
         iterator(container_type* tree, const K& key,
                  KeyComparator kcmp = KeyComparator{})
-            : tree(tree), kcmp(kcmp)
+            : next_leaf(Page::INVALID_PAGE_ID), leaves_until_prefetch(0),
+              prefetch_window(0), ended(false), kcmp(kcmp), tree(tree),
+              epoch_guard(std::make_shared<EpochManager::Guard>(&tree->epochs))
         {
-            ended = false;
-            tree->collect_values(key, &next_key, key_buf, value_buf);
+            {
+                LatencyTimer timer(tree->scan_latency);
+                tree->collect_values(key, &next_leaf, key_buf, value_buf);
+            }
             idx = std::lower_bound(key_buf.begin(), key_buf.end(), key, kcmp) -
                   key_buf.begin();
-            if (idx == key_buf.size()) {
-                ended = true;
-            } else {
-                kvp = std::make_pair(key_buf[idx], value_buf[idx]);
-            }
+            if (idx == key_buf.size()) get_next_batch();
+            if (!ended) kvp = std::make_pair(key_buf[idx], value_buf[idx]);
         }
 
         void inc()
@@ -350,48 +1218,26 @@ public:
             kvp = std::make_pair(key_buf[idx], value_buf[idx]);
         }
 
-        void prefetch_next_batch() {
-            if (!next_key) return;
-
-            K key = *next_key;
-            
-            // Prefetch nodes that might contain this key and subsequent keys
-            tree->prefetch_search_path(key);
-            
-            // If we know this key is in a leaf node, also try to prefetch subsequent leaf nodes
-            // This is a simplified approach - in a real implementation, you'd track leaf node pointers
-            if (!key_buf.empty() && !tree->root->is_leaf()) {
-                // Estimate a few keys ahead
-                K ahead_key = key;
-                // This is a simple heuristic - you might need to adjust for your key type
-                if constexpr (std::is_integral_v<K>) {
-                    ahead_key += 100; // Look ~100 keys ahead
-                }
-                tree->prefetch_search_path(ahead_key);
-            }
-        }
-
+        /* follow the sibling links to the next non-empty leaf */
         void get_next_batch()
         {
-            if (!next_key) {
-                ended = true;
+            LatencyTimer timer(tree->scan_latency);
+            while (next_leaf != Page::INVALID_PAGE_ID) {
+                if (!tree->read_leaf(next_leaf, key_buf, value_buf,
+                                     next_leaf)) {
+                    break;
+                }
+
+                if (key_buf.empty()) continue;
+                idx = 0;
+
+                tree->prefetch_scan(key_buf.back(), next_leaf, prefetch_window,
+                                    leaves_until_prefetch);
                 return;
             }
 
-            K key = *next_key;
-            next_key = std::nullopt;
-            
-            // After getting data, prefetch the next batch
-            tree->collect_values(key, &next_key, key_buf, value_buf);
-            idx = std::lower_bound(key_buf.begin(), key_buf.end(), key, kcmp) -
-                key_buf.begin();
-            
-            if (idx == key_buf.size()) {
-                ended = true;
-            } else if (next_key) {
-                // Prefetch the next batch in advance
-                prefetch_next_batch();
-            }
+            ended = true;
+            epoch_guard.reset();
         }
     };
 
@@ -428,17 +1274,739 @@ public:
     Sentinel end() const { return Sentinel{}; }
 
 private:
-    static const PageID META_PAGE_ID = 1;
-    static const PageID FIRST_NODE_PAGE_ID = META_PAGE_ID + 1;
-    static const uint32_t META_PAGE_MAGIC = 0x00C0FFEE;
-    static const uint32_t INNER_TAG = 1;
-    static const uint32_t LEAF_TAG = 2;
+    static constexpr PageID META_PAGE_ID = 1;
+    static constexpr PageID FIRST_NODE_PAGE_ID = META_PAGE_ID + 1;
+    /* bumped whenever the page layout changes. 0x00C0FFEE files have leaves
+     * without the next leaf link, 0x00C0FFEF files no siblings that are not
+     * linked yet */
+    static constexpr uint32_t META_PAGE_MAGIC = 0x00C0FFF0;
+    static constexpr uint32_t OLD_META_PAGE_MAGIC = 0x00C0FFEE;
+    static constexpr uint32_t INNER_TAG = 1;
+    static constexpr uint32_t LEAF_TAG = 2;
 
     AbstractPageCache* page_cache;
+    WriteAheadLog* log;
+    /* pages for new nodes, allocated outside of the node locks */
+    PageReserve pages;
+    /* protects nodes unlinked by erase() from the readers that may still
+     * be on them */
+    EpochManager epochs;
+    /* declared before root so that it outlives the nodes */
+    std::atomic<int64_t> num_nodes;
+    std::atomic<size_t> num_node_evictions;
     std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>> root;
-    std::atomic<size_t> num_pairs;
+    std::atomic<PageID> root_pid;
+    std::atomic<LeafNode<N, K, V, KeySerializer, KeyComparator, KeyEq,
+                         ValueSerializer, LeafN>*>
+        rightmost_leaf{nullptr};
+    ShardedCounter num_pairs;
+    ShardedCounter read_restarts;
+    ShardedCounter insert_restarts;
+    ShardedCounter erase_restarts;
+    ShardedCounter num_appends;
+    AdaptivePrefetcher prefetcher;
+    MetricCounter num_splits;
+    MetricCounter num_merges;
+    LatencyHistogram get_value_latency;
+    LatencyHistogram insert_latency;
+    LatencyHistogram scan_latency;
+    std::unique_ptr<InsertBuffer<K, V, KeyComparator>> insert_buffer;
+    size_t metadata_commit_interval;
+    size_t max_cached_nodes;
+    std::mutex evict_mutex;
+
+    void lookup(const K& key, std::vector<V>& value_list)
+    {
+        check_node_budget();
+        EpochManager::Guard guard(&epochs);
+        prefetch_search_path(key);
+
+        RestartBackoff backoff;
+        while (true) {
+            bool need_restart = false;
+            value_list.clear();
+            auto* root_node = root.get();
+            root_node->get_values(key, false, nullptr, nullptr, value_list, 0,
+                                  need_restart);
+            if (!need_restart && root_node == root.get()) break;
+            restarted(read_restarts, backoff);
+        }
+    }
+
+    /* the caller is in an epoch */
+    void insert_pairs(const K* keys, const V* values, size_t n)
+    {
+        RestartBackoff backoff;
+        size_t done = 0;
+        while (done < n) {
+            bool need_restart = false;
+            size_t num_inserted = 0;
+            auto old_root = root.get();
+            if (!old_root) {
+                /* old_root may be nullptr when another thread is updating
+                 * the root node pointer */
+                restarted(insert_restarts, backoff);
+                continue;
+            }
+
+            /* a root that split gets a new root before anything goes in */
+            if (old_root->has_sibling()) {
+                if (!link_root_sibling(old_root)) {
+                    restarted(insert_restarts, backoff);
+                }
+                continue;
+            }
+
+            if (old_root->insert_run(keys + done, values + done, n - done,
+                                     nullptr, num_inserted, 0, need_restart)) {
+                link_root_sibling(old_root);
+                continue;
+            }
+            if (need_restart) {
+                restarted(insert_restarts, backoff);
+                continue;
+            }
+
+            done += num_inserted;
+            inserted(num_inserted);
+        }
+    }
+
+    /* the second half of a split of the root, a new root above it and
+     * the sibling it kept. returns false on a concurrent update */
+    bool link_root_sibling(BaseNode<K, V, KeyComparator, KeyEq>* old_root)
+    {
+        reserve_split_pages();
+
+        bool need_restart;
+        old_root->write_lock_or_restart(need_restart);
+        if (need_restart) return false;
+        if (old_root != root.get() || !old_root->has_sibling()) {
+            old_root->write_unlock();
+            return true;
+        }
+
+        begin_log_group();
+        PageID sibling_pid;
+        K sibling_key;
+        /* nullptr if the sibling was not read since the tree was opened */
+        auto sibling = old_root->unlink_sibling(sibling_pid, sibling_key);
+        auto new_root = create_node<InnerNodeType>(nullptr);
+
+        old_root->set_parent(new_root.get());
+        if (sibling) sibling->set_parent(new_root.get());
+
+        new_root->set_size(1);
+        new_root->keys[0] = sibling_key;
+        new_root->child_pages[0] = old_root->get_pid();
+        new_root->child_pages[1] = sibling_pid;
+        new_root->child_cache[0] = std::move(root);
+        new_root->child_cache[1] = std::move(sibling);
+
+        root = std::move(new_root);
+        root_pid.store(root->get_pid());
+        write_node(old_root, old_root->get_size());
+        write_node(root.get());
+        write_metadata();
+        end_log_group();
+
+        old_root->write_unlock();
+        return true;
+    }
+
+    void inserted(size_t n)
+    {
+        auto count = (size_t)num_pairs.add(n);
+        if (count / metadata_commit_interval !=
+            (count - n) / metadata_commit_interval) {
+            /* group commit: the pairs inserted by all threads since the
+             * last commit are persisted together */
+            write_metadata();
+        }
+    }
+
+    void restarted(ShardedCounter& counter, RestartBackoff& backoff)
+    {
+        counter.add(1);
+        backoff.pause();
+    }
+
+    void check_node_budget()
+    {
+        if (max_cached_nodes &&
+            num_nodes.load(std::memory_order_relaxed) > (int64_t)max_cached_nodes) {
+            evict_nodes();
+        }
+    }
+
+    /* drop nodes until the budget is met with some slack, so that this does
+     * not run on every operation. one thread evicts at a time, the others
+     * go on */
+    void evict_nodes()
+    {
+        std::unique_lock<std::mutex> lock(evict_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) return;
+
+        int64_t target = (int64_t)(max_cached_nodes - max_cached_nodes / 8);
+
+        {
+            EpochManager::Guard guard(&epochs);
+            int64_t excess = num_nodes.load() - target;
+            size_t attempts = 4 * std::max<int64_t>(excess, 0) + 64;
+
+            while (num_nodes.load() > target && attempts-- > 0) {
+                evict_one_node();
+            }
+        }
 
-    /* metadata: | magic(4 bytes) | root page id(4 bytes) | */
+        epochs.reclaim();
+    }
+
+    /* walk down from the root through randomly chosen in-memory children
+     * until a node without in-memory children is found and unswizzle it,
+     * i.e. drop it from its parent's child_cache, which still has its page
+     * ID. a node that was used since the last visit gets a second chance
+     * like in CLOCK. only nodes without in-memory children are dropped so
+     * that no node is left pointing at a parent that is gone. gives up on
+     * any concurrent update, the caller just tries again */
+    void evict_one_node()
+    {
+        thread_local uint64_t rand_state = 0x9E3779B97F4A7C15ULL;
+        auto next_rand = []() {
+            rand_state ^= rand_state << 13;
+            rand_state ^= rand_state >> 7;
+            rand_state ^= rand_state << 17;
+            return rand_state;
+        };
+
+        auto* node = root.get();
+        if (!node || node->is_leaf()) return;
+        auto* parent = static_cast<InnerNodeType*>(node);
+
+        while (true) {
+            bool need_restart;
+            auto version = parent->read_lock_or_restart(need_restart);
+            if (need_restart) return;
+
+            size_t num_children = parent->get_size() + 1;
+            size_t start = next_rand() % num_children;
+            int idx = -1;
+            BaseNode<K, V, KeyComparator, KeyEq>* child = nullptr;
+            for (size_t i = 0; i < num_children; i++) {
+                size_t j = (start + i) % num_children;
+                child = parent->child_cache[j].get();
+                if (child) {
+                    idx = (int)j;
+                    break;
+                }
+            }
+            if (!child) return;
+
+            auto child_version = child->read_lock_or_restart(need_restart);
+            if (need_restart) return;
+            bool has_children =
+                !child->is_leaf() &&
+                static_cast<InnerNodeType*>(child)->has_cached_children();
+            /* its sibling is only reachable through it until it is linked */
+            bool has_sibling = child->has_sibling();
+            if (parent->read_unlock_or_restart(version)) return;
+            if (has_sibling) return;
+
+            if (has_children) {
+                parent = static_cast<InnerNodeType*>(child);
+                continue;
+            }
+
+            if (child->is_referenced()) {
+                child->set_referenced(false);
+                return;
+            }
+
+            parent->upgrade_to_write_lock_or_restart(version, need_restart);
+            if (need_restart) return;
+            child->upgrade_to_write_lock_or_restart(child_version, need_restart);
+            if (need_restart) {
+                parent->write_unlock();
+                return;
+            }
+
+            /* the page of the child is up to date as every update writes
+             * the node back before unlocking it */
+            auto* victim = parent->child_cache[idx].release();
+            forget_rightmost_leaf(victim);
+            victim->write_unlock_obsolete();
+            parent->write_unlock();
+
+            epochs.retire([victim]() { delete victim; });
+            num_node_evictions++;
+            return;
+        }
+    }
+
+    size_t erase_pairs(const K& key, const V* value)
+    {
+        /* the buffer first, a pair that is drained meanwhile is in the tree
+         * when it is searched */
+        size_t buffered = insert_buffer ? insert_buffer->erase(key, value) : 0;
+        size_t removed = 0;
+        check_node_budget();
+
+        {
+            EpochManager::Guard guard(&epochs);
+            bool underflow = false;
+
+            /* the removal first, then another descent to merge the leaf if
+             * it underflowed. the second pass may restart without redoing
+             * the removal */
+            RestartBackoff backoff;
+            for (bool remove : {true, false}) {
+                if (!remove && !underflow) break;
+
+                while (true) {
+                    bool need_restart = false;
+                    auto* root_node = root.get();
+                    if (root_node) {
+                        auto n = root_node->erase(key, value, remove, underflow, 0,
+                                                  need_restart);
+                        if (!need_restart) {
+                            if (remove) removed = n;
+                            break;
+                        }
+                    }
+                    restarted(erase_restarts, backoff);
+                }
+            }
+        }
+
+        if (removed > 0) {
+            num_pairs.add(-(int64_t)removed);
+        }
+
+        /* outside of our own epoch so that it does not hold anything back */
+        epochs.reclaim();
+        commit_log();
+        return removed + buffered;
+    }
+
+    using InnerNodeType = InnerNode<N, K, V, KeySerializer, KeyComparator,
+                                    KeyEq, ValueSerializer, LeafN>;
+    using LeafNodeType = LeafNode<N, K, V, KeySerializer, KeyComparator,
+                                  KeyEq, ValueSerializer, LeafN>;
+
+    /* packs sorted pairs into leaves and builds the inner levels on top of
+     * them once all pairs are added */
+    class BulkLoader {
+    public:
+        BulkLoader(BTree* tree, double fill_factor)
+            : tree(tree), count(0), leaf_bound(0)
+        {
+            fill_factor = std::min(1.0, std::max(0.0, fill_factor));
+            leaf_fill = std::max<size_t>(
+                1, (size_t)std::lround((LeafN - 1) * fill_factor));
+            inner_fanout =
+                std::max<size_t>(2, (size_t)std::lround(N * fill_factor));
+            fill_bytes = (size_t)std::lround(tree->get_node_capacity() * fill_factor);
+
+            /* the first leaf takes over the page of the empty root */
+            leaf = std::make_unique<LeafNodeType>(tree, nullptr,
+                                                  tree->root->get_pid());
+        }
+
+        void add(const K& key, const V& value)
+        {
+            size_t size = leaf->get_size();
+            bool full = size >= leaf_fill;
+            bool overflows = size == LeafN - 1;
+
+            if constexpr (LeafNodeType::VARIABLE_SIZE) {
+                /* the sum of the encodings of the single elements bounds the
+                 * one of the leaf, only compute it when that gets close */
+                leaf_bound += encoded_size(leaf->key_serializer, &key, &key + 1) +
+                              encoded_size(leaf->value_serializer, &value, &value + 1);
+                if (size > 0 &&
+                    2 * sizeof(uint32_t) + leaf_bound > fill_bytes) {
+                    full = full || !leaf->fits_with(key, value, fill_bytes);
+                    overflows = overflows ||
+                                !leaf->fits_with(key, value, tree->get_node_capacity());
+                }
+            }
+
+            /* do not split a run of equal keys between leaves unless it
+             * fills a whole leaf, lookups only search one leaf */
+            if (size > 0 && full &&
+                !(!overflows && leaf->keq(key, leaf->keys[size - 1]))) {
+                auto next = tree->template create_node<LeafNodeType>(nullptr);
+                leaf->next_leaf = next->get_pid();
+                K next_separator = separator_key<K, KeyComparator>(
+                    leaf->key_serializer, leaf->keys[size - 1], key);
+                flush_leaf();
+                separator = next_separator;
+                leaf = std::move(next);
+                leaf_bound = encoded_size(leaf->key_serializer, &key, &key + 1) +
+                             encoded_size(leaf->value_serializer, &value, &value + 1);
+                size = 0;
+            }
+
+            leaf->keys[size] = key;
+            leaf->values[size] = value;
+            leaf->set_size(size + 1);
+            count++;
+        }
+
+        void finish()
+        {
+            if (count == 0) return;
+            flush_leaf();
+
+            /* each level only keeps the first key and page of its nodes,
+             * the nodes themselves are read back lazily */
+            while (level.size() > 1) {
+                std::vector<std::pair<K, PageID>> next_level;
+                size_t i = 0;
+
+                for (size_t num_children : group_children()) {
+                    auto node =
+                        tree->template create_node<InnerNodeType>(nullptr);
+
+                    for (size_t j = 0; j < num_children; j++) {
+                        node->child_pages[j] = level[i + j].second;
+                        if (j > 0) node->keys[j - 1] = level[i + j].first;
+                    }
+                    node->set_size(num_children - 1);
+                    tree->write_node(node.get());
+
+                    next_level.emplace_back(level[i].first, node->get_pid());
+                    i += num_children;
+                    top = std::move(node);
+                }
+
+                level = std::move(next_level);
+            }
+
+            tree->forget_rightmost_leaf(tree->root.get());
+            tree->root = std::move(top);
+            tree->root_pid.store(tree->root->get_pid());
+            tree->num_pairs.store(count);
+            tree->write_metadata();
+        }
+
+    private:
+        BTree* tree;
+        size_t leaf_fill;
+        size_t inner_fanout;
+        size_t fill_bytes;
+        size_t count;
+        size_t leaf_bound;
+        std::unique_ptr<LeafNodeType> leaf;
+        K separator; /* between the current leaf and the previous one */
+        std::vector<std::pair<K, PageID>> level;
+        std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>> top;
+
+        /* the # of children of each node of the next level */
+        std::vector<size_t> group_children() const
+        {
+            std::vector<size_t> groups;
+
+            if constexpr (InnerNodeType::VARIABLE_SIZE) {
+                /* fill by the bound that InnerNode::insert checks, so that
+                 * the nodes have room for fill_bytes first */
+                KeySerializer ser;
+                size_t nbytes = 0;
+                for (const auto& child : level) {
+                    size_t child_bytes =
+                        sizeof(PageID) +
+                        encoded_size(ser, &child.first, &child.first + 1);
+                    if (groups.empty() ||
+                        (groups.back() >= 2 && (groups.back() == inner_fanout ||
+                                                nbytes + child_bytes > fill_bytes))) {
+                        groups.push_back(0);
+                        nbytes = sizeof(uint32_t) + max_encoded_size<K>(ser) +
+                                 sizeof(PageID);
+                    }
+                    groups.back()++;
+                    nbytes += child_bytes;
+                }
+
+                if (groups.size() > 1 && groups.back() == 1 &&
+                    groups[groups.size() - 2] > 2) {
+                    groups[groups.size() - 2]--;
+                    groups.back()++;
+                }
+                return groups;
+            }
+
+            /* spread the children evenly so that the last node is not left
+             * with a single child */
+            size_t num_nodes = (level.size() + inner_fanout - 1) / inner_fanout;
+            for (size_t n = 0; n < num_nodes; n++) {
+                groups.push_back(level.size() / num_nodes +
+                                 (n < level.size() % num_nodes));
+            }
+            return groups;
+        }
+
+        void flush_leaf()
+        {
+            tree->write_node(leaf.get());
+            level.emplace_back(level.empty() ? leaf->keys[0] : separator,
+                               leaf->get_pid());
+            top = std::move(leaf);
+        }
+    };
+
+    /* sort the pairs in runs of BULK_LOAD_RUN_SIZE and merge the runs into
+     * loader. pairs with equal keys keep their input order */
+    template <typename Iterator>
+    void external_sort(Iterator first, Iterator last, BulkLoader& loader)
+    {
+        using Pair = std::pair<K, V>;
+        KeyComparator kcmp;
+        auto key_less = [&kcmp](const Pair& a, const Pair& b) {
+            return kcmp(a.first, b.first);
+        };
+
+        struct RunFile {
+            std::FILE* file;
+            ~RunFile() { std::fclose(file); }
+        };
+
+        std::vector<Pair> run;
+        std::vector<std::unique_ptr<RunFile>> runs;
+
+        auto spill = [&]() {
+            std::stable_sort(run.begin(), run.end(), key_less);
+
+            auto* file = std::tmpfile();
+            if (!file) throw std::runtime_error("unable to create sort run");
+            runs.push_back(std::unique_ptr<RunFile>(new RunFile{file}));
+
+            if (std::fwrite(run.data(), sizeof(Pair), run.size(), file) !=
+                run.size()) {
+                throw std::runtime_error("unable to write sort run");
+            }
+            std::rewind(file);
+            run.clear();
+        };
+
+        for (; first != last; ++first) {
+            run.emplace_back(first->first, first->second);
+            if (run.size() == BULK_LOAD_RUN_SIZE) spill();
+        }
+
+        if (runs.empty()) {
+            /* everything fits in one run */
+            std::stable_sort(run.begin(), run.end(), key_less);
+            for (auto&& p : run) {
+                loader.add(p.first, p.second);
+            }
+            return;
+        }
+
+        if (!run.empty()) spill();
+        run.shrink_to_fit();
+
+        /* k-way merge with a small read buffer per run */
+        const size_t buffer_size = std::max<size_t>(
+            1, BULK_LOAD_RUN_SIZE / runs.size());
+        std::vector<std::vector<Pair>> buffers(runs.size());
+        std::vector<size_t> positions(runs.size(), 0);
+
+        auto refill = [&](size_t r) {
+            buffers[r].resize(buffer_size);
+            size_t n = std::fread(buffers[r].data(), sizeof(Pair), buffer_size,
+                                  runs[r]->file);
+            buffers[r].resize(n);
+            positions[r] = 0;
+            return n > 0;
+        };
+
+        /* min-heap on (key, run) so that equal keys come out in run order */
+        auto heap_greater = [&](size_t a, size_t b) {
+            const auto& ka = buffers[a][positions[a]].first;
+            const auto& kb = buffers[b][positions[b]].first;
+            if (kcmp(kb, ka)) return true;
+            if (kcmp(ka, kb)) return false;
+            return a > b;
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(heap_greater)>
+            heap(heap_greater);
+
+        for (size_t r = 0; r < runs.size(); r++) {
+            if (refill(r)) heap.push(r);
+        }
+
+        while (!heap.empty()) {
+            size_t r = heap.top();
+            heap.pop();
+
+            const auto& p = buffers[r][positions[r]];
+            loader.add(p.first, p.second);
+
+            if (++positions[r] < buffers[r].size() || refill(r)) {
+                heap.push(r);
+            }
+        }
+    }
+
+    /* a multi_get() batch in key order. results of the keys in
+     * [0, done) are final, values of the p-th key are at
+     * values[offsets[p]] .. values[offsets[p + 1] - 1] */
+    struct MultiGetBatch {
+        const K* keys;
+        std::vector<size_t> order;
+        std::vector<V> values;
+        std::vector<size_t> offsets;
+        size_t done;
+
+        const K& key(size_t p) const { return keys[order[p]]; }
+    };
+
+    /* end of the run of keys starting at begin that go to child child_idx */
+    static size_t child_run_end(InnerNodeType* node, const MultiGetBatch& batch,
+                                int child_idx, size_t begin, size_t end)
+    {
+        if (child_idx == (int)node->get_size()) return end;
+
+        const auto& separator = node->keys[child_idx];
+        size_t p = begin + 1;
+        while (p < end && node->kcmp(batch.key(p), separator)) {
+            p++;
+        }
+        return p;
+    }
+
+    static int child_index(InnerNodeType* node, const K& key)
+    {
+        return upper_bound_index(node->keys.data(), node->get_size(), key,
+                                 node->kcmp);
+    }
+
+    /* best effort: collect the pages of all children the batch needs that
+     * are not in memory yet and prefetch them together */
+    void prefetch_batch(const MultiGetBatch& batch)
+    {
+        std::vector<PageID> pages_to_prefetch;
+
+        collect_batch_pages(root.get(), batch, 0, batch.order.size(),
+                            pages_to_prefetch);
+
+        if (!pages_to_prefetch.empty()) {
+            page_cache->prefetch_pages(pages_to_prefetch);
+        }
+    }
+
+    /* stops at the first concurrent update and returns false */
+    bool collect_batch_pages(BaseNode<K, V, KeyComparator, KeyEq>* node,
+                             const MultiGetBatch& batch, size_t begin,
+                             size_t end, std::vector<PageID>& pages)
+    {
+        if (!node || node->is_leaf()) return true;
+        auto* inner = static_cast<InnerNodeType*>(node);
+
+        bool need_restart;
+        auto version = inner->read_lock_or_restart(need_restart);
+        if (need_restart) return false;
+
+        for (size_t p = begin; p < end;) {
+            int child_idx = child_index(inner, batch.key(p));
+            size_t q = child_run_end(inner, batch, child_idx, p, end);
+            auto* child = inner->child_cache[child_idx].get();
+            auto child_pid = inner->child_pages[child_idx];
+
+            if (inner->read_unlock_or_restart(version)) return false;
+
+            if (child) {
+                if (!collect_batch_pages(child, batch, p, q, pages)) return false;
+            } else if (child_pid != Page::INVALID_PAGE_ID) {
+                pages.push_back(child_pid);
+            }
+            p = q;
+        }
+        return true;
+    }
+
+    /* look up the keys in [begin, end) of the batch under node. returns
+     * false on a concurrent update, batch.done tells how far it got */
+    bool multi_get_node(BaseNode<K, V, KeyComparator, KeyEq>* node,
+                        MultiGetBatch& batch, size_t begin, size_t end,
+                        uint64_t parent_version)
+    {
+        bool need_restart;
+        auto version = node->read_lock_or_restart(need_restart);
+        if (need_restart) return false;
+
+        auto* parent = node->get_parent();
+        if (parent && parent->read_unlock_or_restart(parent_version)) {
+            return false;
+        }
+
+        /* the keys from mid on belong to a sibling that is not linked yet,
+         * they are looked up in it after the others */
+        size_t mid = begin;
+        while (mid < end && !node->sibling_covers(batch.key(mid))) {
+            mid++;
+        }
+
+        if (node->is_leaf()) {
+            auto* leaf = static_cast<LeafNodeType*>(node);
+            auto keys_end = leaf->keys.begin() + leaf->get_size();
+            auto lower = leaf->keys.begin();
+
+            for (size_t p = begin; p < mid; p++) {
+                const auto& key = batch.key(p);
+                /* keys are sorted so the search resumes where the previous
+                 * one stopped */
+                size_t from = lower - leaf->keys.begin();
+                lower += lower_bound_index(leaf->keys.data() + from,
+                                           leaf->get_size() - from, key,
+                                           leaf->kcmp);
+
+                auto upper = lower;
+                while (upper != keys_end && leaf->keq(key, *upper)) {
+                    upper++;
+                }
+
+                batch.values.insert(
+                    batch.values.end(),
+                    &leaf->values[lower - leaf->keys.begin()],
+                    &leaf->values[upper - leaf->keys.begin()]);
+                batch.offsets[p + 1] = batch.values.size();
+            }
+
+            if (leaf->read_unlock_or_restart(version)) return false;
+            batch.done = mid;
+        } else {
+            auto* inner = static_cast<InnerNodeType*>(node);
+            for (size_t p = begin; p < mid;) {
+                int child_idx = child_index(inner, batch.key(p));
+                size_t q = child_run_end(inner, batch, child_idx, p, mid);
+
+                auto* child =
+                    inner->get_child(child_idx, false, version, need_restart);
+                if (need_restart || inner->read_unlock_or_restart(version)) {
+                    return false;
+                }
+
+                if (child) {
+                    if (!multi_get_node(child, batch, p, q, version)) return false;
+                } else {
+                    for (size_t i = p; i < q; i++) {
+                        batch.offsets[i + 1] = batch.values.size();
+                    }
+                    batch.done = q;
+                }
+                p = q;
+            }
+        }
+        if (mid == end) return true;
+
+        auto* sibling = node->move_right(version, need_restart);
+        if (!sibling) return false;
+        return multi_get_node(sibling, batch, mid, end, version);
+    }
+
+    /* metadata: | magic(4 bytes) | root page id(4 bytes) | # pairs(4 bytes) |.
+     * a file with another magic is rejected with IOException */
     bool read_metadata()
     {
         boost::upgrade_lock<Page> lock;
@@ -446,11 +2014,25 @@ private:
         if (!page) return false;
 
         const auto* buf = page->get_buffer(lock);
+        uint32_t magic = *reinterpret_cast<const uint32_t*>(buf);
+        if (magic != META_PAGE_MAGIC) {
+            page_cache->unpin_page(page, false, lock);
+            page_cache->set_write_ahead_log(nullptr);
+
+            std::stringstream ss;
+            if (magic >= OLD_META_PAGE_MAGIC && magic < META_PAGE_MAGIC) {
+                ss << "the tree was written with an older page layout";
+            } else {
+                ss << "bad metadata page(magic " << std::hex << magic << ")";
+            }
+            throw IOException(ss.str().c_str());
+        }
         buf += sizeof(uint32_t);
         PageID root_pid = (PageID) * reinterpret_cast<const uint32_t*>(buf);
         buf += sizeof(uint32_t);
         size_t pair_count = *reinterpret_cast<const uint32_t*>(buf);
         root = read_node(nullptr, root_pid);
+        this->root_pid.store(root_pid);
         num_pairs.store(pair_count);
 
         page_cache->unpin_page(page, false, lock);
@@ -462,22 +2044,212 @@ private:
     {
         boost::upgrade_lock<Page> lock;
         auto page = page_cache->fetch_page(META_PAGE_ID, lock);
+        if (log) wait_for_log_group(page, lock);
 
         {
+            /* read the root page ID under the page lock so that a concurrent
+             * commit cannot overwrite a newer root with a stale one */
             boost::upgrade_to_unique_lock<Page> ulock(lock);
             auto* buf = page->get_buffer(ulock);
+            auto* page_buf = buf;
+            if (log) save_page(page, buf);
 
             *reinterpret_cast<uint32_t*>(buf) = META_PAGE_MAGIC;
             buf += sizeof(uint32_t);
-            *reinterpret_cast<uint32_t*>(buf) = (uint32_t)root->get_pid();
+            *reinterpret_cast<uint32_t*>(buf) = (uint32_t)root_pid.load();
             buf += sizeof(uint32_t);
             *reinterpret_cast<uint32_t*>(buf) = (uint32_t)num_pairs.load();
+
+            if (log) log_page(page, lock, page_buf);
         }
 
         page_cache->unpin_page(page, true, lock);
     }
+
+    /* a run of unchanged bytes at least this long splits a page delta in
+     * two, it is the size of a record header */
+    static constexpr size_t LOG_DELTA_GAP = 16;
+
+    /* the logged page writes of the calling thread, see begin_log_group().
+     * a thread is in one tree operation at a time */
+    struct LogGroup {
+        int depth = 0;
+        LogBatch batch;
+        std::vector<Page*> pages;
+        /* the LSN of the thread's last batch, for commit_log() */
+        uint64_t last_lsn = 0;
+        /* the page content before the current write */
+        std::vector<uint8_t> old_page;
+        LogBatch single;
+    };
+
+    static LogGroup& log_group()
+    {
+        static thread_local LogGroup group;
+        return group;
+    }
+
+    bool in_log_group(const Page* page)
+    {
+        const auto& pages = log_group().pages;
+        return std::find(pages.begin(), pages.end(), page) != pages.end();
+    }
+
+    /* a page in another thread's batch is written after the batch is
+     * appended so that the records of a page are in the log in the order
+     * of its writes */
+    void wait_for_log_group(Page* page, boost::upgrade_lock<Page>& lock)
+    {
+        while (page->get_lsn() == WriteAheadLog::PENDING_LSN &&
+               !in_log_group(page)) {
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+    }
+
+    void save_page(const Page* page, const uint8_t* buf)
+    {
+        auto& old_page = log_group().old_page;
+        old_page.assign(buf, buf + page->get_size());
+    }
+
+    /* log the bytes of the page that changed since save_page(). requires
+     * the page's write lock */
+    void log_page(Page* page, boost::upgrade_lock<Page>& lock, const uint8_t* buf)
+    {
+        auto& group = log_group();
+        auto& batch = group.depth > 0 ? group.batch : group.single;
+        const auto* old = group.old_page.data();
+        size_t size = page->get_size();
+        PageID pid = page->get_id();
+
+        if (*reinterpret_cast<const uint32_t*>(old) == 0) {
+            /* a page that was just allocated, its bytes in the file are
+             * whatever the last owner left there */
+            size_t length = size;
+            while (length > 0 && buf[length - 1] == 0) length--;
+            batch.add_image(pid, buf, (uint32_t)length);
+        } else {
+            size_t i = 0;
+            while (i < size) {
+                if (old[i] == buf[i]) {
+                    i++;
+                    continue;
+                }
+
+                size_t end = i + 1, j = i + 1;
+                while (j < size && j - end < LOG_DELTA_GAP) {
+                    if (old[j] != buf[j]) end = j + 1;
+                    j++;
+                }
+                batch.add_delta(pid, (uint32_t)i, &buf[i], (uint32_t)(end - i));
+                i = j;
+            }
+        }
+
+        if (group.depth > 0) {
+            if (!in_log_group(page)) {
+                page_cache->pin_page(page, lock);
+                group.pages.push_back(page);
+            }
+            page->set_lsn(WriteAheadLog::PENDING_LSN);
+        } else if (!batch.empty()) {
+            group.last_lsn = log->append(batch);
+            page->set_lsn(group.last_lsn);
+            batch.clear();
+        }
+    }
+
+    /* with a sync_commit log, wait until the batches of the calling thread
+     * are durable */
+    void commit_log()
+    {
+        if (log && log->is_sync_commit()) {
+            log->flush(log_group().last_lsn);
+        }
+    }
+
+    /* apply the records of the log to the pages, returns the # of records
+     * applied. a page that fails its checksum (e.g. a torn write) is
+     * rebuilt from its PAGE_IMAGE record, the records before the image are
+     * skipped. recovery fails with IOException if such a page has records
+     * but no image */
+    size_t replay_log()
+    {
+        /* corrupt pages that no image has rebuilt yet */
+        std::unordered_set<PageID> corrupt_pages;
+
+        size_t num_replayed = log->replay([this, &corrupt_pages](const LogRecord& rec) {
+            boost::upgrade_lock<Page> lock;
+            bool corrupt = false;
+            auto page = page_cache->fetch_page_for_redo(rec.pid, lock, corrupt);
+            /* the heap file never got the page, nothing refers to it */
+            if (!page) return;
+
+            if (corrupt) corrupt_pages.insert(rec.pid);
+            if (corrupt_pages.count(rec.pid)) {
+                if (rec.type != LogRecordType::PAGE_IMAGE) {
+                    /* a delta of a zeroed page, not written back */
+                    page_cache->unpin_page(page, false, lock);
+                    return;
+                }
+                corrupt_pages.erase(rec.pid);
+            }
+
+            {
+                boost::upgrade_to_unique_lock<Page> ulock(lock);
+                auto* buf = page->get_buffer(ulock);
+                size_t size = page->get_size();
+                size_t offset = std::min<size_t>(rec.offset, size);
+                size_t length = std::min<size_t>(rec.length, size - offset);
+
+                ::memcpy(&buf[offset], rec.data, length);
+                if (rec.type == LogRecordType::PAGE_IMAGE) {
+                    ::memset(&buf[length], 0, size - length);
+                }
+            }
+
+            page_cache->unpin_page(page, true, lock);
+        });
+
+        if (!corrupt_pages.empty()) {
+            /* no tree, the cache must not refer to the log any more */
+            page_cache->set_write_ahead_log(nullptr);
+            std::stringstream ss;
+            ss << "page " << *corrupt_pages.begin()
+               << " is corrupt and the log has no image to rebuild it from";
+            throw IOException(ss.str().c_str());
+        }
+        return num_replayed;
+    }
+
+    /* # of pairs in the leaf chain */
+    size_t count_leaf_pairs()
+    {
+        size_t count = 0;
+        std::vector<K> key_list;
+        std::vector<V> value_list;
+        PageID pid = FIRST_NODE_PAGE_ID;
+        while (pid != Page::INVALID_PAGE_ID &&
+               read_leaf(pid, key_list, value_list, pid)) {
+            count += key_list.size();
+        }
+        return count;
+    }
 };
 
+/* a tree whose leaf and inner fan-outs are the largest that fit in pages
+ * of PageSize bytes, e.g. PageFitBTree<4096, uint64_t, uint64_t> for the
+ * default HeapPageCache page size */
+template <size_t PageSize, typename K, typename V,
+          typename KeyComparator = std::less<K>,
+          typename KeyEq = std::equal_to<K>>
+using PageFitBTree =
+    BTree<PageFit<PageSize, K, V>::INNER_FANOUT, K, V, CopySerializer<K>,
+          KeyComparator, KeyEq, CopySerializer<V>,
+          PageFit<PageSize, K, V>::LEAF_FANOUT>;
+
 } // namespace bptree
 
 #endif
@@ -1,23 +1,99 @@
 #ifndef _BPTREE_TREE_NODE_H_
 #define _BPTREE_TREE_NODE_H_
 
+#include "bptree/node_search.h"
+#include "bptree/object_pool.h"
 #include "bptree/page.h"
 #include "bptree/serializer.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cstring>
 #include <functional>
+#include <initializer_list>
 #include <iostream>
 #include <memory>
 #include <optional>
 #include <ostream>
+#include <thread>
 #include <vector>
 
 namespace bptree {
 
-    class OLCRestart : public std::exception {};
+    /* backs off between the restarts of an optimistic operation: spins
+     * for a doubling number of pause instructions first, then yields the
+     * CPU so that the writer holding the lock can finish */
+    class RestartBackoff {
+    public:
+        static constexpr unsigned int MAX_SPIN_ROUNDS = 8;
+
+        RestartBackoff() : rounds(0) {}
+
+        void pause()
+        {
+            if (rounds < MAX_SPIN_ROUNDS) {
+                for (unsigned int i = 0; i < (1u << rounds); i++) {
+                    cpu_relax();
+                }
+                rounds++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+
+    private:
+        unsigned int rounds;
+
+        static void cpu_relax()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield");
+#endif
+        }
+    };
+
+    /* the key that separates a node ending with left from its right sibling
+     * starting with right in their parent. shortened if the serializer can
+     * do it for the default order */
+    template <typename K, typename KeyComparator, typename KeySerializer>
+    K separator_key(const KeySerializer& ser, const K& left, const K& right)
+    {
+        if constexpr (has_shorten<KeySerializer, K>::value &&
+                      std::is_same<KeyComparator, std::less<K>>::value) {
+            return ser.shorten(left, right);
+        } else {
+            return right;
+        }
+    }
+
+    /* the split point m in [lo, hi] that keeps the larger of the two sides
+     * smallest, where the bytes left of m, left(m), grow with m and the bytes
+     * right of it, right(m), shrink */
+    template <typename Left, typename Right>
+    size_t balanced_split(size_t lo, size_t hi, Left left, Right right)
+    {
+        size_t first = lo, last = hi;
+        while (first < last) {
+            size_t m = first + (last - first) / 2;
+            if (left(m) >= right(m)) {
+                last = m;
+            } else {
+                first = m + 1;
+            }
+        }
+
+        if (first > lo && std::max(left(first - 1), right(first - 1)) <
+                              std::max(left(first), right(first))) {
+            first--;
+        }
+        return first;
+    }
 
     template <unsigned int N, typename K, typename V, typename KeySerializer,
-            typename KeyComparator, typename KeyEq, typename ValueSerializer>
+            typename KeyComparator, typename KeyEq, typename ValueSerializer,
+            unsigned int LeafN>
     class BTree;
 
     template <typename K, typename V, typename KeyComparator, typename KeyEq>
@@ -26,7 +102,8 @@ namespace bptree {
         BaseNode(BaseNode* parent, PageID pid, KeyComparator kcmp = KeyComparator{},
                 KeyEq keq = KeyEq{})
             : pid(pid), parent(parent), kcmp(kcmp), keq(keq), size(0),
-            version_counter(0b100)
+            version_counter(initial_version()), referenced(false),
+            sibling_pid(Page::INVALID_PAGE_ID)
         {}
 
         virtual ~BaseNode() = default;
@@ -40,18 +117,120 @@ namespace bptree {
         size_t get_size() const { return size; }
         void set_size(size_t size) { this->size = size; }
 
-        virtual void serialize(uint8_t* buf, size_t size) const = 0;
+        /* a split only locks the node that splits. the new right sibling
+         * hangs off the node until the parent links it in a second, short
+         * critical section (see InnerNode::link_sibling()). meanwhile keys
+         * that are not less than the sibling key belong to the sibling, it
+         * is the high key and right link of a B-link tree. the sibling's
+         * parent is the node until then */
+        bool has_sibling() const { return sibling_pid != Page::INVALID_PAGE_ID; }
+        const K& get_sibling_key() const { return sibling_key; }
+        bool sibling_covers(const K& key) const
+        {
+            return has_sibling() && !kcmp(key, sibling_key);
+        }
+
+        /* the node is write-locked */
+        void set_sibling(std::unique_ptr<BaseNode> node, const K& key)
+        {
+            sibling_pid = node->get_pid();
+            sibling_key = key;
+            sibling = std::move(node);
+        }
+
+        /* hand the sibling over to the parent that links it, the node is
+         * write-locked. the sibling is nullptr if it is not in memory */
+        std::unique_ptr<BaseNode> unlink_sibling(PageID& pid, K& key)
+        {
+            pid = sibling_pid;
+            key = sibling_key;
+            sibling_pid = Page::INVALID_PAGE_ID;
+            return std::move(sibling);
+        }
+
+        /* the sibling of a key that sibling_covers(), the node is read-locked
+         * with version. a sibling that is not in memory yet is read like a
+         * child by get_child(), nullptr is returned and a restart requested */
+        BaseNode* move_right(uint64_t& version, bool& need_restart)
+        {
+            auto* node = sibling.get();
+            if (!node) {
+                version = upgrade_to_write_lock_or_restart(version, need_restart);
+                if (need_restart) return nullptr;
+
+                if (!sibling && has_sibling()) {
+                    sibling = read_sibling();
+                }
+
+                write_unlock();
+                need_restart = true;
+                return nullptr;
+            }
+
+            need_restart = read_unlock_or_restart(version);
+            return need_restart ? nullptr : node;
+        }
+
+        /* reference bit for the node cache eviction */
+        bool is_referenced() const
+        {
+            return referenced.load(std::memory_order_relaxed);
+        }
+        void set_referenced(bool r)
+        {
+            if (is_referenced() != r) {
+                referenced.store(r, std::memory_order_relaxed);
+            }
+        }
+
+        /* slots before first_slot are the same as on the page and are not
+         * written again if the serializers allow it */
+        virtual void serialize(uint8_t* buf, size_t size,
+                               size_t first_slot = 0) const = 0;
         virtual void deserialize(const uint8_t* buf, size_t size) = 0;
 
+        /* the node is merged with or refilled from a neighbour by erase */
+        virtual bool is_underfull() const = 0;
+
+        /* the operations below set need_restart instead of finishing when
+         * they run into a concurrent update. all locks they took are
+         * released by then and the caller starts over from the root */
+
+        /* with collect, all pairs of the leaf of key are returned and
+         * next_leaf is set to its right sibling */
         virtual void get_values(const K& key, bool collect,
-                                std::optional<K>* next_key,
+                                PageID* next_leaf,
                                 std::vector<K>* key_list,
                                 std::vector<V>& value_list,
-                                uint64_t parent_version) = 0;
+                                uint64_t parent_version, bool& need_restart) = 0;
+
+        bool insert(const K& key, const V& val, uint64_t parent_version,
+                    bool& need_restart)
+        {
+            size_t num_inserted;
+            return insert_run(&key, &val, 1, nullptr, num_inserted,
+                              parent_version, need_restart);
+        }
 
-        virtual std::unique_ptr<BaseNode> insert(const K& key, const V& val,
-                                                K& split_key,
-                                                uint64_t parent_version) = 0;
+        /* insert a prefix of the n sorted pairs into the leaf of keys[0]
+         * with one lock and one write, num_inserted is set to its length.
+         * the prefix ends before the first key that is not less than *upper
+         * (the bound of the subtree, nullptr if there is none) or does not
+         * fit in the leaf. a full node on the way is split like by insert()
+         * and nothing is inserted. returns true if the node that was split
+         * keeps a sibling for the caller to link, see has_sibling() */
+        virtual bool insert_run(const K* keys, const V* vals, size_t n,
+                                const K* upper, size_t& num_inserted,
+                                uint64_t parent_version, bool& need_restart) = 0;
+
+        /* remove the pairs of key (only those equal to *value unless value
+         * is nullptr) from the leaf that get_values() would search, returns
+         * the # of pairs removed. underflow is set if the leaf is left with
+         * too few pairs. without remove, only the underfull nodes on the
+         * path to the leaf are fixed */
+        virtual size_t erase(const K& key, const V* value, bool remove,
+                             bool& underflow, uint64_t parent_version,
+                             bool& need_restart) = 0;
 
         virtual uint64_t read_lock_or_restart(bool& need_restart)
         {
@@ -80,14 +259,22 @@ namespace bptree {
         }
 
         virtual void write_unlock() { version_counter.fetch_add(0b10); }
+        /* release the write lock on a node that was unlinked from the tree,
+         * all readers that still reach it restart */
+        virtual void write_unlock_obsolete() { version_counter.fetch_add(0b11); }
         virtual bool read_unlock_or_restart(uint64_t start_version) const
         {
             return (start_version != version_counter.load());
         }
 
-        virtual void
-        print(std::ostream& os,
-            const std::string& padding = "") = 0; /* for debug purpose */
+        /* for debug purpose. the subtree is walked optimistically, the
+         * output is incomplete if need_restart is set */
+        virtual void print(std::ostream& os, const std::string& padding,
+                           bool& need_restart) = 0;
+
+        /* set in the size on the page of a node with a sibling that is not
+         * linked yet */
+        static constexpr uint32_t SIBLING_FLAG = 1u << 31;
 
     protected:
         size_t size;
@@ -96,29 +283,48 @@ namespace bptree {
         KeyComparator kcmp;
         KeyEq keq;
         std::atomic<uint64_t> version_counter;
+        std::atomic<bool> referenced;
+        PageID sibling_pid;
+        K sibling_key;
+        std::unique_ptr<BaseNode> sibling;
+
+        virtual std::unique_ptr<BaseNode> read_sibling() = 0;
 
         bool is_locked(uint64_t version) const { return (version & 0b10) == 0b10; }
         bool is_obsolete(uint64_t version) const { return (version & 1) == 1; }
+
+        /* a node checks the version of its parent against the one its
+         * caller read, but a split, rebalance or reload may have given it
+         * another parent since. versions start in distinct ranges so that
+         * the other parent never has the version that was read */
+        static uint64_t initial_version()
+        {
+            static std::atomic<uint64_t> next_range{1};
+            return (next_range.fetch_add(1, std::memory_order_relaxed) << 32) |
+                   0b100;
+        }
     };
 
     template <unsigned int N, typename K, typename V, typename KeySerializer,
-            typename KeyComparator, typename KeyEq, typename ValueSerializer>
+            typename KeyComparator, typename KeyEq, typename ValueSerializer,
+            unsigned int LeafN>
     class LeafNode;
 
     template <unsigned int N, typename K, typename V,
             typename KeySerializer = CopySerializer<K>,
             typename KeyComparator = std::less<K>,
             typename KeyEq = std::equal_to<K>,
-            typename ValueSerializer = CopySerializer<V>>
+            typename ValueSerializer = CopySerializer<V>,
+            unsigned int LeafN = N>
     class InnerNode : public BaseNode<K, V, KeyComparator, KeyEq> {
         friend class LeafNode<N, K, V, KeySerializer, KeyComparator, KeyEq,
-                            ValueSerializer>;
+                            ValueSerializer, LeafN>;
         friend class BTree<N, K, V, KeySerializer, KeyComparator, KeyEq,
-                        ValueSerializer>;
+                        ValueSerializer, LeafN>;
 
     public:
         InnerNode(BTree<N, K, V, KeySerializer, KeyComparator, KeyEq,
-                        ValueSerializer>* tree,
+                        ValueSerializer, LeafN>* tree,
                 BaseNode<K, V, KeyComparator, KeyEq>* parent,
                 PageID pid = Page::INVALID_PAGE_ID,
                 KeySerializer kser = KeySerializer{},
@@ -126,26 +332,58 @@ namespace bptree {
             : BaseNode<K, V, KeyComparator, KeyEq>(parent, pid), tree(tree),
             key_serializer(kser)
         {
-            for (int i = 0; i < N + 1; i++) {
+            for (unsigned int i = 0; i < N; i++) {
                 child_pages[i] = Page::INVALID_PAGE_ID;
             }
+            tree->node_created();
         }
 
+        ~InnerNode() { tree->node_destroyed(); }
+
+        /* nodes come from a pool of their type, see ObjectPool */
+        static void* operator new(size_t size)
+        {
+            if (size != sizeof(InnerNode)) return ::operator new(size);
+            return ObjectPool<InnerNode>::allocate();
+        }
+
+        static void operator delete(void* p, size_t size)
+        {
+            if (size != sizeof(InnerNode)) return ::operator delete(p);
+            ObjectPool<InnerNode>::deallocate(p);
+        }
+
+        static constexpr bool FIXED_STRIDE = is_fixed_stride<K, KeySerializer>::value;
+
+        /* keys of varying length, the node is full when its page is */
+        static constexpr bool VARIABLE_SIZE =
+            has_encoded_size<KeySerializer, K>::value;
+
+        /* bytes of a full inner node on its page after the tag */
+        static constexpr size_t MAX_SERIALIZED_SIZE =
+            sizeof(uint32_t) + (N - 1) * sizeof(K) + N * sizeof(PageID);
+
+        /* a child that is not in memory yet is read while this node is
+         * write-locked, the lock is then released and a restart requested */
         BaseNode<K, V, KeyComparator, KeyEq>* get_child(int idx, bool write_locked,
-                                                        uint64_t& version)
+                                                        uint64_t& version,
+                                                        bool& need_restart)
         {
-            if (child_cache[idx]) {
+            need_restart = false;
+            /* loaded once, a concurrent writer may reset the slot */
+            auto* child = child_cache[idx].get();
+            if (child) {
                 /* child in cache */
-                return child_cache[idx].get();
+                child->set_referenced(true);
+                return child;
             }
 
             if (child_pages[idx] != Page::INVALID_PAGE_ID) {
                 /* read child from page cache */
-                bool need_restart;
                 if (!write_locked) {
                     version = this->upgrade_to_write_lock_or_restart(version,
                                                                     need_restart);
-                    if (need_restart) throw OLCRestart();
+                    if (need_restart) return nullptr;
                 }
 
                 if (!child_cache[idx]) {
@@ -153,115 +391,222 @@ namespace bptree {
                 }
 
                 this->write_unlock();
-                throw OLCRestart();
-
-                /* unreachable */
-                return child_cache[idx].get();
+                need_restart = true;
+                return nullptr;
             }
 
+            /* an optimistic reader saw a slot in the middle of an update */
+            need_restart = !write_locked;
             return nullptr;
         }
 
-        virtual void serialize(uint8_t* buf, size_t size) const
+        virtual void serialize(uint8_t* buf, size_t size,
+                               size_t first_slot = 0) const
         {
-            /* | size | keys | child_pages | */
-            *reinterpret_cast<uint32_t*>(buf) = (uint32_t)this->size;
+            /* | size | keys | child_pages |. a sibling that is not linked
+             * yet sets SIBLING_FLAG, its key and page ID follow the ones of
+             * the node (in the last slots of the fixed-stride layout, a node
+             * with a sibling leaves them free) */
+            bool has_sibling = this->has_sibling();
+            *reinterpret_cast<uint32_t*>(buf) =
+                (uint32_t)this->size | (has_sibling ? this->SIBLING_FLAG : 0);
             buf += sizeof(uint32_t);
             size -= sizeof(uint32_t);
-            size_t nbytes =
-                key_serializer.serialize(buf, size, keys.begin(), keys.end());
+
+            if constexpr (FIXED_STRIDE) {
+                /* only the used slots from first_slot on */
+                first_slot = std::min(first_slot, this->size);
+                ::memcpy(buf + first_slot * sizeof(K), &keys[first_slot],
+                         (this->size - first_slot) * sizeof(K));
+                if (has_sibling) {
+                    ::memcpy(buf + (N - 2) * sizeof(K), &this->sibling_key,
+                             sizeof(K));
+                }
+                buf += (N - 1) * sizeof(K);
+                ::memcpy(buf + first_slot * sizeof(PageID),
+                         &child_pages[first_slot],
+                         (this->size + 1 - first_slot) * sizeof(PageID));
+                if (has_sibling) {
+                    ::memcpy(buf + (N - 1) * sizeof(PageID), &this->sibling_pid,
+                             sizeof(PageID));
+                }
+                return;
+            }
+
+            size_t nbytes = key_serializer.serialize(buf, size, keys.begin(),
+                                                     keys.begin() + this->size);
             buf += nbytes;
             size -= nbytes;
-            ::memcpy(buf, child_pages.begin(), sizeof(PageID) * (N + 1));
+            if (has_sibling) {
+                nbytes = key_serializer.serialize(buf, size, &this->sibling_key,
+                                                  &this->sibling_key + 1);
+                buf += nbytes;
+                size -= nbytes;
+            }
+            ::memcpy(buf, child_pages.begin(), sizeof(PageID) * (this->size + 1));
+            if (has_sibling) {
+                ::memcpy(buf + sizeof(PageID) * (this->size + 1), &this->sibling_pid,
+                         sizeof(PageID));
+            }
         }
         virtual void deserialize(const uint8_t* buf, size_t size)
         {
-            this->size = (size_t) * reinterpret_cast<const uint32_t*>(buf);
+            uint32_t header = *reinterpret_cast<const uint32_t*>(buf);
+            bool has_sibling = (header & this->SIBLING_FLAG) != 0;
             buf += sizeof(uint32_t);
             size -= sizeof(uint32_t);
-            size_t nbytes =
-                key_serializer.deserialize(keys.begin(), keys.end(), buf, size);
-            buf += nbytes;
-            size -= nbytes;
-            ::memcpy(child_pages.begin(), buf, sizeof(PageID) * (N + 1));
+            /* a torn or corrupt page must not overrun the arrays */
+            this->size = std::min<size_t>(header & ~this->SIBLING_FLAG,
+                                          has_sibling ? N - 2 : N - 1);
+            this->sibling_pid = Page::INVALID_PAGE_ID;
+            this->sibling.reset();
+
+            PageID sibling_pid = Page::INVALID_PAGE_ID;
+            if constexpr (FIXED_STRIDE) {
+                ::memcpy(keys.begin(), buf, this->size * sizeof(K));
+                if (has_sibling) {
+                    ::memcpy(&this->sibling_key, buf + (N - 2) * sizeof(K),
+                             sizeof(K));
+                }
+                buf += (N - 1) * sizeof(K);
+                ::memcpy(child_pages.begin(), buf,
+                         (this->size + 1) * sizeof(PageID));
+                if (has_sibling) {
+                    ::memcpy(&sibling_pid, buf + (N - 1) * sizeof(PageID),
+                             sizeof(PageID));
+                }
+            } else {
+                size_t nbytes = key_serializer.deserialize(
+                    keys.begin(), keys.begin() + this->size, buf, size);
+                buf += nbytes;
+                size -= nbytes;
+                if (has_sibling) {
+                    nbytes = key_serializer.deserialize(
+                        &this->sibling_key, &this->sibling_key + 1, buf, size);
+                    buf += nbytes;
+                    size -= nbytes;
+                }
+                ::memcpy(child_pages.begin(), buf,
+                         sizeof(PageID) * (this->size + 1));
+                if (has_sibling) {
+                    ::memcpy(&sibling_pid, buf + sizeof(PageID) * (this->size + 1),
+                             sizeof(PageID));
+                }
+            }
+            std::fill(child_pages.begin() + this->size + 1, child_pages.end(),
+                      Page::INVALID_PAGE_ID);
+            if (has_sibling) this->sibling_pid = sibling_pid;
             for (auto&& p : child_cache) {
                 p.reset();
             }
         }
 
+        virtual bool is_underfull() const
+        {
+            if (this->size >= UNDERFLOW_SIZE) return false;
+            if constexpr (VARIABLE_SIZE) {
+                return 4 * encoded_bytes(keys.data(), this->size) <
+                       tree->get_node_capacity();
+            }
+            return true;
+        }
+
         virtual void get_values(const K& key, bool collect,
-                                std::optional<K>* next_key,
+                                PageID* next_leaf,
                                 std::vector<K>* key_list,
-                                std::vector<V>& value_list, uint64_t parent_version)
+                                std::vector<V>& value_list, uint64_t parent_version,
+                                bool& need_restart)
         {
             uint64_t version;
-            bool need_restart;
             version = this->read_lock_or_restart(need_restart);
-            if (need_restart) throw OLCRestart();
+            if (need_restart) return;
 
             if (this->parent &&
                 this->parent->read_unlock_or_restart(parent_version)) {
-                throw OLCRestart();
+                need_restart = true;
+                return;
             }
 
-            /* direct the search to the child */
-            int child_idx;
-            child_idx = std::distance(keys.begin(),
-                                    std::upper_bound(keys.begin(),
-                                                    keys.begin() + this->size,
-                                                    key, this->kcmp));
-
-            if (next_key && child_idx < this->size) {
-                *next_key = keys[child_idx];
+            if (this->sibling_covers(key)) {
+                auto* sibling = this->move_right(version, need_restart);
+                if (!sibling) return;
+                sibling->get_values(key, collect, next_leaf, key_list, value_list,
+                                    version, need_restart);
+                return;
             }
 
-            auto child = get_child(child_idx, false, version);
+            /* direct the search to the child */
+            int child_idx =
+                upper_bound_index(keys.data(), this->size, key, this->kcmp);
+
+            auto child = get_child(child_idx, false, version, need_restart);
             if (!child) return;
 
-            if (this->read_unlock_or_restart(version)) throw OLCRestart();
+            if (this->read_unlock_or_restart(version)) {
+                need_restart = true;
+                return;
+            }
 
-            child->get_values(key, collect, next_key, key_list, value_list,
-                            version);
+            child->get_values(key, collect, next_leaf, key_list, value_list,
+                            version, need_restart);
         }
 
-        virtual std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>>
-        insert(const K& key, const V& val, K& split_key, uint64_t parent_version)
+        virtual bool insert_run(const K* run_keys, const V* run_vals, size_t n,
+                                const K* upper, size_t& num_inserted,
+                                uint64_t parent_version, bool& need_restart)
         {
-            bool need_restart;
+            num_inserted = 0;
             auto version = this->read_lock_or_restart(need_restart);
-            if (need_restart) throw OLCRestart();
+            if (need_restart) return false;
+
+            if (this->sibling_covers(run_keys[0])) {
+                if (this->parent &&
+                    this->parent->read_unlock_or_restart(parent_version)) {
+                    need_restart = true;
+                    return false;
+                }
+                auto* sibling = this->move_right(version, need_restart);
+                if (!sibling) return false;
+                return sibling->insert_run(run_keys, run_vals, n, upper,
+                                           num_inserted, version, need_restart);
+            }
 
-            if (this->size == N - 1) { /* node is full, do eager split */
-                /* upgrade parent's and own lock to write lock */
-                if (this->parent) {
-                    parent_version = this->parent->upgrade_to_write_lock_or_restart(
-                        parent_version, need_restart);
-                    if (need_restart) throw OLCRestart();
+            if (is_full()) { /* node is full, do eager split */
+                /* the parent links the sibling of the last split first */
+                if (this->has_sibling()) {
+                    need_restart = true;
+                    return false;
                 }
 
+                /* allocate the new sibling's page before taking the lock */
+                tree->reserve_split_pages();
+
+                /* only this node is locked, the parent is not needed until
+                 * the sibling is linked */
                 version =
                     this->upgrade_to_write_lock_or_restart(version, need_restart);
-                if (need_restart) {
-                    if (this->parent) {
-                        this->parent->write_unlock();
-                    }
-                    throw OLCRestart();
-                }
+                if (need_restart) return false;
 
-                /* safe to split now */
+                /* the pages of both halves are logged as one batch. it is
+                 * appended before the node is unlocked, so it precedes the
+                 * batch of the parent that links the sibling */
+                tree->begin_log_group();
                 auto right_sibling = tree->template create_node<InnerNode<
-                    N, K, V, KeySerializer, KeyComparator, KeyEq, ValueSerializer>>(
-                    this->parent);
+                    N, K, V, KeySerializer, KeyComparator, KeyEq, ValueSerializer,
+                    LeafN>>(
+                    this);
+                tree->node_split();
 
-                right_sibling->size = this->size - N / 2 - 1;
+                size_t mid = split_index();
+                right_sibling->size = this->size - mid - 1;
 
-                ::memcpy(right_sibling->keys.begin(), &this->keys[N / 2 + 1],
+                ::memcpy(right_sibling->keys.begin(), &this->keys[mid + 1],
                         sizeof(K) * right_sibling->size);
                 ::memcpy(right_sibling->child_pages.begin(),
-                        &this->child_pages[N / 2 + 1],
+                        &this->child_pages[mid + 1],
                         sizeof(PageID) * (1 + right_sibling->size));
 
-                for (size_t i = N / 2 + 1, j = 0; i <= this->size; i++, j++) {
+                for (size_t i = mid + 1, j = 0; i <= this->size; i++, j++) {
                     right_sibling->child_cache[j] = std::move(this->child_cache[i]);
                     if (right_sibling->child_cache[j]) {
                         right_sibling->child_cache[j]->set_parent(
@@ -269,151 +614,846 @@ namespace bptree {
                     }
                 }
 
-                split_key = this->keys[N / 2];
-                this->size = N / 2;
+                K split_key = this->keys[mid];
+                this->size = mid;
 
-                tree->write_node(this);
+                /* the slots that stay have not moved */
                 tree->write_node(right_sibling.get());
+                this->set_sibling(std::move(right_sibling), split_key);
+                tree->write_node(this, this->size);
+                tree->end_log_group();
 
-                /* if the current node is the root node, the lock is not
-                * released until new root is created in BTree::insert() */
-                if (this->parent) {
-                    this->write_unlock();
-                }
-
-                /* hold parent's lock until the new sibling node has been
-                * inserted into parent node */
-                return right_sibling;
+                this->write_unlock();
+                need_restart = true;
+                return true;
             }
 
             if (this->parent) {
-                if (this->parent->read_unlock_or_restart(parent_version))
-                    throw OLCRestart();
+                if (this->parent->read_unlock_or_restart(parent_version)) {
+                    need_restart = true;
+                    return false;
+                }
             }
 
-            auto it = std::upper_bound(keys.begin(), keys.begin() + this->size, key,
-                                    this->kcmp);
-            if (this->read_unlock_or_restart(version))
-                throw OLCRestart(); /* make sure current node is still valid */
+            int child_idx = upper_bound_index(keys.data(), this->size,
+                                              run_keys[0], this->kcmp);
+            /* the bound of the child, a single key needs none. the last
+             * child ends where the keys of the sibling begin */
+            K child_upper;
+            if (n > 1 && child_idx < (int)this->size) {
+                child_upper = keys[child_idx];
+                upper = &child_upper;
+            } else if (n > 1 && this->has_sibling()) {
+                child_upper = this->sibling_key;
+                upper = &child_upper;
+            }
+            /* make sure current node is still valid */
+            if (this->read_unlock_or_restart(version)) {
+                need_restart = true;
+                return false;
+            }
 
-            int child_idx = it - keys.begin();
-            auto child = get_child(child_idx, false, version);
-            auto new_child = child->insert(key, val, split_key, version);
+            auto child = get_child(child_idx, false, version, need_restart);
+            if (need_restart) return false;
 
-            if (!new_child)
-                return nullptr; /* child did not split so the lock is already
-                                released in child insert */
+            /* a child that split is linked before anything goes into it */
+            if (child->has_sibling()) {
+                link_sibling(child_idx, version);
+                need_restart = true;
+                return false;
+            }
 
-            /* insert the key pushed up by the child to current node
-            * we may assume that current node will not overflow at this point
-            */
-            ::memmove(&keys[child_idx + 1], &keys[child_idx],
-                    (this->size - child_idx) * sizeof(K));
-            ::memmove(&child_pages[child_idx + 2], &child_pages[child_idx + 1],
-                    (this->size - child_idx) * sizeof(PageID));
-            for (size_t i = this->size; i > child_idx; i--) {
-                child_cache[i + 1] = std::move(child_cache[i]);
+            if (child->insert_run(run_keys, run_vals, n, upper, num_inserted,
+                                  version, need_restart)) {
+                /* the second half of the child's split, it restarts anyway */
+                link_sibling(child_idx, version);
             }
+            return false;
+        }
 
-            keys[child_idx] = split_key;
-            child_pages[child_idx + 1] = new_child->get_pid();
-            child_cache[child_idx + 1] = std::move(new_child);
+        virtual size_t erase(const K& key, const V* value, bool remove,
+                             bool& underflow, uint64_t parent_version,
+                             bool& need_restart)
+        {
+            /* a child that cannot be rebalanced is passed through as it is
+             * on the second try */
+            for (bool fix_child = true;; fix_child = false) {
+                auto version = this->read_lock_or_restart(need_restart);
+                if (need_restart) return 0;
+
+                if (this->parent &&
+                    this->parent->read_unlock_or_restart(parent_version)) {
+                    need_restart = true;
+                    return 0;
+                }
 
-            this->size++;
-            tree->write_node(this);
+                if (this->sibling_covers(key)) {
+                    auto* sibling = this->move_right(version, need_restart);
+                    if (!sibling) return 0;
+                    return sibling->erase(key, value, remove, underflow, version,
+                                          need_restart);
+                }
 
-            /* current lock is upgraded during child insert, release the lock
-            * now and restart */
-            this->write_unlock();
-            throw OLCRestart();
+                int child_idx =
+                    upper_bound_index(keys.data(), this->size, key, this->kcmp);
 
-            return nullptr;
+                auto child = get_child(child_idx, false, version, need_restart);
+                if (!child) {
+                    if (!need_restart) {
+                        need_restart = this->read_unlock_or_restart(version);
+                    }
+                    return 0;
+                }
+
+                auto child_version = child->read_lock_or_restart(need_restart);
+                if (need_restart) return 0;
+                bool child_underfull = child->is_underfull();
+                bool child_is_leaf = child->is_leaf();
+                if (this->read_unlock_or_restart(version)) {
+                    need_restart = true;
+                    return 0;
+                }
+
+                /* underflows are fixed lazily on the way down, the same way
+                 * splits are done eagerly by insert. both restart from the
+                 * root afterwards */
+                if (fix_child && this->size > 0 && child_underfull) {
+                    need_restart = rebalance(child_idx, version, child_version);
+                    if (need_restart) return 0;
+                    continue;
+                }
+                if (!this->parent && this->size == 0 && !child_is_leaf) {
+                    absorb_child(version, child_version);
+                    need_restart = true;
+                    return 0;
+                }
+
+                return child->erase(key, value, remove, underflow, version,
+                                    need_restart);
+            }
         }
 
-        virtual void print(std::ostream& os, const std::string& padding = "")
+        virtual void print(std::ostream& os, const std::string& padding,
+                           bool& need_restart)
         {
-            uint64_t version;
-            this->get_child(0, true, version)->print(os, padding + "    ");
-            for (int i = 0; i < this->size; i++) {
-                // os << padding << keys[i] << std::endl;
-                this->get_child(i + 1, true, version)->print(os, padding + "    ");
+            uint64_t version = this->read_lock_or_restart(need_restart);
+            if (need_restart) return;
+
+            size_t num_keys = this->size;
+            for (size_t i = 0; i <= num_keys; i++) {
+                auto* child = this->get_child(i, false, version, need_restart);
+                if (need_restart) return;
+                /* the child is still the one of slot i */
+                if (this->read_unlock_or_restart(version)) {
+                    need_restart = true;
+                    return;
+                }
+
+                child->print(os, padding + "    ", need_restart);
+                if (need_restart) return;
+            }
+
+            if (this->has_sibling()) {
+                auto* sibling = this->move_right(version, need_restart);
+                if (!sibling) return;
+                sibling->print(os, padding, need_restart);
+                return;
             }
+
+            need_restart = this->read_unlock_or_restart(version);
+        }
+
+    protected:
+        virtual std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>> read_sibling()
+        {
+            return tree->read_node(this, this->sibling_pid);
         }
 
     private:
-        BTree<N, K, V, KeySerializer, KeyComparator, KeyEq, ValueSerializer>* tree;
-        std::array<K, N - 1> keys;
+        /* a child with fewer keys or pairs than this is merged with or
+         * refilled from a neighbour */
+        static constexpr size_t UNDERFLOW_SIZE = N / 4;
+
+        BTree<N, K, V, KeySerializer, KeyComparator, KeyEq, ValueSerializer, LeafN>* tree;
+        /* aligned so that the search reads whole cache lines */
+        alignas(64) std::array<K, N - 1> keys;
         std::array<PageID, N> child_pages;
         std::array<std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>>, N>
             child_cache;
         KeySerializer key_serializer;
+
+        using LeafType = LeafNode<N, K, V, KeySerializer, KeyComparator, KeyEq,
+                                  ValueSerializer, LeafN>;
+
+        enum class Rebalanced { MERGED, MOVED, UNCHANGED };
+
+        /* the slots of a sibling that is not linked yet are taken on the
+         * page */
+        size_t max_size() const { return this->has_sibling() ? N - 2 : N - 1; }
+
+        size_t sibling_bytes() const
+        {
+            return this->has_sibling()
+                       ? max_encoded_size<K>(key_serializer) + sizeof(PageID)
+                       : 0;
+        }
+
+        bool is_full() const
+        {
+            if (this->size >= max_size()) return true;
+            if constexpr (VARIABLE_SIZE) {
+                /* the keys are bounded one by one so that a key added by a
+                 * split below always fits */
+                size_t nbytes = sizeof(uint32_t) +
+                                max_encoded_size<K>(key_serializer) +
+                                (this->size + 2) * sizeof(PageID) + sibling_bytes();
+                for (size_t i = 0; i < this->size; i++) {
+                    nbytes += encoded_size(key_serializer, &keys[i], &keys[i + 1]);
+                }
+                return nbytes > tree->get_node_capacity();
+            }
+            return false;
+        }
+
+        /* bytes on the page after the tag of an inner node with n keys */
+        size_t encoded_bytes(const K* first, size_t n) const
+        {
+            return sizeof(uint32_t) + encoded_size(key_serializer, first, first + n) +
+                   (n + 1) * sizeof(PageID);
+        }
+
+        bool fits(const K* first, size_t n) const
+        {
+            return n <= N - 1 && encoded_bytes(first, n) <= tree->get_node_capacity();
+        }
+
+        /* the key that moves up when the full node is split */
+        size_t split_index() const
+        {
+            if constexpr (VARIABLE_SIZE) {
+                size_t mid = balanced_split(
+                    1, this->size - 1,
+                    [this](size_t m) { return encoded_bytes(keys.data(), m); },
+                    [this](size_t m) {
+                        return encoded_bytes(&keys[m + 1], this->size - m - 1);
+                    });
+                /* the left half keeps the key of the new sibling */
+                size_t capacity = tree->get_node_capacity() -
+                                  max_encoded_size<K>(key_serializer) -
+                                  sizeof(PageID);
+                while (mid > 1 && encoded_bytes(keys.data(), mid) > capacity) {
+                    mid--;
+                }
+                return mid;
+            }
+            return N / 2;
+        }
+
+        /* whether the node still fits after keys[idx] is replaced by key */
+        bool fits_with_key(size_t idx, const K& key) const
+        {
+            if constexpr (VARIABLE_SIZE) {
+                std::vector<K> new_keys(keys.begin(), keys.begin() + this->size);
+                new_keys[idx] = key;
+                return fits(new_keys.data(), new_keys.size());
+            }
+            return true;
+        }
+
+        /* the second half of a split of the child at child_idx: the sibling
+         * it kept is linked into this node, which is read-locked with version
+         * and has room for it. the child's page drops the link in the same
+         * batch. all locks are released, the caller restarts either way */
+        void link_sibling(int child_idx, uint64_t version)
+        {
+            bool need_restart;
+            version = this->upgrade_to_write_lock_or_restart(version, need_restart);
+            if (need_restart) return;
+
+            auto* child = child_cache[child_idx].get();
+            if (child) child->write_lock_or_restart(need_restart);
+            if (!child || need_restart) {
+                this->write_unlock();
+                return;
+            }
+            if (!child->has_sibling()) {
+                child->write_unlock();
+                this->write_unlock();
+                return;
+            }
+
+            tree->begin_log_group();
+            PageID sibling_pid;
+            K sibling_key;
+            auto sibling = child->unlink_sibling(sibling_pid, sibling_key);
+            if (sibling) sibling->set_parent(this);
+
+            ::memmove(&keys[child_idx + 1], &keys[child_idx],
+                      (this->size - child_idx) * sizeof(K));
+            ::memmove(&child_pages[child_idx + 2], &child_pages[child_idx + 1],
+                      (this->size - child_idx) * sizeof(PageID));
+            for (size_t i = this->size; i > (size_t)child_idx; i--) {
+                child_cache[i + 1] = std::move(child_cache[i]);
+            }
+
+            keys[child_idx] = sibling_key;
+            child_pages[child_idx + 1] = sibling_pid;
+            child_cache[child_idx + 1] = std::move(sibling);
+            this->size++;
+
+            tree->write_node(child, child->get_size());
+            tree->write_node(this, child_idx);
+            tree->end_log_group();
+
+            child->write_unlock();
+            this->write_unlock();
+        }
+
+        /* merge the child at child_idx with a neighbour if both fit in one
+         * node, otherwise even out their sizes. returns whether the caller
+         * has to restart, which it always has to unless nothing could be
+         * moved. all locks are released either way */
+        bool rebalance(int child_idx, uint64_t version, uint64_t child_version)
+        {
+            bool need_restart;
+            version = this->upgrade_to_write_lock_or_restart(version, need_restart);
+            if (need_restart) return true;
+
+            int left_idx = child_idx < (int)this->size ? child_idx : child_idx - 1;
+            /* loading a neighbour releases the lock and restarts */
+            for (int idx : {left_idx, left_idx + 1}) {
+                get_child(idx, true, version, need_restart);
+                if (need_restart) return true;
+            }
+
+            auto* child = child_cache[child_idx].get();
+            auto* sibling =
+                child_cache[child_idx == left_idx ? left_idx + 1 : left_idx].get();
+
+            child->upgrade_to_write_lock_or_restart(child_version, need_restart);
+            if (need_restart) {
+                this->write_unlock();
+                return true;
+            }
+            sibling->write_lock_or_restart(need_restart);
+            if (need_restart) {
+                child->write_unlock();
+                this->write_unlock();
+                return true;
+            }
+
+            auto* left = child_cache[left_idx].get();
+            auto* right = child_cache[left_idx + 1].get();
+            /* the children stay locked until the batch with their pages and
+             * this node's is appended, nobody else logs a write of them in
+             * between */
+            tree->begin_log_group();
+            Rebalanced result;
+            if (left->has_sibling() || right->has_sibling()) {
+                /* the keys of a sibling that is not linked yet lie between
+                 * them, it is linked first */
+                result = Rebalanced::UNCHANGED;
+            } else if (left->is_leaf()) {
+                result = rebalance_leaves(left_idx, static_cast<LeafType*>(left),
+                                          static_cast<LeafType*>(right));
+            } else {
+                result = rebalance_inner(left_idx, static_cast<InnerNode*>(left),
+                                         static_cast<InnerNode*>(right));
+            }
+
+            if (result == Rebalanced::UNCHANGED) {
+                tree->end_log_group();
+                left->write_unlock();
+                right->write_unlock();
+                this->write_unlock();
+                return false;
+            }
+
+            if (result == Rebalanced::MERGED) {
+                /* the right node is emptied into the left one */
+                std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>> retired =
+                    std::move(child_cache[left_idx + 1]);
+                remove_child(left_idx + 1);
+                tree->write_node(this);
+                tree->end_log_group();
+                tree->nodes_merged();
+
+                left->write_unlock();
+                retired->write_unlock_obsolete();
+                tree->retire_node(std::move(retired));
+            } else {
+                tree->write_node(this);
+                tree->end_log_group();
+                left->write_unlock();
+                right->write_unlock();
+            }
+
+            this->write_unlock();
+            return true;
+        }
+
+        /* the node that receives pairs is written first so that a scan along
+         * the leaf chain sees them at least once */
+        Rebalanced rebalance_leaves(int left_idx, LeafType* left, LeafType* right)
+        {
+            size_t total = left->size + right->size;
+            bool merge = total <= LeafN - 1;
+            size_t left_size = total / 2;
+
+            if constexpr (LeafType::VARIABLE_SIZE) {
+                std::vector<K> all_keys(left->keys.begin(),
+                                        left->keys.begin() + left->size);
+                all_keys.insert(all_keys.end(), right->keys.begin(),
+                                right->keys.begin() + right->size);
+                std::vector<V> all_values(left->values.begin(),
+                                          left->values.begin() + left->size);
+                all_values.insert(all_values.end(), right->values.begin(),
+                                  right->values.begin() + right->size);
+
+                size_t capacity = tree->get_node_capacity();
+                auto bytes = [&](size_t first, size_t last) {
+                    return left->encoded_bytes(all_keys.data() + first,
+                                               all_values.data() + first,
+                                               last - first);
+                };
+
+                merge = merge && bytes(0, total) <= capacity;
+                if (!merge) {
+                    left_size = balanced_split(
+                        1, total - 1, [&](size_t m) { return bytes(0, m); },
+                        [&](size_t m) { return bytes(m, total); });
+
+                    if (left_size == left->size || left_size > LeafN - 1 ||
+                        total - left_size > LeafN - 1 ||
+                        bytes(0, left_size) > capacity ||
+                        bytes(left_size, total) > capacity ||
+                        !fits_with_key(left_idx,
+                                       separator_key<K, KeyComparator>(
+                                           key_serializer, all_keys[left_size - 1],
+                                           all_keys[left_size]))) {
+                        return Rebalanced::UNCHANGED;
+                    }
+                }
+            }
+
+            if (merge) {
+                std::copy(right->keys.begin(), right->keys.begin() + right->size,
+                          left->keys.begin() + left->size);
+                std::copy(right->values.begin(),
+                          right->values.begin() + right->size,
+                          left->values.begin() + left->size);
+                left->size = total;
+                left->next_leaf = right->next_leaf;
+                tree->write_node(left);
+                return Rebalanced::MERGED;
+            }
+
+            if (left->size < left_size) {
+                size_t n = left_size - left->size;
+                std::copy(right->keys.begin(), right->keys.begin() + n,
+                          left->keys.begin() + left->size);
+                std::copy(right->values.begin(), right->values.begin() + n,
+                          left->values.begin() + left->size);
+                std::copy(right->keys.begin() + n,
+                          right->keys.begin() + right->size, right->keys.begin());
+                std::copy(right->values.begin() + n,
+                          right->values.begin() + right->size,
+                          right->values.begin());
+                left->size = left_size;
+                right->size = total - left_size;
+                tree->write_node(left);
+                tree->write_node(right);
+            } else {
+                size_t n = left->size - left_size;
+                std::copy_backward(right->keys.begin(),
+                                   right->keys.begin() + right->size,
+                                   right->keys.begin() + right->size + n);
+                std::copy_backward(right->values.begin(),
+                                   right->values.begin() + right->size,
+                                   right->values.begin() + right->size + n);
+                std::copy(left->keys.begin() + left_size,
+                          left->keys.begin() + left->size, right->keys.begin());
+                std::copy(left->values.begin() + left_size,
+                          left->values.begin() + left->size,
+                          right->values.begin());
+                left->size = left_size;
+                right->size = total - left_size;
+                tree->write_node(right);
+                tree->write_node(left);
+            }
+
+            keys[left_idx] = separator_key<K, KeyComparator>(
+                key_serializer, left->keys[left->size - 1], right->keys[0]);
+            return Rebalanced::MOVED;
+        }
+
+        /* the separator of left and right is pulled down into the merged
+         * node or rotated through this node */
+        Rebalanced rebalance_inner(int left_idx, InnerNode* left, InnerNode* right)
+        {
+            size_t total = left->size + right->size + 1;
+
+            std::vector<K> all_keys(left->keys.begin(),
+                                    left->keys.begin() + left->size);
+            all_keys.push_back(keys[left_idx]);
+            all_keys.insert(all_keys.end(), right->keys.begin(),
+                            right->keys.begin() + right->size);
+
+            size_t left_size = (total - 1) / 2;
+            bool merge = total <= N - 1;
+            if constexpr (VARIABLE_SIZE) {
+                merge = fits(all_keys.data(), total);
+                if (!merge) {
+                    left_size = balanced_split(
+                        1, total - 2,
+                        [&](size_t m) { return encoded_bytes(all_keys.data(), m); },
+                        [&](size_t m) {
+                            return encoded_bytes(&all_keys[m + 1], total - 1 - m);
+                        });
+
+                    if (left_size == left->size ||
+                        !fits(all_keys.data(), left_size) ||
+                        !fits(&all_keys[left_size + 1], total - 1 - left_size) ||
+                        !fits_with_key(left_idx, all_keys[left_size])) {
+                        return Rebalanced::UNCHANGED;
+                    }
+                }
+            }
+
+            if (merge) {
+                left->keys[left->size] = keys[left_idx];
+                std::copy(right->keys.begin(), right->keys.begin() + right->size,
+                          left->keys.begin() + left->size + 1);
+                for (size_t i = 0; i <= right->size; i++) {
+                    left->adopt(left->size + 1 + i, right, i);
+                }
+                left->size = total;
+                tree->write_node(left);
+                return Rebalanced::MERGED;
+            }
+
+            /* concatenate, then split again at the middle */
+            std::vector<PageID> all_pages;
+            std::vector<std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>>>
+                all_children;
+            for (auto* node : {left, right}) {
+                for (size_t i = 0; i <= node->size; i++) {
+                    all_pages.push_back(node->child_pages[i]);
+                    all_children.push_back(std::move(node->child_cache[i]));
+                    node->child_pages[i] = Page::INVALID_PAGE_ID;
+                }
+            }
+
+            for (size_t i = 0; i < all_pages.size(); i++) {
+                auto* node = i <= left_size ? left : right;
+                size_t idx = i <= left_size ? i : i - left_size - 1;
+                node->child_pages[idx] = all_pages[i];
+                node->child_cache[idx] = std::move(all_children[i]);
+                if (node->child_cache[idx]) node->child_cache[idx]->set_parent(node);
+            }
+
+            std::copy(all_keys.begin(), all_keys.begin() + left_size,
+                      left->keys.begin());
+            keys[left_idx] = all_keys[left_size];
+            std::copy(all_keys.begin() + left_size + 1, all_keys.end(),
+                      right->keys.begin());
+            left->size = left_size;
+            right->size = total - 1 - left_size;
+
+            tree->write_node(left);
+            tree->write_node(right);
+            return Rebalanced::MOVED;
+        }
+
+        bool has_cached_children() const
+        {
+            for (size_t i = 0; i <= this->size; i++) {
+                if (child_cache[i]) return true;
+            }
+            return false;
+        }
+
+        /* move the child at from->child_*[from_idx] to slot idx */
+        void adopt(size_t idx, InnerNode* from, size_t from_idx)
+        {
+            child_pages[idx] = from->child_pages[from_idx];
+            child_cache[idx] = std::move(from->child_cache[from_idx]);
+            if (child_cache[idx]) child_cache[idx]->set_parent(this);
+        }
+
+        void remove_child(int idx)
+        {
+            std::copy(keys.begin() + idx, keys.begin() + this->size,
+                      keys.begin() + idx - 1);
+            for (size_t i = idx; i < this->size; i++) {
+                child_pages[i] = child_pages[i + 1];
+                child_cache[i] = std::move(child_cache[i + 1]);
+            }
+            child_pages[this->size] = Page::INVALID_PAGE_ID;
+            this->size--;
+        }
+
+        /* a root with a single inner child takes over the child's content so
+         * that the tree shrinks without replacing the root node. the caller
+         * always restarts afterwards */
+        void absorb_child(uint64_t version, uint64_t child_version)
+        {
+            bool need_restart;
+            version = this->upgrade_to_write_lock_or_restart(version, need_restart);
+            if (need_restart) return;
+
+            auto* child = static_cast<InnerNode*>(child_cache[0].get());
+            child->upgrade_to_write_lock_or_restart(child_version, need_restart);
+            if (need_restart) {
+                this->write_unlock();
+                return;
+            }
+            /* the child is not the only one while its sibling is not linked */
+            if (this->has_sibling() || child->has_sibling()) {
+                child->write_unlock();
+                this->write_unlock();
+                return;
+            }
+
+            std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>> retired =
+                std::move(child_cache[0]);
+
+            std::copy(child->keys.begin(), child->keys.begin() + child->size,
+                      keys.begin());
+            for (size_t i = 0; i <= child->size; i++) {
+                adopt(i, child, i);
+            }
+            this->size = child->size;
+            tree->write_node(this);
+
+            retired->write_unlock_obsolete();
+            tree->retire_node(std::move(retired));
+
+            this->write_unlock();
+        }
     };
 
     template <unsigned int N, typename K, typename V,
             typename KeySerializer = CopySerializer<K>,
             typename KeyComparator = std::less<K>,
             typename KeyEq = std::equal_to<K>,
-            typename ValueSerializer = CopySerializer<V>>
+            typename ValueSerializer = CopySerializer<V>,
+            unsigned int LeafN = N>
     class LeafNode : public BaseNode<K, V, KeyComparator, KeyEq> {
         friend class InnerNode<N, K, V, KeySerializer, KeyComparator, KeyEq,
-                            ValueSerializer>;
+                            ValueSerializer, LeafN>;
         friend class BTree<N, K, V, KeySerializer, KeyComparator, KeyEq,
-                        ValueSerializer>;
+                        ValueSerializer, LeafN>;
         friend class BTree<N, K, V, KeySerializer, KeyComparator, KeyEq,
-                        ValueSerializer>::iterator;
+                        ValueSerializer, LeafN>::iterator;
 
     public:
         LeafNode(BTree<N, K, V, KeySerializer, KeyComparator, KeyEq,
-                    ValueSerializer>* tree,
+                    ValueSerializer, LeafN>* tree,
                 BaseNode<K, V, KeyComparator, KeyEq>* parent,
                 PageID pid = Page::INVALID_PAGE_ID,
                 KeySerializer kser = KeySerializer{},
                 KeyComparator kcmp = KeyComparator{},
                 ValueSerializer vser = ValueSerializer{})
             : BaseNode<K, V, KeyComparator, KeyEq>(parent, pid, kcmp), tree(tree),
-            key_serializer(kser), value_serializer(vser)
-        {}
+            next_leaf(Page::INVALID_PAGE_ID), key_serializer(kser),
+            value_serializer(vser)
+        {
+            tree->node_created();
+        }
+
+        ~LeafNode() { tree->node_destroyed(); }
+
+        /* nodes come from a pool of their type, see ObjectPool */
+        static void* operator new(size_t size)
+        {
+            if (size != sizeof(LeafNode)) return ::operator new(size);
+            return ObjectPool<LeafNode>::allocate();
+        }
+
+        static void operator delete(void* p, size_t size)
+        {
+            if (size != sizeof(LeafNode)) return ::operator delete(p);
+            ObjectPool<LeafNode>::deallocate(p);
+        }
+
+        PageID get_next_leaf() const { return next_leaf; }
+
+        static constexpr bool FIXED_STRIDE =
+            is_fixed_stride<K, KeySerializer>::value &&
+            is_fixed_stride<V, ValueSerializer>::value;
+
+        /* bytes of a full leaf on its page after the tag, fixed-stride only */
+        static constexpr size_t MAX_SERIALIZED_SIZE =
+            sizeof(uint32_t) + sizeof(PageID) + (LeafN - 1) * (sizeof(K) + sizeof(V));
+
+        static constexpr size_t UNDERFLOW_SIZE = LeafN / 4;
+
+        /* keys or values of varying length, the leaf is full when its page
+         * is */
+        static constexpr bool VARIABLE_SIZE =
+            has_encoded_size<KeySerializer, K>::value ||
+            has_encoded_size<ValueSerializer, V>::value;
+
+        /* append the pairs of the serialized leaf in buf without building a
+         * node. only for the fixed-stride layout */
+        static void read_pairs(const uint8_t* buf, std::vector<K>& key_list,
+                               std::vector<V>& value_list, PageID& next_leaf)
+        {
+            static_assert(FIXED_STRIDE, "leaf layout is not fixed-stride");
+
+            constexpr uint32_t flag =
+                BaseNode<K, V, KeyComparator, KeyEq>::SIBLING_FLAG;
+            uint32_t header = *reinterpret_cast<const uint32_t*>(buf);
+            size_t size = std::min<size_t>(header & ~flag,
+                                           (header & flag) ? LeafN - 2 : LeafN - 1);
+            buf += sizeof(uint32_t);
+            next_leaf = *reinterpret_cast<const PageID*>(buf);
+            buf += sizeof(PageID);
+
+            const K* key_slots = reinterpret_cast<const K*>(buf);
+            const V* value_slots =
+                reinterpret_cast<const V*>(buf + (LeafN - 1) * sizeof(K));
+            key_list.insert(key_list.end(), key_slots, key_slots + size);
+            value_list.insert(value_list.end(), value_slots, value_slots + size);
+        }
 
         virtual bool is_leaf() const { return true; }
 
-        virtual void serialize(uint8_t* buf, size_t size) const
+        virtual void serialize(uint8_t* buf, size_t size,
+                               size_t first_slot = 0) const
         {
-            /* | size | keys | child_pages | */
-            *reinterpret_cast<uint32_t*>(buf) = (uint32_t)this->size;
+            /* | size | next leaf | keys | values |. a sibling that is not
+             * linked yet sets SIBLING_FLAG, it is the next leaf and its key
+             * follows the keys (in the last key slot of the fixed-stride
+             * layout, a leaf with a sibling leaves it free) */
+            bool has_sibling = this->has_sibling();
+            *reinterpret_cast<uint32_t*>(buf) =
+                (uint32_t)this->size | (has_sibling ? this->SIBLING_FLAG : 0);
             buf += sizeof(uint32_t);
             size -= sizeof(uint32_t);
-            size_t nbytes =
-                key_serializer.serialize(buf, size, keys.begin(), keys.end());
+            *reinterpret_cast<PageID*>(buf) = next_leaf;
+            buf += sizeof(PageID);
+            size -= sizeof(PageID);
+
+            if constexpr (FIXED_STRIDE) {
+                first_slot = std::min(first_slot, this->size);
+                ::memcpy(buf + first_slot * sizeof(K), &keys[first_slot],
+                         (this->size - first_slot) * sizeof(K));
+                if (has_sibling) {
+                    ::memcpy(buf + (LeafN - 2) * sizeof(K), &this->sibling_key,
+                             sizeof(K));
+                }
+                buf += (LeafN - 1) * sizeof(K);
+                ::memcpy(buf + first_slot * sizeof(V), &values[first_slot],
+                         (this->size - first_slot) * sizeof(V));
+                return;
+            }
+
+            size_t nbytes = key_serializer.serialize(buf, size, keys.begin(),
+                                                     keys.begin() + this->size);
             buf += nbytes;
             size -= nbytes;
-            nbytes =
-                value_serializer.serialize(buf, size, values.begin(), values.end());
+            if (has_sibling) {
+                nbytes = key_serializer.serialize(buf, size, &this->sibling_key,
+                                                  &this->sibling_key + 1);
+                buf += nbytes;
+                size -= nbytes;
+            }
+            nbytes = value_serializer.serialize(buf, size, values.begin(),
+                                                values.begin() + this->size);
         }
         virtual void deserialize(const uint8_t* buf, size_t size)
         {
-            this->size = (size_t) * reinterpret_cast<const uint32_t*>(buf);
+            uint32_t header = *reinterpret_cast<const uint32_t*>(buf);
+            bool has_sibling = (header & this->SIBLING_FLAG) != 0;
             buf += sizeof(uint32_t);
             size -= sizeof(uint32_t);
-            size_t nbytes =
-                key_serializer.deserialize(keys.begin(), keys.end(), buf, size);
+            next_leaf = *reinterpret_cast<const PageID*>(buf);
+            buf += sizeof(PageID);
+            size -= sizeof(PageID);
+            /* a torn or corrupt page must not overrun the arrays */
+            this->size = std::min<size_t>(header & ~this->SIBLING_FLAG,
+                                          has_sibling ? LeafN - 2 : LeafN - 1);
+            this->sibling_pid = has_sibling ? next_leaf : Page::INVALID_PAGE_ID;
+            this->sibling.reset();
+
+            if constexpr (FIXED_STRIDE) {
+                ::memcpy(keys.begin(), buf, this->size * sizeof(K));
+                if (has_sibling) {
+                    ::memcpy(&this->sibling_key, buf + (LeafN - 2) * sizeof(K),
+                             sizeof(K));
+                }
+                buf += (LeafN - 1) * sizeof(K);
+                ::memcpy(values.begin(), buf, this->size * sizeof(V));
+                return;
+            }
+
+            size_t nbytes = key_serializer.deserialize(
+                keys.begin(), keys.begin() + this->size, buf, size);
             buf += nbytes;
             size -= nbytes;
-            nbytes = value_serializer.deserialize(values.begin(), values.end(), buf,
-                                                size);
+            if (has_sibling) {
+                nbytes = key_serializer.deserialize(
+                    &this->sibling_key, &this->sibling_key + 1, buf, size);
+                buf += nbytes;
+                size -= nbytes;
+            }
+            nbytes = value_serializer.deserialize(
+                values.begin(), values.begin() + this->size, buf, size);
+        }
+
+        virtual bool is_underfull() const
+        {
+            if (this->size >= UNDERFLOW_SIZE) return false;
+            if constexpr (VARIABLE_SIZE) {
+                return 4 * encoded_bytes(keys.data(), values.data(), this->size) <
+                       tree->get_node_capacity();
+            }
+            return true;
+        }
+
+        /* bytes on the page after the tag of a leaf with n pairs */
+        size_t encoded_bytes(const K* first_key, const V* first_value,
+                             size_t n) const
+        {
+            return sizeof(uint32_t) + sizeof(PageID) +
+                   encoded_size(key_serializer, first_key, first_key + n) +
+                   encoded_size(value_serializer, first_value, first_value + n);
+        }
+
+        /* whether the leaf takes at most capacity bytes with one more pair */
+        bool fits_with(const K& key, const V& val, size_t capacity) const
+        {
+            return sizeof(uint32_t) + sizeof(PageID) +
+                       encoded_size(key_serializer, keys.data(),
+                                    keys.data() + this->size, key) +
+                       encoded_size(value_serializer, values.data(),
+                                    values.data() + this->size, val) <=
+                   capacity;
         }
 
         virtual void get_values(const K& key, bool collect,
-                                std::optional<K>* next_key,
+                                PageID* next_leaf,
                                 std::vector<K>* key_list,
-                                std::vector<V>& value_list, uint64_t parent_version)
+                                std::vector<V>& value_list, uint64_t parent_version,
+                                bool& need_restart)
         {
-            bool need_restart;
             auto version = this->read_lock_or_restart(need_restart);
-            if (need_restart) throw OLCRestart();
+            if (need_restart) return;
 
             if (this->parent &&
                 this->parent->read_unlock_or_restart(parent_version)) {
-                throw OLCRestart();
+                need_restart = true;
+                return;
+            }
+
+            if (this->sibling_covers(key)) {
+                auto* sibling = this->move_right(version, need_restart);
+                if (!sibling) return;
+                sibling->get_values(key, collect, next_leaf, key_list, value_list,
+                                    version, need_restart);
+                return;
             }
 
             if (collect) {
@@ -421,14 +1461,16 @@ namespace bptree {
                         std::back_inserter(*key_list));
                 std::copy(values.begin(), values.begin() + this->size,
                         std::back_inserter(value_list));
+                if (next_leaf) *next_leaf = this->next_leaf;
             } else {
-                auto lower = std::lower_bound(
-                    keys.begin(), keys.begin() + this->size, key, this->kcmp);
+                auto lower = keys.begin() + lower_bound_index(keys.data(), this->size,
+                                                              key, this->kcmp);
 
                 if (lower == keys.begin() + this->size) return;
 
                 auto upper = lower;
-                while (this->keq(key, *upper))
+                while (upper != keys.begin() + this->size &&
+                       this->keq(key, *upper))
                     upper++;
 
                 std::copy(&values[lower - keys.begin()],
@@ -436,100 +1478,362 @@ namespace bptree {
                         std::back_inserter(value_list));
             }
 
-            if (this->read_unlock_or_restart(version)) throw OLCRestart();
+            if (this->read_unlock_or_restart(version)) {
+                need_restart = true;
+                return;
+            }
         }
 
-        virtual std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>>
-        insert(const K& key, const V& val, K& split_key, uint64_t parent_version)
+        virtual bool insert_run(const K* run_keys, const V* run_vals, size_t n,
+                                const K* upper, size_t& num_inserted,
+                                uint64_t parent_version, bool& need_restart)
         {
-            bool need_restart;
+            num_inserted = 0;
+            const K& key = run_keys[0];
             auto version = this->read_lock_or_restart(need_restart);
-            if (need_restart) throw OLCRestart();
+            if (need_restart) return false;
+
+            if (this->sibling_covers(key)) {
+                if (this->parent &&
+                    this->parent->read_unlock_or_restart(parent_version)) {
+                    need_restart = true;
+                    return false;
+                }
+                auto* sibling = this->move_right(version, need_restart);
+                if (!sibling) return false;
+                return sibling->insert_run(run_keys, run_vals, n, upper,
+                                           num_inserted, version, need_restart);
+            }
 
-            if (this->size == N - 1) { /* leaf node is full, do eager split */
-                /* upgrade parent's and own lock to write lock */
-                if (this->parent) {
-                    parent_version = this->parent->upgrade_to_write_lock_or_restart(
-                        parent_version, need_restart);
-                    if (need_restart) throw OLCRestart();
+            if (is_full(key, run_vals[0])) { /* leaf node is full, do eager split */
+                /* the parent links the sibling of the last split first */
+                if (this->has_sibling()) {
+                    need_restart = true;
+                    return false;
                 }
 
+                /* allocate the new sibling's page before taking the lock */
+                tree->reserve_split_pages();
+
+                /* only this leaf is locked, the parent is not needed until
+                 * the sibling is linked */
                 version =
                     this->upgrade_to_write_lock_or_restart(version, need_restart);
-                if (need_restart) {
-                    if (this->parent) {
-                        this->parent->write_unlock();
-                    }
-                    throw OLCRestart();
-                }
+                if (need_restart) return false;
 
+                tree->begin_log_group();
                 auto right_sibling = tree->template create_node<LeafNode<
-                    N, K, V, KeySerializer, KeyComparator, KeyEq, ValueSerializer>>(
-                    this->parent);
-
-                right_sibling->size = this->size - N / 2;
+                    N, K, V, KeySerializer, KeyComparator, KeyEq, ValueSerializer,
+                    LeafN>>(
+                    this);
+                tree->node_split();
+
+                /* appends at the right edge leave the left leaf nearly
+                 * full, it will not get any more keys */
+                bool append = this->next_leaf == Page::INVALID_PAGE_ID &&
+                              !this->kcmp(key, this->keys[this->size - 1]);
+                size_t mid = append ? append_split_index() : split_index();
+                if constexpr (VARIABLE_SIZE) {
+                    /* the left leaf keeps the key of the new sibling */
+                    size_t capacity = tree->get_node_capacity() -
+                                      max_encoded_size<K>(key_serializer);
+                    while (mid > 1 && encoded_bytes(keys.data(), values.data(),
+                                                    mid) > capacity) {
+                        mid--;
+                    }
+                }
+                right_sibling->size = this->size - mid;
 
-                ::memcpy(right_sibling->keys.begin(), &this->keys[N / 2],
+                ::memcpy(right_sibling->keys.begin(), &this->keys[mid],
                         right_sibling->size * sizeof(K));
-                ::memcpy(right_sibling->values.begin(), &this->values[N / 2],
+                ::memcpy(right_sibling->values.begin(), &this->values[mid],
                         right_sibling->size * sizeof(V));
 
-                split_key = this->keys[N / 2];
-                this->size = N / 2;
+                K split_key = separator_key<K, KeyComparator>(
+                    key_serializer, this->keys[mid - 1], this->keys[mid]);
+                this->size = mid;
 
-                tree->write_node(this);
-                tree->write_node(right_sibling.get());
+                right_sibling->next_leaf = this->next_leaf;
+                this->next_leaf = right_sibling->get_pid();
 
-                if (this->parent) {
-                    this->write_unlock();
-                }
+                /* write the new sibling first so that a scan following the
+                 * leaf chain through the pages never reaches an empty page.
+                 * the batch is appended before the leaf is unlocked, so it
+                 * precedes the one of the parent that links the sibling */
+                tree->write_node(right_sibling.get());
+                this->set_sibling(std::move(right_sibling), split_key);
+                tree->write_node(this, this->size);
+                tree->end_log_group();
 
-                /* hold parent's lock */
-                return right_sibling;
+                this->write_unlock();
+                need_restart = true;
+                return true;
             }
 
             /* no need to split, only lock current node */
             version = this->upgrade_to_write_lock_or_restart(version, need_restart);
-            if (need_restart) throw OLCRestart();
+            if (need_restart) return false;
             if (this->parent) {
                 if (this->parent->read_unlock_or_restart(parent_version)) {
                     this->write_unlock();
-                    throw OLCRestart();
+                    need_restart = true;
+                    return false;
                 }
             }
 
             /* we may assume current will not overflow at this point */
-            auto it = std::upper_bound(keys.begin(), keys.begin() + this->size, key,
-                                    this->kcmp);
-            size_t pos = it - keys.begin();
+            size_t pos;
+            if (n == 1) {
+                pos = upper_bound_index(keys.data(), this->size, key, this->kcmp);
+                auto it = keys.begin() + pos;
+
+                ::memmove(it + 1, it, (this->size - pos) * sizeof(K));
+                ::memmove(&values[pos + 1], &values[pos],
+                        (this->size - pos) * sizeof(V));
+
+                keys[pos] = key;
+                values[pos] = run_vals[0];
+                this->size++;
+                num_inserted = 1;
+            } else {
+                /* the keys of the sibling are not less than the ones of
+                 * the subtree */
+                if (this->has_sibling()) upper = &this->sibling_key;
+                pos = merge_run(run_keys, run_vals, n, upper, num_inserted);
+            }
+
+            tree->write_node(this, pos);
+            if (next_leaf == Page::INVALID_PAGE_ID) {
+                tree->set_rightmost_leaf(this);
+            }
+            this->write_unlock();
+
+            return false;
+        }
+
+        /* merge the longest prefix of the run that belongs to this leaf and
+         * fits into it, from the back so that every pair moves once. pairs
+         * of an equal key go after the ones in the leaf like with insert().
+         * returns the first slot that changed */
+        size_t merge_run(const K* run_keys, const V* run_vals, size_t n,
+                         const K* upper, size_t& num_inserted)
+        {
+            size_t m = 0;
+            if constexpr (VARIABLE_SIZE) {
+                /* whether a pair fits depends on the ones before it, they
+                 * are inserted one by one */
+                size_t first = this->size;
+                while (m < n && (!upper || this->kcmp(run_keys[m], *upper)) &&
+                       (m == 0 || !is_full(run_keys[m], run_vals[m]))) {
+                    size_t pos = upper_bound_index(keys.data(), this->size,
+                                                   run_keys[m], this->kcmp);
+                    ::memmove(&keys[pos + 1], &keys[pos],
+                              (this->size - pos) * sizeof(K));
+                    ::memmove(&values[pos + 1], &values[pos],
+                              (this->size - pos) * sizeof(V));
+                    keys[pos] = run_keys[m];
+                    values[pos] = run_vals[m];
+                    this->size++;
+                    first = std::min(first, pos);
+                    m++;
+                }
+                num_inserted = m;
+                return first;
+            }
+
+            while (m < n && this->size + m < max_size() &&
+                   (!upper || this->kcmp(run_keys[m], *upper))) {
+                m++;
+            }
+
+            size_t i = this->size, j = m, out = this->size + m;
+            while (j > 0) {
+                if (i > 0 && this->kcmp(run_keys[j - 1], keys[i - 1])) {
+                    keys[--out] = keys[--i];
+                    values[out] = values[i];
+                } else {
+                    keys[--out] = run_keys[--j];
+                    values[out] = run_vals[j];
+                }
+            }
+
+            this->size += m;
+            num_inserted = m;
+            return out;
+        }
+
+        /* insert key at the end without a descent if this is the rightmost
+         * leaf, key is not less than its last key and it does not have to
+         * split. only the leaf is locked: it is the one a descent would
+         * reach, whatever its parent looks like. returns false if the
+         * caller has to take the normal path */
+        bool append(const K& key, const V& val)
+        {
+            bool need_restart;
+            auto version = this->read_lock_or_restart(need_restart);
+            if (need_restart) return false;
+
+            /* read optimistically, the upgrade validates them */
+            size_t size = this->size;
+            if (next_leaf != Page::INVALID_PAGE_ID || size == 0 ||
+                size >= LeafN - 1 || this->kcmp(key, keys[size - 1]) ||
+                is_full(key, val)) {
+                return false;
+            }
 
-            ::memmove(it + 1, it, (this->size - pos) * sizeof(K));
-            ::memmove(&values[pos + 1], &values[pos],
-                    (this->size - pos) * sizeof(V));
+            this->upgrade_to_write_lock_or_restart(version, need_restart);
+            if (need_restart) return false;
 
-            keys[pos] = key;
-            values[pos] = val;
+            keys[size] = key;
+            values[size] = val;
             this->size++;
 
-            tree->write_node(this);
+            tree->write_node(this, size);
             this->write_unlock();
+            return true;
+        }
 
-            return nullptr;
+        virtual size_t erase(const K& key, const V* value, bool remove,
+                             bool& underflow, uint64_t parent_version,
+                             bool& need_restart)
+        {
+            auto version = this->read_lock_or_restart(need_restart);
+            if (need_restart) return 0;
+
+            if (this->parent &&
+                this->parent->read_unlock_or_restart(parent_version)) {
+                need_restart = true;
+                return 0;
+            }
+            if (!remove) return 0;
+
+            if (this->sibling_covers(key)) {
+                auto* sibling = this->move_right(version, need_restart);
+                if (!sibling) return 0;
+                return sibling->erase(key, value, remove, underflow, version,
+                                      need_restart);
+            }
+
+            version = this->upgrade_to_write_lock_or_restart(version, need_restart);
+            if (need_restart) return 0;
+            if (this->parent) {
+                if (this->parent->read_unlock_or_restart(parent_version)) {
+                    this->write_unlock();
+                    need_restart = true;
+                    return 0;
+                }
+            }
+
+            size_t first = lower_bound_index(keys.data(), this->size, key, this->kcmp);
+            size_t last = first;
+            while (last < this->size && this->keq(key, keys[last])) {
+                last++;
+            }
+
+            /* compact the pairs of key that are kept */
+            size_t kept = first;
+            for (size_t i = first; i < last; i++) {
+                if (value && !(values[i] == *value)) {
+                    keys[kept] = keys[i];
+                    values[kept] = values[i];
+                    kept++;
+                }
+            }
+
+            size_t removed = last - kept;
+            if (removed > 0) {
+                ::memmove(&keys[kept], &keys[last], (this->size - last) * sizeof(K));
+                ::memmove(&values[kept], &values[last],
+                        (this->size - last) * sizeof(V));
+                this->size -= removed;
+                tree->write_node(this, first);
+            }
+            underflow = is_underfull();
+
+            this->write_unlock();
+            return removed;
         }
 
-        virtual void print(std::ostream& os, const std::string& padding = "")
+        virtual void print(std::ostream& os, const std::string& padding,
+                           bool& need_restart)
         {
             os << padding << "Page ID: " << this->get_pid() << std::endl;
 
             // for (int i = 0; i < this->size; i++) {
             //     os << padding << keys[i] << " -> " << values[i] << std::endl;
             // }
+
+            if (this->has_sibling()) {
+                auto version = this->read_lock_or_restart(need_restart);
+                if (need_restart) return;
+                auto* sibling = this->move_right(version, need_restart);
+                if (!sibling) return;
+                sibling->print(os, padding, need_restart);
+            }
+        }
+
+    protected:
+        virtual std::unique_ptr<BaseNode<K, V, KeyComparator, KeyEq>> read_sibling()
+        {
+            return tree->read_node(this, this->sibling_pid);
         }
 
     private:
-        BTree<N, K, V, KeySerializer, KeyComparator, KeyEq, ValueSerializer>* tree;
-        std::array<K, N - 1> keys;
-        std::array<V, N - 1> values;
+        /* the last slot is taken on the page by the key of a sibling that
+         * is not linked yet */
+        size_t max_size() const { return this->has_sibling() ? LeafN - 2 : LeafN - 1; }
+
+        bool is_full(const K& key, const V& val) const
+        {
+            if (this->size >= max_size()) return true;
+            if constexpr (VARIABLE_SIZE) {
+                size_t capacity = tree->get_node_capacity();
+                if (this->has_sibling()) {
+                    capacity -= encoded_size(key_serializer, &this->sibling_key,
+                                             &this->sibling_key + 1);
+                }
+                return !fits_with(key, val, capacity);
+            }
+            return false;
+        }
+
+        /* the first pair that moves to the right sibling on a split */
+        size_t split_index() const
+        {
+            if constexpr (VARIABLE_SIZE) {
+                return balanced_split(
+                    1, this->size - 1,
+                    [this](size_t m) {
+                        return encoded_bytes(keys.data(), values.data(), m);
+                    },
+                    [this](size_t m) {
+                        return encoded_bytes(&keys[m], &values[m], this->size - m);
+                    });
+            }
+            return LeafN / 2;
+        }
+
+        /* 90/10 by pairs or by bytes */
+        size_t append_split_index() const
+        {
+            if constexpr (VARIABLE_SIZE) {
+                return balanced_split(
+                    1, this->size - 1,
+                    [this](size_t m) {
+                        return encoded_bytes(keys.data(), values.data(), m);
+                    },
+                    [this](size_t m) {
+                        return 9 * encoded_bytes(&keys[m], &values[m],
+                                                 this->size - m);
+                    });
+            }
+            return this->size - std::max<size_t>(1, this->size / 10);
+        }
+
+        BTree<N, K, V, KeySerializer, KeyComparator, KeyEq, ValueSerializer, LeafN>* tree;
+        alignas(64) std::array<K, LeafN - 1> keys;
+        std::array<V, LeafN - 1> values;
+        PageID next_leaf; /* right sibling */
         KeySerializer key_serializer;
         ValueSerializer value_serializer;
     };
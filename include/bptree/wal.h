@@ -0,0 +1,155 @@
+#ifndef _BPTREE_WAL_H_
+#define _BPTREE_WAL_H_
+
+#include "bptree/heap_file.h"
+#include "bptree/page.h"
+#include "bptree/rate_limiter.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace bptree {
+
+/* PAGE_DELTA overwrites length bytes of a page at offset. PAGE_IMAGE writes
+ * the first length bytes of a page and zeroes the rest, it is logged for the
+ * first write of a page that was just allocated. PAGE_FREE marks a page that
+ * went back to the heap file's free list */
+enum class LogRecordType : uint16_t { PAGE_DELTA = 1, PAGE_IMAGE = 2, PAGE_FREE = 3 };
+
+/* a record as it is handed to WriteAheadLog::replay(), data points into the
+ * log and is only valid during the call */
+struct LogRecord {
+    LogRecordType type;
+    PageID pid;
+    uint32_t offset;
+    uint32_t length;
+    const uint8_t* data;
+};
+
+/* records that are appended to the log as one frame. a frame is replayed
+ * completely or not at all, which makes the page writes of a split or a
+ * merge atomic */
+class LogBatch {
+public:
+    void add_delta(PageID pid, uint32_t offset, const uint8_t* data,
+                   uint32_t length);
+    void add_image(PageID pid, const uint8_t* data, uint32_t length);
+    void add_free(PageID pid);
+
+    bool empty() const { return bytes.empty(); }
+    void clear() { bytes.clear(); }
+    const std::vector<uint8_t>& get_bytes() const { return bytes; }
+
+private:
+    std::vector<uint8_t> bytes;
+
+    void add(LogRecordType type, PageID pid, uint32_t offset,
+             const uint8_t* data, uint32_t length);
+};
+
+/* a redo log of page writes. append() only copies a batch into the log
+ * buffer and returns its LSN, the LSN of the end of the batch. flush(lsn)
+ * makes everything up to lsn durable with group commit: one thread writes
+ * and fdatasync()s the buffer for all threads that wait, batches appended
+ * meanwhile go with the next sync. a page cache must not write a page back
+ * before the log is durable up to the page's LSN (see
+ * AbstractPageCache::set_write_ahead_log()), so the heap file only ever
+ * holds page versions that the log can bring forward.
+ *
+ * the log file is | magic | version | base LSN | frames... | and a frame is
+ * | magic | length | CRC-32C | reserved | records... |. LSNs count the
+ * bytes of all frames ever appended, truncate() drops the frames before an
+ * LSN and moves the base. a torn or corrupt frame ends the log, it is cut
+ * off when the log is opened.
+ *
+ * with sync_commit, BTree waits for the records of every insert and erase
+ * to be durable before it returns. otherwise they become durable with the
+ * next flush, e.g. when a page is written back or on BTree::checkpoint() */
+class WriteAheadLog {
+public:
+    /* LSN of a page that is part of a batch that has not been appended yet.
+     * such a page is pinned and must not be written back */
+    static constexpr uint64_t PENDING_LSN = UINT64_MAX;
+
+    /* the buffer is written out once it holds this many bytes */
+    static constexpr size_t MAX_BUFFER_SIZE = 4 << 20;
+
+    WriteAheadLog(std::string_view filename, bool create,
+                  bool sync_commit = true);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    uint64_t append(const LogBatch& batch);
+    void flush(uint64_t lsn);
+    void flush_all() { flush(get_end_lsn()); }
+
+    /* drop the frames before lsn, which must be an LSN returned by append()
+     * or get_end_lsn(). their pages must have been written back and synced.
+     * does nothing while the log is retained */
+    void truncate(uint64_t lsn);
+
+    /* keep truncate() from dropping frames, e.g. while a backup copies
+     * them. calls nest */
+    void retain();
+    void release();
+
+    /* write the durable frames in [first, last) to a new log file whose
+     * base LSN is first, paced by limiter. the log must be retained since
+     * before first was taken. returns the # of bytes written */
+    size_t write_frames(std::string_view filename, uint64_t first,
+                        uint64_t last, RateLimiter& limiter);
+
+    /* call apply for every record in the log, in log order. records of pages
+     * whose last record is PAGE_FREE are skipped so that the free list links
+     * in those pages are left alone. returns the # of records applied */
+    size_t replay(const std::function<void(const LogRecord&)>& apply);
+
+    bool is_sync_commit() const { return sync_commit; }
+    uint64_t get_end_lsn();
+    uint64_t get_durable_lsn();
+    /* # of fdatasync() calls for flush() */
+    size_t get_num_syncs();
+    /* # of bytes of frames in the log file and the buffer */
+    size_t get_size();
+
+private:
+    static constexpr uint32_t MAGIC = 0x57414C31;
+    static constexpr uint32_t FRAME_MAGIC = 0x46524D31;
+    static constexpr uint32_t VERSION = 1;
+
+    std::string filename;
+    bool sync_commit;
+    int fd;
+
+    std::mutex mutex;
+    std::condition_variable flushed_cv;
+    uint64_t base_lsn;     /* LSN of the first frame in the file */
+    uint64_t end_lsn;      /* LSN after the last appended frame */
+    uint64_t durable_lsn;  /* everything before it is synced */
+    size_t file_end;       /* file offset after the last written frame */
+    std::vector<uint8_t> buffer;
+    /* the buffer that is being written, only used by the syncing thread */
+    std::vector<uint8_t> flush_buffer;
+    bool flushing;
+    size_t num_syncs;
+    size_t num_retained;
+
+    void create();
+    void open();
+    /* find the end of the valid frames and cut off the rest */
+    void recover_end();
+    void write_header(int fd, uint64_t base);
+    void write_all(int fd, const uint8_t* buf, size_t length, size_t offset);
+    void read_all(uint8_t* buf, size_t length, size_t offset);
+    void sync_directory();
+};
+
+} // namespace bptree
+
+#endif
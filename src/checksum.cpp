@@ -0,0 +1,38 @@
+#include "bptree/checksum.h"
+
+namespace bptree {
+
+namespace {
+
+struct Crc32cTable {
+    uint32_t entries[256];
+
+    Crc32cTable()
+    {
+        /* reflected polynomial of CRC-32C */
+        const uint32_t poly = 0x82F63B78;
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++) {
+                crc = (crc >> 1) ^ (crc & 1 ? poly : 0);
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+const Crc32cTable table;
+
+} // namespace
+
+uint32_t crc32c(const void* data, size_t length, uint32_t crc)
+{
+    const auto* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+} // namespace bptree
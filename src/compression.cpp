@@ -0,0 +1,162 @@
+#include "bptree/compression.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace bptree {
+
+namespace {
+
+const size_t MIN_MATCH = 4;
+/* the last 5 bytes are always literals and the last match starts at least
+ * 12 bytes before the end, as the format requires */
+const size_t LAST_LITERALS = 5;
+const size_t MATCH_FIND_LIMIT = 12;
+const size_t MAX_OFFSET = 65535;
+const int HASH_BITS = 12;
+
+inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    ::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/* bytes needed to encode a length of at least 15 after the token */
+inline size_t extra_length_bytes(size_t len)
+{
+    return len < 15 ? 0 : (len - 15) / 255 + 1;
+}
+
+inline uint8_t* write_extra_length(uint8_t* op, size_t len)
+{
+    for (len -= 15; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+} // namespace
+
+size_t lz4_compress(const uint8_t* src, size_t length, uint8_t* dst,
+                    size_t capacity)
+{
+    /* positions + 1, 0 is an empty slot */
+    uint32_t table[1 << HASH_BITS] = {};
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + capacity;
+    size_t anchor = 0;
+    size_t pos = 0;
+
+    auto emit = [&](size_t literals, size_t offset, size_t match_length) {
+        size_t needed = 1 + extra_length_bytes(literals) + literals;
+        if (match_length) {
+            needed += 2 + extra_length_bytes(match_length - MIN_MATCH);
+        }
+        if ((size_t)(oend - op) < needed) return false;
+
+        uint8_t* token = op++;
+        *token = (uint8_t)(std::min<size_t>(literals, 15) << 4);
+        if (literals >= 15) op = write_extra_length(op, literals);
+        ::memcpy(op, src + anchor, literals);
+        op += literals;
+
+        if (match_length) {
+            *op++ = (uint8_t)offset;
+            *op++ = (uint8_t)(offset >> 8);
+            size_t len = match_length - MIN_MATCH;
+            *token |= (uint8_t)std::min<size_t>(len, 15);
+            if (len >= 15) op = write_extra_length(op, len);
+        }
+        return true;
+    };
+
+    while (length > MATCH_FIND_LIMIT && pos + MATCH_FIND_LIMIT < length) {
+        uint32_t seq = read32(src + pos);
+        uint32_t& slot = table[hash32(seq)];
+        size_t candidate = slot;
+        slot = (uint32_t)pos + 1;
+
+        if (candidate == 0 || pos - (candidate - 1) > MAX_OFFSET ||
+            read32(src + candidate - 1) != seq) {
+            pos++;
+            continue;
+        }
+        candidate--;
+
+        size_t match_length = MIN_MATCH;
+        while (pos + match_length < length - LAST_LITERALS &&
+               src[candidate + match_length] == src[pos + match_length]) {
+            match_length++;
+        }
+
+        if (!emit(pos - anchor, pos - candidate, match_length)) return 0;
+        pos += match_length;
+        anchor = pos;
+    }
+
+    if (!emit(length - anchor, 0, 0)) return 0;
+    return op - dst;
+}
+
+bool lz4_decompress(const uint8_t* src, size_t length, uint8_t* dst,
+                    size_t dst_length)
+{
+    const uint8_t* ip = src;
+    const uint8_t* const iend = src + length;
+    uint8_t* op = dst;
+    uint8_t* const oend = dst + dst_length;
+
+    auto read_length = [&](size_t& len) {
+        uint8_t b;
+        do {
+            if (ip >= iend) return false;
+            b = *ip++;
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !read_length(literals)) return false;
+        if ((size_t)(iend - ip) < literals || (size_t)(oend - op) < literals) {
+            return false;
+        }
+        ::memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        /* the last sequence has no match */
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return false;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return false;
+
+        size_t match_length = token & 15;
+        if (match_length == 15 && !read_length(match_length)) return false;
+        match_length += MIN_MATCH;
+        if ((size_t)(oend - op) < match_length) return false;
+
+        /* the match may overlap the bytes it produces */
+        const uint8_t* match = op - offset;
+        for (size_t i = 0; i < match_length; i++) {
+            op[i] = match[i];
+        }
+        op += match_length;
+    }
+
+    return op == oend;
+}
+
+} // namespace bptree
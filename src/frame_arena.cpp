@@ -0,0 +1,58 @@
+#include "bptree/frame_arena.h"
+
+#include <new>
+#include <sys/mman.h>
+
+namespace bptree {
+
+static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+FrameArena::FrameArena(size_t num_frames, size_t frame_size,
+                       bool use_huge_pages)
+    : base(nullptr), num_frames(num_frames), frame_size(frame_size),
+      huge_pages(false)
+{
+    mapped_size = num_frames * frame_size;
+    if (mapped_size == 0) return;
+
+    void* addr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (use_huge_pages) {
+        size_t huge_size =
+            (mapped_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        addr = ::mmap(nullptr, huge_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (addr != MAP_FAILED) {
+            mapped_size = huge_size;
+            huge_pages = true;
+        }
+    }
+#endif
+
+    if (addr == MAP_FAILED) {
+        addr = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (use_huge_pages) {
+            /* only a hint, the kernel may not have THP enabled */
+            ::madvise(addr, mapped_size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    base = static_cast<uint8_t*>(addr);
+}
+
+FrameArena::~FrameArena()
+{
+    if (base) {
+        ::munmap(base, mapped_size);
+    }
+}
+
+} // namespace bptree
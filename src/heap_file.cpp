@@ -1,31 +1,54 @@
 #include "bptree/heap_file.h"
+#include "bptree/checksum.h"
+#include "bptree/compression.h"
+#include "bptree/io_uring.h"
 #include "bptree/latency_simulator.h"
 
 #include <cstdlib>
+#include <cstring>
+#include <new>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sstream>
 
-#ifdef __APPLE__
-    // macOS doesn't have off64_t and lseek64
-    #define off64_t off_t
-    #define lseek64 lseek
-#endif
-
 namespace bptree {
 
-HeapFile::HeapFile(std::string_view filename, bool create, size_t page_size)
-    : filename(filename), page_size(page_size)
+HeapFile::HeapFile(std::string_view filename, bool create, size_t page_size,
+                   IOBackend backend, bool direct_io, PageFormat format)
+    : page_size(page_size), format(format), num_bytes_written(0),
+      filename(filename), backend(backend), snapshot_open(false)
 {
     fd = -1;
+    direct_fd = -1;
+    file_size_pages.store(0);
+    free_list_head = Page::INVALID_PAGE_ID;
+    num_free_pages.store(0);
 
     open(create);
+
+    data_size = this->format == PageFormat::RAW ? this->page_size
+                                                : this->page_size - PAGE_HEADER_SIZE;
+
+    if (direct_io && this->page_size % DIRECT_IO_ALIGNMENT == 0) {
+        /* stays -1 if the file system rejects O_DIRECT */
+        direct_fd = ::open(this->filename.c_str(), O_RDWR | O_DIRECT);
+    }
+
+    if (backend == IOBackend::IO_URING) {
+        if (IOUring::is_supported()) {
+            ring = std::make_unique<IOUring>();
+        } else {
+            this->backend = IOBackend::SYNC;
+        }
+    }
 }
 
 HeapFile::~HeapFile()
 {
+    ring.reset();
+
     if (is_open()) {
         close();
     }
@@ -35,68 +58,507 @@ PageID HeapFile::new_page()
 {
     std::lock_guard<std::mutex> guard(mutex);
 
-    PageID new_page = (PageID)file_size_pages;
-    ftruncate(fd, file_size_pages * page_size);
+    if (free_list_head != Page::INVALID_PAGE_ID) {
+        PageID pid = free_list_head;
+        PageID next;
+
+        if (::pread(fd, &next, sizeof(next), (off_t)pid * page_size) !=
+            sizeof(next)) {
+            throw IOException("unable to read free page");
+        }
+
+        free_list_head = next;
+        num_free_pages--;
+        write_header();
 
-    file_size_pages++;
+        return pid;
+    }
+
+    PageID new_page = (PageID)file_size_pages.load();
+    if (ftruncate(fd, ((off_t)new_page + 1) * page_size) != 0) {
+        throw IOException("unable to resize heap file");
+    }
+
+    file_size_pages.store(new_page + 1);
     write_header();
 
     return new_page;
 }
 
-void HeapFile::read_page(Page* page, boost::upgrade_to_unique_lock<Page>& lock)
+void HeapFile::free_page(PageID pid)
 {
-    // Simulate network latency for far memory access
-    LatencySimulator::simulate_network_latency();
+    check_page_id(pid);
 
     std::lock_guard<std::mutex> guard(mutex);
 
-    auto pid = page->get_id();
+    preserve_page(pid);
+
+    /* the link clears the page header too, so that a free page reads as
+     * zeros and not as a corrupt page */
+    uint8_t link[PAGE_HEADER_SIZE] = {};
+    size_t link_size =
+        format == PageFormat::RAW ? sizeof(PageID) : PAGE_HEADER_SIZE;
+    ::memcpy(link, &free_list_head, sizeof(PageID));
+    if (::pwrite(fd, link, link_size, (off_t)pid * page_size) !=
+        (ssize_t)link_size) {
+        throw IOException("unable to write free page");
+    }
+
+    free_list_head = pid;
+    num_free_pages++;
+    write_header();
+}
+
+void HeapFile::check_page_id(PageID pid) const
+{
     if (pid == Page::INVALID_PAGE_ID) {
         std::stringstream ss;
         ss << "page ID (" << pid << ") is invalid";
         throw IOException(ss.str().c_str());
     }
 
-    if (pid >= file_size_pages) {
+    auto num_pages = file_size_pages.load();
+    if (pid >= num_pages) {
         std::stringstream ss;
-        ss << "page ID (" << pid << ") >= # pages (" << file_size_pages << ")";
+        ss << "page ID (" << pid << ") >= # pages (" << num_pages << ")";
         throw IOException(ss.str().c_str());
     }
+}
+
+void HeapFile::pread_page(PageID pid, uint8_t* buf)
+{
+    off_t offset = (off_t)pid * page_size;
+    size_t nbytes = 0;
+
+    while (nbytes < page_size) {
+        ssize_t retval = ::pread(page_fd(), buf + nbytes, page_size - nbytes,
+                                 offset + nbytes);
+        if (retval < 0) {
+            if (errno == EINTR) continue;
+            throw IOException(
+                ("read failed(error code: " + std::to_string(errno) + ")")
+                    .c_str());
+        }
+        if (retval == 0) break;
+        nbytes += retval;
+    }
 
-    auto* buf = page->get_buffer(lock);
+    num_bytes_read.add(nbytes);
+    /* pages that were allocated but never written read as zeros */
+    ::memset(buf + nbytes, 0, page_size - nbytes);
+}
 
-    off64_t retval;
-    if ((retval = lseek64(fd, (off64_t)pid * page_size, SEEK_SET)) != (off64_t)pid * page_size) {
+void HeapFile::pwrite_page(PageID pid, const uint8_t* buf, size_t length)
+{
+    off_t offset = (off_t)pid * page_size;
+    size_t nbytes = 0;
+
+    while (nbytes < length) {
+        ssize_t retval = ::pwrite(page_fd(), buf + nbytes, length - nbytes,
+                                  offset + nbytes);
+        if (retval < 0) {
+            if (errno == EINTR) continue;
+            throw IOException(
+                ("write failed(error code: " + std::to_string(errno) + ")")
+                    .c_str());
+        }
+        nbytes += retval;
+    }
+
+    num_bytes_written.fetch_add(length, std::memory_order_relaxed);
+}
+
+HeapFile::PageBuffer HeapFile::alloc_page_buffer() const
+{
+    size_t size = (page_size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT *
+                  DIRECT_IO_ALIGNMENT;
+    auto* buf = static_cast<uint8_t*>(std::aligned_alloc(DIRECT_IO_ALIGNMENT, size));
+    if (!buf) throw std::bad_alloc();
+    return PageBuffer(buf, std::free);
+}
+
+/* page header: | CRC-32C(4 bytes) | version(2 bytes) | compression(2 bytes) |
+ *              | stored length(4 bytes) | reserved(4 bytes) | LSN(8 bytes) |
+ * the checksum covers the rest of the header and the stored bytes. a page
+ * whose version is 0 was never written or is free and reads as zeros */
+static const uint16_t PAGE_VERSION = 1;
+static const uint16_t COMPRESSION_NONE = 0;
+static const uint16_t COMPRESSION_LZ4 = 1;
+
+size_t HeapFile::encode_page(const uint8_t* data, uint64_t lsn,
+                             uint8_t* out) const
+{
+    uint8_t* body = out + PAGE_HEADER_SIZE;
+    uint16_t compression = COMPRESSION_NONE;
+    size_t length = 0;
+
+    if (format == PageFormat::LZ4) {
+        /* 0 if the page does not get smaller */
+        length = lz4_compress(data, data_size, body, data_size - 1);
+        if (length) compression = COMPRESSION_LZ4;
+    }
+    if (!length) {
+        ::memcpy(body, data, data_size);
+        length = data_size;
+    }
+
+    uint16_t version = PAGE_VERSION;
+    uint32_t stored_length = (uint32_t)length;
+    uint32_t reserved = 0;
+    ::memcpy(out + 4, &version, sizeof(version));
+    ::memcpy(out + 6, &compression, sizeof(compression));
+    ::memcpy(out + 8, &stored_length, sizeof(stored_length));
+    ::memcpy(out + 12, &reserved, sizeof(reserved));
+    ::memcpy(out + 16, &lsn, sizeof(lsn));
+
+    uint32_t crc = crc32c(out + 4, PAGE_HEADER_SIZE - 4 + length);
+    ::memcpy(out, &crc, sizeof(crc));
+
+    /* the rest of the page is left as it is on disk, O_DIRECT writes whole
+     * blocks though */
+    size_t nbytes = PAGE_HEADER_SIZE + length;
+    if (direct_fd != -1) {
+        size_t aligned = (nbytes + DIRECT_IO_ALIGNMENT - 1) /
+                         DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+        ::memset(out + nbytes, 0, aligned - nbytes);
+        nbytes = aligned;
+    }
+    return nbytes;
+}
+
+void HeapFile::decode_page(PageID pid, const uint8_t* in, uint8_t* data) const
+{
+    uint32_t crc, stored_length;
+    uint16_t version, compression;
+    ::memcpy(&crc, in, sizeof(crc));
+    ::memcpy(&version, in + 4, sizeof(version));
+    ::memcpy(&compression, in + 6, sizeof(compression));
+    ::memcpy(&stored_length, in + 8, sizeof(stored_length));
+
+    if (version == 0) {
+        ::memset(data, 0, data_size);
+        return;
+    }
+
+    const uint8_t* body = in + PAGE_HEADER_SIZE;
+    bool ok = version == PAGE_VERSION && stored_length <= data_size &&
+              crc32c(in + 4, PAGE_HEADER_SIZE - 4 + stored_length) == crc;
+    if (ok) {
+        if (compression == COMPRESSION_NONE && stored_length == data_size) {
+            ::memcpy(data, body, data_size);
+        } else if (compression == COMPRESSION_LZ4) {
+            ok = lz4_decompress(body, stored_length, data, data_size);
+        } else {
+            ok = false;
+        }
+    }
+
+    if (!ok) {
         std::stringstream ss;
-        ss << "seek failed (return code: " << retval << ", errno: " << errno << ")";
+        ss << "page " << pid << " is corrupt";
         throw IOException(ss.str().c_str());
     }
+}
+
+void HeapFile::read_page(Page* page, boost::upgrade_to_unique_lock<Page>& lock)
+{
+    // Simulate network latency for far memory access
+    LatencySimulator::simulate_transfer(page_size);
+
+    auto pid = page->get_id();
+    check_page_id(pid);
+
+    if (format == PageFormat::RAW) {
+        pread_page(pid, page->get_buffer(lock));
+        return;
+    }
 
-    read(fd, buf, page_size);
+    auto buf = alloc_page_buffer();
+    pread_page(pid, buf.get());
+    decode_page(pid, buf.get(), page->get_buffer(lock));
 }
 
 void HeapFile::write_page(Page* page, boost::upgrade_lock<Page>& lock)
 {
+    auto pid = page->get_id();
+    check_page_id(pid);
+
+    preserve_page(pid);
+    if (format == PageFormat::RAW) {
+        pwrite_page(pid, page->get_buffer(lock), page_size);
+        return;
+    }
+
+    auto buf = alloc_page_buffer();
+    size_t length = encode_page(page->get_buffer(lock), page->get_lsn(), buf.get());
+    pwrite_page(pid, buf.get(), length);
+}
+
+void HeapFile::read_pages(std::vector<PageIORequest>& requests)
+{
+    submit_batch(requests, false);
+}
+
+void HeapFile::write_pages(std::vector<PageIORequest>& requests)
+{
+    if (snapshot_open.load()) {
+        for (auto&& req : requests) {
+            if (req.pid != Page::INVALID_PAGE_ID &&
+                req.pid < file_size_pages.load()) {
+                preserve_page(req.pid);
+            }
+        }
+    }
+
+    submit_batch(requests, true);
+}
+
+void HeapFile::sync()
+{
+    if (::fdatasync(fd) != 0) {
+        throw IOException("unable to sync heap file");
+    }
+}
+
+void HeapFile::read_raw_page(PageID pid, uint8_t* buf)
+{
+    off_t offset = (off_t)pid * page_size;
+    size_t nbytes = 0;
+
+    while (nbytes < page_size) {
+        ssize_t retval =
+            ::pread(fd, buf + nbytes, page_size - nbytes, offset + nbytes);
+        if (retval < 0) {
+            if (errno == EINTR) continue;
+            throw IOException("unable to read page for snapshot");
+        }
+        if (retval == 0) break;
+        nbytes += retval;
+    }
+
+    ::memset(buf + nbytes, 0, page_size - nbytes);
+}
+
+void HeapFile::begin_snapshot(const std::function<void()>& started)
+{
+    /* no page is allocated or freed meanwhile, the header and the free
+     * list are taken as one */
     std::lock_guard<std::mutex> guard(mutex);
+    std::lock_guard<std::mutex> snapshot_guard(snapshot_mutex);
 
-    auto pid = page->get_id();
-    if (pid == Page::INVALID_PAGE_ID) {
-        throw IOException("page ID is invalid");
+    if (snapshot) {
+        throw IOException("a snapshot of the heap file is already open");
+    }
+
+    snapshot = std::make_unique<Snapshot>();
+    snapshot->num_pages = file_size_pages.load();
+    snapshot->copied.assign(snapshot->num_pages, false);
+
+    /* the header is rewritten on every allocation */
+    auto header = std::make_unique<uint8_t[]>(page_size);
+    read_raw_page(0, header.get());
+    snapshot->old_pages[0] = std::move(header);
+    snapshot->copied[0] = true;
+
+    snapshot_open.store(true);
+    if (started) started();
+}
+
+void HeapFile::preserve_page(PageID pid)
+{
+    if (!snapshot_open.load()) return;
+
+    std::lock_guard<std::mutex> guard(snapshot_mutex);
+    if (!snapshot || pid >= snapshot->num_pages || snapshot->copied[pid]) {
+        return;
     }
 
-    if (pid >= file_size_pages) {
-        throw IOException("page ID >= # pages");
+    auto old_page = std::make_unique<uint8_t[]>(page_size);
+    read_raw_page(pid, old_page.get());
+    snapshot->old_pages[pid] = std::move(old_page);
+    snapshot->copied[pid] = true;
+}
+
+size_t HeapFile::write_snapshot(std::string_view filename, RateLimiter& limiter)
+{
+    size_t num_pages;
+    {
+        std::lock_guard<std::mutex> guard(snapshot_mutex);
+        if (!snapshot) {
+            throw IOException("no snapshot of the heap file is open");
+        }
+        num_pages = snapshot->num_pages;
     }
 
-    const auto* buf = page->get_buffer(lock);
+    int out = ::open(std::string(filename).c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                     S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (out < 0) {
+        throw IOException("unable to create snapshot file");
+    }
+
+    auto buf = std::make_unique<uint8_t[]>(page_size);
+    size_t nbytes = 0;
+    try {
+        for (PageID pid = 0; pid < num_pages; pid++) {
+            {
+                /* a writer of the page waits until it is copied */
+                std::lock_guard<std::mutex> guard(snapshot_mutex);
+                auto it = snapshot->old_pages.find(pid);
+                if (it != snapshot->old_pages.end()) {
+                    ::memcpy(buf.get(), it->second.get(), page_size);
+                    snapshot->old_pages.erase(it);
+                } else {
+                    read_raw_page(pid, buf.get());
+                    snapshot->copied[pid] = true;
+                }
+            }
+
+            size_t written = 0;
+            while (written < page_size) {
+                ssize_t retval =
+                    ::pwrite(out, buf.get() + written, page_size - written,
+                             (off_t)pid * page_size + written);
+                if (retval < 0 && errno == EINTR) continue;
+                if (retval <= 0) {
+                    throw IOException("unable to write snapshot file");
+                }
+                written += retval;
+            }
+            nbytes += page_size;
+            limiter.acquire(page_size);
+        }
 
-    off64_t retval;
-    if ((retval = lseek64(fd, (off64_t)pid * page_size, SEEK_SET)) != (off64_t)pid * page_size) {
-         throw IOException(("seek failed(error code: " + std::to_string(errno) + ")").c_str());
+        if (::fdatasync(out) != 0) {
+            throw IOException("unable to sync snapshot file");
+        }
+    } catch (IOException&) {
+        ::close(out);
+        throw;
     }
 
-    write(fd, buf, page_size);
+    ::close(out);
+    return nbytes;
+}
+
+void HeapFile::end_snapshot()
+{
+    std::lock_guard<std::mutex> guard(snapshot_mutex);
+    snapshot_open.store(false);
+    snapshot.reset();
+}
+
+size_t HeapFile::get_num_snapshot_copies()
+{
+    std::lock_guard<std::mutex> guard(snapshot_mutex);
+    return snapshot ? snapshot->old_pages.size() : 0;
+}
+
+void HeapFile::submit_batch(std::vector<PageIORequest>& requests, bool write)
+{
+    if (requests.empty()) return;
+
+    /* pages with a header are read and written in their on-disk form
+     * through page buffers */
+    std::vector<PageBuffer> bufs;
+    std::vector<size_t> lengths(requests.size(), page_size);
+    if (format != PageFormat::RAW) {
+        bufs.reserve(requests.size());
+        for (size_t i = 0; i < requests.size(); i++) {
+            bufs.push_back(alloc_page_buffer());
+            if (write) {
+                lengths[i] = encode_page(requests[i].buf, requests[i].lsn,
+                                         bufs[i].get());
+            }
+        }
+    }
+    auto io_buf = [&](size_t i) {
+        return bufs.empty() ? requests[i].buf : bufs[i].get();
+    };
+    auto finish_read = [&](size_t i) {
+        if (!bufs.empty()) decode_page(requests[i].pid, bufs[i].get(), requests[i].buf);
+    };
+
+    if (!ring) {
+        for (size_t i = 0; i < requests.size(); i++) {
+            auto& req = requests[i];
+            if (!write) LatencySimulator::simulate_transfer(page_size);
+
+            try {
+                check_page_id(req.pid);
+                if (write) {
+                    pwrite_page(req.pid, io_buf(i), lengths[i]);
+                } else {
+                    pread_page(req.pid, io_buf(i));
+                    finish_read(i);
+                }
+                req.ok = true;
+            } catch (IOException&) {
+                req.ok = false;
+            }
+        }
+
+        return;
+    }
+
+    /* all pages of the batch are in flight together so they pay for a single
+     * round trip */
+    if (!write) LatencySimulator::simulate_transfer(requests.size() * page_size);
+
+    std::unique_ptr<IOUring::Request[]> ring_requests(
+        new IOUring::Request[requests.size()]);
+    std::vector<bool> submitted(requests.size(), false);
+
+    for (size_t i = 0; i < requests.size(); i++) {
+        auto& req = requests[i];
+        req.ok = false;
+
+        try {
+            check_page_id(req.pid);
+        } catch (IOException&) {
+            continue;
+        }
+
+        off_t offset = (off_t)req.pid * page_size;
+        if (write) {
+            ring->prepare_write(page_fd(), io_buf(i), lengths[i], offset,
+                                &ring_requests[i]);
+        } else {
+            ring->prepare_read(page_fd(), io_buf(i), page_size, offset,
+                               &ring_requests[i]);
+        }
+        submitted[i] = true;
+    }
+
+    ring->submit();
+
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (!submitted[i]) continue;
+
+        auto& req = requests[i];
+        ring->wait(&ring_requests[i]);
+        int result = ring_requests[i].result;
+
+        try {
+            if (result == (int)lengths[i] || (!write && result >= 0)) {
+                if (write) {
+                    num_bytes_written.fetch_add(lengths[i],
+                                                std::memory_order_relaxed);
+                } else {
+                    num_bytes_read.add(result);
+                    ::memset(io_buf(i) + result, 0, page_size - result);
+                }
+            } else if (write) {
+                /* short write or error, retry synchronously */
+                pwrite_page(req.pid, io_buf(i), lengths[i]);
+            } else {
+                pread_page(req.pid, io_buf(i));
+            }
+
+            if (!write) finish_read(i);
+            req.ok = true;
+        } catch (IOException&) {
+        }
+    }
 }
 
 void HeapFile::open(bool create)
@@ -127,6 +589,11 @@ void HeapFile::open(bool create)
 
 void HeapFile::close()
 {
+    if (direct_fd != -1) {
+        ::close(direct_fd);
+        direct_fd = -1;
+    }
+
     write_header();
     ::close(fd);
     fd = -1;
@@ -142,7 +609,7 @@ void HeapFile::create()
     }
 
     int err = ftruncate(fd, page_size);
-    file_size_pages = 1;
+    file_size_pages.store(1);
     if (err != 0) {
         fd = -1;
         throw IOException("unable to resize heap file");
@@ -151,28 +618,69 @@ void HeapFile::create()
     write_header();
 }
 
+/* header: | magic(4 bytes) | page size(8 bytes) | # pages(4 bytes) |
+ *         | free list head(4 bytes) | # free pages(4 bytes) |
+ *         | page format(4 bytes) |
+ * files written before there was a free list or a page format read as
+ * zeros there, i.e. an empty list and RAW pages */
+static const size_t HEADER_SIZE = 5 * sizeof(uint32_t) + sizeof(size_t);
+
 void HeapFile::read_header()
 {
-    uint32_t magic;
+    uint8_t buf[HEADER_SIZE];
+
+    if (::pread(fd, buf, sizeof(buf), 0) != sizeof(buf)) {
+        throw IOException("bad heap file(header)");
+    }
 
-    lseek(fd, 0, SEEK_SET);
-    read(fd, &magic, sizeof(magic));
+    uint32_t magic;
+    ::memcpy(&magic, buf, sizeof(magic));
     if (magic != MAGIC) {
         throw IOException("bad heap file(magic)");
     }
 
-    read(fd, &page_size, sizeof(page_size));
-    read(fd, &file_size_pages, sizeof(file_size_pages));
+    uint32_t num_pages, num_free;
+    size_t offset = sizeof(magic);
+    ::memcpy(&page_size, buf + offset, sizeof(page_size));
+    offset += sizeof(page_size);
+    ::memcpy(&num_pages, buf + offset, sizeof(num_pages));
+    offset += sizeof(num_pages);
+    ::memcpy(&free_list_head, buf + offset, sizeof(free_list_head));
+    offset += sizeof(free_list_head);
+    ::memcpy(&num_free, buf + offset, sizeof(num_free));
+    offset += sizeof(num_free);
+    ::memcpy(&format, buf + offset, sizeof(format));
+    if (format != PageFormat::RAW && format != PageFormat::CHECKSUM &&
+        format != PageFormat::LZ4) {
+        throw IOException("bad heap file(page format)");
+    }
+    file_size_pages.store(num_pages);
+    num_free_pages.store(num_free);
 }
 
 void HeapFile::write_header()
 {
+    uint8_t buf[HEADER_SIZE];
     uint32_t magic = MAGIC;
-
-    lseek(fd, 0, SEEK_SET);
-    write(fd, &magic, sizeof(magic));
-    write(fd, &page_size, sizeof(page_size));
-    write(fd, &file_size_pages, sizeof(file_size_pages));
+    uint32_t num_pages = file_size_pages.load();
+    uint32_t num_free = num_free_pages.load();
+
+    size_t offset = 0;
+    ::memcpy(buf, &magic, sizeof(magic));
+    offset += sizeof(magic);
+    ::memcpy(buf + offset, &page_size, sizeof(page_size));
+    offset += sizeof(page_size);
+    ::memcpy(buf + offset, &num_pages, sizeof(num_pages));
+    offset += sizeof(num_pages);
+    ::memcpy(buf + offset, &free_list_head, sizeof(free_list_head));
+    offset += sizeof(free_list_head);
+    ::memcpy(buf + offset, &num_free, sizeof(num_free));
+    offset += sizeof(num_free);
+    ::memcpy(buf + offset, &format, sizeof(format));
+
+    if (::pwrite(fd, buf, sizeof(buf), 0) != sizeof(buf)) {
+        throw IOException("unable to write heap file header");
+    }
 }
 
 } // namespace bptree
@@ -1,197 +1,1014 @@
 #include "bptree/heap_page_cache.h"
+#include "bptree/wal.h"
 
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace bptree {
 
+    static bool read_fully(int fd, void* buf, size_t n)
+    {
+        auto* p = static_cast<uint8_t*>(buf);
+        while (n > 0) {
+            ssize_t retval = ::read(fd, p, n);
+            if (retval < 0 && errno == EINTR) continue;
+            if (retval <= 0) return false;
+            p += retval;
+            n -= retval;
+        }
+        return true;
+    }
+
+    static bool write_fully(int fd, const void* buf, size_t n)
+    {
+        auto* p = static_cast<const uint8_t*>(buf);
+        while (n > 0) {
+            ssize_t retval = ::write(fd, p, n);
+            if (retval < 0 && errno == EINTR) continue;
+            if (retval <= 0) return false;
+            p += retval;
+            n -= retval;
+        }
+        return true;
+    }
+
     HeapPageCache::HeapPageCache(std::string_view filename, bool create,
-                                size_t max_pages, size_t page_size)
-        : heap_file(std::make_unique<HeapFile>(filename, create, page_size)),
-        max_pages(max_pages)
+                                size_t max_pages, size_t page_size,
+                                WritePolicy write_policy,
+                                size_t dirty_high_watermark,
+                                IOBackend io_backend,
+                                size_t num_prefetch_threads,
+                                size_t max_prefetch_pages,
+                                size_t num_shards,
+                                ReplacementPolicyType replacement_policy,
+                                bool prioritize_inner_nodes,
+                                bool direct_io, bool use_huge_pages,
+                                PageFormat page_format)
+        : HeapPageCache(std::make_unique<HeapFile>(filename, create, page_size,
+                                                   io_backend, direct_io,
+                                                   page_format),
+                        max_pages, write_policy, dirty_high_watermark,
+                        num_prefetch_threads, max_prefetch_pages, num_shards,
+                        replacement_policy, prioritize_inner_nodes,
+                        use_huge_pages)
+    {}
+
+    HeapPageCache::HeapPageCache(std::unique_ptr<PageStore> store,
+                                size_t max_pages,
+                                WritePolicy write_policy,
+                                size_t dirty_high_watermark,
+                                size_t num_prefetch_threads,
+                                size_t max_prefetch_pages,
+                                size_t num_shards,
+                                ReplacementPolicyType replacement_policy,
+                                bool prioritize_inner_nodes,
+                                bool use_huge_pages)
+        : store(std::move(store)),
+        heap_file(dynamic_cast<HeapFile*>(this->store.get())),
+        max_pages(max_pages),
+        frame_arena(max_pages, this->store->get_data_size(), use_huge_pages),
+        num_shards(num_shards),
+        replacement_policy(replacement_policy),
+        prioritize_inner_nodes(prioritize_inner_nodes),
+        write_policy(write_policy), dirty_high_watermark(dirty_high_watermark),
+        flusher_stop(false), log(nullptr), max_prefetch_pages(max_prefetch_pages),
+        prefetch_stop(false)
     {
-        this->page_size = page_size;
+        this->page_size = this->store->get_data_size();
+        num_cached.store(0);
+        num_dirty.store(0);
+        num_prefetch_pending.store(0);
+        num_prefetched.store(0);
+        num_prefetch_hits.store(0);
+        warm_up_stop.store(false);
+        num_warmed.store(0);
+
+        if (this->dirty_high_watermark == 0) {
+            this->dirty_high_watermark = std::max<size_t>(1, max_pages / 2);
+        }
+
+        if (this->max_prefetch_pages == 0) {
+            this->max_prefetch_pages = std::max<size_t>(1, max_pages / 8);
+        }
+
+        if (this->num_shards == 0) {
+            this->num_shards = std::min(MAX_SHARDS,
+                                        max_pages / DEFAULT_FRAMES_PER_SHARD);
+        }
+        this->num_shards =
+            std::max<size_t>(1, std::min(this->num_shards, max_pages));
+
+        /* buffers are not touched here so that the kernel only backs the
+         * frames that are actually used */
+        frames = std::allocator<Page>().allocate(max_pages);
+        frame_policy.reset(new uint8_t[max_pages]);
+        for (size_t i = 0; i < max_pages; i++) {
+            new (&frames[i]) Page(Page::INVALID_PAGE_ID, page_size,
+                                  frame_arena.get_frame(i));
+            frame_policy[i] = NO_POLICY;
+        }
+
+        shards.reset(new Shard[this->num_shards]);
+        for (size_t s = 0; s < this->num_shards; s++) {
+            auto& shard = shards[s];
+            size_t first = s * max_pages / this->num_shards;
+            size_t last = (s + 1) * max_pages / this->num_shards;
+
+            shard.first_frame = first;
+            shard.num_frames = last - first;
+            for (auto&& policy : shard.policies) {
+                policy = ReplacementPolicy::create(replacement_policy,
+                                                   shard.num_frames);
+            }
+            shard.hits.store(0);
+            shard.misses.store(0);
+            shard.evictions.store(0);
+            /* hand out lower frames first */
+            for (size_t i = last; i > first; i--) {
+                shard.free_frames.push_back(&frames[i - 1]);
+            }
+        }
+
+        if (write_policy == WritePolicy::WRITE_BACK) {
+            flusher = std::thread([this]() { flusher_main(); });
+        }
+
+        for (size_t i = 0; i < num_prefetch_threads; i++) {
+            prefetch_threads.emplace_back([this]() { prefetch_main(); });
+        }
     }
 
-    Page* HeapPageCache::alloc_page(PageID id, boost::upgrade_lock<Page>& lock)
+    HeapPageCache::~HeapPageCache()
     {
-        if (size() < max_pages) {
-            auto page = new Page(id, page_size);
-            lock = boost::upgrade_lock(*page);
-            pages.emplace_back(page);
-            page_map[id] = page;
+        warm_up_stop = true;
+        wait_for_warm_up();
 
+        {
+            std::lock_guard<std::mutex> guard(prefetch_mutex);
+            prefetch_stop = true;
+        }
+        prefetch_cv.notify_all();
+        for (auto&& t : prefetch_threads) {
+            t.join();
+        }
+
+        if (flusher.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(flusher_mutex);
+                flusher_stop = true;
+            }
+            flusher_cv.notify_one();
+            flusher.join();
+        }
+
+        flush_all_pages();
+
+        for (size_t i = 0; i < max_pages; i++) {
+            frames[i].~Page();
+        }
+        std::allocator<Page>().deallocate(frames, max_pages);
+    }
+
+    HeapPageCache::Shard& HeapPageCache::shard_for(PageID id) const
+    {
+        /* fibonacci hashing so that strided page IDs still spread out */
+        uint64_t hash = (uint64_t)id * 0x9E3779B97F4A7C15ULL;
+        return shards[(hash >> 32) % num_shards];
+    }
+
+    PageCacheStats HeapPageCache::get_stats() const
+    {
+        PageCacheStats stats;
+        for (size_t s = 0; s < num_shards; s++) {
+            stats.hits += shards[s].hits.load();
+            stats.misses += shards[s].misses.load();
+            stats.evictions += shards[s].evictions.load();
+        }
+        stats.dirty_pages = num_dirty.load();
+        stats.prefetched = num_prefetched.load();
+        stats.prefetch_hits = num_prefetch_hits.load();
+        if (heap_file) {
+            stats.bytes_read = heap_file->get_num_bytes_read();
+            stats.bytes_written = heap_file->get_num_bytes_written();
+        }
+        return stats;
+    }
+
+    Page* HeapPageCache::alloc_frame(Shard& shard,
+                                     boost::upgrade_lock<Page>& lock,
+                                     std::unique_lock<std::mutex>& guard)
+    {
+        if (!shard.free_frames.empty()) {
+            auto* page = shard.free_frames.back();
+            shard.free_frames.pop_back();
+            lock = boost::upgrade_lock<Page>(*page);
+            page->set_priority(PagePriority::NORMAL);
             return page;
         }
 
-        PageID victim_id;
-        if (!lru_victim(victim_id)) {
+        auto* page = evict_frame(shard);
+        if (!page) {
             return nullptr;
         }
 
-        auto it = page_map.find(victim_id);
-        assert(it != page_map.end());
+        lock = boost::upgrade_lock<Page>(*page);
+        page->set_priority(PagePriority::NORMAL);
 
-        auto* page = it->second;
-        lock = boost::upgrade_lock(*page);
+        auto victim_id = page->get_id();
+        shard.page_map.erase(victim_id);
+        num_cached--;
+        if (shard.prefetched_unused.erase(victim_id)) {
+            num_prefetch_pending--; /* evicted before anyone used it */
+        }
 
         if (page->is_dirty()) {
-            flush_page(page, lock);
-        }
+            /* the log flush and the write happen without the shard lock.
+             * fetchers of the victim wait for the write like for a read and
+             * then read it back. a read of the victim that is still in
+             * flight (e.g. a prefetch racing with new_page()) keeps the
+             * lock */
+            bool unlock = shard.pending_reads.find(victim_id) ==
+                          shard.pending_reads.end();
+            if (unlock) {
+                shard.pending_reads[victim_id] =
+                    std::make_shared<PendingRead>(PendingRead{true, false});
+                guard.unlock();
+            }
+
+            try {
+                flush_page(page, lock);
+            } catch (IOException&) {
+                /* still cached, but no longer evictable */
+                if (unlock) {
+                    guard.lock();
+                    shard.pending_reads.erase(victim_id);
+                    shard.read_cv.notify_all();
+                }
+                shard.page_map[victim_id] = page;
+                num_cached++;
+                throw;
+            }
 
-        boost::upgrade_to_unique_lock<Page> ulock(lock);
-        page_map.erase(it);
-        page->set_id(id);
-        page_map[id] = page;
+            if (unlock) {
+                guard.lock();
+                shard.pending_reads.erase(victim_id);
+                shard.read_cv.notify_all();
+            }
+        }
 
         return page;
     }
 
+    void HeapPageCache::release_frame(Shard& shard, Page* page)
+    {
+        /* frames are released before they join a policy */
+        page->set_id(Page::INVALID_PAGE_ID);
+        shard.free_frames.push_back(page);
+    }
+
     Page* HeapPageCache::new_page(boost::upgrade_lock<Page>& lock)
     {
-        std::lock_guard<std::mutex> guard(mutex);
+        /* the shard depends on the page ID so allocate it first */
+        PageID new_id = store->new_page();
+        auto& shard = shard_for(new_id);
+
+        std::unique_lock<std::mutex> guard(shard.mutex);
 
-        PageID new_id = heap_file->new_page();
-        auto page = alloc_page(new_id, lock);
+        /* a reused page may have been prefetched after it was freed */
+        drop_page_locked(shard, new_id, guard);
 
-        pin_page(page, lock);
+        /* alloc_frame() may drop the shard lock, nobody reads the page in
+         * the meantime */
+        shard.pending_reads[new_id] =
+            std::make_shared<PendingRead>(PendingRead{true, false});
+        Page* page;
+        try {
+            page = alloc_frame(shard, lock, guard);
+        } catch (IOException&) {
+            shard.pending_reads.erase(new_id);
+            shard.read_cv.notify_all();
+            throw;
+        }
+        shard.pending_reads.erase(new_id);
+        shard.read_cv.notify_all();
+        if (!page) return nullptr;
+
+        {
+            boost::upgrade_to_unique_lock<Page> ulock(lock);
+            page->set_id(new_id);
+            page->set_lsn(0);
+            ::memset(page->get_buffer(ulock), 0, page_size);
+        }
+
+        shard.page_map[new_id] = page;
+        num_cached++;
+        pin_locked(shard, page);
 
         return page;
     }
 
-    Page* HeapPageCache::fetch_page(PageID id, boost::upgrade_lock<Page>& lock)
+    void HeapPageCache::free_page(PageID id)
     {
-        bptree::Page* page = nullptr;
+        auto& shard = shard_for(id);
+
         {
-            std::lock_guard<std::mutex> guard(mutex);
+            std::unique_lock<std::mutex> guard(shard.mutex);
+            drop_page_locked(shard, id, guard);
+        }
+
+        store->free_page(id);
+    }
+
+    void HeapPageCache::drop_page_locked(Shard& shard, PageID id,
+                                         std::unique_lock<std::mutex>& guard)
+    {
+        while (true) {
+            auto pit = shard.pending_reads.find(id);
+            if (pit == shard.pending_reads.end()) break;
+
+            if (!pit->second->started) {
+                if (pit->second->prefetch) num_prefetch_pending--;
+                shard.pending_reads.erase(pit);
+                break;
+            }
 
-            auto it = page_map.find(id);
+            shard.read_cv.wait(guard);
+        }
+
+        auto it = shard.page_map.find(id);
+        if (it == shard.page_map.end()) return;
+
+        auto* page = it->second;
+        size_t i = frame_index(page);
+        if (frame_policy[i] != NO_POLICY) {
+            shard.policies[frame_policy[i]]->remove(i - shard.first_frame);
+            frame_policy[i] = NO_POLICY;
+        }
 
-            if (it == page_map.end()) {
-                auto page = alloc_page(id, lock);
+        shard.page_map.erase(it);
+        num_cached--;
+        if (shard.prefetched_unused.erase(id)) {
+            num_prefetch_pending--;
+        }
 
-                try {
-                    boost::upgrade_to_unique_lock<Page> ulock(lock);
-                    heap_file->read_page(page, ulock);
-                    pin_page(page, lock);
+        {
+            /* waits for the flusher if it is writing the page */
+            boost::upgrade_lock<Page> lock(*page);
+            if (page->is_dirty()) {
+                page->set_dirty(false);
+                num_dirty--;
+            }
+        }
+
+        release_frame(shard, page);
+    }
+
+    Page* HeapPageCache::fetch_page(PageID id, boost::upgrade_lock<Page>& lock)
+    {
+        return fetch(id, lock, nullptr);
+    }
 
-                    return page;
-                } catch (IOException e) {
-                    // std::cerr << "Failed to read page: " << e.what() << std::endl;
-                    return nullptr;
+    Page* HeapPageCache::fetch_page_for_redo(PageID id,
+                                             boost::upgrade_lock<Page>& lock,
+                                             bool& corrupt)
+    {
+        corrupt = false;
+        return fetch(id, lock, &corrupt);
+    }
+
+    Page* HeapPageCache::fetch(PageID id, boost::upgrade_lock<Page>& lock,
+                               bool* corrupt)
+    {
+        auto& shard = shard_for(id);
+        std::unique_lock<std::mutex> guard(shard.mutex);
+        bool first_lookup = true;
+
+        while (true) {
+            auto it = shard.page_map.find(id);
+
+            if (first_lookup) {
+                if (it != shard.page_map.end()) {
+                    shard.hits++;
+                } else {
+                    shard.misses++;
                 }
+                first_lookup = false;
             }
 
-            page = it->second;
-            pin_page(page, lock);
+            if (it != shard.page_map.end()) {
+                auto* page = it->second;
+                pin_locked(shard, page);
+
+                if (!shard.prefetched_unused.empty() &&
+                    shard.prefetched_unused.erase(id)) {
+                    num_prefetch_pending--;
+                    num_prefetch_hits++;
+                }
+
+                guard.unlock();
+
+                /* blocks until a prefetch thread that is still publishing
+                 * the page releases it */
+                lock = boost::upgrade_lock<Page>(*page);
+                return page;
+            }
+
+            auto pit = shard.pending_reads.find(id);
+            if (pit == shard.pending_reads.end()) break;
+
+            if (!pit->second->started) {
+                /* still in the prefetch queue, read it ourselves. the
+                 * prefetch thread skips it as it is no longer pending */
+                if (pit->second->prefetch) num_prefetch_pending--;
+                shard.pending_reads.erase(pit);
+                break;
+            }
+
+            shard.read_cv.wait(guard);
+        }
+
+        /* fetchers of the page wait for the read, alloc_frame() may already
+         * drop the shard lock */
+        shard.pending_reads[id] =
+            std::make_shared<PendingRead>(PendingRead{true, false});
+
+        Page* page;
+        try {
+            page = alloc_frame(shard, lock, guard);
+        } catch (IOException&) {
+            shard.pending_reads.erase(id);
+            shard.read_cv.notify_all();
+            throw;
+        }
+        if (!page) {
+            shard.pending_reads.erase(id);
+            guard.unlock();
+            shard.read_cv.notify_all();
+            return nullptr;
+        }
+
+        /* do the I/O without holding the shard lock */
+        guard.unlock();
+
+        bool ok = true;
+        try {
+            boost::upgrade_to_unique_lock<Page> ulock(lock);
+            page->set_id(id);
+            page->set_lsn(0);
+            store->read_page(page, ulock);
+        } catch (IOException& e) {
+            // std::cerr << "Failed to read page: " << e.what() << std::endl;
+            ok = false;
+        }
+
+        /* only a page beyond the end of the store is missing */
+        if (!ok && corrupt && id < store->get_num_pages()) {
+            boost::upgrade_to_unique_lock<Page> ulock(lock);
+            ::memset(page->get_buffer(ulock), 0, page->get_size());
+            *corrupt = true;
+            ok = true;
+        }
+
+        guard.lock();
+        shard.pending_reads.erase(id);
+
+        if (ok) {
+            shard.page_map[id] = page;
+            num_cached++;
+            pin_locked(shard, page);
+        } else {
+            release_frame(shard, page);
+            page = nullptr;
+        }
+
+        guard.unlock();
+        shard.read_cv.notify_all();
+
+        if (!page) {
+            lock = boost::upgrade_lock<Page>();
         }
 
-        lock = boost::upgrade_lock<Page>(*page);
         return page;
     }
 
-    void HeapPageCache::pin_page(Page* page, boost::upgrade_lock<Page>& lock)
+    void HeapPageCache::pin_locked(Shard& shard, Page* page)
     {
+        size_t i = frame_index(page);
+        auto priority = frame_policy[i];
+
+        if (priority == NO_POLICY) {
+            page->pin();
+            return;
+        }
+
+        auto& policy = *shard.policies[priority];
+        policy.on_access(i - shard.first_frame);
         if (page->pin() == 0) {
-            lru_erase(page->get_id());
+            policy.set_evictable(i - shard.first_frame, false);
         }
     }
 
+    void HeapPageCache::unpin_locked(Shard& shard, Page* page)
+    {
+        if (page->unpin() != 1) return;
+
+        size_t i = frame_index(page);
+        size_t local = i - shard.first_frame;
+        uint8_t priority = prioritize_inner_nodes
+                               ? (uint8_t)page->get_priority()
+                               : (uint8_t)PagePriority::NORMAL;
+
+        /* a frame joins a policy when it is first unpinned after a load, by
+         * which time the tree has set the page's priority */
+        if (frame_policy[i] != priority) {
+            if (frame_policy[i] != NO_POLICY) {
+                shard.policies[frame_policy[i]]->remove(local);
+            }
+            shard.policies[priority]->on_load(local, page->get_id());
+            frame_policy[i] = priority;
+        }
+
+        shard.policies[priority]->set_evictable(local, true);
+    }
+
+    void HeapPageCache::pin_page(Page* page, boost::upgrade_lock<Page>&)
+    {
+        auto& shard = shard_for(page->get_id());
+        std::lock_guard<std::mutex> guard(shard.mutex);
+
+        pin_locked(shard, page);
+    }
+
     void HeapPageCache::unpin_page(Page* page, bool dirty, boost::upgrade_lock<Page>& lock)
     {
-        page->set_dirty(dirty);
+        if (dirty) {
+            mark_dirty(page);
+        }
+
+        {
+            auto& shard = shard_for(page->get_id());
+            std::lock_guard<std::mutex> guard(shard.mutex);
 
-        int pin_count = page->unpin();
-        if (pin_count == 1) {
-            lru_insert(page->get_id());
+            unpin_locked(shard, page);
         }
 
-        flush_page(page, lock);
+        if (write_policy == WritePolicy::WRITE_THROUGH) {
+            flush_page(page, lock);
+        }
     }
 
     void HeapPageCache::flush_page(Page* page, boost::upgrade_lock<Page>& lock)
     {
         if (page->is_dirty()) {
-            heap_file->write_page(page, lock);
+            if (log) {
+                /* written back when its batch is appended */
+                auto lsn = page->get_lsn();
+                if (lsn == WriteAheadLog::PENDING_LSN) return;
+                log->flush(lsn);
+            }
+
+            store->write_page(page, lock);
 
             page->set_dirty(false);
+            num_dirty--;
         }
     }
 
     void HeapPageCache::flush_all_pages()
     {
-        for (auto&& p : pages) {
-            auto lock = boost::upgrade_lock<Page>(*p);
-            flush_page(p.get(), lock);
+        flush_dirty_pages(true);
+        store->sync();
+
+        if (!manifest_filename.empty()) {
+            try {
+                write_manifest();
+            } catch (IOException&) {
+                /* the manifest is only a hint for the next open */
+            }
         }
     }
 
-    void HeapPageCache::lru_insert(PageID id)
+    void HeapPageCache::mark_dirty(Page* page)
     {
-        std::lock_guard<std::mutex> lock(lru_mutex);
+        /* dirty flag only changes under the page's upgrade lock */
+        if (page->is_dirty()) return;
+
+        page->set_dirty(true);
+        if (++num_dirty == dirty_high_watermark &&
+            write_policy == WritePolicy::WRITE_BACK) {
+            std::lock_guard<std::mutex> guard(flusher_mutex);
+            flusher_cv.notify_one();
+        }
+    }
 
-        if (lru_map.find(id) == lru_map.end()) {
-            lru_list.push_front(id);
-            lru_map.emplace(id, lru_list.begin());
+    void HeapPageCache::flush_dirty_pages(bool wait_pending)
+    {
+        std::vector<Page*> dirty_pages;
+        for (size_t i = 0; i < max_pages; i++) {
+            if (frames[i].is_dirty()) dirty_pages.push_back(&frames[i]);
         }
+
+        /* write pages back in page ID order so that the heap file sees
+         * (mostly) sequential writes. a frame may be evicted and reused for
+         * another page before we get its lock, in which case it is flushed
+         * under its new page ID */
+        std::sort(dirty_pages.begin(), dirty_pages.end(),
+                  [](const Page* a, const Page* b) {
+                      return a->get_id() < b->get_id();
+                  });
+
+        std::vector<Page*> batch;
+        std::vector<boost::upgrade_lock<Page>> locks;
+        std::vector<PageIORequest> requests;
+
+        auto write_batch = [&]() {
+            if (batch.empty()) return;
+
+            requests.clear();
+            uint64_t max_lsn = 0;
+            for (size_t i = 0; i < batch.size(); i++) {
+                max_lsn = std::max(max_lsn, batch[i]->get_lsn());
+                /* the buffer is only read by write_pages() */
+                auto* buf = const_cast<uint8_t*>(batch[i]->get_buffer(locks[i]));
+                requests.push_back(
+                    {batch[i]->get_id(), buf, false, batch[i]->get_lsn()});
+            }
+
+            if (log) log->flush(max_lsn);
+            store->write_pages(requests);
+
+            for (size_t i = 0; i < batch.size(); i++) {
+                if (requests[i].ok) {
+                    batch[i]->set_dirty(false);
+                    num_dirty--;
+                }
+            }
+
+            batch.clear();
+            locks.clear();
+        };
+
+        for (auto* page : dirty_pages) {
+            /* never block on a page lock while holding the locks of the
+             * current batch */
+            boost::upgrade_lock<Page> lock(*page, boost::try_to_lock);
+            if (!lock.owns_lock()) {
+                write_batch();
+                lock = boost::upgrade_lock<Page>(*page);
+            }
+
+            if (!page->is_dirty()) continue;
+
+            if (log && page->get_lsn() == WriteAheadLog::PENDING_LSN) {
+                if (!wait_pending) continue;
+
+                /* the batch is appended by a writer that needs the page
+                 * lock, give it up while waiting */
+                write_batch();
+                while (page->get_lsn() == WriteAheadLog::PENDING_LSN) {
+                    lock.unlock();
+                    std::this_thread::yield();
+                    lock = boost::upgrade_lock<Page>(*page);
+                }
+                if (!page->is_dirty()) continue;
+            }
+
+            batch.push_back(page);
+            locks.push_back(std::move(lock));
+            if (batch.size() == FLUSH_BATCH_SIZE) write_batch();
+        }
+
+        write_batch();
     }
 
-    void HeapPageCache::lru_erase(PageID id)
+    void HeapPageCache::flusher_main()
     {
-        std::lock_guard<std::mutex> lock(lru_mutex);
+        std::unique_lock<std::mutex> guard(flusher_mutex);
 
-        auto it = lru_map.find(id);
+        while (true) {
+            flusher_cv.wait(guard, [this]() {
+                return flusher_stop || num_dirty.load() >= dirty_high_watermark;
+            });
+            if (flusher_stop) break;
 
-        if (it != lru_map.end()) {
-            lru_list.erase(it->second);
-            lru_map.erase(it);
+            guard.unlock();
+            flush_dirty_pages(false);
+            guard.lock();
         }
     }
 
-    bool HeapPageCache::lru_victim(PageID& id)
+    Page* HeapPageCache::evict_frame(Shard& shard)
     {
-        std::lock_guard<std::mutex> lock(lru_mutex);
+        auto& normal = *shard.policies[(int)PagePriority::NORMAL];
+        auto& high = *shard.policies[(int)PagePriority::HIGH];
+
+        bool high_first = high.num_evictable() > 0 &&
+                          (normal.num_evictable() == 0 ||
+                           high.size() > shard.num_frames / 2);
 
-        if (lru_list.empty()) {
-            return false;
+        size_t local;
+        if (!(high_first ? high : normal).evict(local) &&
+            !(high_first ? normal : high).evict(local)) {
+            return nullptr;
         }
 
-        id = lru_list.back();
-        lru_map.erase(id);
-        lru_list.pop_back();
+        size_t i = shard.first_frame + local;
+        frame_policy[i] = NO_POLICY;
+        shard.evictions++;
 
-        return true;
+        return &frames[i];
     }
 
     void HeapPageCache::prefetch_page(PageID id) {
-        {
-            std::lock_guard<std::mutex> guard(mutex);
-            if (page_map.find(id) != page_map.end()) {
-                return; // Already in cache
+        prefetch_pages(std::vector<PageID>{id});
+    }
+
+    void HeapPageCache::prefetch_pages(const std::vector<PageID>& ids) {
+        if (prefetch_threads.empty()) return;
+
+        std::vector<std::pair<PageID, std::shared_ptr<PendingRead>>> queued;
+
+        for (PageID id : ids) {
+            if (id == Page::INVALID_PAGE_ID) continue;
+
+            auto& shard = shard_for(id);
+            std::lock_guard<std::mutex> guard(shard.mutex);
+
+            if (shard.page_map.find(id) != shard.page_map.end()) continue;
+            if (shard.pending_reads.find(id) != shard.pending_reads.end()) {
+                continue;
+            }
+
+            /* do not let prefetched pages push out the working set */
+            if (num_prefetch_pending.fetch_add(1) >= max_prefetch_pages) {
+                num_prefetch_pending--;
+                break;
             }
+
+            auto pending =
+                std::make_shared<PendingRead>(PendingRead{false, true});
+            shard.pending_reads[id] = pending;
+            queued.emplace_back(id, std::move(pending));
         }
-        
-        boost::upgrade_lock<Page> lock;
-        Page* page = nullptr;
-        
+
+        if (queued.empty()) return;
+
         {
-            std::lock_guard<std::mutex> guard(mutex);
-            page = alloc_page(id, lock);
-            if (!page) return; // Couldn't allocate a page
+            std::lock_guard<std::mutex> guard(prefetch_mutex);
+            for (auto&& p : queued) {
+                prefetch_queue.push_back(std::move(p));
+            }
         }
-        
-        try {
-            boost::upgrade_to_unique_lock<Page> ulock(lock);
-            heap_file->read_page(page, ulock);
-        } catch (IOException& e) {
-            std::cerr << "Failed to prefetch page: " << e.what() << std::endl;
+        prefetch_cv.notify_one();
+    }
+
+    void HeapPageCache::prefetch_main()
+    {
+        std::vector<std::pair<PageID, std::shared_ptr<PendingRead>>> batch;
+        std::vector<Page*> pages;
+        std::vector<boost::upgrade_lock<Page>> locks;
+        std::vector<PageIORequest> requests;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(prefetch_mutex);
+                prefetch_cv.wait(guard, [this]() {
+                    return prefetch_stop || !prefetch_queue.empty();
+                });
+                if (prefetch_stop) break;
+
+                while (!prefetch_queue.empty() &&
+                       batch.size() < PREFETCH_BATCH_SIZE) {
+                    batch.push_back(std::move(prefetch_queue.front()));
+                    prefetch_queue.pop_front();
+                }
+            }
+
+            /* allocate frames for the reads that have not been taken over
+             * by fetch_page() */
+            for (auto&& [id, pending] : batch) {
+                auto& shard = shard_for(id);
+                std::unique_lock<std::mutex> guard(shard.mutex);
+
+                auto it = shard.pending_reads.find(id);
+                if (it == shard.pending_reads.end() || it->second != pending) {
+                    continue;
+                }
+
+                /* fetchers wait from here on, alloc_frame() may drop the
+                 * shard lock */
+                pending->started = true;
+
+                boost::upgrade_lock<Page> lock;
+                auto* page = alloc_frame(shard, lock, guard);
+                if (!page) {
+                    shard.pending_reads.erase(id);
+                    num_prefetch_pending--;
+                    guard.unlock();
+                    shard.read_cv.notify_all();
+                    continue;
+                }
+
+                pages.push_back(page);
+                locks.push_back(std::move(lock));
+                requests.push_back({id, nullptr, false});
+            }
+            batch.clear();
+
+            if (pages.empty()) continue;
+            read_batch(pages, locks, requests, true);
         }
     }
 
-    void HeapPageCache::prefetch_pages(const std::vector<PageID>& ids) {
-        for (PageID id : ids) {
-            prefetch_page(id);
+    size_t HeapPageCache::read_batch(std::vector<Page*>& pages,
+                                     std::vector<boost::upgrade_lock<Page>>& locks,
+                                     std::vector<PageIORequest>& requests,
+                                     bool prefetch)
+    {
+        std::vector<std::unique_ptr<boost::upgrade_to_unique_lock<Page>>> ulocks;
+        for (size_t i = 0; i < pages.size(); i++) {
+            ulocks.emplace_back(
+                std::make_unique<boost::upgrade_to_unique_lock<Page>>(locks[i]));
+            pages[i]->set_id(requests[i].pid);
+            pages[i]->set_lsn(0);
+            requests[i].buf = pages[i]->get_buffer(*ulocks[i]);
+        }
+
+        store->read_pages(requests);
+        ulocks.clear();
+
+        size_t num_published = 0;
+        for (size_t i = 0; i < pages.size(); i++) {
+            auto id = requests[i].pid;
+            auto& shard = shard_for(id);
+
+            {
+                std::lock_guard<std::mutex> guard(shard.mutex);
+                shard.pending_reads.erase(id);
+
+                /* page_map may already have the page if it was created
+                 * by new_page() while we were reading it */
+                if (requests[i].ok &&
+                    shard.page_map.find(id) == shard.page_map.end()) {
+                    shard.page_map[id] = pages[i];
+                    num_cached++;
+                    num_published++;
+                    if (prefetch) {
+                        shard.prefetched_unused.insert(id);
+                        num_prefetched++;
+                    }
+
+                    /* published unpinned */
+                    pages[i]->pin();
+                    unpin_locked(shard, pages[i]);
+                } else {
+                    release_frame(shard, pages[i]);
+                    if (prefetch) num_prefetch_pending--;
+                }
+
+                /* the frame is visible to alloc_frame() now, which may
+                 * wait for its lock while holding the shard lock */
+                locks[i].unlock();
+            }
+
+            /* fetchers waiting for this page find it in page_map and
+             * block on the page lock until we drop it */
+            shard.read_cv.notify_all();
+        }
+
+        pages.clear();
+        locks.clear();
+        requests.clear();
+        return num_published;
+    }
+
+    size_t HeapPageCache::use_manifest(std::string_view filename)
+    {
+        wait_for_warm_up();
+        manifest_filename = filename;
+
+        int fd = ::open(manifest_filename.c_str(), O_RDONLY);
+        if (fd < 0) return 0;
+
+        /* | magic | # of inner node pages | # of pages | page IDs | */
+        uint32_t header[3];
+        std::vector<PageID> pids;
+        bool ok = read_fully(fd, header, sizeof(header)) &&
+                  header[0] == MANIFEST_MAGIC && header[1] <= header[2] &&
+                  header[2] <= store->get_num_pages();
+        if (ok) {
+            pids.resize(header[2]);
+            ok = read_fully(fd, pids.data(), pids.size() * sizeof(PageID));
+        }
+        ::close(fd);
+        if (!ok || pids.empty()) return 0;
+
+        size_t num_pages = pids.size();
+        size_t num_inner = header[1];
+        warm_up_thread = std::thread([this, pids = std::move(pids), num_inner]() mutable {
+            warm_up_main(std::move(pids), num_inner);
+        });
+        return num_pages;
+    }
+
+    size_t HeapPageCache::write_manifest()
+    {
+        if (manifest_filename.empty()) return 0;
+
+        std::vector<PageID> inner;
+        std::vector<PageID> other;
+        for (size_t s = 0; s < num_shards; s++) {
+            auto& shard = shards[s];
+            std::lock_guard<std::mutex> guard(shard.mutex);
+            for (auto&& [id, page] : shard.page_map) {
+                if (page->get_priority() == PagePriority::HIGH) {
+                    inner.push_back(id);
+                } else {
+                    other.push_back(id);
+                }
+            }
+        }
+        std::sort(inner.begin(), inner.end());
+        std::sort(other.begin(), other.end());
+
+        std::vector<uint32_t> buf{MANIFEST_MAGIC, (uint32_t)inner.size(),
+                                  (uint32_t)(inner.size() + other.size())};
+        buf.insert(buf.end(), inner.begin(), inner.end());
+        buf.insert(buf.end(), other.begin(), other.end());
+
+        /* written to a temporary file that replaces the old manifest, so
+         * that a crash leaves one of them complete */
+        std::lock_guard<std::mutex> guard(manifest_mutex);
+        auto tmp_filename = manifest_filename + ".tmp";
+        int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fd < 0) {
+            throw IOException("unable to create manifest file");
+        }
+
+        bool ok = write_fully(fd, buf.data(), buf.size() * sizeof(uint32_t));
+        ::close(fd);
+        if (!ok || ::rename(tmp_filename.c_str(), manifest_filename.c_str()) != 0) {
+            ::unlink(tmp_filename.c_str());
+            throw IOException("unable to write manifest file");
+        }
+
+        return inner.size() + other.size();
+    }
+
+    void HeapPageCache::wait_for_warm_up()
+    {
+        if (warm_up_thread.joinable()) warm_up_thread.join();
+    }
+
+    void HeapPageCache::warm_up_main(std::vector<PageID> pids, size_t num_inner)
+    {
+        std::vector<Page*> pages;
+        std::vector<boost::upgrade_lock<Page>> locks;
+        std::vector<PageIORequest> requests;
+
+        for (size_t start = 0; start < pids.size(); start += WARM_UP_BATCH_SIZE) {
+            /* the working set has taken over the free frames */
+            if (warm_up_stop.load() || num_cached.load() >= max_pages) break;
+
+            size_t end = std::min(start + WARM_UP_BATCH_SIZE, pids.size());
+            for (size_t i = start; i < end; i++) {
+                PageID id = pids[i];
+                if (id == Page::INVALID_PAGE_ID || id >= store->get_num_pages()) {
+                    continue;
+                }
+
+                auto& shard = shard_for(id);
+                std::unique_lock<std::mutex> guard(shard.mutex);
+                if (shard.free_frames.empty() ||
+                    shard.page_map.find(id) != shard.page_map.end() ||
+                    shard.pending_reads.find(id) != shard.pending_reads.end()) {
+                    continue;
+                }
+
+                /* a free frame, alloc_frame() keeps the shard lock */
+                boost::upgrade_lock<Page> lock;
+                auto* page = alloc_frame(shard, lock, guard);
+                /* so that an inner node is protected before the tree reads it */
+                if (i < num_inner) page->set_priority(PagePriority::HIGH);
+
+                /* fetchers of the page wait for the read */
+                shard.pending_reads[id] =
+                    std::make_shared<PendingRead>(PendingRead{true, false});
+                pages.push_back(page);
+                locks.push_back(std::move(lock));
+                requests.push_back({id, nullptr, false});
+            }
+
+            if (!pages.empty()) {
+                num_warmed += read_batch(pages, locks, requests, false);
+            }
         }
     }
 
@@ -0,0 +1,255 @@
+#include "bptree/io_uring.h"
+#include "bptree/heap_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <string>
+
+#ifdef BPTREE_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace bptree {
+
+#ifdef BPTREE_HAVE_IO_URING
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+                              unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, nullptr, _NSIG / 8);
+}
+
+bool IOUring::is_supported()
+{
+    static const bool supported = []() {
+        struct io_uring_params p;
+        ::memset(&p, 0, sizeof(p));
+        int fd = sys_io_uring_setup(1, &p);
+        if (fd < 0) return false;
+        ::close(fd);
+        return true;
+    }();
+
+    return supported;
+}
+
+IOUring::IOUring(unsigned int queue_depth) : pending(0)
+{
+    struct io_uring_params p;
+    ::memset(&p, 0, sizeof(p));
+
+    ring_fd = sys_io_uring_setup(queue_depth, &p);
+    if (ring_fd < 0) {
+        throw IOException(
+            ("io_uring_setup failed(error code: " + std::to_string(errno) + ")")
+                .c_str());
+    }
+
+    sq_entries = p.sq_entries;
+    cq_entries = p.cq_entries;
+    in_flight.store(0);
+
+    sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+
+    sq_ptr = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        ::close(ring_fd);
+        throw IOException("unable to map io_uring submission ring");
+    }
+
+    if (single_mmap) {
+        cq_ptr = sq_ptr;
+    } else {
+        cq_ptr = ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            ::munmap(sq_ptr, sq_ring_size);
+            ::close(ring_fd);
+            throw IOException("unable to map io_uring completion ring");
+        }
+    }
+
+    sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (cq_ptr != sq_ptr) ::munmap(cq_ptr, cq_ring_size);
+        ::munmap(sq_ptr, sq_ring_size);
+        ::close(ring_fd);
+        throw IOException("unable to map io_uring submission entries");
+    }
+
+    auto* sq = static_cast<uint8_t*>(sq_ptr);
+    sq_head = reinterpret_cast<unsigned int*>(sq + p.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned int*>(sq + p.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned int*>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned int*>(sq + p.sq_off.array);
+
+    auto* cq = static_cast<uint8_t*>(cq_ptr);
+    cq_head = reinterpret_cast<unsigned int*>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned int*>(cq + p.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned int*>(cq + p.cq_off.ring_mask);
+    cqes = cq + p.cq_off.cqes;
+}
+
+IOUring::~IOUring()
+{
+    /* the kernel still writes to our buffers until requests complete */
+    while (in_flight.load() > 0) {
+        std::lock_guard<std::mutex> guard(cq_mutex);
+        if (reap() == 0) {
+            sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+        }
+    }
+
+    ::munmap(sqes, sqes_size);
+    if (cq_ptr != sq_ptr) ::munmap(cq_ptr, cq_ring_size);
+    ::munmap(sq_ptr, sq_ring_size);
+    ::close(ring_fd);
+}
+
+void IOUring::prepare(int opcode, int fd, uint64_t addr, size_t len,
+                      off_t offset, Request* req)
+{
+    std::lock_guard<std::mutex> guard(sq_mutex);
+
+    /* keep at most sq_entries requests in flight so that the completion
+     * ring (at least as large as the submission ring) never overflows */
+    while (in_flight.load() + pending >= sq_entries) {
+        if (pending > 0) submit_locked();
+
+        std::lock_guard<std::mutex> cq_guard(cq_mutex);
+        if (reap() == 0) {
+            sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+        }
+    }
+
+    req->done.store(false);
+    req->result = 0;
+
+    unsigned int tail = __atomic_load_n(sq_tail, __ATOMIC_RELAXED);
+    unsigned int index = tail & *sq_mask;
+    auto* sqe = static_cast<struct io_uring_sqe*>(sqes) + index;
+
+    ::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (uint8_t)opcode;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->len = (uint32_t)len;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = reinterpret_cast<uint64_t>(req);
+
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    pending++;
+}
+
+void IOUring::prepare_read(int fd, void* buf, size_t len, off_t offset,
+                           Request* req)
+{
+    prepare(IORING_OP_READ, fd, reinterpret_cast<uint64_t>(buf), len, offset,
+            req);
+}
+
+void IOUring::prepare_write(int fd, const void* buf, size_t len, off_t offset,
+                            Request* req)
+{
+    prepare(IORING_OP_WRITE, fd, reinterpret_cast<uint64_t>(buf), len, offset,
+            req);
+}
+
+void IOUring::submit()
+{
+    std::lock_guard<std::mutex> guard(sq_mutex);
+    submit_locked();
+}
+
+void IOUring::submit_locked()
+{
+    while (pending > 0) {
+        int ret = sys_io_uring_enter(ring_fd, pending, 0, 0);
+        if (ret < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            throw IOException(("io_uring_enter failed(error code: " +
+                               std::to_string(errno) + ")")
+                                  .c_str());
+        }
+
+        in_flight += ret;
+        pending -= ret;
+    }
+}
+
+void IOUring::wait(Request* req)
+{
+    while (!req->done.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> guard(cq_mutex);
+        if (req->done.load(std::memory_order_acquire)) break;
+
+        if (reap() == 0) {
+            sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+        }
+    }
+}
+
+size_t IOUring::reap()
+{
+    size_t count = 0;
+    unsigned int head = __atomic_load_n(cq_head, __ATOMIC_RELAXED);
+
+    while (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        auto* cqe = static_cast<struct io_uring_cqe*>(cqes) + (head & *cq_mask);
+        auto* req = reinterpret_cast<Request*>(cqe->user_data);
+
+        req->result = cqe->res;
+        req->done.store(true, std::memory_order_release);
+
+        head++;
+        count++;
+    }
+
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    in_flight -= count;
+
+    return count;
+}
+
+#else
+
+bool IOUring::is_supported() { return false; }
+
+IOUring::IOUring(unsigned int)
+{
+    throw IOException("io_uring support is not compiled in");
+}
+
+IOUring::~IOUring() {}
+
+void IOUring::prepare(int, int, uint64_t, size_t, off_t, Request*) {}
+void IOUring::prepare_read(int, void*, size_t, off_t, Request*) {}
+void IOUring::prepare_write(int, const void*, size_t, off_t, Request*) {}
+void IOUring::submit() {}
+void IOUring::submit_locked() {}
+void IOUring::wait(Request*) {}
+size_t IOUring::reap() { return 0; }
+
+#endif
+
+} // namespace bptree
@@ -0,0 +1,220 @@
+#include "bptree/mmap_page_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace bptree {
+
+MmapPageCache::MmapPageCache(std::string_view filename, bool create,
+                             size_t page_size, size_t max_file_size,
+                             bool sync_on_flush)
+    : heap_file(std::make_unique<HeapFile>(filename, create, page_size)),
+      page_size(page_size), max_pages(max_file_size / page_size),
+      sync_on_flush(sync_on_flush), fd(-1), base(nullptr)
+{
+    system_page_size = (size_t)::sysconf(_SC_PAGESIZE);
+    mapped_size = max_pages * page_size;
+
+    /* pages are handed out as they are mapped */
+    if (heap_file->get_page_format() != PageFormat::RAW) {
+        throw IOException("MmapPageCache needs a heap file of RAW pages");
+    }
+
+    if (heap_file->get_num_pages() > max_pages) {
+        throw IOException("heap file is larger than max_file_size");
+    }
+
+    fd = ::open(std::string(filename).c_str(), O_RDWR);
+    if (fd < 0) {
+        throw IOException("unable to open heap file");
+    }
+
+    /* the mapping may extend past the end of the file, pages there are
+     * only touched once the file has grown over them */
+    void* addr = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (addr == MAP_FAILED) {
+        ::close(fd);
+        throw IOException("unable to map heap file");
+    }
+    base = static_cast<uint8_t*>(addr);
+
+    num_chunks = (max_pages + CHUNK_PAGES - 1) / CHUNK_PAGES;
+    chunks.reset(new std::atomic<Chunk*>[num_chunks]);
+    for (size_t i = 0; i < num_chunks; i++) {
+        chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+MmapPageCache::~MmapPageCache()
+{
+    flush_all_pages();
+
+    for (size_t i = 0; i < num_chunks; i++) {
+        auto* chunk = chunks[i].load();
+        if (!chunk) continue;
+
+        for (size_t j = 0; j < CHUNK_PAGES; j++) {
+            chunk->pages[j].~Page();
+        }
+        std::allocator<Page>().deallocate(chunk->pages, CHUNK_PAGES);
+        delete chunk;
+    }
+
+    ::munmap(base, mapped_size);
+    ::close(fd);
+}
+
+MmapPageCache::Chunk* MmapPageCache::chunk_for(PageID id)
+{
+    auto& slot = chunks[id / CHUNK_PAGES];
+    auto* chunk = slot.load(std::memory_order_acquire);
+    if (chunk) return chunk;
+
+    PageID first = id / CHUNK_PAGES * CHUNK_PAGES;
+    auto* new_chunk = new Chunk;
+    new_chunk->pages = std::allocator<Page>().allocate(CHUNK_PAGES);
+    for (size_t j = 0; j < CHUNK_PAGES; j++) {
+        new (&new_chunk->pages[j])
+            Page(first + j, page_size, base + (size_t)(first + j) * page_size);
+    }
+    for (auto&& word : new_chunk->touched) {
+        word.store(0, std::memory_order_relaxed);
+    }
+
+    /* another thread may have created the chunk in the meantime */
+    if (slot.compare_exchange_strong(chunk, new_chunk,
+                                     std::memory_order_acq_rel)) {
+        return new_chunk;
+    }
+
+    for (size_t j = 0; j < CHUNK_PAGES; j++) {
+        new_chunk->pages[j].~Page();
+    }
+    std::allocator<Page>().deallocate(new_chunk->pages, CHUNK_PAGES);
+    delete new_chunk;
+    return chunk;
+}
+
+bool MmapPageCache::touch(Chunk* chunk, PageID id)
+{
+    auto& word = chunk->touched[id % CHUNK_PAGES / 64];
+    uint64_t bit = (uint64_t)1 << (id % 64);
+
+    /* no write once the bit is set */
+    if (word.load(std::memory_order_relaxed) & bit) return true;
+    return word.fetch_or(bit, std::memory_order_relaxed) & bit;
+}
+
+Page* MmapPageCache::new_page(boost::upgrade_lock<Page>& lock)
+{
+    PageID id = heap_file->new_page();
+    if (id >= max_pages) {
+        throw IOException("heap file is larger than max_file_size");
+    }
+
+    auto* chunk = chunk_for(id);
+    touch(chunk, id);
+    auto* page = &chunk->pages[id % CHUNK_PAGES];
+    lock = boost::upgrade_lock<Page>(*page);
+
+    {
+        /* a reused page still has the free list link */
+        boost::upgrade_to_unique_lock<Page> ulock(lock);
+        ::memset(page->get_buffer(ulock), 0, page_size);
+    }
+
+    return page;
+}
+
+Page* MmapPageCache::fetch_page(PageID id, boost::upgrade_lock<Page>& lock)
+{
+    if (id == Page::INVALID_PAGE_ID || id >= heap_file->get_num_pages()) {
+        return nullptr;
+    }
+
+    auto* chunk = chunk_for(id);
+    touch(chunk, id);
+    auto* page = &chunk->pages[id % CHUNK_PAGES];
+    lock = boost::upgrade_lock<Page>(*page);
+    return page;
+}
+
+void MmapPageCache::free_page(PageID id)
+{
+    /* the link is written through the file and shows up in the mapping */
+    heap_file->free_page(id);
+}
+
+void MmapPageCache::flush_page(Page* page, boost::upgrade_lock<Page>&)
+{
+    sync_range(page->get_id(), page->get_id() + 1);
+}
+
+void MmapPageCache::flush_all_pages()
+{
+    if (!sync_on_flush) return;
+    sync_range(0, heap_file->get_num_pages());
+}
+
+void MmapPageCache::sync_range(PageID first, PageID last)
+{
+    if (first >= last) return;
+
+    /* msync() takes page-aligned addresses */
+    size_t start = (size_t)first * page_size / system_page_size * system_page_size;
+    size_t end = (size_t)last * page_size;
+    if (::msync(base + start, end - start, MS_SYNC) != 0) {
+        throw IOException("unable to sync heap file");
+    }
+}
+
+void MmapPageCache::advise_range(PageID first, PageID last)
+{
+    size_t start = (size_t)first * page_size / system_page_size * system_page_size;
+    size_t end = (size_t)last * page_size;
+    /* only a hint, errors are ignored */
+    ::madvise(base + start, end - start, MADV_WILLNEED);
+}
+
+void MmapPageCache::prefetch_page(PageID id)
+{
+    prefetch_pages(std::vector<PageID>{id});
+}
+
+void MmapPageCache::prefetch_pages(const std::vector<PageID>& ids)
+{
+    PageID num_pages = heap_file->get_num_pages();
+    std::vector<PageID> sorted;
+    sorted.reserve(ids.size());
+    for (auto id : ids) {
+        if (id == Page::INVALID_PAGE_ID || id >= num_pages) continue;
+        if (!touch(chunk_for(id), id)) sorted.push_back(id);
+    }
+    if (sorted.empty()) return;
+    std::sort(sorted.begin(), sorted.end());
+
+    size_t i = 0;
+    while (i < sorted.size()) {
+        size_t j = i + 1;
+        while (j < sorted.size() && sorted[j] <= sorted[j - 1] + 1) {
+            j++;
+        }
+        advise_range(sorted[i], sorted[j - 1] + 1);
+        i = j;
+    }
+}
+
+void MmapPageCache::set_write_ahead_log(WriteAheadLog* log)
+{
+    if (log) {
+        throw std::invalid_argument(
+            "MmapPageCache can not order page writes after the log");
+    }
+}
+
+} // namespace bptree
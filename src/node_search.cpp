@@ -0,0 +1,267 @@
+#include "bptree/node_search.h"
+
+#include <atomic>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BPTREE_SEARCH_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define BPTREE_SEARCH_NEON
+#include <arm_neon.h>
+#endif
+
+namespace bptree {
+
+/* all kernels compare signed integers. unsigned keys are flipped at the
+ * sign bit (bias) first, which maps their order onto the signed one. the
+ * kernels return the # of keys greater than key with upper and the # of
+ * keys less than key otherwise */
+
+template <typename S>
+static size_t scalar_count(const S* keys, size_t n, S key, S bias, bool upper)
+{
+    S k = key ^ bias;
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        S v = keys[i] ^ bias;
+        count += upper ? (v > k) : (v < k);
+    }
+    return count;
+}
+
+#ifdef BPTREE_SEARCH_X86
+
+__attribute__((target("avx2"))) static size_t
+avx2_count(const int32_t* keys, size_t n, int32_t key, int32_t bias, bool upper)
+{
+    const __m256i b = _mm256_set1_epi32(bias);
+    const __m256i k = _mm256_set1_epi32(key ^ bias);
+    size_t count = 0, i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_xor_si256(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), b);
+        __m256i m = upper ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+    }
+
+    return count + scalar_count(keys + i, n - i, key, bias, upper);
+}
+
+__attribute__((target("avx2"))) static size_t
+avx2_count(const int64_t* keys, size_t n, int64_t key, int64_t bias, bool upper)
+{
+    const __m256i b = _mm256_set1_epi64x(bias);
+    const __m256i k = _mm256_set1_epi64x(key ^ bias);
+    size_t count = 0, i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_xor_si256(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), b);
+        __m256i m = upper ? _mm256_cmpgt_epi64(v, k) : _mm256_cmpgt_epi64(k, v);
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+    }
+
+    return count + scalar_count(keys + i, n - i, key, bias, upper);
+}
+
+/* the tail is read with a masked load, which does not touch the memory of
+ * the lanes that are off */
+__attribute__((target("avx512f"))) static size_t
+avx512_count(const int32_t* keys, size_t n, int32_t key, int32_t bias,
+             bool upper)
+{
+    const __m512i b = _mm512_set1_epi32(bias);
+    const __m512i k = _mm512_set1_epi32(key ^ bias);
+    size_t count = 0;
+
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 lanes = n - i >= 16 ? 0xffff : (__mmask16)((1u << (n - i)) - 1);
+        __m512i v = _mm512_xor_si512(_mm512_maskz_loadu_epi32(lanes, keys + i), b);
+        __mmask16 m = upper ? _mm512_mask_cmpgt_epi32_mask(lanes, v, k)
+                            : _mm512_mask_cmpgt_epi32_mask(lanes, k, v);
+        count += __builtin_popcount(m);
+    }
+
+    return count;
+}
+
+__attribute__((target("avx512f"))) static size_t
+avx512_count(const int64_t* keys, size_t n, int64_t key, int64_t bias,
+             bool upper)
+{
+    const __m512i b = _mm512_set1_epi64(bias);
+    const __m512i k = _mm512_set1_epi64(key ^ bias);
+    size_t count = 0;
+
+    for (size_t i = 0; i < n; i += 8) {
+        __mmask8 lanes = n - i >= 8 ? 0xff : (__mmask8)((1u << (n - i)) - 1);
+        __m512i v = _mm512_xor_si512(_mm512_maskz_loadu_epi64(lanes, keys + i), b);
+        __mmask8 m = upper ? _mm512_mask_cmpgt_epi64_mask(lanes, v, k)
+                           : _mm512_mask_cmpgt_epi64_mask(lanes, k, v);
+        count += __builtin_popcount(m);
+    }
+
+    return count;
+}
+
+#endif
+
+#ifdef BPTREE_SEARCH_NEON
+
+/* a true lane is all ones, subtracting it adds one to the lane's count */
+static size_t neon_count(const int32_t* keys, size_t n, int32_t key,
+                         int32_t bias, bool upper)
+{
+    const int32x4_t b = vdupq_n_s32(bias);
+    const int32x4_t k = vdupq_n_s32(key ^ bias);
+    uint32x4_t acc = vdupq_n_u32(0);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        int32x4_t v = veorq_s32(vld1q_s32(keys + i), b);
+        acc = vsubq_u32(acc, upper ? vcgtq_s32(v, k) : vcltq_s32(v, k));
+    }
+
+    return vaddvq_u32(acc) + scalar_count(keys + i, n - i, key, bias, upper);
+}
+
+static size_t neon_count(const int64_t* keys, size_t n, int64_t key,
+                         int64_t bias, bool upper)
+{
+    const int64x2_t b = vdupq_n_s64(bias);
+    const int64x2_t k = vdupq_n_s64(key ^ bias);
+    uint64x2_t acc = vdupq_n_u64(0);
+    size_t i = 0;
+
+    for (; i + 2 <= n; i += 2) {
+        int64x2_t v = veorq_s64(vld1q_s64(keys + i), b);
+        acc = vsubq_u64(acc, upper ? vcgtq_s64(v, k) : vcltq_s64(v, k));
+    }
+
+    return vaddvq_u64(acc) + scalar_count(keys + i, n - i, key, bias, upper);
+}
+
+#endif
+
+static bool kernel_supported(SearchKernel kernel)
+{
+    switch (kernel) {
+    case SearchKernel::SCALAR:
+        return true;
+#ifdef BPTREE_SEARCH_X86
+    case SearchKernel::AVX2:
+        return __builtin_cpu_supports("avx2");
+    case SearchKernel::AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+#ifdef BPTREE_SEARCH_NEON
+    case SearchKernel::NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+static SearchKernel detect_kernel()
+{
+#ifdef BPTREE_SEARCH_X86
+    __builtin_cpu_init();
+#endif
+    for (auto kernel :
+         {SearchKernel::AVX512, SearchKernel::AVX2, SearchKernel::NEON}) {
+        if (kernel_supported(kernel)) return kernel;
+    }
+    return SearchKernel::SCALAR;
+}
+
+/* detected on first use so that trees built by static initializers in
+ * other translation units see it too */
+static std::atomic<SearchKernel>& current_kernel()
+{
+    static std::atomic<SearchKernel> kernel{detect_kernel()};
+    return kernel;
+}
+
+SearchKernel node_search_kernel()
+{
+    return current_kernel().load(std::memory_order_relaxed);
+}
+
+bool set_node_search_kernel(SearchKernel kernel)
+{
+    if (!kernel_supported(kernel)) return false;
+    current_kernel().store(kernel, std::memory_order_relaxed);
+    return true;
+}
+
+const char* search_kernel_name(SearchKernel kernel)
+{
+    switch (kernel) {
+    case SearchKernel::SCALAR:
+        return "scalar";
+    case SearchKernel::AVX2:
+        return "AVX2";
+    case SearchKernel::AVX512:
+        return "AVX-512";
+    case SearchKernel::NEON:
+        return "NEON";
+    }
+    return "unknown";
+}
+
+template <typename S>
+static size_t count_signed(const S* keys, size_t n, S key, S bias, bool upper)
+{
+    size_t count;
+
+    switch (node_search_kernel()) {
+#ifdef BPTREE_SEARCH_X86
+    case SearchKernel::AVX512:
+        count = avx512_count(keys, n, key, bias, upper);
+        break;
+    case SearchKernel::AVX2:
+        count = avx2_count(keys, n, key, bias, upper);
+        break;
+#endif
+#ifdef BPTREE_SEARCH_NEON
+    case SearchKernel::NEON:
+        count = neon_count(keys, n, key, bias, upper);
+        break;
+#endif
+    default:
+        count = scalar_count(keys, n, key, bias, upper);
+        break;
+    }
+
+    return upper ? n - count : count;
+}
+
+size_t count_keys_before(const uint32_t* keys, size_t n, uint32_t key,
+                         bool upper)
+{
+    return count_signed(reinterpret_cast<const int32_t*>(keys), n,
+                        (int32_t)key, (int32_t)INT32_MIN, upper);
+}
+
+size_t count_keys_before(const int32_t* keys, size_t n, int32_t key,
+                         bool upper)
+{
+    return count_signed(keys, n, key, (int32_t)0, upper);
+}
+
+size_t count_keys_before(const uint64_t* keys, size_t n, uint64_t key,
+                         bool upper)
+{
+    return count_signed(reinterpret_cast<const int64_t*>(keys), n,
+                        (int64_t)key, (int64_t)INT64_MIN, upper);
+}
+
+size_t count_keys_before(const int64_t* keys, size_t n, int64_t key,
+                         bool upper)
+{
+    return count_signed(keys, n, key, (int64_t)0, upper);
+}
+
+} // namespace bptree
@@ -0,0 +1,171 @@
+#include "bptree/prefetcher.h"
+
+#include <algorithm>
+
+namespace bptree {
+
+/* threads are assigned streams round-robin on first use */
+static size_t stream_index(size_t num_streams)
+{
+    static std::atomic<size_t> next_index{0};
+    static thread_local size_t index = next_index++;
+    return index % num_streams;
+}
+
+AdaptivePrefetcher::AdaptivePrefetcher(size_t max_depth)
+    : enabled(true), max_depth(std::max<size_t>(1, max_depth)),
+      depth(std::min(INITIAL_DEPTH, this->max_depth)), width(1), num_pending(0),
+      next_seq(0), num_issued(0), num_useful(0), window_issued(0),
+      window_useful(0), idle_checks(0)
+{}
+
+void AdaptivePrefetcher::on_lookup(PageID parent, int idx, int num_children,
+                                   std::vector<int>& child_indexes)
+{
+    if (!enabled) return;
+
+    auto& stream = streams[stream_index(NUM_STREAMS)];
+    size_t lookups;
+    {
+        std::lock_guard<std::mutex> guard(stream.mutex);
+        lookups = ++stream.lookups;
+
+        if (parent == stream.parent) {
+            int delta = idx - stream.idx;
+            stream.lookups_in_parent++;
+            if (delta != 0) {
+                stream.run = (delta == stream.delta) ? stream.run + 1 : 0;
+                stream.delta = delta;
+            }
+        } else {
+            /* a forward stream that moves on to the first children of the
+             * next inner node keeps going */
+            bool continues = stream.run > 0 && stream.delta > 0 &&
+                             idx < stream.delta;
+            if (!continues) {
+                stream.run = 0;
+                stream.delta = 0;
+            }
+            stream.lookups_in_parent = 0;
+        }
+        stream.parent = parent;
+        stream.idx = idx;
+
+        if (stream.run > 0) {
+            size_t n = std::min<size_t>(depth.load(),
+                                        (size_t)1 << std::min<size_t>(stream.run, 6));
+            for (size_t k = 1; k <= n; k++) {
+                int child = idx + stream.delta * (int)k;
+                if (child < 0 || child >= num_children) break;
+                child_indexes.push_back(child);
+            }
+        } else if (stream.lookups_in_parent >= HOT_LOOKUPS) {
+            int w = (int)width.load();
+            for (int k = 1; k <= w; k++) {
+                if (idx - k >= 0) child_indexes.push_back(idx - k);
+                if (idx + k < num_children) child_indexes.push_back(idx + k);
+            }
+        }
+    }
+
+    if (lookups % ADJUST_INTERVAL == 0) adjust();
+}
+
+size_t AdaptivePrefetcher::next_scan_window(size_t window) const
+{
+    size_t limit = depth.load();
+    if (window == 0) return std::min(INITIAL_SCAN_WINDOW, limit);
+    return std::min(2 * window, limit);
+}
+
+void AdaptivePrefetcher::on_prefetch(std::vector<PageID>& pids)
+{
+    size_t n = 0;
+    for (auto pid : pids) {
+        auto& shard = shard_of(pid);
+        std::lock_guard<std::mutex> guard(shard.mutex);
+
+        auto seq = next_seq++;
+        if (!shard.pending.emplace(pid, seq).second) continue;
+        shard.order.emplace_back(pid, seq);
+        num_pending++;
+
+        /* forget the oldest page, it was prefetched in vain */
+        if (shard.order.size() > SHARD_CAPACITY) {
+            auto [old_pid, old_seq] = shard.order.front();
+            shard.order.pop_front();
+            auto it = shard.pending.find(old_pid);
+            if (it != shard.pending.end() && it->second == old_seq) {
+                shard.pending.erase(it);
+                num_pending--;
+            }
+        }
+
+        pids[n++] = pid;
+    }
+    pids.resize(n);
+
+    num_issued += n;
+    if (window_issued.fetch_add(n) + n >= WINDOW) adjust();
+}
+
+void AdaptivePrefetcher::on_read(PageID pid)
+{
+    num_demand_reads.add(1);
+    if (num_pending.load(std::memory_order_relaxed) == 0) return;
+
+    auto& shard = shard_of(pid);
+    {
+        std::lock_guard<std::mutex> guard(shard.mutex);
+        if (!shard.pending.erase(pid)) return;
+    }
+    num_pending--;
+    num_useful++;
+    window_useful++;
+}
+
+PrefetchStats AdaptivePrefetcher::get_stats() const
+{
+    return PrefetchStats{num_issued.load(), num_useful.load(),
+                         (size_t)num_demand_reads.load(), depth.load(),
+                         width.load()};
+}
+
+void AdaptivePrefetcher::adjust()
+{
+    std::unique_lock<std::mutex> lock(adjust_mutex, std::try_to_lock);
+    if (!lock.owns_lock()) return;
+
+    size_t issued = window_issued.load();
+    if (issued < WINDOW) {
+        if (++idle_checks >= IDLE_CHECKS) {
+            idle_checks = 0;
+            grow();
+        }
+        return;
+    }
+
+    idle_checks = 0;
+    window_issued -= issued;
+    double accuracy = (double)window_useful.exchange(0) / issued;
+
+    if (accuracy < LOW_ACCURACY) {
+        shrink();
+    } else if (accuracy > HIGH_ACCURACY) {
+        grow();
+    }
+}
+
+void AdaptivePrefetcher::grow()
+{
+    depth = std::min(2 * depth.load(), max_depth);
+    width = std::min(width.load() + 1, MAX_WIDTH);
+}
+
+void AdaptivePrefetcher::shrink()
+{
+    depth = std::max<size_t>(1, depth.load() / 2);
+    if (width.load() > 0) width--;
+}
+
+} // namespace bptree
@@ -0,0 +1,717 @@
+#include "bptree/remote_page_store.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace bptree {
+
+namespace {
+
+enum Opcode : uint32_t {
+    OP_INFO = 1,
+    OP_NEW_PAGE = 2,
+    OP_FREE_PAGE = 3,
+    OP_READ = 4,
+    OP_WRITE = 5,
+    OP_SYNC = 6,
+};
+
+/* request: | id(8 bytes) | opcode(4 bytes) | # ops(4 bytes) | body |
+ *   OP_FREE_PAGE: | pid |, OP_READ: | pid |... and
+ *   OP_WRITE: | pid | LSN(8 bytes) | data |...
+ * answer: | id(8 bytes) | ok(4 bytes) | # pages of the store(8 bytes) | body |
+ *   OP_INFO: | data size(8 bytes) |, OP_NEW_PAGE: | pid |,
+ *   OP_READ: | ok(1 byte) | data |... and OP_WRITE: | ok(1 byte) |...
+ * ok of the answer is 0 if an op other than a read or write failed */
+const size_t MAX_MESSAGE_SIZE = 1 << 30;
+
+template <typename T> void put(std::vector<uint8_t>& buf, T value)
+{
+    size_t offset = buf.size();
+    buf.resize(offset + sizeof(T));
+    ::memcpy(&buf[offset], &value, sizeof(T));
+}
+
+class MessageReader {
+public:
+    explicit MessageReader(const std::vector<uint8_t>& message)
+        : p(message.data()), end(message.data() + message.size())
+    {}
+
+    template <typename T> T get()
+    {
+        T value;
+        ::memcpy(&value, bytes(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    const uint8_t* bytes(size_t length)
+    {
+        if ((size_t)(end - p) < length) {
+            throw IOException("malformed page store message");
+        }
+        auto* start = p;
+        p += length;
+        return start;
+    }
+
+    size_t remaining() const { return end - p; }
+
+private:
+    const uint8_t* p;
+    const uint8_t* end;
+};
+
+std::vector<std::unique_ptr<PageTransport>>
+connect_all(std::string_view host, uint16_t port, size_t num_connections)
+{
+    std::vector<std::unique_ptr<PageTransport>> transports;
+    for (size_t i = 0; i < std::max<size_t>(1, num_connections); i++) {
+        transports.push_back(std::make_unique<TcpTransport>(host, port));
+    }
+    return transports;
+}
+
+} // namespace
+
+TcpTransport::TcpTransport(std::string_view host, uint16_t port) : fd(-1)
+{
+    struct addrinfo hints;
+    ::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* addrs;
+    if (::getaddrinfo(std::string(host).c_str(), std::to_string(port).c_str(),
+                      &hints, &addrs) != 0) {
+        throw IOException("unable to resolve page server address");
+    }
+
+    for (auto* ai = addrs; ai; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        ::close(fd);
+        fd = -1;
+    }
+    ::freeaddrinfo(addrs);
+
+    if (fd < 0) {
+        throw IOException("unable to connect to page server");
+    }
+
+    /* requests are small and wait for their answers */
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+TcpTransport::TcpTransport(int fd) : fd(fd)
+{
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+TcpTransport::~TcpTransport()
+{
+    if (fd != -1) ::close(fd);
+}
+
+void TcpTransport::send(const std::vector<uint8_t>& message)
+{
+    uint32_t length = (uint32_t)message.size();
+    struct iovec iov[2] = {{&length, sizeof(length)},
+                           {const_cast<uint8_t*>(message.data()), message.size()}};
+    struct msghdr msg;
+    ::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    size_t total = sizeof(length) + message.size();
+    while (total > 0) {
+        ssize_t retval = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (retval < 0) {
+            if (errno == EINTR) continue;
+            throw IOException("unable to send to page server");
+        }
+
+        total -= retval;
+        while (retval > 0 && msg.msg_iovlen > 0) {
+            size_t n = std::min<size_t>(retval, msg.msg_iov->iov_len);
+            msg.msg_iov->iov_base = (uint8_t*)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+            retval -= n;
+            if (msg.msg_iov->iov_len == 0) {
+                msg.msg_iov++;
+                msg.msg_iovlen--;
+            }
+        }
+    }
+}
+
+bool TcpTransport::receive(std::vector<uint8_t>& message)
+{
+    auto recv_all = [this](uint8_t* buf, size_t length) {
+        while (length > 0) {
+            ssize_t retval = ::recv(fd, buf, length, 0);
+            if (retval < 0 && errno == EINTR) continue;
+            if (retval <= 0) return false;
+            buf += retval;
+            length -= retval;
+        }
+        return true;
+    };
+
+    uint32_t length;
+    if (!recv_all(reinterpret_cast<uint8_t*>(&length), sizeof(length))) {
+        return false;
+    }
+    if (length > MAX_MESSAGE_SIZE) return false;
+
+    message.resize(length);
+    return recv_all(message.data(), length);
+}
+
+void TcpTransport::close() { ::shutdown(fd, SHUT_RDWR); }
+
+RemotePageStore::RemotePageStore(std::string_view host, uint16_t port,
+                                 size_t num_connections, size_t max_batch_pages,
+                                 size_t max_in_flight)
+    : RemotePageStore(connect_all(host, port, num_connections), max_batch_pages,
+                      max_in_flight)
+{}
+
+RemotePageStore::RemotePageStore(
+    std::vector<std::unique_ptr<PageTransport>> transports,
+    size_t max_batch_pages, size_t max_in_flight)
+    : max_batch_pages(std::max<size_t>(1, max_batch_pages)),
+      max_in_flight(std::max<size_t>(1, max_in_flight)), data_size(0),
+      num_pages(0), next_connection(0), num_messages(0),
+      num_pages_transferred(0)
+{
+    if (transports.empty()) {
+        throw std::invalid_argument("RemotePageStore needs a transport");
+    }
+
+    for (auto&& transport : transports) {
+        auto conn = std::make_unique<Connection>();
+        conn->transport = std::move(transport);
+        conn->next_id = 1;
+        conn->broken = false;
+        conn->stop = false;
+        connections.push_back(std::move(conn));
+    }
+
+    for (auto&& conn : connections) {
+        auto* c = conn.get();
+        conn->sender = std::thread([this, c]() { sender_main(*c); });
+        conn->receiver = std::thread([this, c]() { receiver_main(*c); });
+    }
+
+    Call call;
+    std::vector<Op> ops{{OP_INFO, nullptr, 0, &call}};
+    run(ops, call);
+    if (call.failed) {
+        shutdown();
+        throw IOException("unable to get page store info");
+    }
+    data_size = call.value;
+}
+
+RemotePageStore::~RemotePageStore() { shutdown(); }
+
+void RemotePageStore::shutdown()
+{
+    for (auto&& conn : connections) {
+        {
+            std::lock_guard<std::mutex> guard(conn->mutex);
+            conn->stop = true;
+        }
+        conn->send_cv.notify_all();
+        conn->transport->close();
+    }
+
+    for (auto&& conn : connections) {
+        if (conn->sender.joinable()) conn->sender.join();
+        if (conn->receiver.joinable()) conn->receiver.join();
+    }
+}
+
+PageID RemotePageStore::new_page()
+{
+    Call call;
+    std::vector<Op> ops{{OP_NEW_PAGE, nullptr, 0, &call}};
+    run(ops, call);
+    if (call.failed) {
+        throw IOException("unable to allocate remote page");
+    }
+    return (PageID)call.value;
+}
+
+void RemotePageStore::free_page(PageID pid)
+{
+    Call call;
+    std::vector<Op> ops{{OP_FREE_PAGE, nullptr, pid, &call}};
+    run(ops, call);
+    if (call.failed) {
+        throw IOException("unable to free remote page");
+    }
+}
+
+void RemotePageStore::sync()
+{
+    Call call;
+    std::vector<Op> ops{{OP_SYNC, nullptr, 0, &call}};
+    run(ops, call);
+    if (call.failed) {
+        throw IOException("unable to sync remote pages");
+    }
+}
+
+void RemotePageStore::read_page(Page* page,
+                                boost::upgrade_to_unique_lock<Page>& lock)
+{
+    std::vector<PageIORequest> requests{{page->get_id(), page->get_buffer(lock), false}};
+    read_pages(requests);
+    if (!requests[0].ok) {
+        throw IOException("unable to read remote page");
+    }
+}
+
+void RemotePageStore::write_page(Page* page, boost::upgrade_lock<Page>& lock)
+{
+    /* the buffer is only read */
+    auto* buf = const_cast<uint8_t*>(page->get_buffer(lock));
+    std::vector<PageIORequest> requests{{page->get_id(), buf, false, page->get_lsn()}};
+    write_pages(requests);
+    if (!requests[0].ok) {
+        throw IOException("unable to write remote page");
+    }
+}
+
+void RemotePageStore::read_pages(std::vector<PageIORequest>& requests)
+{
+    Call call;
+    std::vector<Op> ops;
+    for (auto&& req : requests) {
+        ops.push_back({OP_READ, &req, req.pid, &call});
+    }
+    run(ops, call);
+}
+
+void RemotePageStore::write_pages(std::vector<PageIORequest>& requests)
+{
+    Call call;
+    std::vector<Op> ops;
+    for (auto&& req : requests) {
+        ops.push_back({OP_WRITE, &req, req.pid, &call});
+    }
+    run(ops, call);
+}
+
+void RemotePageStore::run(std::vector<Op>& ops, Call& call)
+{
+    call.remaining = ops.size();
+    call.failed = false;
+    call.value = 0;
+    if (ops.empty()) return;
+
+    auto& conn = *connections[next_connection++ % connections.size()];
+    std::unique_lock<std::mutex> lock(conn.mutex);
+
+    if (conn.broken || conn.stop) {
+        for (auto&& op : ops) {
+            complete_op(op, false);
+        }
+        return;
+    }
+
+    for (auto&& op : ops) {
+        conn.queue.push_back(op);
+    }
+    conn.send_cv.notify_one();
+    conn.done_cv.wait(lock, [&call]() { return call.remaining == 0; });
+}
+
+void RemotePageStore::complete_op(const Op& op, bool ok)
+{
+    if (op.req) op.req->ok = ok;
+    if (!ok) op.call->failed = true;
+    op.call->remaining--;
+}
+
+void RemotePageStore::mark_broken(Connection& conn)
+{
+    conn.broken = true;
+
+    for (auto&& op : conn.queue) {
+        complete_op(op, false);
+    }
+    conn.queue.clear();
+    for (auto&& [id, ops] : conn.in_flight) {
+        for (auto&& op : ops) {
+            complete_op(op, false);
+        }
+    }
+    conn.in_flight.clear();
+
+    conn.done_cv.notify_all();
+    conn.send_cv.notify_all();
+}
+
+void RemotePageStore::sender_main(Connection& conn)
+{
+    std::unique_lock<std::mutex> lock(conn.mutex);
+
+    while (true) {
+        conn.send_cv.wait(lock, [this, &conn]() {
+            return conn.stop || conn.broken ||
+                   (!conn.queue.empty() && conn.in_flight.size() < max_in_flight);
+        });
+        if (conn.stop || conn.broken) break;
+
+        /* everything that queued up while the previous messages were in
+         * flight goes together */
+        uint32_t opcode = conn.queue.front().opcode;
+        bool batched = opcode == OP_READ || opcode == OP_WRITE;
+        std::vector<Op> ops;
+        while (!conn.queue.empty() && conn.queue.front().opcode == opcode &&
+               (ops.empty() || (batched && ops.size() < max_batch_pages))) {
+            ops.push_back(conn.queue.front());
+            conn.queue.pop_front();
+        }
+
+        uint64_t id = conn.next_id++;
+        conn.in_flight[id] = ops;
+        lock.unlock();
+
+        /* the callers wait, their buffers stay valid */
+        std::vector<uint8_t> message;
+        message.reserve(16 + ops.size() * (opcode == OP_WRITE ? 12 + data_size : 4));
+        put<uint64_t>(message, id);
+        put<uint32_t>(message, opcode);
+        put<uint32_t>(message, (uint32_t)ops.size());
+        for (auto&& op : ops) {
+            if (opcode == OP_FREE_PAGE || opcode == OP_READ) {
+                put<PageID>(message, op.pid);
+            } else if (opcode == OP_WRITE) {
+                put<PageID>(message, op.pid);
+                put<uint64_t>(message, op.req->lsn);
+                message.insert(message.end(), op.req->buf, op.req->buf + data_size);
+            }
+        }
+
+        bool sent = true;
+        try {
+            conn.transport->send(message);
+        } catch (IOException&) {
+            sent = false;
+        }
+        num_messages++;
+        if (batched) num_pages_transferred += ops.size();
+
+        lock.lock();
+        if (!sent) {
+            conn.transport->close();
+            mark_broken(conn);
+        }
+    }
+}
+
+void RemotePageStore::receiver_main(Connection& conn)
+{
+    std::vector<uint8_t> message;
+
+    while (conn.transport->receive(message)) {
+        std::vector<Op> ops;
+        std::vector<bool> oks;
+        bool ok;
+
+        try {
+            MessageReader in(message);
+            auto id = in.get<uint64_t>();
+            ok = in.get<uint32_t>() != 0;
+            num_pages.store(in.get<uint64_t>());
+
+            {
+                std::lock_guard<std::mutex> guard(conn.mutex);
+                auto it = conn.in_flight.find(id);
+                if (it == conn.in_flight.end()) break;
+                ops = std::move(it->second);
+                conn.in_flight.erase(it);
+            }
+
+            /* the ops are out of in_flight, their buffers are only ours */
+            oks.assign(ops.size(), ok);
+            switch (ops.front().opcode) {
+            case OP_INFO:
+                ops.front().call->value = in.get<uint64_t>();
+                break;
+            case OP_NEW_PAGE:
+                ops.front().call->value = in.get<PageID>();
+                break;
+            case OP_READ:
+                for (size_t i = 0; i < ops.size(); i++) {
+                    oks[i] = in.get<uint8_t>() != 0;
+                    ::memcpy(ops[i].req->buf, in.bytes(data_size), data_size);
+                }
+                break;
+            case OP_WRITE:
+                for (size_t i = 0; i < ops.size(); i++) {
+                    oks[i] = in.get<uint8_t>() != 0;
+                }
+                break;
+            default:
+                break;
+            }
+        } catch (IOException&) {
+            /* a malformed answer, the connection is given up */
+            std::lock_guard<std::mutex> guard(conn.mutex);
+            for (auto&& op : ops) {
+                complete_op(op, false);
+            }
+            break;
+        }
+
+        std::lock_guard<std::mutex> guard(conn.mutex);
+        for (size_t i = 0; i < ops.size(); i++) {
+            complete_op(ops[i], oks[i]);
+        }
+        conn.done_cv.notify_all();
+        conn.send_cv.notify_one();
+    }
+
+    std::lock_guard<std::mutex> guard(conn.mutex);
+    conn.transport->close();
+    mark_broken(conn);
+}
+
+PageServer::PageServer(PageStore* store, uint16_t port)
+    : store(store), port(port), listen_fd(-1), stop(false)
+{
+    listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        throw IOException("unable to create page server socket");
+    }
+
+    int one = 1;
+    ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    socklen_t addr_len = sizeof(addr);
+    if (::bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        ::listen(listen_fd, 64) != 0 ||
+        ::getsockname(listen_fd, (struct sockaddr*)&addr, &addr_len) != 0) {
+        ::close(listen_fd);
+        throw IOException("unable to listen for page store connections");
+    }
+    this->port = ntohs(addr.sin_port);
+
+    acceptor = std::thread([this]() { acceptor_main(); });
+}
+
+PageServer::~PageServer()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stop = true;
+    }
+    ::shutdown(listen_fd, SHUT_RDWR);
+    acceptor.join();
+    ::close(listen_fd);
+
+    for (auto&& conn : connections) {
+        conn->transport->close();
+        {
+            std::lock_guard<std::mutex> guard(conn->mutex);
+            conn->closed = true;
+        }
+        conn->cv.notify_all();
+        conn->reader.join();
+        conn->writer.join();
+    }
+}
+
+void PageServer::acceptor_main()
+{
+    while (true) {
+        int fd = ::accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+
+        std::lock_guard<std::mutex> guard(mutex);
+        if (stop) {
+            ::close(fd);
+            break;
+        }
+
+        auto conn = std::make_unique<Connection>();
+        conn->transport = std::make_unique<TcpTransport>(fd);
+        conn->closed = false;
+        auto* c = conn.get();
+        conn->reader = std::thread([this, c]() { reader_main(*c); });
+        conn->writer = std::thread([this, c]() { writer_main(*c); });
+        connections.push_back(std::move(conn));
+    }
+}
+
+void PageServer::reader_main(Connection& conn)
+{
+    /* the store is local to the server, only the answers go over the
+     * modeled link */
+    LatencySimulator::LocalIO local_io;
+    std::vector<uint8_t> request;
+
+    while (conn.transport->receive(request)) {
+        std::vector<uint8_t> answer;
+        try {
+            answer = handle(request);
+        } catch (IOException&) {
+            break;
+        }
+
+        auto due = LatencySimulator::reserve_transfer(request.size() + answer.size());
+        std::lock_guard<std::mutex> guard(conn.mutex);
+        conn.answers.emplace(due, std::move(answer));
+        conn.cv.notify_one();
+    }
+
+    std::lock_guard<std::mutex> guard(conn.mutex);
+    conn.closed = true;
+    conn.cv.notify_one();
+}
+
+void PageServer::writer_main(Connection& conn)
+{
+    std::unique_lock<std::mutex> lock(conn.mutex);
+
+    while (!conn.answers.empty() || !conn.closed) {
+        if (conn.answers.empty()) {
+            conn.cv.wait(lock);
+            continue;
+        }
+
+        auto it = conn.answers.begin();
+        if (it->first > LatencySimulator::Clock::now()) {
+            conn.cv.wait_until(lock, it->first);
+            continue;
+        }
+
+        auto answer = std::move(it->second);
+        conn.answers.erase(it);
+        lock.unlock();
+
+        try {
+            conn.transport->send(answer);
+        } catch (IOException&) {
+            conn.transport->close();
+            lock.lock();
+            break;
+        }
+
+        lock.lock();
+    }
+}
+
+std::vector<uint8_t> PageServer::handle(const std::vector<uint8_t>& request)
+{
+    MessageReader in(request);
+    auto id = in.get<uint64_t>();
+    auto opcode = in.get<uint32_t>();
+    auto count = in.get<uint32_t>();
+
+    std::vector<uint8_t> answer;
+    put<uint64_t>(answer, id);
+    put<uint32_t>(answer, 1);
+    put<uint64_t>(answer, 0);
+    bool ok = true;
+    size_t data_size = store->get_data_size();
+
+    switch (opcode) {
+    case OP_INFO:
+        put<uint64_t>(answer, data_size);
+        break;
+    case OP_NEW_PAGE: {
+        PageID pid = Page::INVALID_PAGE_ID;
+        try {
+            pid = store->new_page();
+        } catch (IOException&) {
+            ok = false;
+        }
+        put<PageID>(answer, pid);
+        break;
+    }
+    case OP_FREE_PAGE:
+        try {
+            store->free_page(in.get<PageID>());
+        } catch (IOException&) {
+            ok = false;
+        }
+        break;
+    case OP_SYNC:
+        try {
+            store->sync();
+        } catch (IOException&) {
+            ok = false;
+        }
+        break;
+    case OP_READ: {
+        if (in.remaining() < (size_t)count * sizeof(PageID)) {
+            throw IOException("malformed page store message");
+        }
+
+        /* pages are read straight into the answer */
+        size_t offset = answer.size();
+        answer.resize(offset + count * (1 + data_size));
+        std::vector<PageIORequest> requests;
+        for (uint32_t i = 0; i < count; i++) {
+            uint8_t* entry = &answer[offset + i * (1 + data_size)];
+            requests.push_back({in.get<PageID>(), entry + 1, false});
+        }
+        store->read_pages(requests);
+        for (uint32_t i = 0; i < count; i++) {
+            answer[offset + i * (1 + data_size)] = requests[i].ok;
+        }
+        break;
+    }
+    case OP_WRITE: {
+        std::vector<PageIORequest> requests;
+        for (uint32_t i = 0; i < count; i++) {
+            auto pid = in.get<PageID>();
+            auto lsn = in.get<uint64_t>();
+            auto* data = const_cast<uint8_t*>(in.bytes(data_size));
+            requests.push_back({pid, data, false, lsn});
+        }
+        store->write_pages(requests);
+        for (auto&& req : requests) {
+            put<uint8_t>(answer, req.ok);
+        }
+        break;
+    }
+    default:
+        throw IOException("unknown page store request");
+    }
+
+    uint32_t ok_word = ok;
+    uint64_t num_pages = store->get_num_pages();
+    ::memcpy(&answer[sizeof(id)], &ok_word, sizeof(ok_word));
+    ::memcpy(&answer[sizeof(id) + sizeof(ok_word)], &num_pages, sizeof(num_pages));
+    return answer;
+}
+
+} // namespace bptree
@@ -0,0 +1,494 @@
+#include "bptree/replacement_policy.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace bptree {
+
+static const size_t NO_FRAME = SIZE_MAX;
+
+/* intrusive doubly linked list of frame indices. the links live in an array
+ * that is shared by all lists of a policy as a frame is on at most one of
+ * them at a time */
+class FrameList {
+public:
+    struct Link {
+        size_t prev;
+        size_t next;
+    };
+
+    explicit FrameList(Link* links)
+        : links(links), head(NO_FRAME), tail(NO_FRAME), count(0)
+    {}
+
+    void push_front(size_t i)
+    {
+        links[i] = {NO_FRAME, head};
+        if (head != NO_FRAME) {
+            links[head].prev = i;
+        } else {
+            tail = i;
+        }
+        head = i;
+        count++;
+    }
+
+    void erase(size_t i)
+    {
+        auto& link = links[i];
+        if (link.prev != NO_FRAME) {
+            links[link.prev].next = link.next;
+        } else {
+            head = link.next;
+        }
+        if (link.next != NO_FRAME) {
+            links[link.next].prev = link.prev;
+        } else {
+            tail = link.prev;
+        }
+        count--;
+    }
+
+    size_t back() const { return tail; }
+    size_t prev(size_t i) const { return links[i].prev; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+private:
+    Link* links;
+    size_t head;
+    size_t tail;
+    size_t count;
+};
+
+/* IDs of recently evicted pages, most recent first */
+class GhostList {
+public:
+    void push_front(PageID id)
+    {
+        list.push_front(id);
+        map[id] = list.begin();
+    }
+
+    bool erase(PageID id)
+    {
+        auto it = map.find(id);
+        if (it == map.end()) return false;
+
+        list.erase(it->second);
+        map.erase(it);
+        return true;
+    }
+
+    void pop_back()
+    {
+        map.erase(list.back());
+        list.pop_back();
+    }
+
+    size_t size() const { return map.size(); }
+    bool empty() const { return map.empty(); }
+
+private:
+    std::list<PageID> list;
+    std::unordered_map<PageID, std::list<PageID>::iterator> map;
+};
+
+class LRUPolicy : public ReplacementPolicy {
+public:
+    explicit LRUPolicy(size_t num_frames)
+        : links(new FrameList::Link[num_frames]), list(links.get()),
+          state(num_frames, ABSENT), count(0)
+    {}
+
+    virtual void on_load(size_t frame, PageID) override
+    {
+        state[frame] = PINNED;
+        count++;
+    }
+
+    /* the page moves to the head of the list when it is unpinned */
+    virtual void on_access(size_t) override {}
+
+    virtual void set_evictable(size_t frame, bool evictable) override
+    {
+        if (evictable && state[frame] == PINNED) {
+            list.push_front(frame);
+            state[frame] = LISTED;
+        } else if (!evictable && state[frame] == LISTED) {
+            list.erase(frame);
+            state[frame] = PINNED;
+        }
+    }
+
+    virtual bool evict(size_t& frame) override
+    {
+        if (list.empty()) return false;
+
+        frame = list.back();
+        remove(frame);
+        return true;
+    }
+
+    virtual void remove(size_t frame) override
+    {
+        if (state[frame] == ABSENT) return;
+        if (state[frame] == LISTED) list.erase(frame);
+
+        state[frame] = ABSENT;
+        count--;
+    }
+
+    virtual size_t size() const override { return count; }
+    virtual size_t num_evictable() const override { return list.size(); }
+
+private:
+    enum State : uint8_t { ABSENT, PINNED, LISTED };
+
+    std::unique_ptr<FrameList::Link[]> links;
+    FrameList list; /* evictable frames, most recently used first */
+    std::vector<uint8_t> state;
+    size_t count;
+};
+
+class ClockPolicy : public ReplacementPolicy {
+public:
+    explicit ClockPolicy(size_t num_frames)
+        : present(num_frames, false), evictable(num_frames, false),
+          referenced(num_frames, false), hand(0), count(0),
+          evictable_count(0)
+    {}
+
+    virtual void on_load(size_t frame, PageID) override
+    {
+        present[frame] = true;
+        referenced[frame] = true;
+        evictable[frame] = false;
+        count++;
+    }
+
+    virtual void on_access(size_t frame) override { referenced[frame] = true; }
+
+    virtual void set_evictable(size_t frame, bool e) override
+    {
+        if (!present[frame] || evictable[frame] == e) return;
+
+        evictable[frame] = e;
+        if (e) {
+            evictable_count++;
+        } else {
+            evictable_count--;
+        }
+    }
+
+    virtual bool evict(size_t& frame) override
+    {
+        if (evictable_count == 0) return false;
+
+        /* terminates within two sweeps as there is an evictable frame */
+        while (true) {
+            size_t i = hand;
+            hand = (hand + 1) % present.size();
+
+            if (!present[i] || !evictable[i]) continue;
+
+            if (referenced[i]) {
+                referenced[i] = false;
+                continue;
+            }
+
+            frame = i;
+            remove(i);
+            return true;
+        }
+    }
+
+    virtual void remove(size_t frame) override
+    {
+        if (!present[frame]) return;
+
+        set_evictable(frame, false);
+        present[frame] = false;
+        count--;
+    }
+
+    virtual size_t size() const override { return count; }
+    virtual size_t num_evictable() const override { return evictable_count; }
+
+private:
+    std::vector<bool> present;
+    std::vector<bool> evictable;
+    std::vector<bool> referenced;
+    size_t hand;
+    size_t count;
+    size_t evictable_count;
+};
+
+/* base of the policies that keep all of their frames on lists whether they
+ * are pinned or not and scan the lists for unpinned victims */
+class ListPolicy : public ReplacementPolicy {
+public:
+    explicit ListPolicy(size_t num_frames)
+        : links(new FrameList::Link[num_frames]), ids(num_frames),
+          where(num_frames, NONE), evictable(num_frames, false),
+          evictable_count(0)
+    {}
+
+    virtual void set_evictable(size_t frame, bool e) override
+    {
+        if (where[frame] == NONE || evictable[frame] == e) return;
+
+        evictable[frame] = e;
+        if (e) {
+            evictable_count++;
+        } else {
+            evictable_count--;
+        }
+    }
+
+    virtual size_t num_evictable() const override { return evictable_count; }
+
+protected:
+    static constexpr uint8_t NONE = 0;
+
+    std::unique_ptr<FrameList::Link[]> links;
+    std::vector<PageID> ids;
+    std::vector<uint8_t> where; /* list that the frame is on */
+    std::vector<bool> evictable;
+    size_t evictable_count;
+
+    /* least recently inserted evictable frame of list */
+    bool find_victim(const FrameList& list, size_t& frame) const
+    {
+        for (size_t i = list.back(); i != NO_FRAME; i = list.prev(i)) {
+            if (evictable[i]) {
+                frame = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void insert(FrameList& list, uint8_t list_id, size_t frame)
+    {
+        list.push_front(frame);
+        where[frame] = list_id;
+    }
+
+    void detach(FrameList& list, size_t frame)
+    {
+        set_evictable(frame, false);
+        list.erase(frame);
+        where[frame] = NONE;
+    }
+};
+
+/* 2Q (Johnson and Shasha). pages seen for the first time go to the FIFO
+ * a1in. when they are evicted from it their IDs are remembered in a1out and
+ * only pages that come back while in a1out are promoted to the LRU list am */
+class TwoQPolicy : public ListPolicy {
+public:
+    explicit TwoQPolicy(size_t num_frames)
+        : ListPolicy(num_frames), a1in(links.get()), am(links.get()),
+          kin(std::max<size_t>(1, num_frames / 4)),
+          kout(std::max<size_t>(1, num_frames / 2))
+    {}
+
+    virtual void on_load(size_t frame, PageID id) override
+    {
+        ids[frame] = id;
+        if (a1out.erase(id)) {
+            insert(am, AM, frame);
+        } else {
+            insert(a1in, A1IN, frame);
+        }
+    }
+
+    virtual void on_access(size_t frame) override
+    {
+        /* hits in a1in are assumed to be correlated references */
+        if (where[frame] == AM) {
+            am.erase(frame);
+            am.push_front(frame);
+        }
+    }
+
+    virtual bool evict(size_t& frame) override
+    {
+        if (a1in.size() > kin && find_victim(a1in, frame)) {
+            evict_a1in(frame);
+            return true;
+        }
+
+        if (find_victim(am, frame)) {
+            detach(am, frame);
+            return true;
+        }
+
+        if (find_victim(a1in, frame)) {
+            evict_a1in(frame);
+            return true;
+        }
+
+        return false;
+    }
+
+    virtual void remove(size_t frame) override
+    {
+        if (where[frame] == A1IN) {
+            detach(a1in, frame);
+        } else if (where[frame] == AM) {
+            detach(am, frame);
+        }
+    }
+
+    virtual size_t size() const override { return a1in.size() + am.size(); }
+
+private:
+    static constexpr uint8_t A1IN = 1;
+    static constexpr uint8_t AM = 2;
+
+    FrameList a1in;
+    FrameList am;
+    GhostList a1out;
+    size_t kin;
+    size_t kout;
+
+    void evict_a1in(size_t frame)
+    {
+        detach(a1in, frame);
+
+        a1out.push_front(ids[frame]);
+        if (a1out.size() > kout) a1out.pop_back();
+    }
+};
+
+/* ARC (Megiddo and Modha). t1 holds pages seen once recently and t2 pages
+ * seen at least twice. the ghost lists b1/b2 remember pages evicted from
+ * t1/t2 and hits on them adapt the target size p of t1 */
+class ARCPolicy : public ListPolicy {
+public:
+    explicit ARCPolicy(size_t num_frames)
+        : ListPolicy(num_frames), t1(links.get()), t2(links.get()),
+          capacity(num_frames), p(0)
+    {}
+
+    virtual void on_load(size_t frame, PageID id) override
+    {
+        ids[frame] = id;
+
+        size_t b1_size = b1.size(), b2_size = b2.size();
+        if (b1.erase(id)) {
+            p = std::min(capacity, p + std::max<size_t>(1, b2_size / b1_size));
+            insert(t2, T2, frame);
+        } else if (b2.erase(id)) {
+            size_t delta = std::max<size_t>(1, b1_size / b2_size);
+            p = p > delta ? p - delta : 0;
+            insert(t2, T2, frame);
+        } else {
+            insert(t1, T1, frame);
+        }
+
+        trim_ghosts();
+    }
+
+    virtual void on_access(size_t frame) override
+    {
+        if (where[frame] == T1) {
+            t1.erase(frame);
+            insert(t2, T2, frame);
+        } else if (where[frame] == T2) {
+            t2.erase(frame);
+            t2.push_front(frame);
+        }
+    }
+
+    virtual bool evict(size_t& frame) override
+    {
+        bool prefer_t1 = !t1.empty() && t1.size() > p;
+
+        if (prefer_t1 ? evict_from(t1, b1, frame) : evict_from(t2, b2, frame)) {
+            return true;
+        }
+        return prefer_t1 ? evict_from(t2, b2, frame) : evict_from(t1, b1, frame);
+    }
+
+    virtual void remove(size_t frame) override
+    {
+        if (where[frame] == T1) {
+            detach(t1, frame);
+        } else if (where[frame] == T2) {
+            detach(t2, frame);
+        }
+    }
+
+    virtual size_t size() const override { return t1.size() + t2.size(); }
+
+private:
+    static constexpr uint8_t T1 = 1;
+    static constexpr uint8_t T2 = 2;
+
+    FrameList t1;
+    FrameList t2;
+    GhostList b1;
+    GhostList b2;
+    size_t capacity;
+    size_t p;
+
+    bool evict_from(FrameList& list, GhostList& ghosts, size_t& frame)
+    {
+        if (!find_victim(list, frame)) return false;
+
+        detach(list, frame);
+        ghosts.push_front(ids[frame]);
+        trim_ghosts();
+        return true;
+    }
+
+    void trim_ghosts()
+    {
+        while (t1.size() + b1.size() > capacity && !b1.empty()) {
+            b1.pop_back();
+        }
+        while (t1.size() + t2.size() + b1.size() + b2.size() > 2 * capacity &&
+               !b2.empty()) {
+            b2.pop_back();
+        }
+    }
+};
+
+const char* replacement_policy_name(ReplacementPolicyType type)
+{
+    switch (type) {
+    case ReplacementPolicyType::LRU:
+        return "LRU";
+    case ReplacementPolicyType::CLOCK:
+        return "CLOCK";
+    case ReplacementPolicyType::TWO_Q:
+        return "2Q";
+    case ReplacementPolicyType::ARC:
+        return "ARC";
+    }
+    return "unknown";
+}
+
+std::unique_ptr<ReplacementPolicy>
+ReplacementPolicy::create(ReplacementPolicyType type, size_t num_frames)
+{
+    switch (type) {
+    case ReplacementPolicyType::CLOCK:
+        return std::make_unique<ClockPolicy>(num_frames);
+    case ReplacementPolicyType::TWO_Q:
+        return std::make_unique<TwoQPolicy>(num_frames);
+    case ReplacementPolicyType::ARC:
+        return std::make_unique<ARCPolicy>(num_frames);
+    case ReplacementPolicyType::LRU:
+    default:
+        return std::make_unique<LRUPolicy>(num_frames);
+    }
+}
+
+} // namespace bptree
@@ -0,0 +1,458 @@
+#include "bptree/wal.h"
+#include "bptree/checksum.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace bptree {
+
+/* log header: | magic(4 bytes) | version(4 bytes) | base LSN(8 bytes) | */
+static const size_t LOG_HEADER_SIZE = 2 * sizeof(uint32_t) + sizeof(uint64_t);
+
+struct FrameHeader {
+    uint32_t magic;
+    uint32_t length; /* bytes of records after the header */
+    uint32_t checksum;
+    uint32_t reserved;
+};
+
+struct RecordHeader {
+    uint16_t type;
+    uint16_t reserved;
+    PageID pid;
+    uint32_t offset;
+    uint32_t length;
+};
+
+void LogBatch::add(LogRecordType type, PageID pid, uint32_t offset,
+                   const uint8_t* data, uint32_t length)
+{
+    RecordHeader header{(uint16_t)type, 0, pid, offset, length};
+    size_t pos = bytes.size();
+    bytes.resize(pos + sizeof(header) + length);
+    ::memcpy(&bytes[pos], &header, sizeof(header));
+    if (length) ::memcpy(&bytes[pos + sizeof(header)], data, length);
+}
+
+void LogBatch::add_delta(PageID pid, uint32_t offset, const uint8_t* data,
+                         uint32_t length)
+{
+    add(LogRecordType::PAGE_DELTA, pid, offset, data, length);
+}
+
+void LogBatch::add_image(PageID pid, const uint8_t* data, uint32_t length)
+{
+    add(LogRecordType::PAGE_IMAGE, pid, 0, data, length);
+}
+
+void LogBatch::add_free(PageID pid)
+{
+    add(LogRecordType::PAGE_FREE, pid, 0, nullptr, 0);
+}
+
+WriteAheadLog::WriteAheadLog(std::string_view filename, bool create,
+                             bool sync_commit)
+    : filename(filename), sync_commit(sync_commit), fd(-1), base_lsn(0),
+      end_lsn(0), durable_lsn(0), file_end(LOG_HEADER_SIZE), flushing(false),
+      num_syncs(0), num_retained(0)
+{
+    struct stat sbuf;
+    int err = ::stat(this->filename.c_str(), &sbuf);
+
+    if (err < 0 && errno == ENOENT && create) {
+        this->create();
+    } else if (err < 0) {
+        throw IOException("unable to get log file status");
+    } else {
+        open();
+    }
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    try {
+        flush_all();
+    } catch (IOException&) {
+    }
+    ::close(fd);
+}
+
+void WriteAheadLog::create()
+{
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_EXCL,
+                S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        throw IOException("unable to create log file");
+    }
+
+    write_header(fd, 0);
+    if (::fdatasync(fd) != 0) {
+        throw IOException("unable to sync log file");
+    }
+    sync_directory();
+}
+
+void WriteAheadLog::open()
+{
+    fd = ::open(filename.c_str(), O_RDWR);
+    if (fd < 0) {
+        throw IOException("unable to open log file");
+    }
+
+    uint8_t buf[LOG_HEADER_SIZE];
+    if (::pread(fd, buf, sizeof(buf), 0) != sizeof(buf)) {
+        throw IOException("bad log file(header)");
+    }
+
+    uint32_t magic, version;
+    ::memcpy(&magic, buf, sizeof(magic));
+    ::memcpy(&version, buf + sizeof(magic), sizeof(version));
+    ::memcpy(&base_lsn, buf + 2 * sizeof(uint32_t), sizeof(base_lsn));
+    if (magic != MAGIC || version != VERSION) {
+        throw IOException("bad log file(magic)");
+    }
+
+    recover_end();
+}
+
+void WriteAheadLog::recover_end()
+{
+    struct stat sbuf;
+    if (::fstat(fd, &sbuf) != 0) {
+        throw IOException("unable to get log file status");
+    }
+    size_t size = (size_t)sbuf.st_size;
+
+    size_t offset = LOG_HEADER_SIZE;
+    std::vector<uint8_t> records;
+    while (offset + sizeof(FrameHeader) <= size) {
+        FrameHeader header;
+        read_all(reinterpret_cast<uint8_t*>(&header), sizeof(header), offset);
+        if (header.magic != FRAME_MAGIC ||
+            header.length > size - offset - sizeof(header)) {
+            break;
+        }
+
+        records.resize(header.length);
+        read_all(records.data(), header.length, offset + sizeof(header));
+        if (crc32c(records.data(), header.length) != header.checksum) break;
+
+        offset += sizeof(header) + header.length;
+    }
+
+    /* later frames are appended after the last valid one */
+    if (offset != size) {
+        if (::ftruncate(fd, offset) != 0 || ::fdatasync(fd) != 0) {
+            throw IOException("unable to truncate log file");
+        }
+    }
+
+    file_end = offset;
+    end_lsn = durable_lsn = base_lsn + (offset - LOG_HEADER_SIZE);
+}
+
+void WriteAheadLog::write_header(int fd, uint64_t base)
+{
+    uint8_t buf[LOG_HEADER_SIZE];
+    uint32_t magic = MAGIC;
+    uint32_t version = VERSION;
+    ::memcpy(buf, &magic, sizeof(magic));
+    ::memcpy(buf + sizeof(magic), &version, sizeof(version));
+    ::memcpy(buf + 2 * sizeof(uint32_t), &base, sizeof(base));
+    write_all(fd, buf, sizeof(buf), 0);
+}
+
+void WriteAheadLog::write_all(int fd, const uint8_t* buf, size_t length,
+                              size_t offset)
+{
+    while (length > 0) {
+        ssize_t n = ::pwrite(fd, buf, length, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            throw IOException("unable to write log file");
+        }
+        buf += n;
+        length -= n;
+        offset += n;
+    }
+}
+
+void WriteAheadLog::read_all(uint8_t* buf, size_t length, size_t offset)
+{
+    while (length > 0) {
+        ssize_t n = ::pread(fd, buf, length, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            throw IOException("unable to read log file");
+        }
+        buf += n;
+        length -= n;
+        offset += n;
+    }
+}
+
+void WriteAheadLog::sync_directory()
+{
+    /* make the creation or the rename of the log file durable */
+    auto slash = filename.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) return;
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+}
+
+uint64_t WriteAheadLog::append(const LogBatch& batch)
+{
+    const auto& records = batch.get_bytes();
+    FrameHeader header{FRAME_MAGIC, (uint32_t)records.size(),
+                       crc32c(records.data(), records.size()), 0};
+
+    uint64_t lsn;
+    bool full;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        const auto* p = reinterpret_cast<const uint8_t*>(&header);
+        buffer.insert(buffer.end(), p, p + sizeof(header));
+        buffer.insert(buffer.end(), records.begin(), records.end());
+        end_lsn += sizeof(header) + records.size();
+        lsn = end_lsn;
+        full = buffer.size() >= MAX_BUFFER_SIZE;
+    }
+
+    if (full) flush(lsn);
+    return lsn;
+}
+
+void WriteAheadLog::flush(uint64_t lsn)
+{
+    std::unique_lock<std::mutex> guard(mutex);
+    lsn = std::min(lsn, end_lsn);
+
+    while (durable_lsn < lsn) {
+        if (flushing) {
+            /* another thread is syncing, it may take our frames along */
+            flushed_cv.wait(guard);
+            continue;
+        }
+
+        /* sync everything that is buffered on behalf of all waiters */
+        flushing = true;
+        flush_buffer.swap(buffer);
+        uint64_t lsn_after = end_lsn;
+        size_t offset = file_end;
+        guard.unlock();
+
+        bool ok = true;
+        try {
+            write_all(fd, flush_buffer.data(), flush_buffer.size(), offset);
+            if (::fdatasync(fd) != 0) ok = false;
+        } catch (IOException&) {
+            ok = false;
+        }
+
+        guard.lock();
+        flushing = false;
+        if (ok) {
+            file_end = offset + flush_buffer.size();
+            durable_lsn = lsn_after;
+            num_syncs++;
+            flush_buffer.clear();
+        } else {
+            /* put the frames back so that they are retried */
+            flush_buffer.insert(flush_buffer.end(), buffer.begin(), buffer.end());
+            buffer.swap(flush_buffer);
+            flush_buffer.clear();
+        }
+        flushed_cv.notify_all();
+
+        if (!ok) {
+            throw IOException("unable to sync log file");
+        }
+    }
+}
+
+void WriteAheadLog::truncate(uint64_t lsn)
+{
+    flush(lsn);
+
+    std::unique_lock<std::mutex> guard(mutex);
+    flushed_cv.wait(guard, [this]() { return !flushing; });
+    if (lsn <= base_lsn || num_retained > 0) return;
+
+    /* copy the frames after lsn that are in the file to a new log file and
+     * rename it over the old one, buffered frames follow them later */
+    size_t first = LOG_HEADER_SIZE + (size_t)(lsn - base_lsn);
+    std::vector<uint8_t> tail(file_end - first);
+    if (!tail.empty()) read_all(tail.data(), tail.size(), first);
+
+    std::string tmp_name = filename + ".tmp";
+    int new_fd = ::open(tmp_name.c_str(), O_RDWR | O_CREAT | O_TRUNC,
+                        S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (new_fd < 0) {
+        throw IOException("unable to create log file");
+    }
+
+    try {
+        write_header(new_fd, lsn);
+        if (!tail.empty()) {
+            write_all(new_fd, tail.data(), tail.size(), LOG_HEADER_SIZE);
+        }
+        if (::fdatasync(new_fd) != 0 ||
+            ::rename(tmp_name.c_str(), filename.c_str()) != 0) {
+            throw IOException("unable to replace log file");
+        }
+    } catch (IOException&) {
+        ::close(new_fd);
+        ::unlink(tmp_name.c_str());
+        throw;
+    }
+    sync_directory();
+
+    ::close(fd);
+    fd = new_fd;
+    base_lsn = lsn;
+    file_end = LOG_HEADER_SIZE + tail.size();
+}
+
+void WriteAheadLog::retain()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    num_retained++;
+}
+
+void WriteAheadLog::release()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    num_retained--;
+}
+
+size_t WriteAheadLog::write_frames(std::string_view filename, uint64_t first,
+                                   uint64_t last, RateLimiter& limiter)
+{
+    flush(last);
+
+    size_t first_offset, last_offset;
+    {
+        /* the file is not replaced while the log is retained, frames are
+         * only appended after last_offset */
+        std::lock_guard<std::mutex> guard(mutex);
+        if (num_retained == 0 || first < base_lsn || last > durable_lsn ||
+            first > last) {
+            throw IOException("log frames are not available");
+        }
+        first_offset = LOG_HEADER_SIZE + (size_t)(first - base_lsn);
+        last_offset = LOG_HEADER_SIZE + (size_t)(last - base_lsn);
+    }
+
+    std::string name(filename);
+    int out = ::open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC,
+                     S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (out < 0) {
+        throw IOException("unable to create log file");
+    }
+
+    const size_t CHUNK_SIZE = 1 << 20;
+    std::vector<uint8_t> chunk;
+    size_t nbytes = 0;
+    try {
+        write_header(out, first);
+        for (size_t offset = first_offset; offset < last_offset;
+             offset += chunk.size()) {
+            chunk.resize(std::min(CHUNK_SIZE, last_offset - offset));
+            read_all(chunk.data(), chunk.size(), offset);
+            write_all(out, chunk.data(), chunk.size(),
+                      LOG_HEADER_SIZE + (offset - first_offset));
+            nbytes += chunk.size();
+            limiter.acquire(chunk.size());
+        }
+        if (::fdatasync(out) != 0) {
+            throw IOException("unable to sync log file");
+        }
+    } catch (IOException&) {
+        ::close(out);
+        throw;
+    }
+
+    ::close(out);
+    return nbytes + LOG_HEADER_SIZE;
+}
+
+size_t WriteAheadLog::replay(const std::function<void(const LogRecord&)>& apply)
+{
+    /* apply may flush the log, e.g. when it writes a page back */
+    std::vector<uint8_t> frames;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        frames.resize(file_end - LOG_HEADER_SIZE);
+        if (!frames.empty()) {
+            read_all(frames.data(), frames.size(), LOG_HEADER_SIZE);
+        }
+    }
+
+    auto for_each_record = [&frames](auto&& fn) {
+        size_t offset = 0;
+        while (offset < frames.size()) {
+            FrameHeader header;
+            ::memcpy(&header, &frames[offset], sizeof(header));
+            size_t pos = offset + sizeof(header);
+            size_t end = pos + header.length;
+
+            while (pos < end) {
+                RecordHeader rh;
+                ::memcpy(&rh, &frames[pos], sizeof(rh));
+                fn(LogRecord{(LogRecordType)rh.type, rh.pid, rh.offset,
+                             rh.length, &frames[pos + sizeof(rh)]});
+                pos += sizeof(rh) + rh.length;
+            }
+            offset = end;
+        }
+    };
+
+    /* a page whose last record frees it holds a free list link now */
+    std::unordered_map<PageID, bool> freed;
+    for_each_record([&freed](const LogRecord& rec) {
+        freed[rec.pid] = rec.type == LogRecordType::PAGE_FREE;
+    });
+
+    size_t num_applied = 0;
+    for_each_record([&](const LogRecord& rec) {
+        if (rec.type == LogRecordType::PAGE_FREE || freed[rec.pid]) return;
+        apply(rec);
+        num_applied++;
+    });
+
+    return num_applied;
+}
+
+uint64_t WriteAheadLog::get_end_lsn()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return end_lsn;
+}
+
+uint64_t WriteAheadLog::get_durable_lsn()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return durable_lsn;
+}
+
+size_t WriteAheadLog::get_num_syncs()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return num_syncs;
+}
+
+size_t WriteAheadLog::get_size()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    return file_end - LOG_HEADER_SIZE + buffer.size();
+}
+
+} // namespace bptree
@@ -0,0 +1,852 @@
+#include <gtest/gtest.h>
+
+#include "bptree/heap_file.h"
+#include "bptree/heap_page_cache.h"
+#include "bptree/io_uring.h"
+#include "bptree/tree.h"
+#include "test_util.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+
+static void insert_and_reopen(bptree::WritePolicy policy, size_t max_pages,
+                              bptree::IOBackend io_backend = bptree::IOBackend::SYNC,
+                              size_t num_shards = 0,
+                              bptree::PageFormat page_format = bptree::PageFormat::RAW)
+{
+    const int N = 100000;
+    auto filename = temp_heap_file();
+
+    {
+        bptree::HeapPageCache page_cache(filename, true, max_pages, 4096,
+                                         policy, 0, io_backend, 1, 0,
+                                         num_shards,
+                                         bptree::ReplacementPolicyType::LRU,
+                                         false, false, false, page_format);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i + 1);
+        }
+    }
+
+    {
+        bptree::HeapPageCache page_cache(filename, false, max_pages, 4096,
+                                         policy, 0, io_backend, 1, 0,
+                                         num_shards);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        EXPECT_EQ(tree.size(), N);
+        for (int i = 0; i < N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+            ASSERT_EQ(values.size(), 1);
+            EXPECT_EQ(values.front(), i + 1);
+        }
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(HeapPageCacheTest, WriteThroughPersists)
+{
+    insert_and_reopen(bptree::WritePolicy::WRITE_THROUGH, 256);
+}
+
+TEST(HeapPageCacheTest, WriteBackPersists)
+{
+    /* the cache is much smaller than the tree so dirty pages are also
+     * written back by eviction and by the background flusher */
+    insert_and_reopen(bptree::WritePolicy::WRITE_BACK, 256);
+}
+
+TEST(HeapPageCacheTest, IOUringWriteBackPersists)
+{
+    insert_and_reopen(bptree::WritePolicy::WRITE_BACK, 256,
+                      bptree::IOBackend::IO_URING);
+}
+
+TEST(HeapPageCacheTest, ShardedWriteBackPersists)
+{
+    insert_and_reopen(bptree::WritePolicy::WRITE_BACK, 512,
+                      bptree::IOBackend::SYNC, 4);
+}
+
+TEST(HeapPageCacheTest, CompressedPagesPersist)
+{
+    insert_and_reopen(bptree::WritePolicy::WRITE_BACK, 256,
+                      bptree::IOBackend::SYNC, 0, bptree::PageFormat::LZ4);
+    insert_and_reopen(bptree::WritePolicy::WRITE_BACK, 256,
+                      bptree::IOBackend::IO_URING, 0, bptree::PageFormat::CHECKSUM);
+}
+
+/* pages of sorted integer keys take a fraction of the bytes with LZ4 */
+TEST(HeapPageCacheTest, CompressionSavesBytes)
+{
+    const int N = 100000;
+    size_t bytes_written[2];
+    bptree::PageFormat formats[] = {bptree::PageFormat::RAW,
+                                    bptree::PageFormat::LZ4};
+
+    for (int f = 0; f < 2; f++) {
+        auto filename = temp_heap_file();
+        bptree::HeapPageCache page_cache(
+            filename, true, 4096, 4096, bptree::WritePolicy::WRITE_BACK, 0,
+            bptree::IOBackend::SYNC, 1, 0, 0, bptree::ReplacementPolicyType::LRU,
+            false, false, false, formats[f]);
+        bptree::PageFitBTree<4096 - bptree::HeapFile::PAGE_HEADER_SIZE,
+                             KeyType, ValueType>
+            tree(&page_cache);
+
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i + 1);
+        }
+        page_cache.flush_all_pages();
+        bytes_written[f] = page_cache.get_heap_file()->get_num_bytes_written();
+
+        unlink(filename.c_str());
+    }
+
+    EXPECT_LT(bytes_written[1], bytes_written[0] / 2);
+}
+
+TEST(HeapPageCacheTest, DefaultShardCount)
+{
+    auto filename = temp_heap_file();
+
+    {
+        bptree::HeapPageCache small_cache(filename, true, 64);
+        EXPECT_EQ(small_cache.get_num_shards(), 1);
+    }
+    {
+        bptree::HeapPageCache page_cache(filename, false, 4096);
+        EXPECT_EQ(page_cache.get_num_shards(),
+                  4096 / bptree::HeapPageCache::DEFAULT_FRAMES_PER_SHARD);
+    }
+    {
+        /* never more shards than frames */
+        bptree::HeapPageCache page_cache(filename, false, 4, 4096,
+                                         bptree::WritePolicy::WRITE_THROUGH, 0,
+                                         bptree::IOBackend::SYNC, 1, 0, 16);
+        EXPECT_EQ(page_cache.get_num_shards(), 4);
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(HeapPageCacheTest, ReplacementPolicies)
+{
+    const int N = 20000;
+
+    for (auto type :
+         {bptree::ReplacementPolicyType::LRU, bptree::ReplacementPolicyType::CLOCK,
+          bptree::ReplacementPolicyType::TWO_Q, bptree::ReplacementPolicyType::ARC}) {
+        for (bool prioritize_inner_nodes : {false, true}) {
+            auto filename = temp_heap_file();
+
+            {
+                bptree::HeapPageCache page_cache(
+                    filename, true, 64, 4096, bptree::WritePolicy::WRITE_BACK,
+                    0, bptree::IOBackend::SYNC, 1, 0, 2, type,
+                    prioritize_inner_nodes);
+                EXPECT_EQ(page_cache.get_replacement_policy(), type);
+
+                bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+                for (int i = 0; i < N; i++) {
+                    tree.insert(i, i + 1);
+                }
+            }
+
+            {
+                bptree::HeapPageCache page_cache(
+                    filename, false, 64, 4096, bptree::WritePolicy::WRITE_BACK,
+                    0, bptree::IOBackend::SYNC, 1, 0, 2, type,
+                    prioritize_inner_nodes);
+                bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+                for (int i = 0; i < N; i++) {
+                    std::vector<ValueType> values;
+                    tree.get_value(i, values);
+                    ASSERT_EQ(values.size(), 1);
+                    EXPECT_EQ(values.front(), i + 1);
+                }
+
+                auto stats = page_cache.get_stats();
+                EXPECT_GT(stats.hits, 0);
+                EXPECT_GT(stats.misses, 0);
+                EXPECT_GT(stats.evictions, 0);
+                EXPECT_LE(page_cache.size(), 64);
+            }
+
+            unlink(filename.c_str());
+        }
+    }
+}
+
+TEST(HeapPageCacheTest, DirectIOPersists)
+{
+    const int N = 20000;
+    auto filename = temp_heap_file();
+
+    /* erased keys free pages, whose free list links are written to the
+     * file without O_DIRECT */
+    auto open_cache = [&](bool create) {
+        return std::make_unique<bptree::HeapPageCache>(
+            filename, create, 64, 4096, bptree::WritePolicy::WRITE_BACK, 0,
+            bptree::IOBackend::SYNC, 1, 0, 2, bptree::ReplacementPolicyType::LRU,
+            false, true, true);
+    };
+
+    {
+        auto page_cache = open_cache(true);
+        bptree::BTree<64, KeyType, ValueType> tree(page_cache.get());
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i + 1);
+        }
+        for (int i = 0; i < N / 2; i++) {
+            tree.erase(i);
+        }
+        for (int i = 0; i < N / 2; i++) {
+            tree.insert(i, i + 2);
+        }
+    }
+
+    {
+        auto page_cache = open_cache(false);
+        bptree::BTree<64, KeyType, ValueType> tree(page_cache.get());
+
+        EXPECT_EQ(tree.size(), N);
+        for (int i = 0; i < N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+            ASSERT_EQ(values.size(), 1);
+            EXPECT_EQ(values.front(), i < N / 2 ? i + 2 : i + 1);
+        }
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(HeapPageCacheTest, WriteBackDefersWrites)
+{
+    auto filename = temp_heap_file();
+
+    {
+        bptree::HeapPageCache page_cache(filename, true, 4096, 4096,
+                                         bptree::WritePolicy::WRITE_BACK,
+                                         4096);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        for (int i = 0; i < 10000; i++) {
+            tree.insert(i, i);
+        }
+
+        EXPECT_GT(page_cache.get_num_dirty_pages(), 0);
+        page_cache.flush_all_pages();
+        EXPECT_EQ(page_cache.get_num_dirty_pages(), 0);
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(HeapPageCacheTest, WriteBackConcurrentInsert)
+{
+    const int N = 10000;
+    auto filename = temp_heap_file();
+
+    {
+        bptree::HeapPageCache page_cache(filename, true, 128, 4096,
+                                         bptree::WritePolicy::WRITE_BACK, 32);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; i++) {
+            threads.emplace_back([i, &tree]() {
+                for (int j = 0; j < N; j++) {
+                    tree.insert(i * N + j, j);
+                }
+            });
+        }
+
+        for (auto&& p : threads) {
+            p.join();
+        }
+    }
+
+    {
+        bptree::HeapPageCache page_cache(filename, false, 128, 4096,
+                                         bptree::WritePolicy::WRITE_BACK, 32);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        EXPECT_EQ(tree.size(), 4 * N);
+        for (int i = 0; i < 4 * N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+            ASSERT_EQ(values.size(), 1);
+            EXPECT_EQ(values.front(), i % N);
+        }
+    }
+
+    unlink(filename.c_str());
+}
+
+static void batched_read_write(bptree::IOBackend io_backend,
+                               bptree::PageFormat format = bptree::PageFormat::RAW)
+{
+    const int num_pages = 200; /* more than the io_uring queue depth */
+    auto filename = temp_heap_file();
+    size_t page_size = format == bptree::PageFormat::RAW
+                           ? 4096
+                           : 4096 - bptree::HeapFile::PAGE_HEADER_SIZE;
+
+    {
+        bptree::HeapFile heap_file(filename, true, 4096, io_backend, false,
+                                   format);
+        EXPECT_EQ(heap_file.get_data_size(), page_size);
+        if (bptree::IOUring::is_supported()) {
+            EXPECT_EQ(heap_file.get_io_backend(), io_backend);
+        }
+
+        std::vector<std::vector<uint8_t>> bufs;
+        std::vector<bptree::PageIORequest> requests;
+        for (int i = 0; i < num_pages; i++) {
+            auto pid = heap_file.new_page();
+            bufs.emplace_back(page_size, (uint8_t)(pid * 7));
+        }
+        for (int i = 0; i < num_pages; i++) {
+            requests.push_back({(bptree::PageID)(i + 1), bufs[i].data(), false});
+        }
+        /* out-of-range page */
+        std::vector<uint8_t> extra(page_size);
+        requests.push_back({num_pages + 10, extra.data(), true});
+
+        heap_file.write_pages(requests);
+        for (int i = 0; i < num_pages; i++) {
+            EXPECT_TRUE(requests[i].ok);
+        }
+        EXPECT_FALSE(requests.back().ok);
+    }
+
+    {
+        bptree::HeapFile heap_file(filename, false, 4096, io_backend);
+        EXPECT_EQ(heap_file.get_page_format(), format);
+
+        std::vector<std::vector<uint8_t>> bufs(num_pages,
+                                               std::vector<uint8_t>(page_size));
+        std::vector<bptree::PageIORequest> requests;
+        for (int i = 0; i < num_pages; i++) {
+            requests.push_back({(bptree::PageID)(i + 1), bufs[i].data(), false});
+        }
+
+        heap_file.read_pages(requests);
+        for (int i = 0; i < num_pages; i++) {
+            ASSERT_TRUE(requests[i].ok);
+            EXPECT_EQ(bufs[i].front(), (uint8_t)((i + 1) * 7));
+            EXPECT_EQ(bufs[i].back(), (uint8_t)((i + 1) * 7));
+        }
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(HeapFileTest, BatchedReadWrite)
+{
+    batched_read_write(bptree::IOBackend::SYNC);
+}
+
+TEST(HeapFileTest, IOUringBatchedReadWrite)
+{
+    batched_read_write(bptree::IOBackend::IO_URING);
+}
+
+TEST(HeapFileTest, CompressedBatchedReadWrite)
+{
+    batched_read_write(bptree::IOBackend::SYNC, bptree::PageFormat::LZ4);
+    batched_read_write(bptree::IOBackend::IO_URING, bptree::PageFormat::LZ4);
+    batched_read_write(bptree::IOBackend::SYNC, bptree::PageFormat::CHECKSUM);
+}
+
+TEST(HeapFileTest, ChecksumsDetectCorruption)
+{
+    auto filename = temp_heap_file();
+    bptree::HeapFile heap_file(filename, true, 4096, bptree::IOBackend::SYNC,
+                               false, bptree::PageFormat::LZ4);
+    size_t data_size = heap_file.get_data_size();
+
+    /* a page that compresses and one of random bytes that does not */
+    std::vector<uint8_t> zeros(data_size, 0), noise(data_size);
+    for (auto&& b : noise) {
+        b = (uint8_t)std::rand();
+    }
+    zeros[100] = 1;
+    auto p1 = heap_file.new_page();
+    auto p2 = heap_file.new_page();
+    auto p3 = heap_file.new_page();
+    std::vector<bptree::PageIORequest> requests{{p1, zeros.data(), false},
+                                                {p2, noise.data(), false}};
+    heap_file.write_pages(requests);
+    EXPECT_LT(heap_file.get_num_bytes_written(),
+              data_size + 2 * bptree::HeapFile::PAGE_HEADER_SIZE + 100);
+
+    auto read_back = [&](bptree::PageID pid, std::vector<uint8_t>& buf) {
+        std::vector<bptree::PageIORequest> requests{{pid, buf.data(), false}};
+        heap_file.read_pages(requests);
+        return requests[0].ok;
+    };
+
+    std::vector<uint8_t> buf(data_size, 0xff);
+    ASSERT_TRUE(read_back(p1, buf));
+    EXPECT_EQ(buf, zeros);
+    ASSERT_TRUE(read_back(p2, buf));
+    EXPECT_EQ(buf, noise);
+    /* never written */
+    ASSERT_TRUE(read_back(p3, buf));
+    EXPECT_EQ(buf, std::vector<uint8_t>(data_size, 0));
+
+    /* a freed page reads as zeros until it is written again */
+    heap_file.free_page(p2);
+    EXPECT_EQ(heap_file.new_page(), p2);
+    ASSERT_TRUE(read_back(p2, buf));
+    EXPECT_EQ(buf, std::vector<uint8_t>(data_size, 0));
+
+    /* flip a byte of each stored page */
+    heap_file.write_pages(requests);
+    int fd = ::open(filename.c_str(), O_RDWR);
+    for (auto pid : {p1, p2}) {
+        off_t offset = (off_t)pid * 4096 + bptree::HeapFile::PAGE_HEADER_SIZE + 2;
+        uint8_t b;
+        ASSERT_EQ(::pread(fd, &b, 1, offset), 1);
+        b ^= 0x10;
+        ASSERT_EQ(::pwrite(fd, &b, 1, offset), 1);
+    }
+    ::close(fd);
+
+    EXPECT_FALSE(read_back(p1, buf));
+    EXPECT_FALSE(read_back(p2, buf));
+
+    bptree::Page page(p1, data_size);
+    boost::upgrade_lock<bptree::Page> lock(page);
+    boost::upgrade_to_unique_lock<bptree::Page> ulock(lock);
+    EXPECT_THROW(heap_file.read_page(&page, ulock), bptree::IOException);
+
+    unlink(filename.c_str());
+}
+
+TEST(HeapFileTest, FreePagesAreReused)
+{
+    const size_t page_size = 4096;
+    auto filename = temp_heap_file();
+
+    {
+        bptree::HeapFile heap_file(filename, true, page_size);
+        for (int i = 0; i < 10; i++) {
+            EXPECT_EQ(heap_file.new_page(), i + 1);
+        }
+
+        heap_file.free_page(3);
+        heap_file.free_page(7);
+        EXPECT_EQ(heap_file.get_num_free_pages(), 2);
+
+        /* most recently freed first */
+        EXPECT_EQ(heap_file.new_page(), 7);
+        EXPECT_EQ(heap_file.get_num_free_pages(), 1);
+    }
+
+    {
+        /* the free list survives a reopen */
+        bptree::HeapFile heap_file(filename, false, page_size);
+        EXPECT_EQ(heap_file.get_num_free_pages(), 1);
+        EXPECT_EQ(heap_file.new_page(), 3);
+        EXPECT_EQ(heap_file.new_page(), 11);
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(HeapFileTest, SnapshotKeepsOldPages)
+{
+    const size_t page_size = 4096;
+    auto filename = temp_heap_file();
+    auto copy_filename = temp_heap_file();
+
+    {
+        bptree::HeapFile heap_file(filename, true, page_size);
+        std::vector<std::vector<uint8_t>> bufs;
+        std::vector<bptree::PageIORequest> requests;
+        for (int i = 0; i < 4; i++) {
+            auto pid = heap_file.new_page();
+            bufs.emplace_back(page_size, (uint8_t)pid);
+            requests.push_back({pid, bufs.back().data(), false});
+        }
+        heap_file.write_pages(requests);
+
+        bool started = false;
+        heap_file.begin_snapshot([&started]() { started = true; });
+        EXPECT_TRUE(started);
+
+        /* overwritten, freed and allocated after the snapshot began */
+        std::vector<uint8_t> buf(page_size, 0xff);
+        std::vector<bptree::PageIORequest> overwrite{{1, buf.data(), false}};
+        heap_file.write_pages(overwrite);
+        heap_file.free_page(2);
+        EXPECT_EQ(heap_file.new_page(), 2);
+        EXPECT_EQ(heap_file.new_page(), 5);
+        EXPECT_EQ(heap_file.get_num_snapshot_copies(), 3); /* with the header */
+
+        bptree::RateLimiter limiter(0);
+        EXPECT_EQ(heap_file.write_snapshot(copy_filename, limiter), 5 * page_size);
+        heap_file.end_snapshot();
+        EXPECT_EQ(heap_file.get_num_snapshot_copies(), 0);
+    }
+
+    {
+        bptree::HeapFile heap_file(copy_filename, false, page_size);
+        EXPECT_EQ(heap_file.get_num_pages(), 5);
+        EXPECT_EQ(heap_file.get_num_free_pages(), 0);
+
+        std::vector<std::vector<uint8_t>> bufs(4, std::vector<uint8_t>(page_size));
+        std::vector<bptree::PageIORequest> requests;
+        for (int i = 0; i < 4; i++) {
+            requests.push_back({(bptree::PageID)(i + 1), bufs[i].data(), false});
+        }
+        heap_file.read_pages(requests);
+        for (int i = 0; i < 4; i++) {
+            ASSERT_TRUE(requests[i].ok);
+            EXPECT_EQ(bufs[i].front(), (uint8_t)(i + 1));
+            EXPECT_EQ(bufs[i].back(), (uint8_t)(i + 1));
+        }
+    }
+
+    unlink(filename.c_str());
+    unlink(copy_filename.c_str());
+}
+
+TEST(HeapPageCacheTest, FreePageDropsCachedCopy)
+{
+    auto filename = temp_heap_file();
+    bptree::HeapPageCache page_cache(filename, true, 16, 4096,
+                                     bptree::WritePolicy::WRITE_BACK);
+
+    bptree::PageID pid;
+    {
+        boost::upgrade_lock<bptree::Page> lock;
+        auto* page = page_cache.new_page(lock);
+        pid = page->get_id();
+        {
+            boost::upgrade_to_unique_lock<bptree::Page> ulock(lock);
+            page->get_buffer(ulock)[0] = 42;
+        }
+        page_cache.unpin_page(page, true, lock);
+    }
+    EXPECT_EQ(page_cache.size(), 1);
+    EXPECT_EQ(page_cache.get_num_dirty_pages(), 1);
+
+    page_cache.free_page(pid);
+    EXPECT_EQ(page_cache.size(), 0);
+    EXPECT_EQ(page_cache.get_num_dirty_pages(), 0);
+
+    /* the page comes back zeroed */
+    boost::upgrade_lock<bptree::Page> lock;
+    auto* page = page_cache.new_page(lock);
+    EXPECT_EQ(page->get_id(), pid);
+    EXPECT_EQ(page->get_buffer(lock)[0], 0);
+    page_cache.unpin_page(page, false, lock);
+
+    unlink(filename.c_str());
+}
+
+/* dirty victims are written back without the shard lock. a page that is
+ * fetched again while its write-back is in flight comes back with the
+ * content that was written */
+TEST(HeapPageCacheTest, ConcurrentDirtyEvictions)
+{
+    const int NUM_THREADS = 4;
+    const int PAGES_PER_THREAD = 16;
+    const int ROUNDS = 5000;
+    auto filename = temp_heap_file();
+    /* one shard with few frames, most fetches evict a dirty page */
+    bptree::HeapPageCache page_cache(filename, true, 16, 4096,
+                                     bptree::WritePolicy::WRITE_BACK, 0,
+                                     bptree::IOBackend::SYNC, 1, 0, 1);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < NUM_THREADS; t++) {
+        threads.emplace_back([t, &page_cache]() {
+            std::mt19937 gen(t);
+            std::vector<bptree::PageID> pids;
+            std::vector<uint32_t> versions(PAGES_PER_THREAD, 0);
+
+            for (int r = 0; r < ROUNDS; r++) {
+                size_t j = gen() % PAGES_PER_THREAD;
+                boost::upgrade_lock<bptree::Page> lock;
+                bptree::Page* page;
+                if (j >= pids.size()) {
+                    j = pids.size();
+                    page = page_cache.new_page(lock);
+                    ASSERT_NE(page, nullptr);
+                    pids.push_back(page->get_id());
+                } else {
+                    page = page_cache.fetch_page(pids[j], lock);
+                    ASSERT_NE(page, nullptr);
+                    ASSERT_EQ(*reinterpret_cast<const uint32_t*>(page->get_buffer(lock)),
+                              versions[j]);
+                }
+
+                {
+                    boost::upgrade_to_unique_lock<bptree::Page> ulock(lock);
+                    *reinterpret_cast<uint32_t*>(page->get_buffer(ulock)) =
+                        ++versions[j];
+                }
+                page_cache.unpin_page(page, true, lock);
+            }
+        });
+    }
+    for (auto&& p : threads) {
+        p.join();
+    }
+
+    EXPECT_GT(page_cache.get_stats().evictions, 0);
+    unlink(filename.c_str());
+}
+
+/* creates num_pages pages whose first word is their page ID */
+static std::string create_marked_pages(int num_pages)
+{
+    auto filename = temp_heap_file();
+    bptree::HeapPageCache page_cache(filename, true, 64);
+
+    for (int i = 0; i < num_pages; i++) {
+        boost::upgrade_lock<bptree::Page> lock;
+        auto* page = page_cache.new_page(lock);
+        {
+            boost::upgrade_to_unique_lock<bptree::Page> ulock(lock);
+            *reinterpret_cast<uint32_t*>(page->get_buffer(ulock)) =
+                page->get_id();
+        }
+        page_cache.unpin_page(page, true, lock);
+    }
+
+    return filename;
+}
+
+static bool check_marked_page(bptree::HeapPageCache& page_cache,
+                              bptree::PageID pid)
+{
+    boost::upgrade_lock<bptree::Page> lock;
+    auto* page = page_cache.fetch_page(pid, lock);
+    if (!page) return false;
+
+    bool ok = page->get_id() == pid &&
+              *reinterpret_cast<const uint32_t*>(page->get_buffer(lock)) == pid;
+    page_cache.unpin_page(page, false, lock);
+    return ok;
+}
+
+static void wait_for_prefetches(bptree::HeapPageCache& page_cache, size_t n)
+{
+    for (int i = 0; i < 1000 && page_cache.get_num_prefetched_pages() < n; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+TEST(HeapPageCacheTest, AsyncPrefetch)
+{
+    const int num_pages = 100;
+    auto filename = create_marked_pages(num_pages);
+
+    {
+        bptree::HeapPageCache page_cache(filename, false, 256, 4096,
+                                         bptree::WritePolicy::WRITE_THROUGH, 0,
+                                         bptree::IOBackend::IO_URING, 2,
+                                         num_pages);
+
+        std::vector<bptree::PageID> ids;
+        for (int i = 1; i <= num_pages; i++) {
+            ids.push_back(i);
+        }
+        page_cache.prefetch_pages(ids);
+        page_cache.prefetch_pages(ids); /* duplicates are ignored */
+
+        wait_for_prefetches(page_cache, num_pages);
+        EXPECT_EQ(page_cache.get_num_prefetched_pages(), num_pages);
+
+        for (auto pid : ids) {
+            EXPECT_TRUE(check_marked_page(page_cache, pid));
+        }
+        EXPECT_EQ(page_cache.get_num_prefetch_hits(), num_pages);
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(HeapPageCacheTest, PrefetchCap)
+{
+    const int num_pages = 100;
+    auto filename = create_marked_pages(num_pages);
+
+    {
+        bptree::HeapPageCache page_cache(filename, false, 256, 4096,
+                                         bptree::WritePolicy::WRITE_THROUGH, 0,
+                                         bptree::IOBackend::SYNC, 1, 8);
+
+        std::vector<bptree::PageID> ids;
+        for (int i = 1; i <= num_pages; i++) {
+            ids.push_back(i);
+        }
+        page_cache.prefetch_pages(ids);
+
+        wait_for_prefetches(page_cache, 8);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        EXPECT_EQ(page_cache.get_num_prefetched_pages(), 8);
+
+        /* using the prefetched pages makes room for more prefetches */
+        for (int i = 1; i <= 8; i++) {
+            EXPECT_TRUE(check_marked_page(page_cache, i));
+        }
+        page_cache.prefetch_pages(ids);
+        wait_for_prefetches(page_cache, 16);
+        EXPECT_EQ(page_cache.get_num_prefetched_pages(), 16);
+    }
+
+    unlink(filename.c_str());
+}
+
+static void concurrent_prefetch_and_fetch(size_t max_pages, size_t num_shards)
+{
+    const int num_pages = 500;
+    auto filename = create_marked_pages(num_pages);
+
+    {
+        /* cache much smaller than the file so that frames are recycled */
+        bptree::HeapPageCache page_cache(filename, false, max_pages, 4096,
+                                         bptree::WritePolicy::WRITE_THROUGH, 0,
+                                         bptree::IOBackend::IO_URING, 2, 16,
+                                         num_shards);
+
+        std::vector<std::thread> threads;
+        std::atomic<int> failures(0);
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([t, &page_cache, &failures]() {
+                unsigned int seed = t;
+                for (int i = 0; i < 5000; i++) {
+                    bptree::PageID pid = 1 + rand_r(&seed) % num_pages;
+                    page_cache.prefetch_pages({pid, pid % num_pages + 1});
+                    if (!check_marked_page(page_cache, pid)) failures++;
+                }
+            });
+        }
+
+        for (auto&& p : threads) {
+            p.join();
+        }
+
+        EXPECT_EQ(failures.load(), 0);
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(HeapPageCacheTest, ConcurrentPrefetchAndFetch)
+{
+    concurrent_prefetch_and_fetch(64, 1);
+}
+
+TEST(HeapPageCacheTest, ShardedConcurrentPrefetchAndFetch)
+{
+    concurrent_prefetch_and_fetch(128, 8);
+}
+
+TEST(HeapPageCacheTest, WarmRestartFromManifest)
+{
+    const int N = 20000;
+    auto filename = temp_heap_file();
+    auto manifest = filename + ".manifest";
+    size_t num_cached;
+
+    {
+        bptree::HeapPageCache page_cache(filename, true, 1024);
+        EXPECT_EQ(page_cache.use_manifest(manifest), 0);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i + 1);
+        }
+
+        /* written on checkpoints */
+        tree.checkpoint();
+        EXPECT_EQ(access(manifest.c_str(), F_OK), 0);
+        EXPECT_EQ(page_cache.write_manifest(), page_cache.size());
+    }
+
+    {
+        /* | magic | # of inner node pages | # of pages | page IDs | */
+        uint32_t header[3];
+        FILE* f = fopen(manifest.c_str(), "rb");
+        ASSERT_NE(f, nullptr);
+        ASSERT_EQ(fread(header, sizeof(header), 1, f), 1);
+        fclose(f);
+        /* rewritten when the cache was destroyed, after the tree gave
+         * back the pages it had reserved */
+        EXPECT_GT(header[1], 0);
+        EXPECT_GT(header[2], header[1]);
+        num_cached = header[2];
+    }
+
+    {
+        bptree::HeapPageCache page_cache(filename, false, 1024);
+        EXPECT_EQ(page_cache.use_manifest(manifest), num_cached);
+        page_cache.wait_for_warm_up();
+        EXPECT_EQ(page_cache.get_num_warmed_pages(), num_cached);
+
+        /* every page the lookups need is already there */
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+        auto before = page_cache.get_stats();
+        for (int i = 0; i < N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+            ASSERT_EQ(values.size(), 1);
+            EXPECT_EQ(values[0], i + 1);
+        }
+        EXPECT_EQ(page_cache.get_stats().misses, before.misses);
+        EXPECT_EQ(page_cache.get_stats().prefetched, 0);
+    }
+
+    {
+        /* the tree is used while the pages are read back into a smaller
+         * cache, which is filled without evicting anything */
+        bptree::HeapPageCache page_cache(filename, false, 128);
+        EXPECT_GT(page_cache.use_manifest(manifest), 128);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+        for (int i = 0; i < N; i += 7) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+            ASSERT_EQ(values.size(), 1);
+        }
+        page_cache.wait_for_warm_up();
+        EXPECT_LE(page_cache.get_num_warmed_pages(), 128);
+        EXPECT_EQ(page_cache.size(), 128);
+    }
+
+    {
+        FILE* f = fopen(manifest.c_str(), "wb");
+        ASSERT_NE(f, nullptr);
+        fputs("not a manifest", f);
+        fclose(f);
+
+        bptree::HeapPageCache page_cache(filename, false, 1024);
+        EXPECT_EQ(page_cache.use_manifest(manifest), 0);
+        EXPECT_EQ(page_cache.get_num_warmed_pages(), 0);
+    }
+
+    unlink(manifest.c_str());
+    unlink(filename.c_str());
+}
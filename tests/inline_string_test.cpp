@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include "bptree/inline_string.h"
+#include "bptree/serializer.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using String = bptree::InlineString<32>;
+using Serializer = bptree::InlineStringSerializer<32>;
+
+static std::vector<String> sorted_strings(size_t n, std::mt19937& gen)
+{
+    const std::vector<std::string> prefixes = {"", "a", "user:", "user:0000"};
+    std::vector<String> strings;
+    for (size_t i = 0; i < n; i++) {
+        std::string s = prefixes[gen() % prefixes.size()];
+        size_t len = gen() % (32 - s.size() + 1);
+        for (size_t j = 0; j < len; j++) {
+            s.push_back("0123xyz"[gen() % 7]);
+        }
+        strings.emplace_back(s);
+    }
+    std::sort(strings.begin(), strings.end());
+    return strings;
+}
+
+TEST(InlineStringTest, Compare)
+{
+    static_assert(std::is_trivially_copyable<String>::value, "");
+
+    EXPECT_LT(String("abc"), String("abd"));
+    EXPECT_LT(String("ab"), String("abc"));
+    EXPECT_LT(String(""), String("a"));
+    EXPECT_EQ(String("abc"), String(std::string("abc")));
+    EXPECT_NE(String("abc"), String("ab"));
+    EXPECT_EQ(String("abc").str(), "abc");
+    EXPECT_THROW(String(std::string(33, 'x')), std::length_error);
+}
+
+TEST(InlineStringTest, SerializeRoundTrip)
+{
+    static_assert(bptree::has_encoded_size<Serializer, String>::value, "");
+    static_assert(bptree::has_shorten<Serializer, String>::value, "");
+
+    Serializer ser;
+    std::mt19937 gen(7);
+    uint8_t buf[4096];
+
+    for (size_t n = 0; n < 64; n++) {
+        auto strings = sorted_strings(n, gen);
+        const auto* begin = strings.data();
+        const auto* end = begin + n;
+
+        size_t nbytes = ser.serialize(buf, sizeof(buf), begin, end);
+        EXPECT_EQ(nbytes, ser.encoded_size(begin, end));
+        EXPECT_LE(nbytes, 1 + n * ser.max_encoded_size());
+
+        std::vector<String> decoded(n);
+        EXPECT_EQ(ser.deserialize(decoded.data(), decoded.data() + n, buf, nbytes),
+                  nbytes);
+        EXPECT_EQ(decoded, strings);
+
+        /* the size with one more string is the one of the sorted result */
+        String extra = sorted_strings(1, gen).front();
+        auto with_extra = strings;
+        with_extra.insert(std::upper_bound(with_extra.begin(), with_extra.end(), extra),
+                          extra);
+        EXPECT_EQ(ser.encoded_size(begin, end, extra),
+                  ser.encoded_size(with_extra.data(), with_extra.data() + n + 1));
+    }
+
+    String s("abc");
+    EXPECT_THROW(ser.serialize(buf, 4, &s, &s + 1), std::length_error);
+}
+
+TEST(InlineStringTest, DeserializeTruncated)
+{
+    Serializer ser;
+    std::vector<String> strings = {String("user:0001"), String("user:0002xyz")};
+    uint8_t buf[256];
+    size_t nbytes = ser.serialize(buf, sizeof(buf), strings.data(),
+                                  strings.data() + strings.size());
+
+    std::vector<String> decoded(strings.size());
+    for (size_t len = 0; len < nbytes; len++) {
+        EXPECT_THROW(ser.deserialize(decoded.data(), decoded.data() + decoded.size(),
+                                     buf, len),
+                     bptree::IOException);
+    }
+    EXPECT_EQ(ser.deserialize(decoded.data(), decoded.data() + decoded.size(), buf,
+                              nbytes),
+              nbytes);
+    EXPECT_EQ(decoded, strings);
+}
+
+TEST(InlineStringTest, Shorten)
+{
+    Serializer ser;
+    std::mt19937 gen(11);
+
+    EXPECT_EQ(ser.shorten(String("user:0012"), String("user:0345")), String("user:03"));
+    EXPECT_EQ(ser.shorten(String("abc"), String("abc")), String("abc"));
+    EXPECT_EQ(ser.shorten(String("ab"), String("abc")), String("abc"));
+
+    auto strings = sorted_strings(1000, gen);
+    for (size_t i = 1; i < strings.size(); i++) {
+        const auto& left = strings[i - 1];
+        const auto& right = strings[i];
+        String sep = ser.shorten(left, right);
+
+        EXPECT_LE(sep.size(), right.size());
+        EXPECT_LE(sep, right);
+        if (left < right) {
+            EXPECT_LT(left, sep);
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include "bptree/heap_page_cache.h"
+#include "bptree/mem_page_cache.h"
+#include "bptree/metrics.h"
+#include "bptree/tree.h"
+#include "test_util.h"
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+
+TEST(MetricsTest, HistogramBuckets)
+{
+    using H = bptree::LatencyHistogram;
+
+    /* every value lands in a bucket that ends at or after it, and the
+     * bucket is at most 1 / SUB_BUCKETS of the value wide */
+    for (uint64_t v : {0ULL, 1ULL, 15ULL, 16ULL, 17ULL, 31ULL, 32ULL, 33ULL,
+                       1000ULL, 123456ULL, 1ULL << 30, (1ULL << 39) + 5}) {
+        size_t i = H::bucket_of(v);
+        ASSERT_LT(i, H::NUM_BUCKETS);
+        EXPECT_GE(H::bucket_end(i), v);
+        if (i > 0) {
+            EXPECT_LT(H::bucket_end(i - 1), v);
+        }
+        EXPECT_LE(H::bucket_end(i) - v, v / H::SUB_BUCKETS);
+    }
+    EXPECT_EQ(H::bucket_of(1ULL << 50), H::NUM_BUCKETS - 1);
+}
+
+TEST(MetricsTest, HistogramPercentiles)
+{
+    if (!bptree::METRICS_ENABLED) GTEST_SKIP();
+
+    bptree::LatencyHistogram histogram;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t, &histogram]() {
+            for (uint64_t v = 1 + t; v <= 10000; v += 4) {
+                histogram.record(v * 1000);
+            }
+        });
+    }
+    for (auto&& p : threads) {
+        p.join();
+    }
+
+    auto snap = histogram.snapshot();
+    EXPECT_EQ(snap.count, 10000);
+    EXPECT_EQ(snap.max, 10000 * 1000);
+    EXPECT_NEAR(snap.mean(), 5000.5 * 1000, 1);
+    EXPECT_NEAR(snap.percentile(0.5), 5000 * 1000, 5000 * 1000 / 16);
+    EXPECT_NEAR(snap.percentile(0.99), 9900 * 1000, 9900 * 1000 / 16);
+    EXPECT_EQ(snap.percentile(1.0), snap.max);
+
+    std::stringstream ss;
+    ss << snap;
+    EXPECT_NE(ss.str().find("count 10000"), std::string::npos);
+}
+
+TEST(MetricsTest, TreeCounters)
+{
+    if (!bptree::METRICS_ENABLED) GTEST_SKIP();
+
+    const int N = 10000;
+    auto filename = temp_heap_file();
+
+    {
+        bptree::HeapPageCache page_cache(filename, true, 64);
+        bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+
+        for (int i = 0; i < N; i++) {
+            tree.insert((i * 7919) % N, i);
+        }
+        auto metrics = tree.get_metrics();
+        EXPECT_GT(metrics.splits, N / 16);
+        EXPECT_EQ(metrics.merges, 0);
+        EXPECT_EQ(metrics.insert_latency.count, N);
+        EXPECT_EQ(metrics.get_value_latency.count, 0);
+        EXPECT_GT(metrics.page_cache.evictions, 0);
+        EXPECT_GT(metrics.page_cache.bytes_written, 0);
+
+        for (int i = 0; i < N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+        }
+        size_t num_leaves = 0;
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+            num_leaves++;
+        }
+        for (int i = 0; i < N; i++) {
+            tree.erase(i);
+        }
+
+        metrics = tree.get_metrics();
+        EXPECT_EQ(metrics.get_value_latency.count, N);
+        EXPECT_GT(metrics.scan_latency.count, 0);
+        EXPECT_LE(metrics.scan_latency.count, num_leaves);
+        EXPECT_GT(metrics.merges, N / 16);
+        EXPECT_GT(metrics.page_cache.hits + metrics.page_cache.misses, 0);
+        EXPECT_GT(metrics.page_cache.bytes_read, 0);
+
+        std::stringstream ss;
+        ss << metrics;
+        EXPECT_NE(ss.str().find("get_value: count 10000"), std::string::npos);
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(MetricsTest, MemPageCacheHits)
+{
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache, 1024, 16);
+    for (int i = 0; i < 1000; i++) {
+        tree.insert(i, i);
+    }
+    auto stats = tree.get_metrics().page_cache;
+    EXPECT_EQ(stats.misses, 0);
+    if (bptree::METRICS_ENABLED) {
+        EXPECT_GT(stats.hits, 0);
+    } else {
+        EXPECT_EQ(stats.hits, 0);
+    }
+}
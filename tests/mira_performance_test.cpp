@@ -9,11 +9,16 @@
 #include <atomic>
 #include <numeric>
 #include <cmath>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
 
 #include "bptree/heap_page_cache.h"
 #include "bptree/mem_page_cache.h"
+#include "bptree/mmap_page_cache.h"
 #include "bptree/tree.h"
 #include "bptree/latency_simulator.h"
+#include "bptree/node_search.h"
 
 using namespace std::chrono;
 using KeyType = uint64_t;
@@ -45,6 +50,9 @@ struct TestResults {
     std::vector<double> point_query_time_ms;
     std::vector<double> range_query_time_ms;
     std::vector<double> random_query_time_ms;
+    // Prefetch stats of the queries (see bptree::PrefetchStats)
+    std::vector<double> prefetch_accuracy;
+    std::vector<double> prefetch_coverage;
     
     // Get averages
     double avg_insert_time() const {
@@ -67,6 +75,16 @@ struct TestResults {
         return std::accumulate(random_query_time_ms.begin(), random_query_time_ms.end(), 0.0) / random_query_time_ms.size();
     }
     
+    double avg_prefetch_accuracy() const {
+        if (prefetch_accuracy.empty()) return 0.0;
+        return std::accumulate(prefetch_accuracy.begin(), prefetch_accuracy.end(), 0.0) / prefetch_accuracy.size();
+    }
+    
+    double avg_prefetch_coverage() const {
+        if (prefetch_coverage.empty()) return 0.0;
+        return std::accumulate(prefetch_coverage.begin(), prefetch_coverage.end(), 0.0) / prefetch_coverage.size();
+    }
+    
     // Standard deviations
     double stddev_insert_time() const {
         if (insert_time_ms.size() <= 1) return 0.0;
@@ -113,6 +131,7 @@ struct TestResults {
         std::cout << "Point query time: " << avg_point_query_time() << " ± " << stddev_point_query_time() << " ms\n";
         std::cout << "Range query time: " << avg_range_query_time() << " ± " << stddev_range_query_time() << " ms\n";
         std::cout << "Random query time: " << avg_random_query_time() << " ± " << stddev_random_query_time() << " ms\n";
+        std::cout << "Prefetch accuracy: " << avg_prefetch_accuracy() << ", coverage: " << avg_prefetch_coverage() << "\n";
     }
 };
 
@@ -129,6 +148,7 @@ void run_single_test_iteration(const TestConfig& config, TestResults& results) {
         
         // Create the B+Tree
         bptree::BTree<256, KeyType, ValueType> tree(&page_cache);
+        tree.set_prefetching(config.enable_prefetching);
         
         // 1. Insert test
         double insert_time = measure_time_ms([&]() {
@@ -234,6 +254,10 @@ void run_single_test_iteration(const TestConfig& config, TestResults& results) {
             
             results.random_query_time_ms.push_back(random_query_time);
         }
+        
+        auto prefetch_stats = tree.get_prefetch_stats();
+        results.prefetch_accuracy.push_back(prefetch_stats.accuracy());
+        results.prefetch_coverage.push_back(prefetch_stats.coverage());
     } catch (const std::exception& e) {
         std::cerr << "Error during test iteration: " << e.what() << std::endl;
         // Don't propagate the exception, just report it
@@ -262,6 +286,10 @@ TestResults run_performance_test(const TestConfig& config) {
     std::cout << "  Point query: " << results.avg_point_query_time() << " ± " << results.stddev_point_query_time() << " ms\n";
     std::cout << "  Range query: " << results.avg_range_query_time() << " ± " << results.stddev_range_query_time() << " ms\n";
     std::cout << "  Random query: " << results.avg_random_query_time() << " ± " << results.stddev_random_query_time() << " ms\n";
+    if (config.enable_prefetching) {
+        std::cout << "  Prefetch accuracy: " << results.avg_prefetch_accuracy()
+                  << ", coverage: " << results.avg_prefetch_coverage() << "\n";
+    }
     
     return results;
 }
@@ -277,7 +305,8 @@ void save_results_to_csv(const std::vector<TestConfig>& configs,
          << "Insert_Avg(ms),Insert_StdDev(ms),"
          << "PointQuery_Avg(ms),PointQuery_StdDev(ms),"
          << "RangeQuery_Avg(ms),RangeQuery_StdDev(ms),"
-         << "RandomQuery_Avg(ms),RandomQuery_StdDev(ms)\n";
+         << "RandomQuery_Avg(ms),RandomQuery_StdDev(ms),"
+         << "Prefetch_Accuracy,Prefetch_Coverage\n";
     
     // Write data
     for (size_t i = 0; i < configs.size(); i++) {
@@ -294,7 +323,8 @@ void save_results_to_csv(const std::vector<TestConfig>& configs,
              << result.avg_insert_time() << "," << result.stddev_insert_time() << ","
              << result.avg_point_query_time() << "," << result.stddev_point_query_time() << ","
              << result.avg_range_query_time() << "," << result.stddev_range_query_time() << ","
-             << result.avg_random_query_time() << "," << result.stddev_random_query_time() << "\n";
+             << result.avg_random_query_time() << "," << result.stddev_random_query_time() << ","
+             << result.avg_prefetch_accuracy() << "," << result.avg_prefetch_coverage() << "\n";
     }
     
     file.close();
@@ -477,4 +507,497 @@ TEST(MiraPerformanceTest, CompareWithAndWithoutPrefetching) {
     std::cout << "  Point queries: " << std::fixed << std::setprecision(2) << avg_point_improvement << "%\n";
     std::cout << "  Range queries: " << avg_range_improvement << "%\n";
     std::cout << "  Random queries: " << avg_random_improvement << "%\n";
-}
\ No newline at end of file
+}
+// Fetch throughput of the heap page cache for a given # of shards and threads.
+// All pages fit in the cache, so this measures the cost of the page table,
+// pinning and replacement bookkeeping rather than I/O.
+double measure_fetch_throughput(const std::string& filename, size_t num_pages,
+                                size_t num_shards, size_t num_threads,
+                                size_t fetches_per_thread) {
+    bptree::HeapPageCache page_cache(filename, false, 4096, 4096,
+                                     bptree::WritePolicy::WRITE_THROUGH, 0,
+                                     bptree::IOBackend::SYNC, 0, 0, num_shards);
+
+    // Warm up the cache
+    for (bptree::PageID pid = 1; pid <= num_pages; pid++) {
+        boost::upgrade_lock<bptree::Page> lock;
+        auto* page = page_cache.fetch_page(pid, lock);
+        page_cache.unpin_page(page, false, lock);
+    }
+
+    double elapsed_ms = measure_time_ms([&]() {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < num_threads; t++) {
+            threads.emplace_back([&page_cache, t, num_pages, fetches_per_thread]() {
+                std::mt19937 gen(t);
+                std::uniform_int_distribution<bptree::PageID> dist(1, num_pages);
+
+                for (size_t i = 0; i < fetches_per_thread; i++) {
+                    boost::upgrade_lock<bptree::Page> lock;
+                    auto* page = page_cache.fetch_page(dist(gen), lock);
+                    page_cache.unpin_page(page, false, lock);
+                }
+            });
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    });
+
+    return (num_threads * fetches_per_thread) / (elapsed_ms / 1000.0);
+}
+
+TEST(MiraPerformanceTest, PageCacheFetchScaling) {
+    const size_t NUM_PAGES = 2048;
+    const size_t FETCHES_PER_THREAD = 200000;
+    const std::vector<size_t> THREAD_COUNTS = {1, 2, 4, 8, 16};
+    const std::vector<size_t> SHARD_COUNTS = {1, 4, 16};
+
+    bptree::LatencySimulator::configure(0);
+
+    char tmp_template[] = "/tmp/bptree_scaling_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+    std::string filename(tmp_template);
+
+    {
+        bptree::HeapPageCache page_cache(filename, true, 4096);
+        for (size_t i = 0; i < NUM_PAGES; i++) {
+            boost::upgrade_lock<bptree::Page> lock;
+            auto* page = page_cache.new_page(lock);
+            page_cache.unpin_page(page, true, lock);
+        }
+    }
+
+    std::ofstream file("page_cache_scaling_results.csv");
+    file << "Shards,Threads,Fetches/s\n";
+
+    std::cout << "\nPAGE CACHE FETCH THROUGHPUT (fetches/s):\n";
+    std::cout << std::setw(8) << "Threads";
+    for (size_t shards : SHARD_COUNTS) {
+        std::cout << std::setw(14) << (std::to_string(shards) + " shard(s)");
+    }
+    std::cout << "\n";
+
+    for (size_t threads : THREAD_COUNTS) {
+        std::cout << std::setw(8) << threads;
+        for (size_t shards : SHARD_COUNTS) {
+            double throughput = measure_fetch_throughput(
+                filename, NUM_PAGES, shards, threads, FETCHES_PER_THREAD);
+            std::cout << std::setw(14) << std::fixed << std::setprecision(0)
+                      << throughput;
+            file << shards << "," << threads << "," << throughput << "\n";
+        }
+        std::cout << std::endl;
+    }
+
+    file.close();
+    unlink(filename.c_str());
+}
+
+// Batched lookups against per-key lookups when the leaves have to be read
+// through the latency simulator
+TEST(MiraPerformanceTest, MultiGetVsGetValue) {
+    const size_t NUM_KEYS = 200000;
+    const size_t NUM_QUERIES = 20000;
+    const std::vector<size_t> BATCH_SIZES = {64, 256, 1024};
+
+    char tmp_template[] = "/tmp/bptree_multi_get_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+    std::string filename(tmp_template);
+
+    bptree::LatencySimulator::configure(0);
+    {
+        bptree::HeapPageCache page_cache(filename, true, 4096);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+        for (size_t i = 0; i < NUM_KEYS; i++) {
+            tree.insert(i, i + 1);
+        }
+    }
+
+    std::vector<KeyType> queries;
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<KeyType> dist(0, NUM_KEYS - 1);
+    for (size_t i = 0; i < NUM_QUERIES; i++) {
+        queries.push_back(dist(gen));
+    }
+
+    bptree::LatencySimulator::configure(2);
+
+    // A fresh cache smaller than the tree for every run
+    auto run = [&](size_t batch_size) {
+        bptree::HeapPageCache page_cache(filename, false, 1024, 4096,
+                                         bptree::WritePolicy::WRITE_THROUGH, 0,
+                                         bptree::IOBackend::IO_URING, 2, 512);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        return measure_time_ms([&]() {
+            if (batch_size == 0) {
+                std::vector<ValueType> values;
+                for (auto key : queries) {
+                    tree.get_value(key, values);
+                }
+                return;
+            }
+
+            std::vector<ValueType> values;
+            std::vector<size_t> offsets;
+            for (size_t i = 0; i < queries.size(); i += batch_size) {
+                size_t n = std::min(batch_size, queries.size() - i);
+                tree.multi_get(&queries[i], n, values, offsets);
+            }
+        });
+    };
+
+    std::cout << "\nMULTI_GET VS GET_VALUE (" << NUM_QUERIES << " lookups):\n";
+    std::cout << "  get_value: " << run(0) << " ms\n";
+    for (size_t batch_size : BATCH_SIZES) {
+        std::cout << "  multi_get(" << batch_size << "): " << run(batch_size)
+                  << " ms\n";
+    }
+
+    bptree::LatencySimulator::configure(0);
+    unlink(filename.c_str());
+}
+
+// In-node search of a full node against std::upper_bound for the node sizes
+// of BTree<16>, BTree<64> and BTree<256>
+TEST(MiraPerformanceTest, NodeSearchVsBinarySearch) {
+    const size_t NUM_LOOKUPS = 2000000;
+    const std::vector<size_t> NODE_SIZES = {15, 63, 255};
+    const bptree::SearchKernel KERNELS[] = {
+        bptree::SearchKernel::SCALAR, bptree::SearchKernel::AVX2,
+        bptree::SearchKernel::AVX512, bptree::SearchKernel::NEON};
+
+    auto detected = bptree::node_search_kernel();
+    std::mt19937_64 gen(42);
+
+    std::cout << "\nNODE SEARCH (ns/lookup, uint64 keys):\n";
+    std::cout << std::setw(10) << "Keys" << std::setw(14) << "binary";
+    for (auto kernel : KERNELS) {
+        if (bptree::set_node_search_kernel(kernel)) {
+            std::cout << std::setw(14) << bptree::search_kernel_name(kernel);
+        }
+    }
+    std::cout << "\n";
+
+    for (size_t n : NODE_SIZES) {
+        std::vector<KeyType> keys(n);
+        for (auto& k : keys) {
+            k = gen();
+        }
+        std::sort(keys.begin(), keys.end());
+
+        // Random queries so that the branches of the binary search are not
+        // predictable
+        std::vector<KeyType> queries(4096);
+        for (auto& q : queries) {
+            q = gen();
+        }
+
+        size_t checksum = 0;
+        auto ns_per_lookup = [&](auto&& search) {
+            double ms = measure_time_ms([&]() {
+                for (size_t i = 0; i < NUM_LOOKUPS; i++) {
+                    checksum += search(queries[i & (queries.size() - 1)]);
+                }
+            });
+            return ms * 1e6 / NUM_LOOKUPS;
+        };
+
+        std::cout << std::setw(10) << n << std::setw(14) << std::fixed
+                  << std::setprecision(2) << ns_per_lookup([&](KeyType q) {
+                         return std::upper_bound(keys.begin(), keys.end(), q) -
+                                keys.begin();
+                     });
+
+        for (auto kernel : KERNELS) {
+            if (!bptree::set_node_search_kernel(kernel)) continue;
+            std::cout << std::setw(14) << ns_per_lookup([&](KeyType q) {
+                return bptree::upper_bound_index(keys.data(), n, q,
+                                                 std::less<KeyType>{});
+            });
+        }
+        std::cout << " (checksum " << checksum << ")" << std::endl;
+    }
+
+    bptree::set_node_search_kernel(detected);
+}
+
+// Read latency while writer threads insert into the same tree, the readers
+// restart whenever a writer changes a node on their path
+TEST(MiraPerformanceTest, ReadLatencyUnderWriteContention) {
+    const size_t NUM_KEYS = 100000;
+    const size_t NUM_READERS = 2;
+    const std::vector<size_t> WRITER_COUNTS = {0, 1, 2, 4};
+    const auto DURATION = milliseconds(500);
+
+    std::cout << "\nREAD LATENCY UNDER WRITE CONTENTION (" << NUM_READERS
+              << " readers):\n";
+    std::cout << std::setw(10) << "Writers" << std::setw(14) << "reads/s"
+              << std::setw(14) << "writes/s" << std::setw(12) << "p50 (ns)"
+              << std::setw(12) << "p99 (ns)" << std::setw(12) << "restarts"
+              << "\n";
+
+    for (size_t num_writers : WRITER_COUNTS) {
+        bptree::MemPageCache page_cache(4096);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+        for (size_t i = 0; i < NUM_KEYS; i++) {
+            tree.insert(2 * i, i);
+        }
+
+        std::atomic<bool> stop(false);
+        std::atomic<size_t> num_writes(0);
+        std::vector<std::vector<double>> latencies(NUM_READERS);
+        std::vector<std::thread> threads;
+
+        for (size_t t = 0; t < NUM_READERS; t++) {
+            threads.emplace_back([&, t]() {
+                std::mt19937_64 gen(t);
+                std::vector<ValueType> values;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    KeyType key = 2 * (gen() % NUM_KEYS);
+                    auto start = steady_clock::now();
+                    tree.get_value(key, values);
+                    latencies[t].push_back(
+                        duration<double, std::nano>(steady_clock::now() - start)
+                            .count());
+                }
+            });
+        }
+
+        for (size_t t = 0; t < num_writers; t++) {
+            threads.emplace_back([&, t]() {
+                std::mt19937_64 gen(100 + t);
+                size_t n = 0;
+                while (!stop.load(std::memory_order_relaxed)) {
+                    tree.insert(2 * (gen() % NUM_KEYS) + 1, t);
+                    n++;
+                }
+                num_writes += n;
+            });
+        }
+
+        std::this_thread::sleep_for(DURATION);
+        stop = true;
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        std::vector<double> all;
+        for (auto& l : latencies) {
+            all.insert(all.end(), l.begin(), l.end());
+        }
+        std::sort(all.begin(), all.end());
+        double seconds = duration<double>(DURATION).count();
+
+        std::cout << std::setw(10) << num_writers << std::setw(14) << std::fixed
+                  << std::setprecision(0) << all.size() / seconds << std::setw(14)
+                  << num_writes.load() / seconds << std::setw(12)
+                  << all[all.size() / 2] << std::setw(12)
+                  << all[all.size() * 99 / 100] << std::setw(12)
+                  << tree.get_restart_stats().reads << std::endl;
+    }
+}
+
+TEST(MiraPerformanceTest, SequentialInsert) {
+    const size_t NUM_KEYS = 1000000;
+    const size_t NUM_THREADS = 4;
+
+    std::vector<KeyType> shuffled(NUM_KEYS);
+    std::iota(shuffled.begin(), shuffled.end(), 0);
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937_64(42));
+
+    std::cout << "\nSEQUENTIAL INSERT (" << NUM_KEYS << " keys):\n";
+    std::cout << std::setw(24) << "Order" << std::setw(14) << "inserts/s"
+              << std::setw(10) << "pages" << std::setw(14) << "pairs/page"
+              << std::setw(12) << "appends" << "\n";
+
+    auto run = [&](const char* name, size_t num_threads, bool sequential) {
+        bptree::MemPageCache page_cache(4096);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+        std::atomic<size_t> next(0);
+
+        auto start = steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < num_threads; t++) {
+            threads.emplace_back([&]() {
+                for (size_t i = next++; i < NUM_KEYS; i = next++) {
+                    KeyType key = sequential ? i : shuffled[i];
+                    tree.insert(key, key);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        double seconds = duration<double>(steady_clock::now() - start).count();
+
+        EXPECT_EQ(tree.size(), NUM_KEYS);
+        std::cout << std::setw(24) << name << std::setw(14) << std::fixed
+                  << std::setprecision(0) << NUM_KEYS / seconds << std::setw(10)
+                  << page_cache.size() << std::setw(14) << std::setprecision(1)
+                  << (double)NUM_KEYS / page_cache.size() << std::setw(12)
+                  << tree.get_num_appends() << std::endl;
+    };
+
+    run("sequential", 1, true);
+    run("random", 1, false);
+    run("sequential, 4 threads", NUM_THREADS, true);
+    run("random, 4 threads", NUM_THREADS, false);
+}
+
+TEST(MiraPerformanceTest, BufferedInsert) {
+    const size_t NUM_KEYS = 1000000;
+    const size_t NUM_THREADS = 4;
+
+    std::vector<KeyType> shuffled(NUM_KEYS);
+    std::iota(shuffled.begin(), shuffled.end(), 0);
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937_64(42));
+
+    std::cout << "\nBUFFERED INSERT (" << NUM_KEYS << " random keys):\n";
+    std::cout << std::setw(12) << "Batch" << std::setw(10) << "threads"
+              << std::setw(14) << "inserts/s" << "\n";
+
+    auto run = [&](size_t batch_size, size_t num_threads) {
+        bptree::MemPageCache page_cache(4096);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+        tree.set_insert_buffer(batch_size);
+        std::atomic<size_t> next(0);
+
+        auto start = steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < num_threads; t++) {
+            threads.emplace_back([&]() {
+                for (size_t i = next++; i < NUM_KEYS; i = next++) {
+                    tree.insert(shuffled[i], shuffled[i]);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        tree.flush();
+        double seconds = duration<double>(steady_clock::now() - start).count();
+
+        EXPECT_EQ(tree.size(), NUM_KEYS);
+        std::cout << std::setw(12) << (batch_size > 1 ? std::to_string(batch_size) : "off")
+                  << std::setw(10) << num_threads << std::setw(14) << std::fixed
+                  << std::setprecision(0) << NUM_KEYS / seconds << std::endl;
+    };
+
+    for (size_t num_threads : {(size_t)1, NUM_THREADS}) {
+        for (size_t batch_size : {0, 256, 4096, 65536}) {
+            run(batch_size, num_threads);
+        }
+    }
+}
+
+// The same workload on each page cache backend. The heap page cache is
+// large enough to hold the tree so that all three serve pages from memory
+TEST(MiraPerformanceTest, PageCacheBackends) {
+    const size_t NUM_KEYS = 500000;
+    const size_t NUM_THREADS = 4;
+    const size_t MAX_CACHED_NODES = 256;
+
+    bptree::LatencySimulator::configure(0);
+
+    std::vector<KeyType> shuffled(NUM_KEYS);
+    std::iota(shuffled.begin(), shuffled.end(), 0);
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937_64(42));
+
+    std::cout << "\nPAGE CACHE BACKENDS (" << NUM_KEYS << " random keys, "
+              << NUM_THREADS << " threads):\n";
+    std::cout << std::setw(8) << "Backend" << std::setw(14) << "inserts/s"
+              << std::setw(14) << "lookups/s" << std::setw(14) << "scan ms"
+              << "\n";
+
+    auto run = [&](const char* name, bptree::AbstractPageCache* page_cache) {
+        auto parallel = [&](auto&& op) {
+            std::atomic<size_t> next(0);
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < NUM_THREADS; t++) {
+                threads.emplace_back([&]() {
+                    for (size_t i = next++; i < NUM_KEYS; i = next++) {
+                        op(shuffled[i]);
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        };
+
+        double insert_ms;
+        {
+            bptree::BTree<64, KeyType, ValueType> tree(page_cache);
+            insert_ms = measure_time_ms([&]() {
+                parallel([&](KeyType key) { tree.insert(key, key); });
+            });
+        }
+
+        /* reopened with few nodes in memory so that most lookups fetch a
+         * page */
+        bptree::BTree<64, KeyType, ValueType> tree(
+            page_cache,
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            MAX_CACHED_NODES);
+
+        double lookup_ms = measure_time_ms([&]() {
+            parallel([&](KeyType key) {
+                thread_local std::vector<ValueType> values;
+                tree.get_value(key, values);
+            });
+        });
+
+        size_t count = 0;
+        double scan_ms = measure_time_ms([&]() {
+            for (auto it = tree.begin(); it != tree.end(); it++) {
+                count++;
+            }
+        });
+        EXPECT_EQ(count, NUM_KEYS);
+
+        std::cout << std::setw(8) << name << std::setw(14) << std::fixed
+                  << std::setprecision(0) << NUM_KEYS / (insert_ms / 1000.0)
+                  << std::setw(14) << NUM_KEYS / (lookup_ms / 1000.0)
+                  << std::setw(14) << std::setprecision(1) << scan_ms
+                  << std::endl;
+    };
+
+    auto temp_file = []() {
+        char tmp_template[] = "/tmp/bptree_backends_XXXXXX";
+        int fd = mkstemp(tmp_template);
+        close(fd);
+        unlink(tmp_template);
+        return std::string(tmp_template);
+    };
+
+    {
+        bptree::MemPageCache page_cache(4096);
+        run("mem", &page_cache);
+    }
+
+    {
+        auto filename = temp_file();
+        {
+            bptree::HeapPageCache page_cache(filename, true, 65536, 4096,
+                                             bptree::WritePolicy::WRITE_BACK);
+            run("heap", &page_cache);
+        }
+        unlink(filename.c_str());
+    }
+
+    {
+        auto filename = temp_file();
+        {
+            bptree::MmapPageCache page_cache(filename, true);
+            run("mmap", &page_cache);
+        }
+        unlink(filename.c_str());
+    }
+}
@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+
+#include "bptree/mmap_page_cache.h"
+#include "bptree/tree.h"
+#include "test_util.h"
+
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+
+TEST(MmapPageCacheTest, Persists)
+{
+    const int N = 100000;
+    auto filename = temp_heap_file();
+
+    {
+        bptree::MmapPageCache page_cache(filename, true);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i + 1);
+        }
+        for (int i = 0; i < N; i += 2) {
+            tree.erase(i);
+        }
+    }
+
+    {
+        bptree::MmapPageCache page_cache(filename, false);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        EXPECT_EQ(tree.size(), N / 2);
+        for (int i = 0; i < N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+            if (i % 2) {
+                ASSERT_EQ(values.size(), 1);
+                EXPECT_EQ(values.front(), i + 1);
+            } else {
+                EXPECT_TRUE(values.empty());
+            }
+        }
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(MmapPageCacheTest, PagesAreViewsOfTheFile)
+{
+    auto filename = temp_heap_file();
+
+    {
+        bptree::MmapPageCache page_cache(filename, true, 4096, 1 << 20);
+
+        bptree::PageID pid;
+        {
+            boost::upgrade_lock<bptree::Page> lock;
+            auto* page = page_cache.new_page(lock);
+            pid = page->get_id();
+            {
+                boost::upgrade_to_unique_lock<bptree::Page> ulock(lock);
+                page->get_buffer(ulock)[0] = 42;
+            }
+            page_cache.unpin_page(page, true, lock);
+        }
+
+        /* the same page object over the same bytes */
+        boost::upgrade_lock<bptree::Page> lock;
+        auto* page = page_cache.fetch_page(pid, lock);
+        ASSERT_NE(page, nullptr);
+        EXPECT_EQ(page->get_buffer(lock)[0], 42);
+        page_cache.unpin_page(page, false, lock);
+        lock.unlock();
+
+        EXPECT_EQ(page_cache.fetch_page(pid + 1, lock), nullptr);
+        EXPECT_EQ(page_cache.fetch_page(bptree::Page::INVALID_PAGE_ID, lock),
+                  nullptr);
+
+        /* a freed page is handed out again, zeroed */
+        page_cache.free_page(pid);
+        auto* reused = page_cache.new_page(lock);
+        EXPECT_EQ(reused->get_id(), pid);
+        EXPECT_EQ(reused->get_buffer(lock)[0], 0);
+        page_cache.unpin_page(reused, false, lock);
+        lock.unlock();
+
+        /* 256 pages fit in the mapping, the header page included */
+        for (int i = 2; i < 256; i++) {
+            boost::upgrade_lock<bptree::Page> lock;
+            page_cache.new_page(lock);
+        }
+        EXPECT_THROW(page_cache.new_page(lock), bptree::IOException);
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(MmapPageCacheTest, ConcurrentInsert)
+{
+    const int N = 100000;
+    const int NUM_THREADS = 4;
+    auto filename = temp_heap_file();
+
+    {
+        bptree::MmapPageCache page_cache(filename, true, 4096,
+                                         bptree::MmapPageCache::DEFAULT_MAX_FILE_SIZE,
+                                         false);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < NUM_THREADS; t++) {
+            threads.emplace_back([t, &tree]() {
+                for (int i = t; i < N; i += NUM_THREADS) {
+                    tree.insert(i, i + 1);
+                }
+            });
+        }
+        for (auto&& p : threads) {
+            p.join();
+        }
+
+        EXPECT_EQ(tree.size(), N);
+
+        std::vector<bptree::PageID> pages;
+        for (bptree::PageID pid = 1; pid < page_cache.size(); pid++) {
+            pages.push_back(pid);
+        }
+        page_cache.prefetch_pages(pages);
+
+        KeyType expected = 0;
+        for (auto it = tree.begin(); it != tree.end(); it++) {
+            ASSERT_EQ(it->first, expected);
+            EXPECT_EQ(it->second, expected + 1);
+            expected++;
+        }
+        EXPECT_EQ(expected, N);
+    }
+
+    unlink(filename.c_str());
+}
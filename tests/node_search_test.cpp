@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+
+#include "bptree/node_search.h"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+using bptree::SearchKernel;
+
+static const SearchKernel ALL_KERNELS[] = {SearchKernel::SCALAR, SearchKernel::AVX2,
+                                           SearchKernel::AVX512, SearchKernel::NEON};
+
+/* sorted keys with runs of duplicates that cover the whole range of K, so
+ * that unsigned keys with the top bit set and negative keys are included */
+template <typename K> static std::vector<K> sorted_keys(size_t n, std::mt19937_64& gen)
+{
+    std::uniform_int_distribution<K> dist(std::numeric_limits<K>::min(),
+                                          std::numeric_limits<K>::max());
+    std::vector<K> keys;
+    while (keys.size() < n) {
+        K key = dist(gen);
+        size_t copies = 1 + gen() % 3;
+        for (size_t i = 0; i < copies && keys.size() < n; i++) {
+            keys.push_back(key);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+template <typename K> static void check_kernel()
+{
+    std::mt19937_64 gen(42);
+
+    for (size_t n = 0; n <= 300; n++) {
+        auto keys = sorted_keys<K>(n, gen);
+
+        std::vector<K> queries = {std::numeric_limits<K>::min(),
+                                  std::numeric_limits<K>::max(), 0};
+        for (auto k : keys) {
+            queries.push_back(k);
+            queries.push_back(k + 1);
+            queries.push_back(k - 1);
+        }
+
+        for (auto q : queries) {
+            size_t lower = std::lower_bound(keys.begin(), keys.end(), q) - keys.begin();
+            size_t upper = std::upper_bound(keys.begin(), keys.end(), q) - keys.begin();
+
+            ASSERT_EQ(bptree::lower_bound_index(keys.data(), n, q, std::less<K>{}),
+                      lower);
+            ASSERT_EQ(bptree::upper_bound_index(keys.data(), n, q, std::less<K>{}),
+                      upper);
+        }
+    }
+}
+
+TEST(NodeSearchTest, MatchesBinarySearch)
+{
+    auto detected = bptree::node_search_kernel();
+
+    for (auto kernel : ALL_KERNELS) {
+        if (!bptree::set_node_search_kernel(kernel)) continue;
+        SCOPED_TRACE(bptree::search_kernel_name(kernel));
+
+        check_kernel<int32_t>();
+        check_kernel<uint32_t>();
+        check_kernel<int64_t>();
+        check_kernel<uint64_t>();
+    }
+
+    bptree::set_node_search_kernel(detected);
+}
+
+TEST(NodeSearchTest, OtherComparatorsUseBinarySearch)
+{
+    static_assert(bptree::is_simd_searchable<uint64_t, std::less<uint64_t>>::value, "");
+    static_assert(!bptree::is_simd_searchable<uint64_t, std::greater<uint64_t>>::value,
+                  "");
+    static_assert(!bptree::is_simd_searchable<double, std::less<double>>::value, "");
+    static_assert(!bptree::is_simd_searchable<uint16_t, std::less<uint16_t>>::value, "");
+
+    std::vector<int> keys = {9, 7, 7, 4, 1};
+    EXPECT_EQ(bptree::lower_bound_index(keys.data(), keys.size(), 7, std::greater<int>{}),
+              1);
+    EXPECT_EQ(bptree::upper_bound_index(keys.data(), keys.size(), 7, std::greater<int>{}),
+              3);
+}
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+
+#include "bptree/frame_arena.h"
+#include "bptree/object_pool.h"
+
+#include <cstdint>
+#include <set>
+#include <thread>
+#include <vector>
+
+struct SmallObject {
+    uint64_t a, b, c;
+};
+
+struct LargeObject {
+    uint8_t data[(1 << 20) + 1];
+};
+
+TEST(ObjectPoolTest, ReusesFreedChunks)
+{
+    using Pool = bptree::ObjectPool<SmallObject>;
+
+    auto* p = Pool::allocate();
+    Pool::deallocate(p);
+    /* the calling thread gets its most recently freed chunk back */
+    EXPECT_EQ(Pool::allocate(), p);
+
+    std::set<void*> chunks{p};
+    for (int i = 0; i < 10000; i++) {
+        auto* q = Pool::allocate();
+        EXPECT_EQ((uintptr_t)q % Pool::ALIGNMENT, 0);
+        EXPECT_TRUE(chunks.insert(q).second);
+    }
+
+    /* freed chunks are handed out again before a new slab is carved */
+    size_t num_slabs = Pool::get_num_slabs();
+    for (auto* q : chunks) {
+        Pool::deallocate(q);
+    }
+    std::set<void*> reused;
+    for (int i = 0; i < 10001; i++) {
+        EXPECT_TRUE(reused.insert(Pool::allocate()).second);
+    }
+    EXPECT_EQ(Pool::get_num_slabs(), num_slabs);
+    for (auto* q : reused) {
+        Pool::deallocate(q);
+    }
+}
+
+TEST(ObjectPoolTest, LargeObjects)
+{
+    using Pool = bptree::ObjectPool<LargeObject>;
+
+    /* one object per slab */
+    std::vector<void*> objects;
+    for (int i = 0; i < 8; i++) {
+        objects.push_back(Pool::allocate());
+    }
+    EXPECT_EQ(Pool::get_num_slabs(), 8);
+    for (auto* p : objects) {
+        Pool::deallocate(p);
+    }
+}
+
+TEST(ObjectPoolTest, FreedByOtherThreads)
+{
+    using Pool = bptree::ObjectPool<SmallObject>;
+    const int N = 100000;
+    const int NUM_THREADS = 4;
+
+    /* objects allocated by one thread are freed by another, like nodes
+     * that are reclaimed by whoever leaves the last epoch */
+    std::vector<std::vector<void*>> objects(NUM_THREADS);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < NUM_THREADS; t++) {
+        threads.emplace_back([t, &objects]() {
+            for (int i = 0; i < N; i++) {
+                objects[t].push_back(Pool::allocate());
+            }
+        });
+    }
+    for (auto&& p : threads) {
+        p.join();
+    }
+    threads.clear();
+
+    size_t num_slabs = Pool::get_num_slabs();
+    for (int t = 0; t < NUM_THREADS; t++) {
+        threads.emplace_back([t, &objects]() {
+            for (auto* p : objects[(t + 1) % NUM_THREADS]) {
+                Pool::deallocate(p);
+            }
+        });
+    }
+    for (auto&& p : threads) {
+        p.join();
+    }
+
+    /* the exited threads gave their chunks back */
+    std::vector<void*> reused;
+    for (int i = 0; i < N * NUM_THREADS; i++) {
+        reused.push_back(Pool::allocate());
+    }
+    EXPECT_EQ(Pool::get_num_slabs(), num_slabs);
+    for (auto* p : reused) {
+        Pool::deallocate(p);
+    }
+}
+
+TEST(FrameArenaTest, AlignedFrames)
+{
+    for (bool use_huge_pages : {false, true}) {
+        bptree::FrameArena arena(1000, 4096, use_huge_pages);
+        EXPECT_EQ(arena.get_num_frames(), 1000);
+
+        for (size_t i = 0; i < arena.get_num_frames(); i++) {
+            auto* frame = arena.get_frame(i);
+            EXPECT_EQ((uintptr_t)frame % 4096, 0);
+            frame[0] = (uint8_t)i;
+            frame[4095] = (uint8_t)i;
+        }
+        for (size_t i = 0; i < arena.get_num_frames(); i++) {
+            EXPECT_EQ(arena.get_frame(i)[0], (uint8_t)i);
+            EXPECT_EQ(arena.get_frame(i)[4095], (uint8_t)i);
+        }
+    }
+}
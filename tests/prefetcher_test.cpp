@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+
+#include "bptree/heap_page_cache.h"
+#include "bptree/prefetcher.h"
+#include "bptree/tree.h"
+#include "test_util.h"
+
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+
+static std::vector<int> lookup(bptree::AdaptivePrefetcher& prefetcher,
+                               bptree::PageID parent, int idx)
+{
+    std::vector<int> child_indexes;
+    prefetcher.on_lookup(parent, idx, 64, child_indexes);
+    return child_indexes;
+}
+
+TEST(PrefetcherTest, SequentialAndStrided)
+{
+    bptree::AdaptivePrefetcher prefetcher;
+
+    EXPECT_TRUE(lookup(prefetcher, 10, 0).empty());
+    EXPECT_TRUE(lookup(prefetcher, 10, 1).empty());
+    /* the depth doubles with every lookup that confirms the pattern */
+    EXPECT_EQ(lookup(prefetcher, 10, 2), std::vector<int>({3, 4}));
+    EXPECT_EQ(lookup(prefetcher, 10, 3), std::vector<int>({4, 5, 6, 7}));
+    /* staying on a child does not break the pattern */
+    EXPECT_EQ(lookup(prefetcher, 10, 3), std::vector<int>({4, 5, 6, 7}));
+    EXPECT_EQ(lookup(prefetcher, 10, 4).size(), 8);
+    EXPECT_EQ(lookup(prefetcher, 10, 5).size(), 8); /* INITIAL_DEPTH */
+
+    /* the stream goes on in the next inner node */
+    lookup(prefetcher, 10, 61);
+    lookup(prefetcher, 10, 62);
+    EXPECT_TRUE(lookup(prefetcher, 10, 63).empty());
+    EXPECT_EQ(lookup(prefetcher, 11, 0), std::vector<int>({1, 2}));
+
+    EXPECT_TRUE(lookup(prefetcher, 20, 30).empty());
+    EXPECT_TRUE(lookup(prefetcher, 20, 27).empty());
+    EXPECT_EQ(lookup(prefetcher, 20, 24), std::vector<int>({21, 18}));
+    EXPECT_EQ(lookup(prefetcher, 20, 21), std::vector<int>({18, 15, 12, 9}));
+    /* only children that exist */
+    EXPECT_EQ(lookup(prefetcher, 20, 18),
+              std::vector<int>({15, 12, 9, 6, 3, 0}));
+    /* a lookup off the pattern in a busy inner node gets its neighbors */
+    EXPECT_EQ(lookup(prefetcher, 20, 1), std::vector<int>({0, 2}));
+}
+
+TEST(PrefetcherTest, HotSubtreeAndRandom)
+{
+    bptree::AdaptivePrefetcher prefetcher;
+
+    EXPECT_TRUE(lookup(prefetcher, 30, 5).empty());
+    EXPECT_TRUE(lookup(prefetcher, 30, 9).empty());
+    EXPECT_EQ(lookup(prefetcher, 30, 2), std::vector<int>({1, 3}));
+    EXPECT_EQ(lookup(prefetcher, 30, 0), std::vector<int>({1}));
+
+    for (int i = 0; i < 100; i++) {
+        EXPECT_TRUE(lookup(prefetcher, 100 + i, (i * 7) % 64).empty());
+    }
+
+    prefetcher.set_enabled(false);
+    lookup(prefetcher, 40, 0);
+    lookup(prefetcher, 40, 1);
+    EXPECT_TRUE(lookup(prefetcher, 40, 2).empty());
+}
+
+TEST(PrefetcherTest, ThrottlesOnLowAccuracy)
+{
+    bptree::AdaptivePrefetcher prefetcher;
+    bptree::PageID next_pid = 1;
+
+    auto prefetch = [&prefetcher, &next_pid](size_t n, bool read) {
+        std::vector<bptree::PageID> pids;
+        for (size_t i = 0; i < n; i++) {
+            pids.push_back(next_pid++);
+        }
+        prefetcher.on_prefetch(pids);
+        EXPECT_EQ(pids.size(), n);
+        if (read) {
+            for (auto pid : pids) {
+                prefetcher.on_read(pid);
+            }
+        }
+    };
+
+    /* pages that are on their way are not prefetched again */
+    std::vector<bptree::PageID> pids{1000000, 1000000};
+    prefetcher.on_prefetch(pids);
+    EXPECT_EQ(pids.size(), 1);
+    prefetcher.on_read(1000000);
+
+    for (int i = 0; i < 16; i++) {
+        prefetch(bptree::AdaptivePrefetcher::WINDOW / 4, false);
+    }
+    auto stats = prefetcher.get_stats();
+    EXPECT_EQ(stats.depth, 1);
+    EXPECT_EQ(stats.width, 0);
+    EXPECT_EQ(prefetcher.next_scan_window(0), 1);
+    EXPECT_EQ(prefetcher.next_scan_window(1), 1);
+
+    /* the pages of a window are read after it closes, it takes another
+     * window for the accuracy to catch up */
+    for (int i = 0; i < 16; i++) {
+        prefetch(bptree::AdaptivePrefetcher::WINDOW / 8, true);
+    }
+    stats = prefetcher.get_stats();
+    EXPECT_EQ(stats.depth, 4);
+    EXPECT_EQ(stats.width, 2);
+
+    EXPECT_EQ(stats.issued, 1 + 6 * bptree::AdaptivePrefetcher::WINDOW);
+    EXPECT_EQ(stats.useful, 1 + 2 * bptree::AdaptivePrefetcher::WINDOW);
+    EXPECT_EQ(stats.demand_reads, stats.useful);
+    EXPECT_DOUBLE_EQ(stats.coverage(), 1.0);
+    EXPECT_NEAR(stats.accuracy(), 1.0 / 3, 0.01);
+}
+
+TEST(PrefetcherTest, TreeLookupsAndScans)
+{
+    const int N = 50000;
+    auto filename = temp_heap_file();
+
+    {
+        bptree::HeapPageCache page_cache(filename, true, 1024);
+        /* most leaves are not kept as nodes and are read from their pages */
+        bptree::BTree<64, KeyType, ValueType> tree(
+            &page_cache, bptree::BTree<64, KeyType, ValueType>::
+                             DEFAULT_METADATA_COMMIT_INTERVAL,
+            64);
+
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i + 1);
+        }
+
+        auto before = tree.get_prefetch_stats();
+        for (int i = 0; i < N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+            ASSERT_EQ(values.size(), 1);
+        }
+        auto stats = tree.get_prefetch_stats();
+        size_t issued = stats.issued - before.issued;
+        size_t useful = stats.useful - before.useful;
+        size_t demand_reads = stats.demand_reads - before.demand_reads;
+        EXPECT_GT(issued, 0);
+        EXPECT_GT(useful, issued * 3 / 4);
+        EXPECT_GT(useful, demand_reads / 2);
+
+        before = stats;
+        int count = 0;
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+            count++;
+        }
+        EXPECT_EQ(count, N);
+        stats = tree.get_prefetch_stats();
+        useful = stats.useful - before.useful;
+        demand_reads = stats.demand_reads - before.demand_reads;
+        EXPECT_GT(useful, demand_reads * 3 / 4);
+
+        tree.set_prefetching(false);
+        before = tree.get_prefetch_stats();
+        for (auto it = tree.begin(); it != tree.end(); ++it) {
+        }
+        EXPECT_EQ(tree.get_prefetch_stats().issued, before.issued);
+    }
+
+    unlink(filename.c_str());
+}
@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+
+#include "bptree/heap_file.h"
+#include "bptree/heap_page_cache.h"
+#include "bptree/latency_simulator.h"
+#include "bptree/remote_page_store.h"
+#include "bptree/tree.h"
+#include "test_util.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+
+TEST(RemotePageStoreTest, TreePersists)
+{
+    const int N = 20000;
+    const int NUM_THREADS = 4;
+    auto filename = temp_heap_file();
+    bptree::HeapFile heap_file(filename, true, 4096);
+    bptree::PageServer server(&heap_file);
+
+    {
+        bptree::HeapPageCache page_cache(
+            std::make_unique<bptree::RemotePageStore>("127.0.0.1",
+                                                      server.get_port(), 2),
+            256, bptree::WritePolicy::WRITE_BACK);
+        EXPECT_EQ(page_cache.get_page_size(), heap_file.get_data_size());
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < NUM_THREADS; t++) {
+            threads.emplace_back([t, &tree]() {
+                for (int i = t; i < N; i += NUM_THREADS) {
+                    tree.insert(i, i + 1);
+                }
+            });
+        }
+        for (auto&& p : threads) {
+            p.join();
+        }
+        for (int i = 0; i < N; i += 4) {
+            tree.erase(i);
+        }
+    }
+
+    {
+        bptree::HeapPageCache page_cache(
+            std::make_unique<bptree::RemotePageStore>("127.0.0.1",
+                                                      server.get_port()),
+            64);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        EXPECT_EQ(tree.size(), N - N / 4);
+        for (int i = 0; i < N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+            if (i % 4 == 0) {
+                EXPECT_TRUE(values.empty());
+            } else {
+                ASSERT_EQ(values.size(), 1);
+                EXPECT_EQ(values.front(), i + 1);
+            }
+        }
+    }
+
+    unlink(filename.c_str());
+}
+
+/* misses of many threads that queue up behind a message in flight go
+ * together in the next one */
+TEST(RemotePageStoreTest, ConcurrentMissesShareMessages)
+{
+    const int NUM_THREADS = 32;
+    const int LATENCY_US = 5000;
+    auto filename = temp_heap_file();
+    bptree::HeapFile heap_file(filename, true, 4096);
+
+    std::vector<uint8_t> buf(heap_file.get_data_size());
+    std::vector<bptree::PageIORequest> writes;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        auto pid = heap_file.new_page();
+        ::memset(buf.data(), (uint8_t)pid, buf.size());
+        writes = {{pid, buf.data(), false}};
+        heap_file.write_pages(writes);
+    }
+
+    bptree::PageServer server(&heap_file);
+    bptree::RemotePageStore store("127.0.0.1", server.get_port(), 1, 64, 1);
+    bptree::LatencySimulator::configure(LATENCY_US);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    std::atomic<int> num_ok(0);
+    for (int t = 0; t < NUM_THREADS; t++) {
+        threads.emplace_back([t, &store, &num_ok]() {
+            bptree::Page page(t + 1, store.get_data_size());
+            boost::upgrade_lock<bptree::Page> lock(page);
+            boost::upgrade_to_unique_lock<bptree::Page> ulock(lock);
+            store.read_page(&page, ulock);
+            auto* data = page.get_buffer(ulock);
+            if (data[0] == t + 1 && data[store.get_data_size() - 1] == t + 1) {
+                num_ok++;
+            }
+        });
+    }
+    for (auto&& p : threads) {
+        p.join();
+    }
+    double elapsed = seconds_since(start);
+    bptree::LatencySimulator::configure(0);
+
+    EXPECT_EQ(num_ok.load(), NUM_THREADS);
+    EXPECT_EQ(store.get_num_pages_transferred(), NUM_THREADS);
+    EXPECT_LT(store.get_num_messages(), NUM_THREADS / 2);
+    EXPECT_LT(elapsed, NUM_THREADS * LATENCY_US * 1e-6 / 2);
+
+    unlink(filename.c_str());
+}
+
+TEST(RemotePageStoreTest, LostServerFailsRequests)
+{
+    auto filename = temp_heap_file();
+    bptree::HeapFile heap_file(filename, true, 4096);
+    auto server = std::make_unique<bptree::PageServer>(&heap_file);
+    bptree::RemotePageStore store("127.0.0.1", server->get_port());
+
+    auto pid = store.new_page();
+    EXPECT_EQ(store.get_num_pages(), 2);
+
+    server.reset();
+
+    std::vector<uint8_t> buf(store.get_data_size());
+    std::vector<bptree::PageIORequest> requests{{pid, buf.data(), true}};
+    store.read_pages(requests);
+    EXPECT_FALSE(requests[0].ok);
+    EXPECT_THROW(store.new_page(), bptree::IOException);
+
+    unlink(filename.c_str());
+}
+
+TEST(LatencySimulatorTest, BandwidthAndQueueDepth)
+{
+    /* 1 MB at 10 MB/s */
+    bptree::LatencySimulator::configure(0, 0, 10 << 20);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 4; i++) {
+        bptree::LatencySimulator::simulate_transfer(256 << 10);
+    }
+    EXPECT_GE(seconds_since(start), 0.095);
+
+    /* concurrent transfers overlap their latencies up to the queue depth */
+    auto run_concurrent = [](int num_threads) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; t++) {
+            threads.emplace_back(
+                []() { bptree::LatencySimulator::simulate_transfer(0); });
+        }
+        for (auto&& p : threads) {
+            p.join();
+        }
+        return seconds_since(start);
+    };
+
+    bptree::LatencySimulator::configure(20000);
+    EXPECT_LT(run_concurrent(8), 8 * 0.02 / 2);
+
+    bptree::LatencySimulator::configure(20000, 0, 0, 2);
+    EXPECT_GE(run_concurrent(8), 4 * 0.02 * 0.95);
+
+    /* a server's own I/O is not simulated */
+    start = std::chrono::steady_clock::now();
+    {
+        bptree::LatencySimulator::LocalIO local_io;
+        bptree::LatencySimulator::simulate_transfer(0);
+    }
+    EXPECT_LT(seconds_since(start), 0.01);
+
+    bptree::LatencySimulator::configure(0);
+}
@@ -0,0 +1,152 @@
+#include <gtest/gtest.h>
+
+#include "bptree/replacement_policy.h"
+
+#include <unordered_map>
+#include <vector>
+
+using bptree::PageID;
+using bptree::ReplacementPolicy;
+using bptree::ReplacementPolicyType;
+
+static const ReplacementPolicyType ALL_POLICIES[] = {
+    ReplacementPolicyType::LRU, ReplacementPolicyType::CLOCK,
+    ReplacementPolicyType::TWO_Q, ReplacementPolicyType::ARC};
+
+/* replay accesses against a cache of capacity frames and count the hits. a
+ * hit pins and unpins the frame like HeapPageCache does */
+static size_t simulate(ReplacementPolicyType type, size_t capacity,
+                       const std::vector<PageID>& accesses)
+{
+    auto policy = ReplacementPolicy::create(type, capacity);
+    std::unordered_map<PageID, size_t> resident;
+    std::vector<PageID> frame_page(capacity);
+    size_t next_free = 0;
+    size_t hits = 0;
+
+    for (auto id : accesses) {
+        auto it = resident.find(id);
+        if (it != resident.end()) {
+            hits++;
+            policy->on_access(it->second);
+            policy->set_evictable(it->second, false);
+            policy->set_evictable(it->second, true);
+            continue;
+        }
+
+        size_t frame;
+        if (next_free < capacity) {
+            frame = next_free++;
+        } else {
+            EXPECT_TRUE(policy->evict(frame));
+            resident.erase(frame_page[frame]);
+        }
+
+        resident[id] = frame;
+        frame_page[frame] = id;
+        policy->on_load(frame, id);
+        policy->set_evictable(frame, true);
+    }
+
+    return hits;
+}
+
+TEST(ReplacementPolicyTest, OnlyEvictsUnpinnedFrames)
+{
+    for (auto type : ALL_POLICIES) {
+        auto policy = ReplacementPolicy::create(type, 4);
+
+        for (size_t i = 0; i < 4; i++) {
+            policy->on_load(i, i + 1);
+        }
+        EXPECT_EQ(policy->size(), 4);
+        EXPECT_EQ(policy->num_evictable(), 0);
+
+        size_t frame;
+        EXPECT_FALSE(policy->evict(frame));
+
+        policy->set_evictable(2, true);
+        EXPECT_EQ(policy->num_evictable(), 1);
+        ASSERT_TRUE(policy->evict(frame));
+        EXPECT_EQ(frame, 2);
+        EXPECT_EQ(policy->size(), 3);
+        EXPECT_FALSE(policy->evict(frame));
+
+        policy->set_evictable(1, true);
+        policy->remove(1);
+        EXPECT_EQ(policy->num_evictable(), 0);
+        EXPECT_FALSE(policy->evict(frame));
+    }
+}
+
+TEST(ReplacementPolicyTest, LRUEvictsLeastRecentlyUnpinned)
+{
+    auto policy = ReplacementPolicy::create(ReplacementPolicyType::LRU, 4);
+
+    for (size_t i = 0; i < 4; i++) {
+        policy->on_load(i, i + 1);
+        policy->set_evictable(i, true);
+    }
+
+    /* use frame 0 again */
+    policy->set_evictable(0, false);
+    policy->set_evictable(0, true);
+
+    size_t frame;
+    for (size_t expected : {1, 2, 3, 0}) {
+        ASSERT_TRUE(policy->evict(frame));
+        EXPECT_EQ(frame, expected);
+    }
+}
+
+TEST(ReplacementPolicyTest, ClockGivesSecondChance)
+{
+    auto policy = ReplacementPolicy::create(ReplacementPolicyType::CLOCK, 4);
+
+    for (size_t i = 0; i < 4; i++) {
+        policy->on_load(i, i + 1);
+        policy->set_evictable(i, true);
+    }
+
+    size_t frame;
+    ASSERT_TRUE(policy->evict(frame));
+    EXPECT_EQ(frame, 0);
+
+    /* frame 1 is referenced again and skipped once */
+    policy->on_access(1);
+    ASSERT_TRUE(policy->evict(frame));
+    EXPECT_EQ(frame, 2);
+}
+
+TEST(ReplacementPolicyTest, ScanResistance)
+{
+    /* a hot set that fits in the cache and is used twice per round,
+     * interleaved with scans of pages that are never used again. every
+     * round touches more pages than the cache holds so LRU and CLOCK lose
+     * the hot set on every scan */
+    const size_t capacity = 32;
+    std::vector<PageID> accesses;
+    PageID next_scan_page = 1000;
+
+    for (int round = 0; round < 100; round++) {
+        for (int pass = 0; pass < 2; pass++) {
+            for (PageID hot = 1; hot <= 16; hot++) {
+                accesses.push_back(hot);
+            }
+        }
+        for (int i = 0; i < 24; i++) {
+            accesses.push_back(next_scan_page++);
+        }
+    }
+
+    auto lru_hits = simulate(ReplacementPolicyType::LRU, capacity, accesses);
+    auto clock_hits = simulate(ReplacementPolicyType::CLOCK, capacity, accesses);
+    auto two_q_hits = simulate(ReplacementPolicyType::TWO_Q, capacity, accesses);
+    auto arc_hits = simulate(ReplacementPolicyType::ARC, capacity, accesses);
+
+    /* LRU and CLOCK only hit on the second pass over the hot set */
+    EXPECT_EQ(lru_hits, 100 * 16);
+    EXPECT_LE(clock_hits, 100 * 16);
+    EXPECT_GT(two_q_hits, lru_hits * 3 / 2);
+    EXPECT_GT(arc_hits, lru_hits * 3 / 2);
+}
@@ -0,0 +1,19 @@
+#ifndef _BPTREE_TEST_UTIL_H_
+#define _BPTREE_TEST_UTIL_H_
+
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+/* a fresh path under /tmp. the file is not left behind, the heap file or
+ * the log creates it */
+inline std::string temp_heap_file()
+{
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+    return std::string(tmp_template);
+}
+
+#endif
@@ -1,13 +1,20 @@
 #include <gtest/gtest.h>
 
 #include "bptree/heap_page_cache.h"
+#include "bptree/inline_string.h"
 #include "bptree/mem_page_cache.h"
 #include "bptree/tree.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <sys/stat.h>
 #include <thread>
 
 using namespace std::chrono;
@@ -76,6 +83,8 @@ TEST(TreeTest, HandleConcurrentInsert)
 
     high_resolution_clock::time_point t2 = high_resolution_clock::now();
 
+    EXPECT_EQ(tree.size(), 10 * N);
+
     threads.clear();
     for (int i = 0; i < 10; i++) {
         threads.emplace_back([i, &tree]() {
@@ -103,6 +112,218 @@ TEST(TreeTest, HandleConcurrentInsert)
               << std::endl;
 }
 
+TEST(TreeTest, RestartCounters)
+{
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<8, KeyType, ValueType> tree(&page_cache);
+
+    /* a split below an inner node restarts the insert that caused it */
+    for (int i = 0; i < 1000; i++) {
+        tree.insert(i, i);
+    }
+    auto stats = tree.get_restart_stats();
+    EXPECT_GT(stats.inserts, 0);
+
+    /* readers only restart on concurrent updates */
+    std::vector<ValueType> values;
+    for (int i = 0; i < 1000; i++) {
+        tree.get_value(i, values);
+    }
+    EXPECT_EQ(tree.get_restart_stats().reads, stats.reads);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t, &tree]() {
+            std::vector<ValueType> values;
+            for (int i = 0; i < 2000; i++) {
+                if (t % 2) {
+                    tree.insert(1000 + 4 * i + t, i);
+                } else {
+                    values.clear();
+                    tree.get_value(i % 1000, values);
+                    EXPECT_EQ(values.size(), 1);
+                    tree.erase(1000 + 4 * i + t + 1);
+                }
+            }
+        });
+    }
+    for (auto&& thread : threads) {
+        thread.join();
+    }
+    EXPECT_GE(tree.get_restart_stats().inserts, stats.inserts);
+}
+
+/* counts the pages handed out by new_page() */
+class CountingPageCache : public bptree::MemPageCache {
+public:
+    using bptree::MemPageCache::MemPageCache;
+
+    virtual bptree::Page* new_page(boost::upgrade_lock<bptree::Page>& lock) override
+    {
+        num_new_pages++;
+        return bptree::MemPageCache::new_page(lock);
+    }
+
+    std::atomic<size_t> num_new_pages{0};
+};
+
+TEST(TreeTest, SplitsTakeReservedPages)
+{
+    CountingPageCache page_cache(4096);
+
+    {
+        bptree::PageReserve reserve(&page_cache);
+        reserve.reserve(2);
+        size_t allocated = page_cache.num_new_pages;
+        EXPECT_GE(reserve.size(), 2);
+
+        /* reserved pages are taken without calling into the page cache */
+        auto first = reserve.take();
+        auto second = reserve.take();
+        EXPECT_NE(first, second);
+        EXPECT_EQ(page_cache.num_new_pages, allocated);
+        EXPECT_EQ(reserve.size(), allocated - 2);
+    }
+    /* the pages that were not taken are given back */
+    EXPECT_EQ(page_cache.size(), 2);
+
+    bptree::MemPageCache tree_cache(4096);
+    const int N = 5000;
+    {
+        bptree::BTree<16, KeyType, ValueType> tree(&tree_cache);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([t, &tree]() {
+                for (int i = 0; i < N; i++) {
+                    tree.insert(4 * i + t, i);
+                }
+            });
+        }
+        for (auto&& thread : threads) {
+            thread.join();
+        }
+    }
+
+    /* reopened from the pages the splits took */
+    bptree::BTree<16, KeyType, ValueType> tree(&tree_cache);
+    EXPECT_EQ(tree.size(), 4 * N);
+    KeyType expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        EXPECT_EQ(it->second, expected / 4);
+        expected++;
+    }
+    EXPECT_EQ(expected, 4 * N);
+}
+
+TEST(TreeTest, SequentialInsertsFillLeaves)
+{
+    const int N = 30000;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+
+    for (int i = 0; i < N; i++) {
+        tree.insert(i, i);
+    }
+
+    /* only the inserts that split the rightmost leaf take the descent */
+    EXPECT_GT(tree.get_num_appends(), N * 3 / 4);
+    /* right-edge splits leave 13 or 14 of the 15 slots used, 50/50 ones
+     * would leave 7 or 8 */
+    EXPECT_LT(page_cache.size(), N / 12);
+
+    /* concurrent appends of keys that are only roughly in order */
+    std::atomic<int> next_key{N};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&tree, &next_key]() {
+            for (int i = 0; i < N / 4; i++) {
+                int key = next_key++;
+                tree.insert(key, key);
+            }
+        });
+    }
+    for (auto&& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(tree.size(), 2 * N);
+    KeyType expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        EXPECT_EQ(it->second, expected);
+        expected++;
+    }
+    EXPECT_EQ(expected, 2 * N);
+
+    /* a key below the maximum still goes through the descent */
+    size_t appends = tree.get_num_appends();
+    tree.insert(5, 6);
+    EXPECT_EQ(tree.get_num_appends(), appends);
+    std::vector<ValueType> values;
+    tree.get_value(5, values);
+    EXPECT_EQ(values.size(), 2);
+}
+
+/* a split only locks the node that splits, the keys that moved to the new
+ * sibling must be found through it until the parent links it */
+TEST(TreeTest, KeysVisibleDuringSplits)
+{
+    const int N = 20000;
+    const int num_writers = 4;
+    bptree::MemPageCache page_cache(4096);
+    {
+        bptree::BTree<8, KeyType, ValueType> tree(&page_cache);
+
+        std::atomic<int> progress[num_writers];
+        for (auto&& p : progress) {
+            p = 0;
+        }
+        std::atomic<bool> done{false};
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_writers; t++) {
+            threads.emplace_back([t, &tree, &progress]() {
+                for (int i = 0; i < N; i++) {
+                    tree.insert(num_writers * i + t, i);
+                    progress[t] = i + 1;
+                }
+            });
+        }
+        std::thread reader([&tree, &progress, &done]() {
+            unsigned int seed = 7;
+            while (!done) {
+                int t = rand_r(&seed) % num_writers;
+                int inserted = progress[t];
+                if (inserted == 0) continue;
+                int i = rand_r(&seed) % inserted;
+
+                std::vector<ValueType> values;
+                tree.get_value(num_writers * i + t, values);
+                ASSERT_EQ(values.size(), 1);
+                EXPECT_EQ(values[0], i);
+            }
+        });
+
+        for (auto&& thread : threads) {
+            thread.join();
+        }
+        done = true;
+        reader.join();
+        EXPECT_EQ(tree.size(), num_writers * N);
+    }
+
+    /* the siblings were linked into their parents on the pages */
+    bptree::BTree<8, KeyType, ValueType> tree(&page_cache);
+    KeyType expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        EXPECT_EQ(it->second, expected / num_writers);
+        expected++;
+    }
+    EXPECT_EQ(expected, num_writers * N);
+}
+
 TEST(TreeTest, TreeIterator)
 {
     bptree::MemPageCache page_cache(4096);
@@ -116,7 +337,7 @@ TEST(TreeTest, TreeIterator)
         sum1 += i;
     }
 
-    auto it = tree.begin(0);
+    auto it = tree.begin();
     while (it != tree.end()) {
         sum2 += it->first;
         it++;
@@ -125,3 +346,1369 @@ TEST(TreeTest, TreeIterator)
 
     EXPECT_EQ(sum1, sum2);
 }
+
+TEST(TreeTest, IteratorFollowsLeafLinks)
+{
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<8, KeyType, ValueType> tree(&page_cache);
+
+    /* random order so that leaves are split in the middle of the chain */
+    std::vector<KeyType> keys;
+    for (int i = 0; i < 5000; i++) {
+        keys.push_back(i);
+    }
+    std::mt19937 gen(1);
+    std::shuffle(keys.begin(), keys.end(), gen);
+    for (auto k : keys) {
+        tree.insert(k, k + 1);
+    }
+
+    KeyType expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        EXPECT_EQ(it->second, expected + 1);
+        expected++;
+    }
+    EXPECT_EQ(expected, 5000);
+
+    /* start in the middle, and past the last key of a leaf */
+    expected = 1234;
+    for (auto it = tree.begin(1234); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected++);
+    }
+    EXPECT_EQ(expected, 5000);
+    EXPECT_TRUE(tree.begin(5000) == tree.end());
+
+    bptree::MemPageCache empty_cache(4096);
+    bptree::BTree<8, KeyType, ValueType> empty(&empty_cache);
+    EXPECT_TRUE(empty.begin() == empty.end());
+}
+
+TEST(TreeTest, ConcurrentInsertAndScan)
+{
+    const int N = 20000;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+
+    /* even keys are there from the start, odd keys are inserted while
+     * scanning. every scan must see all even keys in order */
+    for (int i = 0; i < N; i += 2) {
+        tree.insert(i, i);
+    }
+
+    std::thread writer([&tree]() {
+        for (int i = 1; i < N; i += 2) {
+            tree.insert(i, i);
+        }
+    });
+
+    for (int scan = 0; scan < 5; scan++) {
+        KeyType prev = 0;
+        size_t count = 0, even = 0;
+        for (auto it = tree.begin(); it != tree.end(); it++) {
+            if (count++ > 0) {
+                EXPECT_LT(prev, it->first);
+            }
+            prev = it->first;
+            if (prev % 2 == 0) even++;
+        }
+        EXPECT_EQ(even, N / 2);
+    }
+
+    writer.join();
+
+    size_t count = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        count++;
+    }
+    EXPECT_EQ(count, N);
+}
+
+TEST(TreeTest, IteratorFromHeapFile)
+{
+    const int N = 50000;
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, true, 64);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+        for (int i = N - 1; i >= 0; i--) {
+            tree.insert(i, i * 2);
+        }
+    }
+
+    {
+        /* the sibling links are read back from the pages */
+        bptree::HeapPageCache page_cache(tmp_template, false, 64);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        KeyType expected = 0;
+        for (auto it = tree.begin(); it != tree.end(); it++) {
+            ASSERT_EQ(it->first, expected);
+            EXPECT_EQ(it->second, expected * 2);
+            expected++;
+        }
+        EXPECT_EQ(expected, N);
+    }
+
+    unlink(tmp_template);
+}
+
+TEST(TreeTest, PrintFromHeapFile)
+{
+    const int N = 5000;
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+
+    std::stringstream expected;
+    {
+        bptree::HeapPageCache page_cache(tmp_template, true, 64);
+        bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i);
+        }
+        expected << tree;
+    }
+
+    {
+        /* only the root is in memory, the other nodes are read on the way */
+        bptree::HeapPageCache page_cache(tmp_template, false, 64);
+        bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+        std::stringstream ss;
+        ss << tree;
+        EXPECT_EQ(ss.str(), expected.str());
+    }
+
+    unlink(tmp_template);
+}
+
+/* a file written with another page layout is not opened as a tree */
+TEST(TreeTest, RejectOldMetadataMagic)
+{
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, true, 64);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+        for (int i = 0; i < 1000; i++) {
+            tree.insert(i, i);
+        }
+    }
+
+    for (uint32_t magic : {0x00C0FFEEU, 0x00C0FFEFU, 0xDEADBEEFU}) {
+        {
+            /* the metadata page is the first one after the invalid page */
+            bptree::HeapPageCache page_cache(tmp_template, false, 64);
+            boost::upgrade_lock<bptree::Page> lock;
+            auto page = page_cache.fetch_page(1, lock);
+            ASSERT_NE(page, nullptr);
+            {
+                boost::upgrade_to_unique_lock<bptree::Page> ulock(lock);
+                *reinterpret_cast<uint32_t*>(page->get_buffer(ulock)) = magic;
+            }
+            page_cache.unpin_page(page, true, lock);
+        }
+
+        bptree::HeapPageCache page_cache(tmp_template, false, 64);
+        EXPECT_THROW((bptree::BTree<64, KeyType, ValueType>(&page_cache)),
+                     bptree::IOException);
+    }
+
+    unlink(tmp_template);
+}
+
+/* same bytes as CopySerializer but not known to be fixed-stride, so nodes
+ * are always written in full */
+template <typename T> struct OpaqueSerializer : bptree::CopySerializer<T> {};
+
+/* random inserts and erases only rewrite the slots that changed, the pages
+ * must still read back to the same tree */
+template <typename Tree> static void check_reopen_after_updates()
+{
+    const int N = 20000;
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+
+    std::vector<KeyType> keys(N);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(7));
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, true, 64);
+        Tree tree(&page_cache);
+        for (auto k : keys) {
+            tree.insert(k, k * 3);
+        }
+        for (int i = 0; i < N; i += 3) {
+            EXPECT_EQ(tree.erase(i), 1);
+        }
+    }
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, false, 64);
+        Tree tree(&page_cache);
+
+        KeyType expected = 1;
+        for (auto it = tree.begin(); it != tree.end(); it++) {
+            ASSERT_EQ(it->first, expected);
+            EXPECT_EQ(it->second, expected * 3);
+            expected += expected % 3 == 1 ? 1 : 2;
+        }
+        EXPECT_GE(expected, N);
+
+        std::vector<ValueType> values;
+        for (int i = 0; i < N; i++) {
+            values.clear();
+            tree.get_value(i, values);
+            ASSERT_EQ(values.size(), i % 3 ? 1 : 0);
+        }
+    }
+
+    unlink(tmp_template);
+}
+
+TEST(TreeTest, PartialNodeWrites)
+{
+    static_assert(bptree::LeafNode<16, KeyType, ValueType>::FIXED_STRIDE, "");
+    check_reopen_after_updates<bptree::BTree<16, KeyType, ValueType>>();
+}
+
+TEST(TreeTest, FullNodeWrites)
+{
+    using Tree = bptree::BTree<16, KeyType, ValueType, OpaqueSerializer<KeyType>,
+                               std::less<KeyType>, std::equal_to<KeyType>,
+                               OpaqueSerializer<ValueType>>;
+    static_assert(!bptree::LeafNode<16, KeyType, ValueType, OpaqueSerializer<KeyType>,
+                                    std::less<KeyType>, std::equal_to<KeyType>,
+                                    OpaqueSerializer<ValueType>>::FIXED_STRIDE,
+                  "");
+    check_reopen_after_updates<Tree>();
+}
+
+TEST(TreeTest, PageFitFanouts)
+{
+    using Fit4K = bptree::PageFit<4096, uint64_t, uint64_t>;
+    static_assert(Fit4K::LEAF_FANOUT == 256, "");
+    static_assert(Fit4K::INNER_FANOUT == 341, "");
+
+    using Fit4KInt = bptree::PageFit<4096, uint32_t, uint32_t>;
+    static_assert(Fit4KInt::LEAF_FANOUT == 511, "");
+    static_assert(Fit4KInt::INNER_FANOUT == 511, "");
+
+    /* the constructor accepts the page size the fan-outs are made for */
+    using Tree = bptree::PageFitBTree<4096, uint64_t, uint64_t>;
+    bptree::MemPageCache page_cache(4096);
+    Tree tree(&page_cache);
+    tree.insert(1, 2);
+    std::vector<ValueType> values;
+    tree.get_value(1, values);
+    ASSERT_EQ(values.size(), 1);
+    EXPECT_EQ(values.front(), 2);
+}
+
+TEST(TreeTest, NodesMustFitInPages)
+{
+    bptree::MemPageCache page_cache(1024);
+    using Tree = bptree::BTree<256, KeyType, ValueType>;
+    EXPECT_THROW(Tree tree(&page_cache), std::invalid_argument);
+}
+
+/* leaves and inner nodes with different fan-outs through splits, merges
+ * and a reopen */
+TEST(TreeTest, SeparateLeafAndInnerFanouts)
+{
+    const int N = 20000;
+    using Tree = bptree::PageFitBTree<512, KeyType, ValueType>;
+    static_assert(bptree::PageFit<512, KeyType, ValueType>::LEAF_FANOUT == 32, "");
+    static_assert(bptree::PageFit<512, KeyType, ValueType>::INNER_FANOUT == 42, "");
+
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+
+    std::vector<KeyType> keys(N);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(3));
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, true, 256, 512);
+        Tree tree(&page_cache);
+        for (auto k : keys) {
+            tree.insert(k, k + 5);
+        }
+        for (int i = 0; i < N; i += 2) {
+            EXPECT_EQ(tree.erase(i), 1);
+        }
+    }
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, false, 256, 512);
+        Tree tree(&page_cache);
+        EXPECT_EQ(tree.size(), N / 2);
+
+        std::vector<ValueType> values;
+        for (int i = 0; i < N; i++) {
+            values.clear();
+            tree.get_value(i, values);
+            ASSERT_EQ(values.size(), i % 2);
+            if (i % 2) {
+                EXPECT_EQ(values.front(), i + 5);
+            }
+        }
+
+        KeyType expected = 1;
+        for (auto it = tree.begin(); it != tree.end(); it++) {
+            ASSERT_EQ(it->first, expected);
+            expected += 2;
+        }
+        EXPECT_EQ(expected, N + 1);
+    }
+
+    unlink(tmp_template);
+}
+
+using StringKey = bptree::InlineString<64>;
+using StringTree =
+    bptree::BTree<256, StringKey, ValueType, bptree::InlineStringSerializer<64>,
+                  std::less<StringKey>, std::equal_to<StringKey>,
+                  bptree::CopySerializer<ValueType>, 512>;
+
+static StringKey user_key(int i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "user:%08d", i);
+    return StringKey(buf);
+}
+
+/* nodes of variable-length keys are split and merged by bytes */
+TEST(TreeTest, VariableLengthKeys)
+{
+    const int N = 20000;
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+
+    std::vector<int> ids(N);
+    std::iota(ids.begin(), ids.end(), 0);
+    std::shuffle(ids.begin(), ids.end(), std::mt19937(5));
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, true, 256);
+        StringTree tree(&page_cache);
+        for (auto i : ids) {
+            tree.insert(user_key(i), i);
+        }
+        for (int i = 0; i < N; i += 2) {
+            EXPECT_EQ(tree.erase(user_key(i)), 1);
+        }
+    }
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, false, 256);
+        StringTree tree(&page_cache);
+        EXPECT_EQ(tree.size(), N / 2);
+
+        std::vector<ValueType> values;
+        for (int i = 0; i < N; i++) {
+            values.clear();
+            tree.get_value(user_key(i), values);
+            ASSERT_EQ(values.size(), i % 2);
+            if (i % 2) {
+                EXPECT_EQ(values.front(), i);
+            }
+        }
+
+        int expected = 1;
+        for (auto it = tree.begin(); it != tree.end(); it++) {
+            ASSERT_EQ(it->first, user_key(expected));
+            expected += 2;
+        }
+        EXPECT_EQ(expected, N + 1);
+    }
+
+    unlink(tmp_template);
+
+    /* a page cannot hold enough of the largest keys */
+    bptree::MemPageCache small_cache(256);
+    EXPECT_THROW(StringTree tree(&small_cache), std::invalid_argument);
+}
+
+TEST(TreeTest, VariableLengthKeysTakeFewerPages)
+{
+    const int N = 20000;
+    std::vector<std::pair<StringKey, ValueType>> pairs;
+    for (int i = 0; i < N; i++) {
+        pairs.emplace_back(user_key(i), i);
+    }
+
+    bptree::MemPageCache padded_cache(4096);
+    bptree::PageFitBTree<4096, StringKey, ValueType> padded(&padded_cache);
+    bptree::MemPageCache compressed_cache(4096);
+    StringTree compressed(&compressed_cache);
+    for (const auto& p : pairs) {
+        padded.insert(p.first, p.second);
+        compressed.insert(p.first, p.second);
+    }
+    EXPECT_GE(padded_cache.size(), 3 * compressed_cache.size());
+
+    bptree::MemPageCache bulk_cache(4096);
+    StringTree bulk(&bulk_cache);
+    ASSERT_TRUE(bulk.bulk_load(pairs.begin(), pairs.end()));
+    EXPECT_LE(bulk_cache.size(), compressed_cache.size());
+
+    std::vector<ValueType> values;
+    for (const auto& p : pairs) {
+        values.clear();
+        bulk.get_value(p.first, values);
+        ASSERT_EQ(values.size(), 1);
+        EXPECT_EQ(values.front(), p.second);
+    }
+
+    size_t count = 0;
+    for (auto it = bulk.begin(); it != bulk.end(); it++) {
+        ASSERT_EQ(it->first, pairs[count++].first);
+    }
+    EXPECT_EQ(count, N);
+}
+
+TEST(TreeTest, BufferedInserts)
+{
+    const int N = 50000;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+    tree.set_insert_buffer(256, std::chrono::seconds(60));
+
+    std::vector<KeyType> keys(N);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(7));
+
+    /* two pairs per key, the second one stays in the buffer for a while */
+    std::vector<ValueType> values;
+    for (int i = 0; i < N; i++) {
+        tree.insert(keys[i], keys[i]);
+        tree.insert(keys[i], keys[i] + 1);
+
+        values.clear();
+        tree.get_value(keys[i], values);
+        ASSERT_EQ(values.size(), 2);
+        EXPECT_EQ(values[0], keys[i]);
+        EXPECT_EQ(values[1], keys[i] + 1);
+    }
+    EXPECT_GT(tree.get_num_buffered(), 0);
+    EXPECT_EQ(tree.size() + tree.get_num_buffered(), 2 * N);
+
+    /* buffered or not */
+    for (int i = 0; i < N; i += 3) {
+        EXPECT_EQ(tree.erase(i, i + 1), 1);
+    }
+
+    tree.flush();
+    EXPECT_EQ(tree.get_num_buffered(), 0);
+
+    KeyType expected = 0;
+    size_t count = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        ASSERT_EQ(it->second, expected);
+        if (expected % 3) {
+            it++;
+            ASSERT_EQ(it->second, expected + 1);
+        }
+        expected++;
+        count++;
+    }
+    EXPECT_EQ(count, N);
+    EXPECT_EQ(tree.size(), 2 * N - (N + 2) / 3);
+}
+
+TEST(TreeTest, BufferedInsertsDrainedAfterMaxDelay)
+{
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+    tree.set_insert_buffer(1024, std::chrono::milliseconds(2));
+
+    /* far fewer pairs than a batch and no insert after them, the drainer
+     * applies them */
+    for (int i = 0; i < 10; i++) {
+        tree.insert(i, i);
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (tree.get_num_buffered() > 0 &&
+           std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(tree.get_num_buffered(), 0);
+    EXPECT_EQ(tree.size(), 10);
+
+    KeyType expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        expected++;
+    }
+    EXPECT_EQ(expected, 10);
+}
+
+TEST(TreeTest, ConcurrentBufferedInserts)
+{
+    const int N = 100000;
+    const int NUM_THREADS = 4;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+    tree.set_insert_buffer(64, std::chrono::microseconds(200));
+
+    /* readers look up keys that other threads inserted while runs with
+     * them are drained */
+    std::atomic<int> num_inserted(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < NUM_THREADS; t++) {
+        threads.emplace_back([t, &tree, &num_inserted]() {
+            std::mt19937 gen(t);
+            std::vector<ValueType> values;
+            for (int i = t; i < N; i += NUM_THREADS) {
+                KeyType key = (KeyType)i * 2654435761u % N;
+                tree.insert(key, key);
+                num_inserted.fetch_add(1);
+
+                values.clear();
+                tree.get_value(key, values);
+                ASSERT_EQ(values.size(), 1);
+                EXPECT_EQ(values.front(), key);
+            }
+        });
+    }
+    for (auto&& p : threads) {
+        p.join();
+    }
+
+    tree.flush();
+    EXPECT_EQ(tree.size(), N);
+
+    KeyType expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        expected++;
+    }
+    EXPECT_EQ(expected, N);
+}
+
+TEST(TreeTest, BufferedVariableLengthKeys)
+{
+    const int N = 20000;
+    std::vector<int> ids(N);
+    std::iota(ids.begin(), ids.end(), 0);
+    std::shuffle(ids.begin(), ids.end(), std::mt19937(11));
+
+    bptree::MemPageCache page_cache(512);
+    StringTree tree(&page_cache);
+    tree.set_insert_buffer(128);
+    for (auto i : ids) {
+        tree.insert(user_key(i), i);
+    }
+    tree.set_insert_buffer(0);
+    EXPECT_EQ(tree.size(), N);
+
+    int expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, user_key(expected));
+        ASSERT_EQ(it->second, expected);
+        expected++;
+    }
+    EXPECT_EQ(expected, N);
+}
+
+TEST(TreeTest, MetadataGroupCommit)
+{
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<64, KeyType, ValueType> tree(&page_cache, 100);
+
+    /* the root only splits once, a new root is committed right away */
+    for (int i = 0; i < 250; i++) {
+        tree.insert(i, i);
+    }
+    EXPECT_EQ(tree.size(), 250);
+
+    /* a second tree opened over the same pages only sees committed
+     * metadata */
+    {
+        bptree::BTree<64, KeyType, ValueType> view(&page_cache);
+        EXPECT_EQ(view.size(), 200);
+    }
+
+    tree.checkpoint();
+    {
+        bptree::BTree<64, KeyType, ValueType> view(&page_cache);
+        EXPECT_EQ(view.size(), 250);
+    }
+}
+
+TEST(TreeTest, Erase)
+{
+    const int N = 20000;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<8, KeyType, ValueType> tree(&page_cache);
+
+    /* descending, appends would leave the leaves too full to underflow */
+    for (int i = N - 1; i >= 0; i--) {
+        tree.insert(i, i);
+    }
+    size_t num_pages = page_cache.size();
+
+    /* drop everything but the multiples of 3 */
+    for (int i = 0; i < N; i++) {
+        if (i % 3 == 0) continue;
+        EXPECT_EQ(tree.erase(i), 1);
+    }
+    EXPECT_EQ(tree.erase(1), 0);
+    EXPECT_EQ(tree.erase(N), 0);
+    EXPECT_EQ(tree.size(), (N + 2) / 3);
+
+    KeyType expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        EXPECT_EQ(it->second, expected);
+        expected += 3;
+    }
+    EXPECT_EQ(expected, N + 1);
+
+    for (int i = 0; i < N; i++) {
+        std::vector<ValueType> values;
+        tree.get_value(i, values);
+        EXPECT_EQ(values.empty(), i % 3 != 0);
+    }
+
+    /* merged nodes gave their pages back */
+    EXPECT_LT(page_cache.size(), num_pages * 3 / 4);
+}
+
+TEST(TreeTest, EraseValue)
+{
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+    for (int i = 0; i < 4; i++) {
+        tree.insert(1, i);
+        tree.insert(2, i);
+    }
+
+    EXPECT_EQ(tree.erase(1, 4), 0);
+    EXPECT_EQ(tree.erase(1, 2), 1);
+    EXPECT_EQ(tree.erase(1), 3);
+    EXPECT_EQ(tree.size(), 4);
+
+    std::vector<ValueType> values;
+    tree.get_value(1, values);
+    EXPECT_TRUE(values.empty());
+    tree.get_value(2, values);
+    EXPECT_EQ(values.size(), 4);
+}
+
+TEST(TreeTest, EraseAllAndReinsert)
+{
+    const int N = 10000;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+
+    for (int round = 0; round < 3; round++) {
+        std::vector<KeyType> keys;
+        for (int i = 0; i < N; i++) {
+            keys.push_back(i);
+        }
+        std::mt19937 gen(round);
+        std::shuffle(keys.begin(), keys.end(), gen);
+
+        for (auto k : keys) {
+            tree.insert(k, k + round);
+        }
+        EXPECT_EQ(tree.size(), N);
+
+        std::shuffle(keys.begin(), keys.end(), gen);
+        for (auto k : keys) {
+            ASSERT_EQ(tree.erase(k, k + round), 1);
+        }
+        EXPECT_EQ(tree.size(), 0);
+        EXPECT_TRUE(tree.begin() == tree.end());
+    }
+
+    /* the pages of each round are recycled by the next one */
+    EXPECT_LT(page_cache.size(), N / 8);
+}
+
+TEST(TreeTest, ConcurrentEraseAndGet)
+{
+    const int N = 40000;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+
+    for (int i = 0; i < N; i++) {
+        tree.insert(i, i);
+    }
+
+    /* odd keys are erased while even keys are looked up and scanned */
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t, &tree]() {
+            for (int i = 2 * t + 1; i < N; i += 8) {
+                EXPECT_EQ(tree.erase(i), 1);
+            }
+        });
+    }
+    threads.emplace_back([&tree]() {
+        std::vector<ValueType> values;
+        for (int i = 0; i < N; i += 2) {
+            values.clear();
+            tree.get_value(i, values);
+            ASSERT_EQ(values.size(), 1);
+            EXPECT_EQ(values.front(), i);
+        }
+    });
+    threads.emplace_back([&tree]() {
+        size_t even = 0;
+        for (auto it = tree.begin(); it != tree.end(); it++) {
+            if (it->first % 2 == 0) even++;
+        }
+        EXPECT_EQ(even, N / 2);
+    });
+
+    for (auto&& p : threads) {
+        p.join();
+    }
+
+    EXPECT_EQ(tree.size(), N / 2);
+    KeyType expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        expected += 2;
+    }
+    EXPECT_EQ(expected, N);
+}
+
+TEST(TreeTest, BoundedNodeCache)
+{
+    const int N = 20000;
+    const size_t max_nodes = 64;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(
+        &page_cache, bptree::BTree<16, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+        max_nodes);
+
+    std::vector<KeyType> keys(N);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+    for (auto k : keys) {
+        tree.insert(k, k + 1);
+        /* a single operation loads at most one path */
+        ASSERT_LE(tree.get_num_cached_nodes(), max_nodes + 16);
+    }
+    EXPECT_GT(tree.get_num_node_evictions(), 0);
+
+    std::vector<ValueType> values;
+    for (int i = 0; i < N; i++) {
+        values.clear();
+        tree.get_value(i, values);
+        ASSERT_EQ(values.size(), 1);
+        EXPECT_EQ(values.front(), i + 1);
+    }
+    EXPECT_LE(tree.get_num_cached_nodes(), max_nodes + 16);
+
+    KeyType expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        expected++;
+    }
+    EXPECT_EQ(expected, N);
+
+    for (int i = 0; i < N; i += 2) {
+        EXPECT_EQ(tree.erase(i), 1);
+    }
+    for (int i = 0; i < N; i++) {
+        values.clear();
+        tree.get_value(i, values);
+        ASSERT_EQ(values.size(), i % 2);
+    }
+}
+
+TEST(TreeTest, ConcurrentBoundedNodeCache)
+{
+    const int N = 40000;
+    const size_t max_nodes = 128;
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+
+    bptree::HeapPageCache page_cache(tmp_template, true, 256);
+    bptree::BTree<16, KeyType, ValueType> tree(
+        &page_cache, bptree::BTree<16, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+        max_nodes);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t, &tree]() {
+            std::vector<ValueType> values;
+            for (int i = t; i < N; i += 4) {
+                tree.insert(i, i);
+                if (i >= 4) {
+                    values.clear();
+                    tree.get_value(i - 4, values);
+                    ASSERT_EQ(values.size(), 1);
+                    EXPECT_EQ(values.front(), i - 4);
+                }
+            }
+        });
+    }
+    for (auto&& p : threads) {
+        p.join();
+    }
+
+    EXPECT_EQ(tree.size(), N);
+    EXPECT_LE(tree.get_num_cached_nodes(), max_nodes + 64);
+
+    KeyType expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        expected++;
+    }
+    EXPECT_EQ(expected, N);
+
+    unlink(tmp_template);
+}
+
+TEST(TreeTest, EvictionRacesWithEraseAndInsert)
+{
+    const int N = 100000;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(
+        &page_cache, bptree::BTree<16, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+        200);
+
+    /* two inserters at the right edge, an eraser behind them and nodes
+     * evicted under all of them */
+    std::vector<std::atomic<bool>> inserted(N);
+    std::atomic<int> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([&]() {
+            for (int i = next++; i < N; i = next++) {
+                tree.insert(i, i);
+                inserted[i] = true;
+            }
+        });
+    }
+    threads.emplace_back([&]() {
+        for (int i = 0; i < N / 2;) {
+            if (!inserted[i] || i + 1000 >= next) {
+                std::this_thread::yield();
+                continue;
+            }
+            ASSERT_EQ(tree.erase(i), 1);
+            i++;
+        }
+    });
+    for (auto&& p : threads) {
+        p.join();
+    }
+
+    EXPECT_GT(tree.get_num_node_evictions(), 0);
+    KeyType expected = N / 2;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        expected++;
+    }
+    EXPECT_EQ(expected, N);
+}
+
+TEST(TreeTest, EraseReusesHeapFilePages)
+{
+    const int N = 50000;
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+
+    auto file_size = [&tmp_template]() {
+        struct stat sbuf;
+        ::stat(tmp_template, &sbuf);
+        return (size_t)sbuf.st_size;
+    };
+
+    size_t full_size;
+    {
+        bptree::HeapPageCache page_cache(tmp_template, true, 64);
+        bptree::BTree<32, KeyType, ValueType> tree(&page_cache);
+
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i);
+        }
+        full_size = file_size();
+
+        /* TTL-style: expire the oldest keys while new ones come in */
+        for (int i = 0; i < N; i++) {
+            EXPECT_EQ(tree.erase(i), 1);
+            tree.insert(N + i, N + i);
+        }
+        EXPECT_LT(file_size(), full_size * 3 / 2);
+    }
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, false, 64);
+        bptree::BTree<32, KeyType, ValueType> tree(&page_cache);
+        EXPECT_EQ(tree.size(), N);
+
+        KeyType expected = N;
+        for (auto it = tree.begin(); it != tree.end(); it++) {
+            ASSERT_EQ(it->first, expected++);
+        }
+        EXPECT_EQ(expected, 2 * N);
+    }
+
+    unlink(tmp_template);
+}
+
+template <typename Tree>
+static void check_multi_get(Tree& tree, const std::vector<KeyType>& keys)
+{
+    std::vector<ValueType> values;
+    std::vector<size_t> offsets;
+    tree.multi_get(keys, values, offsets);
+
+    ASSERT_EQ(offsets.size(), keys.size() + 1);
+    EXPECT_EQ(offsets.back(), values.size());
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        std::vector<ValueType> expected;
+        tree.get_value(keys[i], expected);
+
+        std::vector<ValueType> actual(values.begin() + offsets[i],
+                                      values.begin() + offsets[i + 1]);
+        std::sort(expected.begin(), expected.end());
+        std::sort(actual.begin(), actual.end());
+        EXPECT_EQ(actual, expected);
+    }
+}
+
+TEST(TreeTest, MultiGet)
+{
+    const int N = 10000;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+
+    for (int i = 0; i < N; i++) {
+        tree.insert(2 * i, i);
+    }
+
+    unsigned int seed = 42;
+    for (int batch = 0; batch < 20; batch++) {
+        std::vector<KeyType> keys;
+        for (int i = 0; i < 300; i++) {
+            /* odd keys and keys past the end are missing */
+            keys.push_back(rand_r(&seed) % (2 * N + 100));
+        }
+        keys.push_back(keys.front()); /* duplicate in the batch */
+        check_multi_get(tree, keys);
+    }
+
+    /* empty batch */
+    std::vector<ValueType> values{1};
+    std::vector<size_t> offsets;
+    tree.multi_get(std::vector<KeyType>{}, values, offsets);
+    EXPECT_TRUE(values.empty());
+    ASSERT_EQ(offsets.size(), 1);
+}
+
+TEST(TreeTest, ConcurrentMultiGet)
+{
+    const int N = 20000;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<32, KeyType, ValueType> tree(&page_cache);
+
+    for (int i = 0; i < N; i++) {
+        tree.insert(i, i + 1);
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([t, &tree]() {
+            for (int i = 0; i < N; i++) {
+                tree.insert(N * (t + 1) + i, 0);
+            }
+        });
+    }
+
+    std::atomic<int> failures(0);
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([t, &tree, &failures]() {
+            unsigned int seed = t;
+            std::vector<KeyType> keys;
+            std::vector<ValueType> values;
+            std::vector<size_t> offsets;
+
+            for (int batch = 0; batch < 200; batch++) {
+                keys.clear();
+                for (int i = 0; i < 64; i++) {
+                    keys.push_back(rand_r(&seed) % N);
+                }
+                tree.multi_get(keys, values, offsets);
+
+                for (size_t i = 0; i < keys.size(); i++) {
+                    if (offsets[i + 1] - offsets[i] != 1 ||
+                        values[offsets[i]] != keys[i] + 1) {
+                        failures++;
+                    }
+                }
+            }
+        });
+    }
+
+    for (auto&& p : threads) {
+        p.join();
+    }
+
+    EXPECT_EQ(failures.load(), 0);
+}
+
+TEST(TreeTest, MultiGetFromHeapFile)
+{
+    const int N = 50000;
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, true, 4096);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i + 1);
+        }
+    }
+
+    {
+        /* reopened with a cache smaller than the tree, the leaves of every
+         * batch are read from the heap file */
+        bptree::HeapPageCache page_cache(tmp_template, false, 256, 4096,
+                                         bptree::WritePolicy::WRITE_THROUGH, 0,
+                                         bptree::IOBackend::IO_URING, 2, 64);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        unsigned int seed = 7;
+        for (int batch = 0; batch < 10; batch++) {
+            std::vector<KeyType> keys;
+            for (int i = 0; i < 256; i++) {
+                keys.push_back(rand_r(&seed) % N);
+            }
+            check_multi_get(tree, keys);
+        }
+
+        EXPECT_GT(page_cache.get_num_prefetch_hits(), 0);
+    }
+
+    unlink(tmp_template);
+}
+
+/* scans [lo, hi) and checks that every key in it is seen once, in
+ * ascending order within a span */
+template <typename Tree>
+static void check_parallel_scan(Tree& tree, KeyType lo, KeyType hi,
+                                size_t num_threads, KeyType num_keys)
+{
+    std::vector<std::atomic<int>> seen(num_keys);
+    std::atomic<size_t> num_spans(0);
+    std::atomic<int> failures(0);
+
+    tree.parallel_scan(lo, hi, num_threads,
+                       [&](const KeyType* keys, const ValueType* values, size_t n) {
+                           num_spans++;
+                           for (size_t i = 0; i < n; i++) {
+                               if (keys[i] < lo || keys[i] >= hi ||
+                                   values[i] != keys[i] + 1 ||
+                                   (i > 0 && keys[i] <= keys[i - 1])) {
+                                   failures++;
+                               } else {
+                                   seen[keys[i]]++;
+                               }
+                           }
+                       });
+
+    EXPECT_EQ(failures.load(), 0);
+    for (KeyType k = 0; k < num_keys; k++) {
+        ASSERT_EQ(seen[k].load(), k >= lo && k < hi ? 1 : 0) << "key " << k;
+    }
+    EXPECT_EQ(tree.count_range(lo, hi, num_threads),
+              lo < hi ? std::min(hi, num_keys) - std::min(lo, num_keys) : 0);
+}
+
+TEST(TreeTest, ParallelScan)
+{
+    const int N = 20000;
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+
+    for (int i = 0; i < N; i++) {
+        tree.insert((i * 7919) % N, (i * 7919) % N + 1);
+    }
+
+    for (size_t num_threads : {1, 2, 4, 8}) {
+        check_parallel_scan(tree, 0, N, num_threads, N);
+        check_parallel_scan(tree, 1234, 5678, num_threads, N);
+        check_parallel_scan(tree, 100, 101, num_threads, N);
+        check_parallel_scan(tree, N - 10, 2 * N, num_threads, N);
+    }
+    /* empty ranges */
+    check_parallel_scan(tree, 500, 500, 4, N);
+    check_parallel_scan(tree, 600, 500, 4, N);
+    check_parallel_scan(tree, 2 * N, 3 * N, 4, N);
+
+    /* sums in key order */
+    auto sum = tree.reduce_range(
+        0, N, 4, (uint64_t)0,
+        [](uint64_t& acc, const KeyType*, const ValueType* values, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                acc += values[i];
+            }
+        },
+        std::plus<uint64_t>());
+    EXPECT_EQ(sum, (uint64_t)N * (N + 1) / 2);
+
+    auto keys = tree.reduce_range(
+        10, 2000, 4, std::vector<KeyType>(),
+        [](std::vector<KeyType>& acc, const KeyType* keys, const ValueType*,
+           size_t n) { acc.insert(acc.end(), keys, keys + n); },
+        [](std::vector<KeyType> a, std::vector<KeyType> b) {
+            a.insert(a.end(), b.begin(), b.end());
+            return a;
+        });
+    std::vector<KeyType> expected(1990);
+    std::iota(expected.begin(), expected.end(), 10);
+    EXPECT_EQ(keys, expected);
+
+    /* the first exception stops the scan */
+    std::atomic<int> calls(0);
+    EXPECT_THROW(tree.parallel_scan(0, N, 4,
+                                    [&calls](const KeyType*, const ValueType*,
+                                             size_t) {
+                                        calls++;
+                                        throw std::runtime_error("stop");
+                                    }),
+                 std::runtime_error);
+    EXPECT_LE(calls.load(), 4);
+}
+
+TEST(TreeTest, ParallelScanFromHeapFile)
+{
+    const int N = 100000;
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, true, 256);
+        /* most nodes are read from their pages */
+        bptree::BTree<64, KeyType, ValueType> tree(
+            &page_cache,
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            32);
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i + 1);
+        }
+
+        /* inserts past the range go on during the scans */
+        std::thread writer([&tree]() {
+            for (int i = 0; i < N / 2; i++) {
+                tree.insert(N + i, N + i + 1);
+            }
+        });
+        check_parallel_scan(tree, 0, N, 4, N);
+        check_parallel_scan(tree, N / 3, N / 2, 3, N);
+        writer.join();
+
+        EXPECT_EQ(tree.count_range(0, 2 * N, 4), N + N / 2);
+    }
+
+    unlink(tmp_template);
+}
+
+template <typename Tree>
+static void check_pairs(Tree& tree, const std::vector<std::pair<KeyType, ValueType>>& pairs)
+{
+    EXPECT_EQ(tree.size(), pairs.size());
+    for (auto&& p : pairs) {
+        std::vector<ValueType> values;
+        tree.get_value(p.first, values);
+        ASSERT_EQ(values.size(), 1);
+        EXPECT_EQ(values.front(), p.second);
+    }
+}
+
+TEST(TreeTest, BulkLoadSorted)
+{
+    const int N = 100000;
+    std::vector<std::pair<KeyType, ValueType>> pairs;
+    for (int i = 0; i < N; i++) {
+        pairs.emplace_back(2 * i, i);
+    }
+
+    for (double fill_factor : {1.0, 0.5}) {
+        bptree::MemPageCache page_cache(4096);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+
+        ASSERT_TRUE(tree.bulk_load(pairs.begin(), pairs.end(), fill_factor));
+        check_pairs(tree, pairs);
+
+        /* the tree is only loaded into an empty tree */
+        EXPECT_FALSE(tree.bulk_load(pairs.begin(), pairs.end()));
+
+        /* and can be updated normally afterwards */
+        for (int i = 0; i < 1000; i++) {
+            tree.insert(2 * i + 1, i);
+        }
+        EXPECT_EQ(tree.size(), N + 1000);
+        std::vector<ValueType> values;
+        tree.get_value(1999, values);
+        ASSERT_EQ(values.size(), 1);
+        EXPECT_EQ(values.front(), 999);
+
+        KeyType prev = 0;
+        size_t count = 0;
+        for (auto it = tree.begin(); it != tree.end(); it++) {
+            if (count++ > 0) {
+                EXPECT_LT(prev, it->first);
+            }
+            prev = it->first;
+        }
+        EXPECT_EQ(count, N + 1000);
+    }
+}
+
+TEST(TreeTest, BulkLoadSmall)
+{
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<8, KeyType, ValueType> tree(&page_cache);
+
+    std::vector<std::pair<KeyType, ValueType>> pairs = {{1, 10}, {2, 20}, {3, 30}};
+    ASSERT_TRUE(tree.bulk_load(pairs.begin(), pairs.end()));
+    check_pairs(tree, pairs);
+
+    std::vector<std::pair<KeyType, ValueType>> none;
+    bptree::MemPageCache other_cache(4096);
+    bptree::BTree<8, KeyType, ValueType> other(&other_cache);
+    ASSERT_TRUE(other.bulk_load(none.begin(), none.end()));
+    EXPECT_EQ(other.size(), 0);
+}
+
+TEST(TreeTest, BulkLoadUnsorted)
+{
+    /* more pairs than one sort run so that runs are spilled and merged */
+    const size_t N = bptree::BTree<64, KeyType, ValueType>::BULK_LOAD_RUN_SIZE * 2 + 1000;
+    std::vector<std::pair<KeyType, ValueType>> pairs;
+    for (size_t i = 0; i < N; i++) {
+        pairs.emplace_back(i, i + 1);
+    }
+
+    std::mt19937 gen(1);
+    std::shuffle(pairs.begin(), pairs.end(), gen);
+
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<64, KeyType, ValueType> tree(&page_cache);
+    ASSERT_TRUE(tree.bulk_load(pairs.begin(), pairs.end()));
+
+    EXPECT_EQ(tree.size(), N);
+    KeyType expected = 0;
+    for (auto it = tree.begin(); it != tree.end(); it++) {
+        ASSERT_EQ(it->first, expected);
+        EXPECT_EQ(it->second, expected + 1);
+        expected++;
+    }
+    EXPECT_EQ(expected, N);
+}
+
+TEST(TreeTest, BulkLoadDuplicateKeys)
+{
+    /* runs of equal keys are kept in one leaf */
+    std::vector<std::pair<KeyType, ValueType>> pairs;
+    for (int i = 0; i < 1000; i++) {
+        for (int j = 0; j < 3; j++) {
+            pairs.emplace_back(i, j);
+        }
+    }
+    std::reverse(pairs.begin(), pairs.end());
+
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+    ASSERT_TRUE(tree.bulk_load(pairs.begin(), pairs.end(), 0.5));
+
+    for (int i = 0; i < 1000; i++) {
+        std::vector<ValueType> values;
+        tree.get_value(i, values);
+        EXPECT_EQ(values.size(), 3);
+    }
+}
+
+TEST(TreeTest, BulkLoadInsertBuffer)
+{
+    std::vector<std::pair<KeyType, ValueType>> pairs;
+    for (int i = 0; i < 10000; i++) {
+        pairs.emplace_back(i, i + 1);
+    }
+
+    /* buffered pairs make the tree non-empty */
+    bptree::MemPageCache page_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> tree(&page_cache);
+    tree.set_insert_buffer(256, std::chrono::seconds(60));
+    tree.insert(5, 5);
+    EXPECT_FALSE(tree.bulk_load(pairs.begin(), pairs.end()));
+    EXPECT_EQ(tree.size(), 1);
+
+    /* the buffer is back after the load */
+    bptree::MemPageCache other_cache(4096);
+    bptree::BTree<16, KeyType, ValueType> other(&other_cache);
+    other.set_insert_buffer(64, std::chrono::seconds(60));
+    ASSERT_TRUE(other.bulk_load(pairs.begin(), pairs.end()));
+    check_pairs(other, pairs);
+
+    other.insert(20000, 1);
+    EXPECT_EQ(other.get_num_buffered(), 1);
+    other.flush();
+    EXPECT_EQ(other.size(), pairs.size() + 1);
+}
+
+TEST(TreeTest, BulkLoadHeapFile)
+{
+    const int N = 200000;
+    char tmp_template[] = "/tmp/bptree_XXXXXX";
+    int fd = mkstemp(tmp_template);
+    close(fd);
+    unlink(tmp_template);
+
+    std::vector<std::pair<KeyType, ValueType>> pairs;
+    for (int i = 0; i < N; i++) {
+        pairs.emplace_back(i, i * 3);
+    }
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, true, 256);
+        bptree::BTree<128, KeyType, ValueType> tree(&page_cache);
+        ASSERT_TRUE(tree.bulk_load(pairs.begin(), pairs.end()));
+    }
+
+    {
+        bptree::HeapPageCache page_cache(tmp_template, false, 256);
+        bptree::BTree<128, KeyType, ValueType> tree(&page_cache);
+        check_pairs(tree, pairs);
+    }
+
+    unlink(tmp_template);
+}
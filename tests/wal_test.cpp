@@ -0,0 +1,590 @@
+#include <gtest/gtest.h>
+
+#include "bptree/heap_page_cache.h"
+#include "bptree/mem_page_cache.h"
+#include "bptree/tree.h"
+#include "bptree/wal.h"
+#include "test_util.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+using KeyType = uint64_t;
+using ValueType = uint64_t;
+
+static std::vector<std::pair<bptree::PageID, uint32_t>>
+replay_all(bptree::WriteAheadLog& log)
+{
+    std::vector<std::pair<bptree::PageID, uint32_t>> records;
+    log.replay([&records](const bptree::LogRecord& rec) {
+        uint32_t value = 0;
+        if (rec.length >= sizeof(value)) ::memcpy(&value, rec.data, sizeof(value));
+        records.emplace_back(rec.pid, value);
+    });
+    return records;
+}
+
+static bptree::LogBatch delta(bptree::PageID pid, uint32_t value)
+{
+    bptree::LogBatch batch;
+    batch.add_delta(pid, 0, reinterpret_cast<const uint8_t*>(&value),
+                    sizeof(value));
+    return batch;
+}
+
+TEST(WalTest, GroupCommit)
+{
+    const int N = 2000;
+    const int NUM_THREADS = 8;
+    auto filename = temp_heap_file();
+
+    {
+        bptree::WriteAheadLog log(filename, true);
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < NUM_THREADS; t++) {
+            threads.emplace_back([t, &log]() {
+                for (int i = 0; i < N; i++) {
+                    auto lsn = log.append(delta(t + 1, i));
+                    log.flush(lsn);
+                    EXPECT_GE(log.get_durable_lsn(), lsn);
+                }
+            });
+        }
+        for (auto&& p : threads) {
+            p.join();
+        }
+
+        /* waiters share the syncs */
+        EXPECT_LE(log.get_num_syncs(), N * NUM_THREADS);
+        EXPECT_EQ(log.get_durable_lsn(), log.get_end_lsn());
+    }
+
+    bptree::WriteAheadLog log(filename, false);
+    auto records = replay_all(log);
+    ASSERT_EQ(records.size(), N * NUM_THREADS);
+
+    /* the records of a thread are in the order of its appends */
+    std::vector<uint32_t> next(NUM_THREADS + 1, 0);
+    for (auto&& [pid, value] : records) {
+        EXPECT_EQ(value, next[pid]++);
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(WalTest, TornTailIsCutOff)
+{
+    auto filename = temp_heap_file();
+
+    {
+        bptree::WriteAheadLog log(filename, true);
+        for (uint32_t i = 0; i < 10; i++) {
+            log.append(delta(1, i));
+        }
+        log.flush_all();
+    }
+
+    /* half a frame from a write that did not finish */
+    int fd = ::open(filename.c_str(), O_WRONLY | O_APPEND);
+    const char garbage[] = "FRM1 torn";
+    ASSERT_EQ(::write(fd, garbage, sizeof(garbage)), sizeof(garbage));
+    ::close(fd);
+
+    {
+        bptree::WriteAheadLog log(filename, false);
+        EXPECT_EQ(replay_all(log).size(), 10);
+
+        log.flush(log.append(delta(1, 10)));
+    }
+
+    bptree::WriteAheadLog log(filename, false);
+    auto records = replay_all(log);
+    ASSERT_EQ(records.size(), 11);
+    EXPECT_EQ(records.back().second, 10);
+
+    unlink(filename.c_str());
+}
+
+TEST(WalTest, Truncate)
+{
+    auto filename = temp_heap_file();
+
+    {
+        bptree::WriteAheadLog log(filename, true, false);
+        for (uint32_t i = 0; i < 10; i++) {
+            log.append(delta(1, i));
+        }
+        auto lsn = log.get_end_lsn();
+        for (uint32_t i = 10; i < 15; i++) {
+            log.append(delta(1, i));
+        }
+
+        log.truncate(lsn);
+        /* LSNs go on from where they were */
+        EXPECT_GT(log.get_end_lsn(), lsn);
+        log.flush(log.append(delta(1, 15)));
+    }
+
+    bptree::WriteAheadLog log(filename, false);
+    auto records = replay_all(log);
+    ASSERT_EQ(records.size(), 6);
+    for (uint32_t i = 0; i < 6; i++) {
+        EXPECT_EQ(records[i].second, 10 + i);
+    }
+
+    unlink(filename.c_str());
+}
+
+TEST(WalTest, FreedPagesAreSkipped)
+{
+    auto filename = temp_heap_file();
+    bptree::WriteAheadLog log(filename, true);
+
+    log.append(delta(1, 1));
+    log.append(delta(2, 2));
+
+    bptree::LogBatch batch;
+    batch.add_free(1);
+    batch.add_free(2);
+    log.append(batch);
+
+    /* page 2 is reused */
+    log.flush(log.append(delta(2, 3)));
+
+    auto records = replay_all(log);
+    ASSERT_EQ(records.size(), 2);
+    EXPECT_EQ(records[0], std::make_pair((bptree::PageID)2, (uint32_t)2));
+    EXPECT_EQ(records[1], std::make_pair((bptree::PageID)2, (uint32_t)3));
+
+    unlink(filename.c_str());
+}
+
+/* the tree of a process that exits without writing back its pages is
+ * recovered from the log */
+TEST(WalTest, RecoversAfterCrash)
+{
+    const int N = 100000;
+    const int NUM_THREADS = 4;
+    auto heap_filename = temp_heap_file();
+    auto log_filename = temp_heap_file();
+
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        /* few frames so that pages are written back while the log runs */
+        bptree::HeapPageCache page_cache(heap_filename, true, 64, 4096,
+                                         bptree::WritePolicy::WRITE_BACK);
+        bptree::WriteAheadLog log(log_filename, true);
+        bptree::BTree<64, KeyType, ValueType> tree(
+            &page_cache,
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            0, &log);
+
+        std::vector<std::thread> threads;
+        for (int t = 0; t < NUM_THREADS; t++) {
+            threads.emplace_back([t, &tree]() {
+                for (int i = t; i < N; i += NUM_THREADS) {
+                    tree.insert(i, i + 1);
+                }
+                for (int i = t; i < N; i += 3 * NUM_THREADS) {
+                    tree.erase(i);
+                }
+            });
+        }
+        for (auto&& p : threads) {
+            p.join();
+        }
+
+        /* no destructors, nothing is flushed */
+        _exit(0);
+    }
+
+    int status;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status));
+
+    {
+        bptree::HeapPageCache page_cache(heap_filename, false, 64, 4096,
+                                         bptree::WritePolicy::WRITE_BACK);
+        bptree::WriteAheadLog log(log_filename, false);
+        bptree::BTree<64, KeyType, ValueType> tree(
+            &page_cache,
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            0, &log);
+
+        /* the recovered pages were checkpointed */
+        EXPECT_EQ(log.get_size(), 0);
+
+        size_t expected_size = 0;
+        for (int i = 0; i < N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+            if (i % (3 * NUM_THREADS) < NUM_THREADS) {
+                EXPECT_TRUE(values.empty());
+            } else {
+                ASSERT_EQ(values.size(), 1);
+                EXPECT_EQ(values.front(), i + 1);
+                expected_size++;
+            }
+        }
+        EXPECT_EQ(tree.size(), expected_size);
+    }
+
+    unlink(heap_filename.c_str());
+    unlink(log_filename.c_str());
+}
+
+/* every insert that returned before the process was killed is in the
+ * recovered tree, and the tree is consistent */
+TEST(WalTest, KilledDuringInserts)
+{
+    const uint64_t MIN_COMMITTED = 20000;
+    auto heap_filename = temp_heap_file();
+    auto log_filename = temp_heap_file();
+
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        ::close(fds[0]);
+        bptree::HeapPageCache page_cache(heap_filename, true, 64, 4096,
+                                         bptree::WritePolicy::WRITE_BACK);
+        bptree::WriteAheadLog log(log_filename, true);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache, 100, 0, &log);
+
+        for (uint64_t i = 0;; i++) {
+            /* scatter the keys so that inner nodes split as well */
+            tree.insert(i * 7919 % 1000003, i);
+            if ((i + 1) % 1000 == 0) {
+                uint64_t committed = i + 1;
+                if (::write(fds[1], &committed, sizeof(committed)) !=
+                    sizeof(committed)) {
+                    _exit(1);
+                }
+            }
+        }
+    }
+
+    ::close(fds[1]);
+    uint64_t committed = 0;
+    while (committed < MIN_COMMITTED) {
+        ASSERT_EQ(::read(fds[0], &committed, sizeof(committed)),
+                  sizeof(committed));
+    }
+    ::kill(child, SIGKILL);
+    int status;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ::close(fds[0]);
+
+    {
+        bptree::HeapPageCache page_cache(heap_filename, false, 64, 4096,
+                                         bptree::WritePolicy::WRITE_BACK);
+        bptree::WriteAheadLog log(log_filename, false);
+        bptree::BTree<64, KeyType, ValueType> tree(&page_cache, 100, 0, &log);
+
+        for (uint64_t i = 0; i < committed; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i * 7919 % 1000003, values);
+            ASSERT_EQ(values.size(), 1);
+            EXPECT_EQ(values.front(), i);
+        }
+
+        size_t count = 0;
+        KeyType last = 0;
+        for (auto it = tree.begin(); it != tree.end(); it++) {
+            if (count > 0) {
+                ASSERT_LT(last, it->first);
+            }
+            last = it->first;
+            count++;
+        }
+        EXPECT_EQ(count, tree.size());
+        EXPECT_GE(count, committed);
+    }
+
+    unlink(heap_filename.c_str());
+    unlink(log_filename.c_str());
+}
+
+/* a checksummed heap file with a log, page_format is only used on create */
+static std::unique_ptr<bptree::HeapPageCache> checksum_cache(const std::string& filename,
+                                                             bool create)
+{
+    return std::make_unique<bptree::HeapPageCache>(
+        filename, create, 64, 4096, bptree::WritePolicy::WRITE_BACK, 0,
+        bptree::IOBackend::SYNC, 1, 0, 0, bptree::ReplacementPolicyType::LRU,
+        false, false, false, bptree::PageFormat::CHECKSUM);
+}
+
+/* flip a byte in the body of a page so that its checksum fails */
+static void corrupt_page(const std::string& filename, bptree::PageID pid)
+{
+    int fd = ::open(filename.c_str(), O_RDWR);
+    ASSERT_GE(fd, 0);
+    off_t offset = (off_t)pid * 4096 + bptree::HeapFile::PAGE_HEADER_SIZE + 8;
+    uint8_t byte;
+    ASSERT_EQ(::pread(fd, &byte, 1, offset), 1);
+    byte ^= 0xff;
+    ASSERT_EQ(::pwrite(fd, &byte, 1, offset), 1);
+    ::close(fd);
+}
+
+/* the first node of a tree, the leftmost leaf */
+static const bptree::PageID FIRST_LEAF_PAGE_ID = 2;
+
+/* a page that was written back and then damaged is rebuilt from the image
+ * that was logged when it was allocated */
+TEST(WalTest, CorruptPageRebuiltFromImage)
+{
+    const int N = 20000;
+    auto heap_filename = temp_heap_file();
+    auto log_filename = temp_heap_file();
+
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        auto page_cache = checksum_cache(heap_filename, true);
+        bptree::WriteAheadLog log(log_filename, true);
+        bptree::BTree<64, KeyType, ValueType> tree(
+            page_cache.get(),
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            0, &log);
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i + 1);
+        }
+        /* the pages are in the file and their records in the log */
+        page_cache->flush_all_pages();
+        _exit(0);
+    }
+
+    int status;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status));
+    corrupt_page(heap_filename, FIRST_LEAF_PAGE_ID);
+
+    {
+        auto page_cache = checksum_cache(heap_filename, false);
+        bptree::WriteAheadLog log(log_filename, false);
+        bptree::BTree<64, KeyType, ValueType> tree(
+            page_cache.get(),
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            0, &log);
+
+        for (int i = 0; i < N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+            ASSERT_EQ(values.size(), 1);
+            EXPECT_EQ(values.front(), i + 1);
+        }
+        EXPECT_EQ(tree.size(), N);
+    }
+
+    unlink(heap_filename.c_str());
+    unlink(log_filename.c_str());
+}
+
+/* a damaged page that the log only has deltas for cannot be recovered,
+ * opening the tree fails instead of losing the deltas */
+TEST(WalTest, CorruptPageWithoutImageFailsRecovery)
+{
+    const int N = 20000;
+    auto heap_filename = temp_heap_file();
+    auto log_filename = temp_heap_file();
+
+    {
+        /* checkpointed on close, the log is empty afterwards */
+        auto page_cache = checksum_cache(heap_filename, true);
+        bptree::WriteAheadLog log(log_filename, true);
+        bptree::BTree<64, KeyType, ValueType> tree(
+            page_cache.get(),
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            0, &log);
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i);
+        }
+    }
+
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        auto page_cache = checksum_cache(heap_filename, false);
+        bptree::WriteAheadLog log(log_filename, false);
+        bptree::BTree<64, KeyType, ValueType> tree(
+            page_cache.get(),
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            0, &log);
+        /* every existing leaf gets deltas */
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i + 1);
+        }
+        page_cache->flush_all_pages();
+        _exit(0);
+    }
+
+    int status;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status));
+    corrupt_page(heap_filename, FIRST_LEAF_PAGE_ID);
+
+    {
+        auto page_cache = checksum_cache(heap_filename, false);
+        bptree::WriteAheadLog log(log_filename, false);
+        EXPECT_THROW((bptree::BTree<64, KeyType, ValueType>(
+                         page_cache.get(),
+                         bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+                         0, &log)),
+                     bptree::IOException);
+    }
+
+    unlink(heap_filename.c_str());
+    unlink(log_filename.c_str());
+}
+
+/* a backup taken while inserts go on holds every pair inserted before it
+ * started and is a consistent tree */
+TEST(BackupTest, ConcurrentInserts)
+{
+    const int NUM_THREADS = 4;
+    const int N = 50000;
+    auto heap_filename = temp_heap_file();
+    auto log_filename = temp_heap_file();
+    auto backup_heap_filename = temp_heap_file();
+    auto backup_log_filename = temp_heap_file();
+
+    {
+        bptree::HeapPageCache page_cache(heap_filename, true, 256, 4096,
+                                         bptree::WritePolicy::WRITE_BACK);
+        bptree::WriteAheadLog log(log_filename, true, false);
+        bptree::BTree<64, KeyType, ValueType> tree(
+            &page_cache,
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            0, &log);
+
+        for (int i = 0; i < N; i++) {
+            tree.insert(i * NUM_THREADS, i);
+        }
+
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> threads;
+        for (int t = 1; t < NUM_THREADS; t++) {
+            threads.emplace_back([t, &tree, &stop]() {
+                for (int i = 0; i < N && !stop.load(); i++) {
+                    tree.insert(i * NUM_THREADS + t, i);
+                    if (i % 2) tree.erase((i - 1) * NUM_THREADS);
+                }
+            });
+        }
+
+        tree.backup(backup_heap_filename, backup_log_filename);
+        stop.store(true);
+        for (auto&& p : threads) {
+            p.join();
+        }
+    }
+
+    {
+        bptree::HeapPageCache page_cache(backup_heap_filename, false, 256, 4096,
+                                         bptree::WritePolicy::WRITE_BACK);
+        bptree::WriteAheadLog log(backup_log_filename, false);
+        bptree::BTree<64, KeyType, ValueType> tree(
+            &page_cache,
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            0, &log);
+
+        size_t count = 0;
+        KeyType last = 0;
+        for (auto it = tree.begin(); it != tree.end(); it++) {
+            if (count > 0) {
+                ASSERT_LT(last, it->first);
+            }
+            EXPECT_EQ(it->second, it->first / NUM_THREADS);
+            last = it->first;
+            count++;
+        }
+        EXPECT_EQ(count, tree.size());
+
+        /* the first thread's pairs were there before the backup, the erase
+         * of one of them is in it or not */
+        for (int i = 0; i < N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i * NUM_THREADS, values);
+            EXPECT_LE(values.size(), 1);
+        }
+    }
+
+    for (auto& name : {heap_filename, log_filename, backup_heap_filename,
+                       backup_log_filename}) {
+        unlink(name.c_str());
+    }
+}
+
+TEST(BackupTest, RateLimit)
+{
+    const int N = 20000;
+    const size_t BYTES_PER_SECOND = 4 << 20;
+    auto heap_filename = temp_heap_file();
+    auto log_filename = temp_heap_file();
+    auto backup_heap_filename = temp_heap_file();
+    auto backup_log_filename = temp_heap_file();
+
+    {
+        bptree::HeapPageCache page_cache(heap_filename, true, 1024, 4096,
+                                         bptree::WritePolicy::WRITE_BACK);
+        bptree::WriteAheadLog log(log_filename, true, false);
+        bptree::BTree<64, KeyType, ValueType> tree(
+            &page_cache,
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            0, &log);
+
+        for (int i = 0; i < N; i++) {
+            tree.insert(i, i + 1);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        size_t nbytes = tree.backup(backup_heap_filename, backup_log_filename,
+                                    BYTES_PER_SECOND);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        EXPECT_GE(nbytes, page_cache.get_heap_file()->get_num_pages() * 4096);
+        EXPECT_GE(std::chrono::duration<double>(elapsed).count(),
+                  0.9 * nbytes / BYTES_PER_SECOND);
+
+        /* a backup without a heap file is refused */
+        bptree::MemPageCache mem_cache(4096);
+        bptree::BTree<64, KeyType, ValueType> mem_tree(&mem_cache);
+        EXPECT_THROW(mem_tree.backup(backup_heap_filename, backup_log_filename),
+                     std::invalid_argument);
+    }
+
+    {
+        bptree::HeapPageCache page_cache(backup_heap_filename, false, 1024, 4096);
+        bptree::WriteAheadLog log(backup_log_filename, false);
+        bptree::BTree<64, KeyType, ValueType> tree(
+            &page_cache,
+            bptree::BTree<64, KeyType, ValueType>::DEFAULT_METADATA_COMMIT_INTERVAL,
+            0, &log);
+
+        EXPECT_EQ(tree.size(), N);
+        for (int i = 0; i < N; i++) {
+            std::vector<ValueType> values;
+            tree.get_value(i, values);
+            ASSERT_EQ(values.size(), 1);
+            EXPECT_EQ(values.front(), i + 1);
+        }
+    }
+
+    for (auto& name : {heap_filename, log_filename, backup_heap_filename,
+                       backup_log_filename}) {
+        unlink(name.c_str());
+    }
+}